@@ -0,0 +1,213 @@
+/*
+ * Program: background_save.c
+ *
+ * Description:
+ * ------------
+ * Forked snapshots of a DB_T (see background_save.h). The child reports
+ * back through a pipe: its numbers go in one write just before it
+ * exits, and its exit status says whether the rename happened. Pages
+ * are counted from /proc/self/smaps_rollup in the child: those it
+ * shares with the parent right after the fork, and those it still
+ * shares once the file is written; the difference is what copy-on-write
+ * cost (or what the parent freed meanwhile). Without /proc both counts
+ * are 0.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "background_save.h"
+#include "frozen_db.h"
+
+#define SAVE_BATCH 256          /* customers read per cursor call */
+
+struct BackgroundSave {
+  pid_t pid;
+  int fd;                       /* read end of the child's pipe */
+  double forkMs;
+};
+/*--------------------------------------------------------------------*/
+static double now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+/*--------------------------------------------------------------------*/
+static size_t shared_pages(void)
+
+/* Return the pages this process shares with others, 0 if unknown. */
+{
+  char line[256];
+  size_t kb = 0, v;
+  FILE *fp;
+
+  if ((fp = fopen("/proc/self/smaps_rollup", "r")) == NULL) return 0;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if ((sscanf(line, "Shared_Clean: %zu kB", &v) == 1) ||
+        (sscanf(line, "Shared_Dirty: %zu kB", &v) == 1))
+      kb += v;
+  }
+  fclose(fp);
+  return kb * 1024 / (size_t)sysconf(_SC_PAGESIZE);
+}
+/*--------------------------------------------------------------------*/
+static int sync_path(const char *path, int dir)
+
+/* fsync the file (or directory, if dir) at path. Return 0 or -1. */
+{
+  int fd, r;
+
+  fd = open(path, (dir ? O_DIRECTORY : 0) | O_RDONLY);
+  if (fd < 0) return -1;
+  r = fsync(fd);
+  close(fd);
+  return r;
+}
+/*--------------------------------------------------------------------*/
+static int write_image(DB_T d, const char *path,
+                       struct BackgroundSaveStats *st)
+
+/* Write the frozen image of d to path by way of path.tmp and fill the
+   customer and byte counts of st. Return 0 or -1 (path unchanged). */
+{
+  struct CustomerView views[SAVE_BATCH];
+  FrozenBuilder_T b;
+  FrozenDB_T f;
+  CustomerCursor_T c;
+  struct stat sb;
+  char *tmp, *dir, *slash;
+  int n, i, result = -1;
+
+  tmp = (char *)malloc(strlen(path) + 5);
+  if (tmp == NULL) return -1;
+  sprintf(tmp, "%s.tmp", path);
+
+  if ((b = CreateFrozenBuilder()) == NULL) goto done;
+  if ((c = OpenCustomerCursor(d)) == NULL) {
+    DestroyFrozenBuilder(b);
+    goto done;
+  }
+  while ((n = NextCustomerBatch(c, views, SAVE_BATCH)) > 0) {
+    for (i = 0; i < n; i++) {
+      if (FrozenBuilderAdd(b, views[i].id, views[i].idLen, views[i].name,
+                           views[i].nameLen, views[i].purchase) < 0) {
+        n = -1;
+        break;
+      }
+    }
+    if (n < 0) break;
+    st->customers += (size_t)n;
+  }
+  CloseCustomerCursor(c);
+  if (n < 0) {
+    DestroyFrozenBuilder(b);
+    goto done;
+  }
+  if ((f = FrozenBuild(b)) == NULL) goto done;
+  n = FrozenSave(f, tmp);
+  DestroyFrozenDB(f);
+  if (n < 0) goto done;                 /* FrozenSave() said why */
+  if (sync_path(tmp, 0) < 0 || stat(tmp, &sb) < 0) {
+    fprintf(stderr, "Error: Can't write %s\n", tmp);
+    unlink(tmp);
+    goto done;
+  }
+  if (rename(tmp, path) < 0) {
+    fprintf(stderr, "Error: Can't rename %s to %s\n", tmp, path);
+    unlink(tmp);
+    goto done;
+  }
+  st->bytes = (size_t)sb.st_size;
+
+  /* make the rename itself durable */
+  if ((dir = strdup(path)) != NULL) {
+    slash = strrchr(dir, '/');
+    if (slash == NULL) strcpy(dir, ".");
+    else if (slash == dir) slash[1] = '\0';
+    else *slash = '\0';
+    sync_path(dir, 1);
+    free(dir);
+  }
+  result = 0;
+
+ done:
+  free(tmp);
+  return result;
+}
+/*--------------------------------------------------------------------*/
+BackgroundSave_T
+BackgroundSaveCustomerDB(DB_T d, const char *path)
+{
+  struct BackgroundSaveStats st;
+  BackgroundSave_T s;
+  size_t before, after;
+  double start;
+  int p[2], r;
+
+  if (d == NULL || path == NULL) return NULL;
+  s = (BackgroundSave_T)calloc(1, sizeof(struct BackgroundSave));
+  if (s == NULL) return NULL;
+  if (pipe2(p, O_CLOEXEC) < 0) {
+    free(s);
+    return NULL;
+  }
+
+  start = now_ms();
+  s->pid = fork();
+  if (s->pid == 0) {
+    close(p[0]);
+    memset(&st, 0, sizeof(st));
+    before = shared_pages();
+    r = write_image(d, path, &st);
+    st.saveMs = now_ms() - start;
+    after = shared_pages();
+    st.sharedPages = after;
+    st.copiedPages = before > after ? before - after : 0;
+    if (write(p[1], &st, sizeof(st)) != (ssize_t)sizeof(st)) r = -1;
+    _exit(r == 0 ? 0 : 1);
+  }
+  s->forkMs = now_ms() - start;
+  close(p[1]);
+  if (s->pid < 0) {
+    fprintf(stderr, "Error: Can't fork a background save\n");
+    close(p[0]);
+    free(s);
+    return NULL;
+  }
+  s->fd = p[0];
+  return s;
+}
+/*--------------------------------------------------------------------*/
+int
+BackgroundSaveWait(BackgroundSave_T s, int wait,
+                   struct BackgroundSaveStats *stats)
+{
+  struct BackgroundSaveStats st;
+  pid_t r;
+  int status, result;
+
+  if (s == NULL) return -1;
+  while ((r = waitpid(s->pid, &status, wait ? 0 : WNOHANG)) < 0 &&
+         errno == EINTR)
+    ;
+  if (r == 0) return 1;
+
+  memset(&st, 0, sizeof(st));
+  result = r == s->pid && WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+           read(s->fd, &st, sizeof(st)) == (ssize_t)sizeof(st) ? 0 : -1;
+  st.forkMs = s->forkMs;
+  if (stats != NULL) *stats = st;
+  close(s->fd);
+  free(s);
+  return result;
+}
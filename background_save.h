@@ -0,0 +1,53 @@
+#ifndef BACKGROUND_SAVE_H
+#define BACKGROUND_SAVE_H
+
+/* background_save.h */
+/* Save a point-in-time image of a DB_T without stopping it.
+
+     BackgroundSave_T s = BackgroundSaveCustomerDB(d, "customers.img");
+     ... keep changing d ...
+     if (BackgroundSaveWait(s, 1, &stats) == 0)
+       ... the file holds d as it was at the call ...
+
+   The call forks. The child owns a copy-on-write view of the parent's
+   memory frozen at the fork: it scans d with a cursor, builds the
+   frozen image (frozen_db.h), writes it to "path.tmp", syncs it and
+   renames it over path, so path always holds a whole image. The parent
+   only pays for the fork (copying its page tables) and for the pages
+   that either process writes while the child runs, which the kernel
+   copies one at a time. The file loads with LoadFrozenCustomerDB().
+
+   Call it from the thread that changes d, between calls: the child
+   sees d as it was at the fork, whatever other threads were doing.
+   customer_manager5 reads the pages its pool doesn't hold from its
+   file, which the parent may write meanwhile, so there the image is
+   only point-in-time if the db fits the buffer pool. */
+
+#include <stddef.h>
+#include "customer_manager.h"
+
+typedef struct BackgroundSave *BackgroundSave_T;
+
+struct BackgroundSaveStats {
+  double forkMs;        /* time the parent spent in fork() */
+  double saveMs;        /* from the fork to the rename */
+  size_t customers;     /* customers in the image */
+  size_t bytes;         /* size of the file */
+  size_t sharedPages;   /* pages still shared by the two processes at
+                           the end */
+  size_t copiedPages;   /* pages shared at the fork that were copied
+                           (written by either process) by the end */
+};
+
+/* start saving d to path in a child process. return the save, NULL if
+   the fork failed */
+BackgroundSave_T BackgroundSaveCustomerDB(DB_T d, const char *path);
+
+/* check on s, waiting for it to end if wait is non-zero. return 1 if it
+   is still running, otherwise fill stats (if not NULL), free s and
+   return 0 if path holds the image, -1 if the save failed (path is then
+   unchanged) */
+int BackgroundSaveWait(BackgroundSave_T s, int wait,
+                       struct BackgroundSaveStats *stats);
+
+#endif /* end of BACKGROUND_SAVE_H */
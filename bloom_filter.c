@@ -0,0 +1,134 @@
+/*
+ * Program: bloom_filter.c
+ *
+ * Description:
+ * ------------
+ * Blocked Bloom filter (see bloom_filter.h). The high 32 bits of a key's
+ * hash pick a 64-byte block; the low 32 bits, multiplied by eight odd
+ * constants, pick one bit in each of the block's eight words. Blocks are
+ * allocated on a cache-line boundary, so a query reads exactly one line.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bloom_filter.h"
+
+#define BLOCK_WORDS 8          /* 64-bit words per block */
+#define BLOCK_BYTES 64
+#define BITS_PER_KEY 12
+
+struct BloomFilter {
+  uint64_t (*blocks)[BLOCK_WORDS];  /* nBlocks cache-line aligned blocks */
+  size_t nBlocks;
+  size_t capacity;                  /* keys the filter was sized for */
+};
+
+static const uint32_t salt[BLOCK_WORDS] = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+/*--------------------------------------------------------------------*/
+BloomFilter_T
+CreateBloomFilter(size_t keys)
+{
+  BloomFilter_T b;
+  void *blocks;
+
+  b = (BloomFilter_T)calloc(1, sizeof(struct BloomFilter));
+  if (b == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the Bloom filter\n");
+    return NULL;
+  }
+  b->capacity = keys;
+  b->nBlocks = (keys * BITS_PER_KEY + BLOCK_BYTES * 8 - 1) / (BLOCK_BYTES * 8);
+  if (b->nBlocks == 0) b->nBlocks = 1;
+  if (posix_memalign(&blocks, BLOCK_BYTES, b->nBlocks * BLOCK_BYTES) != 0) {
+    fprintf(stderr, "Error: Can't allocate a memory for the Bloom filter\n");
+    free(b);
+    return NULL;
+  }
+  memset(blocks, 0, b->nBlocks * BLOCK_BYTES);
+  b->blocks = (uint64_t (*)[BLOCK_WORDS])blocks;
+  return b;
+}
+/*--------------------------------------------------------------------*/
+void
+DestroyBloomFilter(BloomFilter_T b)
+{
+  if (b == NULL) return;
+  free(b->blocks);
+  free(b);
+}
+/*--------------------------------------------------------------------*/
+uint64_t
+BloomHash(const char *key, size_t len)
+{
+  const uint64_t m = 0x9e3779b97f4a7c15ULL;
+  uint64_t h = len * m, w;
+  size_t i;
+
+  /* eight bytes at a time, then the tail, then the murmur3 finalizer */
+  for (i = 0; i + 8 <= len; i += 8) {
+    memcpy(&w, key + i, 8);
+    h = (h ^ w) * m;
+    h ^= h >> 29;
+  }
+  if (i < len) {
+    w = 0;
+    memcpy(&w, key + i, len - i);
+    h = (h ^ w) * m;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+/*--------------------------------------------------------------------*/
+static uint64_t *block_of(BloomFilter_T b, uint64_t h)
+{
+  return b->blocks[((h >> 32) * b->nBlocks) >> 32];
+}
+/*--------------------------------------------------------------------*/
+void
+BloomAdd(BloomFilter_T b, uint64_t h)
+{
+  uint64_t *block = block_of(b, h);
+  uint32_t x = (uint32_t)h;
+  int i;
+
+  for (i = 0; i < BLOCK_WORDS; i++)
+    block[i] |= 1ULL << ((x * salt[i]) >> 26);
+}
+/*--------------------------------------------------------------------*/
+int
+BloomMayContain(BloomFilter_T b, uint64_t h)
+{
+  const uint64_t *block = block_of(b, h);
+  uint32_t x = (uint32_t)h;
+  uint64_t miss = 0;
+  int i;
+
+  /* test all eight words without branching on each */
+  for (i = 0; i < BLOCK_WORDS; i++)
+    miss |= ~block[i] & (1ULL << ((x * salt[i]) >> 26));
+  return miss == 0;
+}
+/*--------------------------------------------------------------------*/
+size_t
+BloomCapacity(BloomFilter_T b)
+{
+  return (b != NULL) ? b->capacity : 0;
+}
+/*--------------------------------------------------------------------*/
+size_t
+BloomMemory(BloomFilter_T b)
+{
+  if (b == NULL) return 0;
+  return sizeof(struct BloomFilter) + b->nBlocks * BLOCK_BYTES;
+}
@@ -0,0 +1,43 @@
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+/* bloom_filter.h */
+/* Blocked Bloom filter over customer keys. Every key sets 8 bits in a
+   single 64-byte block, one per 64-bit word of the block, so a query
+   costs one hash and one cache line. At about 12 bits per key the
+   filter answers "maybe" for roughly 1% of absent keys; it never answers
+   "no" for a key that was added.
+
+     uint64_t h = BloomHash(key, len);
+     BloomAdd(b, h);
+     if (!BloomMayContain(b, h)) ... the key was never added
+
+   Keys cannot be removed; a caller that deletes rebuilds the filter. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct BloomFilter *BloomFilter_T;
+
+/* create an empty filter sized for 'keys' keys, NULL on failure */
+BloomFilter_T CreateBloomFilter(size_t keys);
+
+/* free the filter */
+void DestroyBloomFilter(BloomFilter_T b);
+
+/* return the hash of the len-byte key that the calls below take */
+uint64_t BloomHash(const char *key, size_t len);
+
+/* add the key with hash h */
+void BloomAdd(BloomFilter_T b, uint64_t h);
+
+/* return 0 if the key with hash h was certainly never added */
+int BloomMayContain(BloomFilter_T b, uint64_t h);
+
+/* return the number of keys the filter was sized for */
+size_t BloomCapacity(BloomFilter_T b);
+
+/* return the bytes held by the filter */
+size_t BloomMemory(BloomFilter_T b);
+
+#endif /* end of BLOOM_FILTER_H */
@@ -0,0 +1,521 @@
+/*
+ * Program: change_feed.c
+ *
+ * Description:
+ * ------------
+ * Change feed of a customer database and the follower applying it (see
+ * change_feed.h). The leader encodes each change once, into a byte ring
+ * holding the stream exactly as it goes out, so flushing a follower is
+ * one or two writes of the ring from the byte position it has reached.
+ * A follower is behind the ring once the bytes it still needs were
+ * overwritten; it then gets a snapshot written straight from a cursor.
+ * Integers are LEB128 varints as in customer_trace.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "change_feed.h"
+
+#define MAX_VARINT 10
+#define SNAPSHOT_BATCH 256        /* customers per cursor batch */
+#define SNAPSHOT_CHUNK (1 << 16)  /* bytes of snapshot per write */
+#define READ_CHUNK (1 << 16)      /* bytes a follower reads at once */
+
+struct Buf {
+  unsigned char *p;
+  size_t len, cap;
+};
+
+struct FeedFollower {
+  int fd;                    /* -1: free entry */
+  uint64_t pos;              /* stream bytes sent */
+  uint64_t acked;            /* last lsn acknowledged */
+  unsigned char ack[8];      /* partial acknowledgement */
+  int ackLen;
+};
+
+struct ChangeFeed {
+  DB_T d;
+  unsigned char *ring;
+  size_t size;
+  uint64_t written;          /* stream bytes ever appended */
+  uint64_t lsn;              /* changes ever appended */
+  struct Buf frame;          /* encoding buffer of the hook */
+  struct FeedFollower followers[FEED_MAX_FOLLOWERS];
+};
+
+struct Follower {
+  DB_T d;
+  int fd;
+  uint64_t lsn;
+  int inSnapshot;            /* between SNAPSHOT_BEGIN and _END */
+  struct Buf in;             /* bytes read but not applied */
+};
+/*--------------------------------------------------------------------*/
+static int reserve(struct Buf *b, size_t n)
+
+/* Make room for n more bytes in b. Return 0 on success, -1 if b can't
+   grow. */
+{
+  unsigned char *p;
+  size_t cap = b->cap ? b->cap : 256;
+
+  if (b->len + n <= b->cap) return 0;
+  while (cap < b->len + n) cap *= 2;
+  if ((p = (unsigned char *)realloc(b->p, cap)) == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the change feed\n");
+    return -1;
+  }
+  b->p = p;
+  b->cap = cap;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static size_t put_varint(unsigned char *p, uint64_t v)
+{
+  size_t n = 0;
+
+  while (v >= 0x80) {
+    p[n++] = (unsigned char)((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (unsigned char)v;
+  return n;
+}
+/*--------------------------------------------------------------------*/
+static int get_varint(const unsigned char **p, const unsigned char *end,
+                      uint64_t *v)
+
+/* Read a varint at *p (not past end) into *v and advance *p. Return 1
+   on success, 0 if the varint is cut off at end, -1 if it's overlong. */
+{
+  const unsigned char *q = *p;
+  uint64_t result = 0;
+  int shift = 0;
+
+  for (;;) {
+    if (q == end) return 0;
+    result |= (uint64_t)(*q & 0x7f) << shift;
+    if ((*q++ & 0x80) == 0) break;
+    if ((shift += 7) > 63) return -1;
+  }
+  *p = q;
+  *v = result;
+  return 1;
+}
+/*--------------------------------------------------------------------*/
+static uint64_t zigzag(int v)
+{
+  return ((uint64_t)(int64_t)v << 1) ^ (uint64_t)((int64_t)v >> 63);
+}
+
+static int unzigzag(uint64_t v)
+{
+  return (int)(int64_t)((v >> 1) ^ (~(v & 1) + 1));
+}
+/*--------------------------------------------------------------------*/
+static int encode(struct Buf *b, int type, uint64_t lsn,
+                  const char *id, size_t idLen,
+                  const char *name, size_t nameLen, int purchase)
+
+/* Append the frame of one record to b. Keys are left out when NULL.
+   Return 0 on success, -1 if b can't grow. */
+{
+  unsigned char head[MAX_VARINT], *p;
+  size_t body = 1 + (size_t)MAX_VARINT * 4 + idLen + nameLen, n;
+
+  if (reserve(b, MAX_VARINT + body) < 0) return -1;
+  p = b->p + b->len + MAX_VARINT; /* body first, its length in front */
+  n = 0;
+  p[n++] = (unsigned char)type;
+  if (type == FEED_SNAPSHOT_BEGIN) n += put_varint(p + n, lsn);
+  if (id) {
+    n += put_varint(p + n, idLen);
+    memcpy(p + n, id, idLen);
+    n += idLen;
+  }
+  if (name) {
+    n += put_varint(p + n, nameLen);
+    memcpy(p + n, name, nameLen);
+    n += nameLen;
+  }
+  if (type == FEED_REGISTER) n += put_varint(p + n, zigzag(purchase));
+
+  body = put_varint(head, n);
+  memcpy(b->p + b->len, head, body);
+  memmove(b->p + b->len + body, p, n);
+  b->len += body + n;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int write_all(int fd, const void *p, size_t n)
+
+/* Write n bytes to fd, blocking. A socket whose peer is gone fails
+   with EPIPE instead of raising SIGPIPE. Return 0 or -1. */
+{
+  const char *q = (const char *)p;
+  ssize_t w;
+
+  while (n > 0) {
+    w = send(fd, q, n, MSG_NOSIGNAL);
+    if (w < 0 && errno == ENOTSOCK) w = write(fd, q, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    q += w;
+    n -= (size_t)w;
+  }
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+ChangeFeed_T
+CreateChangeFeed(DB_T d, size_t ringSize)
+{
+  ChangeFeed_T f;
+  int i;
+
+  if (d == NULL || ringSize == 0) {
+    fprintf(stderr, "Error: invalid argument to CreateChangeFeed\n");
+    return NULL;
+  }
+  f = (ChangeFeed_T)calloc(1, sizeof(struct ChangeFeed));
+  if (f == NULL || (f->ring = (unsigned char *)malloc(ringSize)) == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the change feed\n");
+    free(f);
+    return NULL;
+  }
+  f->d = d;
+  f->size = ringSize;
+  for (i = 0; i < FEED_MAX_FOLLOWERS; i++)
+    f->followers[i].fd = -1;
+  return f;
+}
+/*--------------------------------------------------------------------*/
+void
+DestroyChangeFeed(ChangeFeed_T f)
+{
+  if (f == NULL) return;
+  free(f->frame.p);
+  free(f->ring);
+  free(f);
+}
+/*--------------------------------------------------------------------*/
+void
+ChangeFeedHook(void *ctx, const struct CustomerOp *op)
+{
+  ChangeFeed_T f = (ChangeFeed_T)ctx;
+  size_t at, first;
+  int type;
+
+  if (f == NULL || op == NULL || op->result != 0) return;
+  switch (op->type) {
+  case CUSTOMER_OP_REGISTER: type = FEED_REGISTER; break;
+  case CUSTOMER_OP_UNREGISTER_ID: type = FEED_UNREGISTER_ID; break;
+  case CUSTOMER_OP_UNREGISTER_NAME: type = FEED_UNREGISTER_NAME; break;
+  default: return; /* lookups change nothing */
+  }
+
+  f->frame.len = 0;
+  if (encode(&f->frame, type, 0,
+             type != FEED_UNREGISTER_NAME ? op->id : NULL, op->idLen,
+             type != FEED_UNREGISTER_ID ? op->name : NULL, op->nameLen,
+             op->purchase) < 0) {
+    /* the record is lost: push everybody out of the ring */
+    f->written += f->size + 1;
+    f->lsn++;
+    return;
+  }
+
+  /* a frame longer than the ring only moves 'written', which sends
+     every follower a snapshot */
+  if (f->frame.len <= f->size) {
+    at = (size_t)(f->written % f->size);
+    first = f->size - at < f->frame.len ? f->size - at : f->frame.len;
+    memcpy(f->ring + at, f->frame.p, first);
+    memcpy(f->ring, f->frame.p + first, f->frame.len - first);
+  }
+  f->written += f->frame.len;
+  f->lsn++;
+}
+/*--------------------------------------------------------------------*/
+static int send_snapshot(ChangeFeed_T f, struct FeedFollower *s)
+
+/* Write the follower s every customer of the db, between the snapshot
+   markers, and move it to the end of the ring. Return 0 or -1. */
+{
+  struct CustomerView views[SNAPSHOT_BATCH];
+  struct Buf b = { NULL, 0, 0 };
+  CustomerCursor_T c;
+  int n, i, result = -1;
+
+  if ((c = OpenCustomerCursor(f->d)) == NULL) return -1;
+  if (encode(&b, FEED_SNAPSHOT_BEGIN, f->lsn, NULL, 0, NULL, 0, 0) < 0)
+    goto done;
+  while ((n = NextCustomerBatch(c, views, SNAPSHOT_BATCH)) > 0) {
+    for (i = 0; i < n; i++) {
+      if (encode(&b, FEED_REGISTER, 0, views[i].id, views[i].idLen,
+                 views[i].name, views[i].nameLen, views[i].purchase) < 0)
+        goto done;
+    }
+    if (b.len >= SNAPSHOT_CHUNK) {
+      if (write_all(s->fd, b.p, b.len) < 0) goto done;
+      b.len = 0;
+    }
+  }
+  if (n < 0 ||
+      encode(&b, FEED_SNAPSHOT_END, 0, NULL, 0, NULL, 0, 0) < 0 ||
+      write_all(s->fd, b.p, b.len) < 0)
+    goto done;
+  s->pos = f->written;
+  result = 0;
+
+ done:
+  CloseCustomerCursor(c);
+  free(b.p);
+  return result;
+}
+/*--------------------------------------------------------------------*/
+int
+ChangeFeedAddFollower(ChangeFeed_T f, int fd)
+{
+  int i;
+
+  if (f == NULL || fd < 0) return -1;
+  for (i = 0; i < FEED_MAX_FOLLOWERS && f->followers[i].fd >= 0; i++)
+    ;
+  if (i == FEED_MAX_FOLLOWERS) {
+    fprintf(stderr, "Error: the change feed has %d followers already\n",
+            FEED_MAX_FOLLOWERS);
+    return -1;
+  }
+  memset(&f->followers[i], 0, sizeof(f->followers[i]));
+  f->followers[i].fd = fd;
+  if (send_snapshot(f, &f->followers[i]) < 0) {
+    f->followers[i].fd = -1;
+    return -1;
+  }
+  return i;
+}
+/*--------------------------------------------------------------------*/
+static void read_acks(struct FeedFollower *s)
+
+/* Take in the acknowledgements that have arrived, without blocking.
+   Over a pipe there are none. */
+{
+  ssize_t n;
+  uint64_t lsn;
+  int i;
+
+  for (;;) {
+    n = recv(s->fd, s->ack + s->ackLen, sizeof(s->ack) - s->ackLen,
+             MSG_DONTWAIT);
+    if (n <= 0) return;
+    if ((s->ackLen += (int)n) < (int)sizeof(s->ack)) continue;
+    for (lsn = 0, i = 7; i >= 0; i--)
+      lsn = lsn << 8 | s->ack[i];
+    s->acked = lsn;
+    s->ackLen = 0;
+  }
+}
+/*--------------------------------------------------------------------*/
+static int flush_follower(ChangeFeed_T f, struct FeedFollower *s)
+
+/* Send s the ring bytes after its position, or a snapshot if they were
+   overwritten. Return 0 or -1. */
+{
+  size_t at, n, first;
+
+  read_acks(s);
+  if (f->written - s->pos > f->size) return send_snapshot(f, s);
+
+  n = (size_t)(f->written - s->pos);
+  if (n == 0) return 0;
+  at = (size_t)(s->pos % f->size);
+  first = f->size - at < n ? f->size - at : n;
+  if (write_all(s->fd, f->ring + at, first) < 0 ||
+      write_all(s->fd, f->ring, n - first) < 0)
+    return -1;
+  s->pos = f->written;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+ChangeFeedFlush(ChangeFeed_T f)
+{
+  int i, served = 0;
+
+  if (f == NULL) return -1;
+  for (i = 0; i < FEED_MAX_FOLLOWERS; i++) {
+    if (f->followers[i].fd < 0) continue;
+    if (flush_follower(f, &f->followers[i]) < 0) {
+      fprintf(stderr, "Error: dropping follower %d of the change feed\n", i);
+      f->followers[i].fd = -1;
+      continue;
+    }
+    served++;
+  }
+  return served;
+}
+/*--------------------------------------------------------------------*/
+uint64_t
+ChangeFeedLsn(ChangeFeed_T f)
+{
+  return f ? f->lsn : 0;
+}
+/*--------------------------------------------------------------------*/
+long
+ChangeFeedLag(ChangeFeed_T f, int follower)
+{
+  struct FeedFollower *s;
+
+  if (f == NULL || follower < 0 || follower >= FEED_MAX_FOLLOWERS ||
+      f->followers[follower].fd < 0)
+    return -1;
+  s = &f->followers[follower];
+  read_acks(s);
+  return (long)(f->lsn - s->acked);
+}
+/*--------------------------------------------------------------------*/
+Follower_T
+CreateFollower(DB_T d, int fd)
+{
+  Follower_T r;
+
+  if (d == NULL || fd < 0) {
+    fprintf(stderr, "Error: invalid argument to CreateFollower\n");
+    return NULL;
+  }
+  r = (Follower_T)calloc(1, sizeof(struct Follower));
+  if (r == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the follower\n");
+    return NULL;
+  }
+  r->d = d;
+  r->fd = fd;
+  return r;
+}
+/*--------------------------------------------------------------------*/
+void
+DestroyFollower(Follower_T r)
+{
+  if (r == NULL) return;
+  free(r->in.p);
+  free(r);
+}
+/*--------------------------------------------------------------------*/
+static int everybody(const char *id, const char *name, const int purchase)
+{
+  (void)id; (void)name; (void)purchase;
+  return 1;
+}
+/*--------------------------------------------------------------------*/
+static int get_key(const unsigned char **p, const unsigned char *end,
+                   const char **key, size_t *len)
+{
+  uint64_t n;
+
+  if (get_varint(p, end, &n) != 1 || n > (uint64_t)(end - *p)) return -1;
+  *key = (const char *)*p;
+  *len = (size_t)n;
+  *p += n;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int apply(Follower_T r, const unsigned char *p,
+                 const unsigned char *end)
+
+/* Apply the record body [p, end) to the db of r. Return 0 or -1 on a
+   malformed record. */
+{
+  const char *id = NULL, *name = NULL;
+  size_t idLen = 0, nameLen = 0;
+  uint64_t v;
+  int type = *p++;
+
+  switch (type) {
+  case FEED_REGISTER:
+    if (get_key(&p, end, &id, &idLen) < 0 ||
+        get_key(&p, end, &name, &nameLen) < 0 ||
+        get_varint(&p, end, &v) != 1)
+      return -1;
+    RegisterCustomerN(r->d, id, idLen, name, nameLen, unzigzag(v));
+    break;
+  case FEED_UNREGISTER_ID:
+    if (get_key(&p, end, &id, &idLen) < 0) return -1;
+    UnregisterCustomerByIDN(r->d, id, idLen);
+    break;
+  case FEED_UNREGISTER_NAME:
+    if (get_key(&p, end, &name, &nameLen) < 0) return -1;
+    UnregisterCustomerByNameN(r->d, name, nameLen);
+    break;
+  case FEED_SNAPSHOT_BEGIN:
+    if (get_varint(&p, end, &v) != 1) return -1;
+    UnregisterCustomersWhere(r->d, everybody);
+    r->lsn = v;
+    r->inSnapshot = 1;
+    return 0;
+  case FEED_SNAPSHOT_END:
+    r->inSnapshot = 0;
+    return 0;
+  default:
+    return -1;
+  }
+  if (!r->inSnapshot) r->lsn++;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+FollowerPoll(Follower_T r, int wait)
+{
+  struct pollfd pfd;
+  const unsigned char *p, *end, *body;
+  unsigned char ack[8];
+  uint64_t len, lsn;
+  ssize_t n;
+  int applied = 0, i;
+
+  if (r == NULL) return -1;
+  pfd.fd = r->fd;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, wait ? -1 : 0) <= 0) return 0;
+  if (reserve(&r->in, READ_CHUNK) < 0) return -1;
+  n = read(r->fd, r->in.p + r->in.len, READ_CHUNK);
+  if (n < 0) return errno == EINTR || errno == EAGAIN ? 0 : -1;
+  if (n == 0) return -1; /* the leader is gone */
+  r->in.len += (size_t)n;
+
+  /* apply every complete frame, keep the rest for the next poll */
+  p = r->in.p;
+  end = r->in.p + r->in.len;
+  for (;;) {
+    body = p;
+    i = get_varint(&body, end, &len);
+    if (i < 0) return -1;
+    if (i == 0 || len > (uint64_t)(end - body)) break;
+    if (len == 0) return -1;
+    if (apply(r, body, body + len) < 0) return -1;
+    p = body + len;
+    applied++;
+  }
+  r->in.len = (size_t)(end - p);
+  memmove(r->in.p, p, r->in.len);
+
+  if (applied > 0 && !r->inSnapshot) {
+    for (lsn = r->lsn, i = 0; i < 8; i++, lsn >>= 8)
+      ack[i] = (unsigned char)lsn;
+    send(r->fd, ack, sizeof(ack), MSG_NOSIGNAL | MSG_DONTWAIT);
+  }
+  return applied;
+}
+/*--------------------------------------------------------------------*/
+uint64_t
+FollowerLsn(Follower_T r)
+{
+  return r ? r->lsn : 0;
+}
@@ -0,0 +1,97 @@
+#ifndef CHANGE_FEED_H
+#define CHANGE_FEED_H
+
+/* change_feed.h */
+/* Stream the changes of a DB_T to read replicas in other processes.
+
+   Leader:
+     ChangeFeed_T f = CreateChangeFeed(d, 1 << 20);
+     SetCustomerDBHook(d, ChangeFeedHook, f);
+     ChangeFeedAddFollower(f, fd);     (socket or pipe to a follower)
+     ... change d, calling ChangeFeedFlush(f) now and then ...
+
+   Follower:
+     Follower_T r = CreateFollower(replica, fd);
+     while (FollowerPoll(r, 1) >= 0)
+       ... look customers up in replica ...
+
+   Every successful registration and unregistration (including those of
+   UnregisterCustomersWhere) is appended to a ring buffer as a compact
+   record; a flush writes each follower the part of the ring it has not
+   been sent. A new follower, and one that fell so far behind that its
+   part was overwritten, first gets a snapshot of the whole db followed
+   by the records after it. Records are numbered by a log sequence
+   number (lsn); over a socket the follower acknowledges the lsn it has
+   applied, which gives the leader its lag.
+
+   Stream format: frames of a varint body length and a body of
+     u8      type (FEED_*)
+     varint  lsn                               snapshot begin only
+     [varint id length, id bytes]              register, unregister by id
+     [varint name length, name bytes]          register, unregister by name
+     [zigzag varint purchase]                  register only
+   Acknowledgements are 8-byte little endian lsns. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "customer_manager.h"
+
+typedef struct ChangeFeed *ChangeFeed_T;
+typedef struct Follower *Follower_T;
+
+/* record types of the stream */
+enum {
+  FEED_REGISTER = 1,
+  FEED_UNREGISTER_ID,
+  FEED_UNREGISTER_NAME,
+  FEED_SNAPSHOT_BEGIN,       /* drop everything, lsn of the snapshot */
+  FEED_SNAPSHOT_END
+};
+
+/* most followers a feed serves */
+#define FEED_MAX_FOLLOWERS 16
+
+/* create a feed of the changes of d keeping the last ringSize bytes of
+   records, NULL on failure. install ChangeFeedHook with the feed as
+   its context to fill it */
+ChangeFeed_T CreateChangeFeed(DB_T d, size_t ringSize);
+
+/* free f. the followers' descriptors stay open */
+void DestroyChangeFeed(ChangeFeed_T f);
+
+/* HOOKFUNC_T appending the successful changes in op to the feed 'ctx' */
+void ChangeFeedHook(void *ctx, const struct CustomerOp *op);
+
+/* send a snapshot of the db to the follower on fd (blocking writes)
+   and serve it from then on. return its number, -1 on failure */
+int ChangeFeedAddFollower(ChangeFeed_T f, int fd);
+
+/* send every follower what it is missing and collect its
+   acknowledgements. a follower whose descriptor fails is dropped.
+   return the followers served, -1 on invalid input */
+int ChangeFeedFlush(ChangeFeed_T f);
+
+/* lsn of the last change recorded */
+uint64_t ChangeFeedLsn(ChangeFeed_T f);
+
+/* changes recorded but not yet acknowledged by the follower (all of
+   them over a pipe), -1 if there is no such follower */
+long ChangeFeedLag(ChangeFeed_T f, int follower);
+
+/* apply the stream arriving on fd to d, which should start empty.
+   NULL on failure */
+Follower_T CreateFollower(DB_T d, int fd);
+
+/* free r (not its db or fd) */
+void DestroyFollower(Follower_T r);
+
+/* read what has arrived (with wait, block until something does),
+   apply its complete records as one batch and acknowledge them.
+   return the records applied, -1 once the leader closed the stream
+   or on a corrupt stream */
+int FollowerPoll(Follower_T r, int wait);
+
+/* lsn of the last change applied */
+uint64_t FollowerLsn(Follower_T r);
+
+#endif /* end of CHANGE_FEED_H */
@@ -6,10 +6,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <assert.h>
+#include <time.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #include "customer_manager.h"
+#include "perf_counter.h"
+#include "customer_trace.h"
+#include "string_pool.h"
+#include "combining_db.h"
+#include "change_feed.h"
+#include "background_save.h"
+#include "quantile_sketch.h"
+#include "customer_protocol.h"
 
 /*--------------------------------------------------------------------*/
 int
@@ -350,138 +370,3798 @@ CorrectnessTest5() {
 	return (result >= 0)? 0 : -1;
 }
 /*--------------------------------------------------------------------*/
+int
+CheckResult(int test_result, int expected_result)
+{
+	if (expected_result == test_result)
+		printf("[PASSED] ");
+	else
+		printf("[FAILED] ");
+	printf("test result: %d / expected result: %d\n",
+		   test_result, expected_result);
+
+	return (expected_result == test_result)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* Correctness Test 6: length-aware (...N) calls on keys that are not
+   NUL-terminated */
+int
+CorrectnessTest6() {
+
+	DB_T d;
+	int result;
+	/* every key is a slice of this buffer, none is NUL-terminated */
+	const char buf[] = "id1name1id2name2";
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 6:\n" \
+		   "  Length-aware calls on non-terminated keys\n" \
+		   "------------------------------------------------------\n");
+
+	d = CreateCustomerDB();
+	if (d == NULL) {
+		printf("CreateCustomerDB() failed, cannot perform the test\n");
+		return -1;
+	}
+
+	printf("RegisterCustomerN(d, \"id1\", 3, \"name1\", 5, 100);\n");
+	result += CheckResult(RegisterCustomerN(d, buf, 3, buf + 3, 5, 100), 0);
+	printf("RegisterCustomerN(d, \"id2\", 3, \"name2\", 5, 200);\n");
+	result += CheckResult(RegisterCustomerN(d, buf + 8, 3, buf + 11, 5, 200),
+						  0);
+	printf("RegisterCustomerN(d, \"id1\", 3, \"name3\", 5, 300);\n");
+	result += CheckResult(RegisterCustomerN(d, buf, 3, "name3", 5, 300), -1);
+	printf("GetPurchaseByIDN(d, \"id2\", 3);\n");
+	result += CheckResult(GetPurchaseByIDN(d, buf + 8, 3), 200);
+	printf("GetPurchaseByNameN(d, \"name1\", 5);\n");
+	result += CheckResult(GetPurchaseByNameN(d, buf + 3, 5), 100);
+	printf("GetPurchaseByIDN(d, \"id\", 2);\n");
+	result += CheckResult(GetPurchaseByIDN(d, buf, 2), -1);
+	result += TestGetPurchaseByID(d, "id1", 100);
+	result += TestGetPurchaseByName(d, "name2", 200);
+	printf("UnregisterCustomerByNameN(d, \"name2\", 5);\n");
+	result += CheckResult(UnregisterCustomerByNameN(d, buf + 11, 5), 0);
+	printf("UnregisterCustomerByIDN(d, \"id2\", 3);\n");
+	result += CheckResult(UnregisterCustomerByIDN(d, buf + 8, 3), -1);
+	printf("UnregisterCustomerByIDN(d, \"id1\", 3);\n");
+	result += CheckResult(UnregisterCustomerByIDN(d, buf, 3), 0);
+	result += TestGetPurchaseByName(d, "name1", -1);
+
+	DestroyCustomerDB(d);
+
+	printf("\nCorrectness Test 6 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* Correctness Test 7: registration with adopted and pooled keys */
+int
+CorrectnessTest7() {
+
+	DB_T d;
+	StringPool_T pool;
+	int result;
+	const char *longId = "id-that-is-too-long-for-the-record";
+	const char *id, *name;
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 7:\n" \
+		   "  Adopted and pooled keys\n" \
+		   "------------------------------------------------------\n");
+
+	d = CreateCustomerDB();
+	pool = CreateStringPool();
+	if (d == NULL || pool == NULL) {
+		printf("CreateCustomerDB() failed, cannot perform the test\n");
+		DestroyCustomerDB(d);
+		DestroyStringPool(pool);
+		return -1;
+	}
+
+	/* the DB frees adopted keys itself, failed calls leave them to us */
+	printf("RegisterCustomerTakeOwnership(d, strdup(\"%s\"), " \
+		   "strdup(\"Adopted\"), 10);\n", longId);
+	result += CheckResult(RegisterCustomerTakeOwnership(d, strdup(longId),
+						  strdup("Adopted"), 10), 0);
+	id = strdup("other");
+	name = strdup("Adopted");
+	printf("RegisterCustomerTakeOwnership(d, strdup(\"other\"), " \
+		   "strdup(\"Adopted\"), 20);\n");
+	result += CheckResult(RegisterCustomerTakeOwnership(d, (char *)id,
+						  (char *)name, 20), -1);
+	free((char *)id);
+	free((char *)name);
+	result += TestGetPurchaseByID(d, longId, 10);
+
+	/* the DB holds its own references on pooled keys */
+	id = StringPoolIntern(pool, longId + 1, strlen(longId + 1));
+	name = StringPoolIntern(pool, "Pooled", 6);
+	printf("RegisterCustomerPooled(d, \"%s\", \"Pooled\", 30);\n", id);
+	result += CheckResult(RegisterCustomerPooled(d, id, name, 30), 0);
+	StringPoolRelease(id);
+	StringPoolRelease(name);
+	result += TestGetPurchaseByName(d, "Pooled", 30);
+	result += TestGetPurchaseByID(d, longId + 1, 30);
+	result += TestUnregisterCustomerByName(d, "Pooled", 0);
+	printf("StringPoolCount(pool);\n");
+	result += CheckResult((int)StringPoolCount(pool), 0);
+
+	DestroyCustomerDB(d);
+	DestroyStringPool(pool);
+
+	printf("\nCorrectness Test 7 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* Correctness Test 8: decimal ids, which some engines index as numbers */
+int
+CorrectnessTest8() {
+
+	DB_T d;
+	int result, errors, i;
+	char id[32], name[32];
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 8:\n" \
+		   "  Decimal ids\n" \
+		   "------------------------------------------------------\n");
+
+	d = CreateCustomerDB();
+	if (d == NULL) {
+		printf("CreateCustomerDB() failed, cannot perform the test\n");
+		return -1;
+	}
+
+	/* "7" and "007" are different ids */
+	result += TestRegisterCustomer(d, "7", "Seven", 7, 0);
+	result += TestRegisterCustomer(d, "007", "Bond", 70, 0);
+	result += TestRegisterCustomer(d, "7", "Other", 1, -1);
+	result += TestRegisterCustomer(d, "0", "Zero", 1, 0);
+	result += TestRegisterCustomer(d, "18446744073709551615", "Max", 2, 0);
+	result += TestRegisterCustomer(d, "18446744073709551616", "Max+1", 3, 0);
+	result += TestGetPurchaseByID(d, "7", 7);
+	result += TestGetPurchaseByID(d, "007", 70);
+	result += TestGetPurchaseByID(d, "07", -1);
+	result += TestGetPurchaseByID(d, "18446744073709551615", 2);
+	result += TestGetPurchaseByID(d, "18446744073709551616", 3);
+	result += TestUnregisterCustomerByName(d, "Seven", 0);
+	result += TestGetPurchaseByID(d, "7", -1);
+	result += TestGetPurchaseByID(d, "007", 70);
+	result += TestUnregisterCustomerByID(d, "0", 0);
+	result += TestUnregisterCustomerByID(d, "0", -1);
+
+	/* enough ids to grow the tables, then remove every other one */
+	printf("Register 5000 decimal ids, unregister the odd ones\n");
+	errors = 0;
+	for (i = 1; i <= 5000; i++) {
+		sprintf(id, "%d", i * 7919);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, i) != 0)
+			errors++;
+	}
+	for (i = 1; i <= 5000; i += 2) {
+		sprintf(id, "%d", i * 7919);
+		if (UnregisterCustomerByID(d, id) != 0)
+			errors++;
+	}
+	for (i = 1; i <= 5000; i++) {
+		sprintf(id, "%d", i * 7919);
+		if (GetPurchaseByID(d, id) != ((i % 2)? -1 : i))
+			errors++;
+	}
+	result += CheckResult(errors, 0);
+
+	DestroyCustomerDB(d);
+
+	printf("\nCorrectness Test 8 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* check the 3000 customers "id%d"/"name%d" of test 9 in d */
+int
+CheckFrozenCustomers(DB_T d)
+{
+	int i, errors = 0;
+	char id[32], name[32];
+
+	for (i = 0; i < 3000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (GetPurchaseByID(d, id) != i + 1 ||
+			GetPurchaseByName(d, name) != i + 1)
+			errors++;
+		sprintf(id, "xid%d", i);
+		sprintf(name, "xname%d", i);
+		if (GetPurchaseByID(d, id) != -1 || GetPurchaseByName(d, name) != -1)
+			errors++;
+	}
+	return errors;
+}
+/*--------------------------------------------------------------------*/
+/* write the len bytes of image to path and return non-zero if
+   LoadFrozenCustomerDB() refuses the file */
+static int
+RefusesImage(const char *path, const char *image, size_t len)
+{
+	FILE *fp;
+	DB_T d;
+
+	fp = fopen(path, "wb");
+	if (fp == NULL || fwrite(image, 1, len, fp) != len) {
+		if (fp)
+			fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+	if ((d = LoadFrozenCustomerDB(path)) == NULL)
+		return 1;
+	DestroyCustomerDB(d);
+	return 0;
+}
+
+/* Correctness Test 9: frozen dbs, saved and loaded again */
+int
+CorrectnessTest9() {
+
+	DB_T d, loaded;
+	int result, i;
+	char id[32], name[32];
+	char path[] = "/tmp/customer_frozen_XXXXXX";
+	char *image = NULL, *key = NULL;
+	uint32_t len32;
+	long size = 0;
+	FILE *fp;
+	int fd;
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 9:\n" \
+		   "  FreezeCustomerDB, Save/LoadFrozenCustomerDB\n" \
+		   "------------------------------------------------------\n");
+
+	d = CreateCustomerDB();
+	if (d == NULL) {
+		printf("CreateCustomerDB() failed, cannot perform the test\n");
+		return -1;
+	}
+	printf("SaveFrozenCustomerDB() of a db that is not frozen\n");
+	result += CheckResult(SaveFrozenCustomerDB(d, "/tmp/never_written"), -1);
+	for (i = 0; i < 3000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, i + 1) != 0)
+			result--;
+	}
+	printf("FreezeCustomerDB(d);\n");
+	result += CheckResult(FreezeCustomerDB(d), 0);
+	result += CheckResult(FreezeCustomerDB(d), -1);
+	printf("Look up the 3000 customers and 6000 absent keys\n");
+	result += CheckResult(CheckFrozenCustomers(d), 0);
+	result += TestRegisterCustomer(d, "new", "New", 1, -1);
+	result += TestUnregisterCustomerByID(d, "id1", -1);
+	result += TestUnregisterCustomerByName(d, "name1", -1);
+	result += TestGetPurchaseByID(d, "id1", 2);
+	result += TestGetSumCustomerPurchase(d, &PurchaseLargerThan100,
+										 "PurchaseLargerThan100",
+										 (101 + 3000) * 2900 / 2);
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		printf("mkstemp() failed, cannot perform the test\n");
+		DestroyCustomerDB(d);
+		return -1;
+	}
+	close(fd);
+	printf("SaveFrozenCustomerDB(d, %s); LoadFrozenCustomerDB(...)\n", path);
+	result += CheckResult(SaveFrozenCustomerDB(d, path), 0);
+	DestroyCustomerDB(d);
+	loaded = LoadFrozenCustomerDB(path);
+	if (loaded == NULL) {
+		printf("[FAILED] LoadFrozenCustomerDB() returned NULL\n");
+		result--;
+	}
+	else {
+		result += CheckResult(CheckFrozenCustomers(loaded), 0);
+		result += TestRegisterCustomer(loaded, "new", "New", 1, -1);
+		DestroyCustomerDB(loaded);
+	}
+
+	/* a damaged image must be refused, not read past its end. a
+	   record is {purchase, id length, name length, id NUL name NUL} */
+	if ((fp = fopen(path, "rb")) != NULL) {
+		if (fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) > 0 &&
+			(image = (char *)malloc(size)) != NULL) {
+			rewind(fp);
+			if (fread(image, 1, size, fp) != (size_t)size)
+				size = 0;
+		}
+		fclose(fp);
+	}
+	for (i = 12; image && i + 10 <= size && key == NULL; i++)
+		if (memcmp(image + i, "id5\0name5\0", 10) == 0)
+			key = image + i;
+	if (key == NULL) {
+		printf("[FAILED] can't find customer id5 in the image\n");
+		result--;
+	}
+	else {
+		printf("LoadFrozenCustomerDB() of a truncated image\n");
+		result += CheckResult(RefusesImage(path, image, size - 8), 1);
+		printf("LoadFrozenCustomerDB() of records with damaged lengths\n");
+		len32 = 0x7fffffff;
+		memcpy(key - 8, &len32, 4);         /* id far past the end */
+		result += CheckResult(RefusesImage(path, image, size), 1);
+		len32 = 4;
+		memcpy(key - 8, &len32, 4);         /* no NUL after the id */
+		result += CheckResult(RefusesImage(path, image, size), 1);
+		len32 = 3;
+		memcpy(key - 8, &len32, 4);
+		len32 = 200;
+		memcpy(key - 4, &len32, 4);         /* name into the next record */
+		result += CheckResult(RefusesImage(path, image, size), 1);
+		len32 = 5;
+		memcpy(key - 4, &len32, 4);         /* repaired */
+		result += CheckResult(RefusesImage(path, image, size), 0);
+	}
+	free(image);
+
+	/* a file that is not an image must be refused */
+	fd = open(path, O_WRONLY | O_TRUNC);
+	if (fd >= 0) {
+		if (write(fd, "not a frozen db, just some bytes", 32) != 32)
+			result--;
+		close(fd);
+	}
+	printf("LoadFrozenCustomerDB() of a file that is not an image\n");
+	result += CheckResult(LoadFrozenCustomerDB(path) == NULL, 1);
+	unlink(path);
+
+	/* an empty db freezes too */
+	d = CreateCustomerDB();
+	if (d != NULL) {
+		result += CheckResult(FreezeCustomerDB(d), 0);
+		result += TestGetPurchaseByID(d, "id1", -1);
+		DestroyCustomerDB(d);
+	}
+
+	printf("\nCorrectness Test 9 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* scan d with batches of 'batch' customers, counting the customers
+   "id%d"/"name%d" (purchase %d + 1) seen in seen[0..count-1]. after
+   each batch, call between(d, batch number, ctx) if it is not NULL.
+   return the number of customers returned, -1 on a wrong view */
+int
+ScanCustomers(DB_T d, int batch, int *seen, int count,
+			  void (*between)(DB_T, int, void *), void *ctx)
+{
+	struct CustomerView views[64];
+	CustomerCursor_T c;
+	int n, i, k, total = 0, batches = 0;
+	char name[32];
+
+	c = OpenCustomerCursor(d);
+	if (c == NULL)
+		return -1;
+	while ((n = NextCustomerBatch(c, views, batch)) > 0) {
+		for (i = 0; i < n; i++) {
+			if (sscanf(views[i].id, "id%d", &k) != 1)
+				continue;        /* added during the scan */
+			sprintf(name, "name%d", k);
+			if (k < 0 || k >= count || views[i].purchase != k + 1 ||
+				views[i].idLen != strlen(views[i].id) ||
+				views[i].nameLen != strlen(name) ||
+				strcmp(views[i].name, name) != 0) {
+				CloseCustomerCursor(c);
+				return -1;
+			}
+			seen[k]++;
+		}
+		total += n;
+		if (between)
+			between(d, batches++, ctx);
+	}
+	CloseCustomerCursor(c);
+	return (n < 0) ? -1 : total;
+}
+
+/* between batches: unregister every third of the next 60 customers */
+void
+UnregisterAhead(DB_T d, int batch, void *ctx)
+{
+	int i;
+	char name[32];
+
+	(void)ctx;
+	for (i = batch * 60; i < batch * 60 + 60; i += 3) {
+		sprintf(name, "name%d", i);
+		UnregisterCustomerByName(d, name);
+	}
+}
+
+/* between batches: register 20 new customers, growing the tables */
+void
+RegisterMore(DB_T d, int batch, void *ctx)
+{
+	int i, *next = (int *)ctx;
+	char id[32], name[32];
+
+	(void)batch;
+	for (i = 0; i < 20; i++, (*next)++) {
+		sprintf(id, "new%d", *next);
+		sprintf(name, "newname%d", *next);
+		RegisterCustomer(d, id, name, 1);
+	}
+}
+
+/* Correctness Test 10: cursors */
+int
+CorrectnessTest10() {
+
+	static int seen[3000];
+	struct CustomerView views[16];
+	CustomerCursor_T c;
+	DB_T d;
+	int result, i, bad, added;
+	char id[32], name[32];
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 10:\n" \
+		   "  OpenCustomerCursor, NextCustomerBatch\n" \
+		   "------------------------------------------------------\n");
+
+	printf("OpenCustomerCursor(NULL), NextCustomerBatch(NULL, ...)\n");
+	result += CheckResult(OpenCustomerCursor(NULL) == NULL, 1);
+	result += CheckResult(NextCustomerBatch(NULL, views, 16), -1);
+
+	d = CreateCustomerDB();
+	if (d == NULL) {
+		printf("CreateCustomerDB() failed, cannot perform the test\n");
+		return -1;
+	}
+	printf("Scan an empty db\n");
+	result += CheckResult(ScanCustomers(d, 16, seen, 3000, NULL, NULL), 0);
+	for (i = 0; i < 3000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, i + 1) != 0)
+			result--;
+	}
+
+	printf("Scan 3000 customers, 7 at a time\n");
+	memset(seen, 0, sizeof(seen));
+	result += CheckResult(ScanCustomers(d, 7, seen, 3000, NULL, NULL), 3000);
+	for (i = bad = 0; i < 3000; i++)
+		bad += (seen[i] != 1);
+	result += CheckResult(bad, 0);
+
+	printf("Stop after one batch\n");
+	c = OpenCustomerCursor(d);
+	result += CheckResult(c != NULL && NextCustomerBatch(c, views, 10) == 10,
+						  1);
+	CloseCustomerCursor(c);
+
+	printf("Scan while unregistering customers ahead of the cursor\n");
+	memset(seen, 0, sizeof(seen));
+	result += CheckResult(ScanCustomers(d, 20, seen, 3000, UnregisterAhead,
+										NULL) < 0, 0);
+	for (i = bad = 0; i < 3000; i++)
+		bad += (i % 3 != 0 && seen[i] != 1) || seen[i] > 1;
+	result += CheckResult(bad, 0);
+
+	/* customer_manager4 may miss customers that inserts move, so only
+	   the views and the end of the scan are checked here */
+	printf("Scan while registering customers (and growing the tables)\n");
+	memset(seen, 0, sizeof(seen));
+	added = 0;
+	result += CheckResult(ScanCustomers(d, 50, seen, 3000, RegisterMore,
+										&added) < 0, 0);
+
+	printf("Scan a frozen db\n");
+	c = OpenCustomerCursor(d);
+	result += CheckResult(FreezeCustomerDB(d), 0);
+	result += CheckResult(NextCustomerBatch(c, views, 16), -1);
+	CloseCustomerCursor(c);
+	memset(seen, 0, sizeof(seen));
+	result += CheckResult(ScanCustomers(d, 16, seen, 3000, NULL, NULL),
+						  2000 + added);
+	for (i = bad = 0; i < 3000; i++)
+		bad += (seen[i] != (i % 3 != 0));
+	result += CheckResult(bad, 0);
+	DestroyCustomerDB(d);
+
+	printf("\nCorrectness Test 10 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* predicates of test 11 */
+int
+OddPurchase(const char *id, const char *name, const int purchase)
+{
+	return purchase % 2;
+}
+
+int
+NoCustomer(const char *id, const char *name, const int purchase)
+{
+	return 0;
+}
+
+/* hook of test 11: count the reported unregistrations by id */
+void
+CountUnregisterHook(void *ctx, const struct CustomerOp *op)
+{
+	if (op->type == CUSTOMER_OP_UNREGISTER_ID && op->result == 0)
+		(*(int *)ctx)++;
+}
+
+/* id of customer i of test 11: every fourth one is a plain number */
+void
+WhereTestID(int i, char *id)
+{
+	sprintf(id, (i % 4 == 0) ? "%d" : "id%d", i);
+}
+
+/* Correctness Test 11: UnregisterCustomersWhere */
+int
+CorrectnessTest11() {
+
+	DB_T d;
+	int result, i, bad, reported = 0;
+	char id[32], name[32];
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 11:\n" \
+		   "  UnregisterCustomersWhere\n" \
+		   "------------------------------------------------------\n");
+
+	d = CreateCustomerDB();
+	if (d == NULL) {
+		printf("CreateCustomerDB() failed, cannot perform the test\n");
+		return -1;
+	}
+	printf("UnregisterCustomersWhere(NULL, ...), (d, NULL)\n");
+	result += CheckResult(UnregisterCustomersWhere(NULL, &OddPurchase), -1);
+	result += CheckResult(UnregisterCustomersWhere(d, NULL), -1);
+	printf("Remove from an empty db\n");
+	result += CheckResult(UnregisterCustomersWhere(d, &OddPurchase), 0);
+
+	for (i = 0; i < 3000; i++) {
+		WhereTestID(i, id);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, i + 1) != 0)
+			result--;
+	}
+	printf("Remove nobody\n");
+	result += CheckResult(UnregisterCustomersWhere(d, &NoCustomer), 0);
+
+	printf("Remove the 1500 customers with an odd purchase\n");
+	SetCustomerDBHook(d, CountUnregisterHook, &reported);
+	result += CheckResult(UnregisterCustomersWhere(d, &OddPurchase), 1500);
+	SetCustomerDBHook(d, NULL, NULL);
+	result += CheckResult(reported, 1500);
+	for (i = bad = 0; i < 3000; i++) {
+		WhereTestID(i, id);
+		sprintf(name, "name%d", i);
+		if (GetPurchaseByID(d, id) != ((i % 2) ? i + 1 : -1) ||
+			GetPurchaseByName(d, name) != ((i % 2) ? i + 1 : -1))
+			bad++;
+	}
+	result += CheckResult(bad, 0);
+	result += TestGetSumCustomerPurchase(d, &PurchaseLargerThan100,
+										 "PurchaseLargerThan100",
+										 (102 + 3000) * 1450 / 2);
+
+	printf("Register the removed customers again\n");
+	for (i = bad = 0; i < 3000; i += 2) {
+		WhereTestID(i, id);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, i + 1) != 0)
+			bad++;
+	}
+	result += CheckResult(bad, 0);
+	result += TestGetPurchaseByID(d, "0", 1);
+
+	printf("UnregisterCustomersWhere() on a frozen db\n");
+	result += CheckResult(FreezeCustomerDB(d), 0);
+	result += CheckResult(UnregisterCustomersWhere(d, &OddPurchase), -1);
+	DestroyCustomerDB(d);
+
+	printf("\nCorrectness Test 11 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* reader process of test 12: look customers 1000..2999 up until the
+   parent writes to 'done', then check that its last customer shows.
+   exit with the number of wrong answers */
+void
+SharedReader(const char *shmName, int ready, int done, int last)
+{
+	DB_T r;
+	int i, bad = 0, rounds = 0;
+	char id[32], c;
+
+	r = AttachCustomerDB(shmName);
+	if (write(ready, "r", 1) != 1 || r == NULL)
+		_exit(1);
+	fcntl(done, F_SETFL, O_NONBLOCK);
+	while (read(done, &c, 1) != 1 || rounds == 0) {
+		for (i = 1000; i < 3000; i++) {
+			sprintf(id, "id%d", i);
+			if (GetPurchaseByID(r, id) != i + 1)
+				bad++;
+		}
+		rounds++;
+	}
+	sprintf(id, "id%d", last);
+	if (GetPurchaseByID(r, id) != last + 1)
+		bad++;
+	DestroyCustomerDB(r);
+	_exit(bad < 100 ? bad : 100);
+}
+
+/* Correctness Test 12: shared-memory dbs */
+int
+CorrectnessTest12() {
+
+	DB_T d, r;
+	struct CustomerDBOptions opt;
+	int result, i, bad, status, ready[2], done[2];
+	char shmName[64], id[32], name[32], c;
+	pid_t pid;
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 12:\n" \
+		   "  Shared-memory dbs\n" \
+		   "------------------------------------------------------\n");
+
+	sprintf(shmName, "/customer_test_%d", (int)getpid());
+	memset(&opt, 0, sizeof(opt));
+	opt.shmName = shmName;
+	d = CreateCustomerDBEx(&opt);
+	if (d == NULL) {
+		printf("CreateCustomerDBEx() failed, cannot perform the test\n");
+		return -1;
+	}
+	for (i = 0; i < 3000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, i + 1) != 0)
+			result--;
+	}
+	r = AttachCustomerDB(shmName);
+	if (r == NULL) {
+		printf("No shared-memory dbs in this engine, nothing to test\n");
+		DestroyCustomerDB(d);
+		printf("\nCorrectness Test 12 %s\n\n",
+			   (result >= 0)? "PASSED" : "FAILED!");
+		return (result >= 0)? 0 : -1;
+	}
+
+	printf("Look the 3000 customers up through the attached db\n");
+	for (i = bad = 0; i < 3000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (GetPurchaseByID(r, id) != i + 1 ||
+			GetPurchaseByName(r, name) != i + 1)
+			bad++;
+	}
+	result += CheckResult(bad, 0);
+	result += TestGetPurchaseByID(r, "id3000", -1);
+	result += TestGetSumCustomerPurchase(r, &PurchaseLargerThan100,
+										 "PurchaseLargerThan100",
+										 (101 + 3000) * 2900 / 2);
+
+	printf("The attached db is read-only\n");
+	result += CheckResult(RegisterCustomer(r, "id3000", "name3000", 1), -1);
+	result += CheckResult(UnregisterCustomerByID(r, "id0"), -1);
+	result += CheckResult(UnregisterCustomersWhere(r, &OddPurchase), -1);
+	result += TestGetPurchaseByID(r, "id0", 1);
+
+	printf("Unregistrations of the creator show\n");
+	for (i = bad = 0; i < 1000; i++) {
+		sprintf(id, "id%d", i);
+		if (UnregisterCustomerByID(d, id) != 0 ||
+			GetPurchaseByID(r, id) != -1)
+			bad++;
+	}
+	result += CheckResult(bad, 0);
+	DestroyCustomerDB(r);
+
+	printf("Another process reads while the creator adds 30000 customers\n");
+	fflush(stdout);
+	if (pipe(ready) < 0 || pipe(done) < 0) {
+		printf("pipe() failed, cannot perform the test\n");
+		DestroyCustomerDB(d);
+		return -1;
+	}
+	pid = fork();
+	if (pid == 0) {
+		close(ready[0]);
+		close(done[1]);
+		SharedReader(shmName, ready[1], done[0], 32999);
+	}
+	close(ready[1]);
+	close(done[0]);
+	if (pid < 0 || read(ready[0], &c, 1) != 1)
+		result--;
+	for (i = 3000; i < 33000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, i + 1) != 0)
+			result--;
+	}
+	if (write(done[1], "d", 1) != 1)
+		result--;
+	if (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status))
+		result += CheckResult(WEXITSTATUS(status), 0);
+	else
+		result--;
+	close(ready[0]);
+	close(done[1]);
+
+	printf("The segment goes away with its creator\n");
+	DestroyCustomerDB(d);
+	r = AttachCustomerDB(shmName);
+	result += CheckResult(r == NULL, 1);
+	DestroyCustomerDB(r);
+
+	printf("\nCorrectness Test 12 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* purchase customer i of test 13 has on the leader in the end */
+int
+FeedTestPurchase(int i)
+{
+	if (i < 500 || (i >= 2000 && i % 3 == 0) || i % 2 == 0)
+		return -1;
+	return i + 1;
+}
+
+/* follower process of test 13: apply the stream until the leader
+   closes it, then exit with the number of wrong customers */
+void
+FeedFollower(int fd)
+{
+	DB_T r;
+	Follower_T f;
+	int i, bad = 0;
+	char id[32], name[32];
+
+	r = CreateCustomerDB();
+	f = CreateFollower(r, fd);
+	if (f == NULL)
+		_exit(1);
+	while (FollowerPoll(f, 1) >= 0)
+		;
+	for (i = 0; i < 4000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (GetPurchaseByID(r, id) != FeedTestPurchase(i) ||
+			GetPurchaseByName(r, name) != FeedTestPurchase(i))
+			bad++;
+	}
+	DestroyFollower(f);
+	DestroyCustomerDB(r);
+	_exit(bad < 100 ? bad : 100);
+}
+
+/* Correctness Test 13: change feed to a follower process */
+int
+CorrectnessTest13() {
+
+	DB_T d;
+	ChangeFeed_T f;
+	int result, i, n, follower, status, sv[2];
+	long lag = -1;
+	char id[32], name[32];
+	pid_t pid;
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 13:\n" \
+		   "  Change feed to a follower process\n" \
+		   "------------------------------------------------------\n");
+
+	d = CreateCustomerDB();
+	f = CreateChangeFeed(d, 8192);
+	if (d == NULL || f == NULL ||
+		socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		printf("Can't set up a change feed, cannot perform the test\n");
+		DestroyChangeFeed(f);
+		DestroyCustomerDB(d);
+		return -1;
+	}
+	SetCustomerDBHook(d, ChangeFeedHook, f);
+	for (i = 0; i < 2000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, i + 1) != 0)
+			result--;
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0) {
+		close(sv[0]);
+		FeedFollower(sv[1]);
+	}
+	close(sv[1]);
+
+	printf("The follower starts from a snapshot of 2000 customers\n");
+	follower = ChangeFeedAddFollower(f, sv[0]);
+	result += CheckResult(follower >= 0, 1);
+
+	printf("Changes flushed every 100 calls\n");
+	for (i = 0; i < 500; i++) {
+		sprintf(id, "id%d", i);
+		if (UnregisterCustomerByID(d, id) != 0)
+			result--;
+		if (i % 100 == 99)
+			ChangeFeedFlush(f);
+	}
+	for (i = 2000; i < 4000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, i + 1) != 0)
+			result--;
+		if (i % 100 == 99)
+			ChangeFeedFlush(f);
+	}
+	printf("Changes overflowing the ring send a new snapshot\n");
+	for (i = 2001; i < 4000; i += 3) {
+		sprintf(name, "name%d", i);
+		if (UnregisterCustomerByName(d, name) != 0)
+			result--;
+	}
+	printf("UnregisterCustomersWhere() is streamed too\n");
+	n = UnregisterCustomersWhere(d, &OddPurchase);
+	result += CheckResult(n, 1417);
+	result += CheckResult(ChangeFeedFlush(f), 1);
+
+	printf("The follower catches up\n");
+	for (i = 0; i < 1000 && (lag = ChangeFeedLag(f, follower)) != 0; i++) {
+		usleep(2000);
+		ChangeFeedFlush(f);
+	}
+	result += CheckResult((int)lag, 0);
+
+	printf("The follower holds the same customers\n");
+	close(sv[0]);
+	if (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status))
+		result += CheckResult(WEXITSTATUS(status), 0);
+	else
+		result--;
+	SetCustomerDBHook(d, NULL, NULL);
+	DestroyChangeFeed(f);
+	DestroyCustomerDB(d);
+
+	printf("\nCorrectness Test 13 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/* Correctness Test 14: background save of a point-in-time image */
+int
+CorrectnessTest14() {
+
+	DB_T d, loaded;
+	BackgroundSave_T s;
+	struct BackgroundSaveStats st;
+	int result, i, r = -1, fd;
+	char path[] = "/tmp/customer_save_XXXXXX";
+	char tmp[64], id[32], name[32];
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 14:\n" \
+		   "  Background save of a point-in-time image\n" \
+		   "------------------------------------------------------\n");
+
+	d = CreateCustomerDB();
+	fd = mkstemp(path);
+	if (d == NULL || fd < 0) {
+		printf("Can't create a db and a file, cannot perform the test\n");
+		DestroyCustomerDB(d);
+		return -1;
+	}
+	close(fd);
+	sprintf(tmp, "%s.tmp", path);
+	for (i = 0; i < 3000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, i + 1) != 0)
+			result--;
+	}
+
+	printf("Invalid input\n");
+	result += CheckResult(BackgroundSaveCustomerDB(NULL, path) == NULL, 1);
+	result += CheckResult(BackgroundSaveWait(NULL, 1, &st), -1);
+
+	printf("The db changes while the save runs\n");
+	fflush(stdout);
+	s = BackgroundSaveCustomerDB(d, path);
+	result += CheckResult(s != NULL, 1);
+	for (i = 0; i < 1000; i++) {
+		sprintf(id, "id%d", i);
+		if (UnregisterCustomerByID(d, id) != 0)
+			result--;
+	}
+	for (i = 3000; i < 4000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, i + 1) != 0)
+			result--;
+	}
+	while (s && (r = BackgroundSaveWait(s, 0, &st)) == 1)
+		usleep(1000);
+	result += CheckResult(r, 0);
+	result += CheckResult(r == 0 ? (int)st.customers : 0, 3000);
+	result += CheckResult(access(tmp, F_OK) == 0, 0);
+
+	printf("The file holds the db as it was at the call\n");
+	loaded = LoadFrozenCustomerDB(path);
+	result += CheckResult(loaded != NULL, 1);
+	if (loaded) {
+		result += CheckResult(GetPurchaseByID(loaded, "id0"), 1);
+		result += CheckResult(GetPurchaseByName(loaded, "name2999"), 3000);
+		result += CheckResult(GetPurchaseByID(loaded, "id3500"), -1);
+		result += CheckResult(GetSumCustomerPurchase(loaded, &OddPurchase),
+							  1500);
+		DestroyCustomerDB(loaded);
+	}
+	result += CheckResult(GetPurchaseByID(d, "id0"), -1);
+	result += CheckResult(GetPurchaseByID(d, "id3500"), 3501);
+
+	printf("A failed save leaves no file\n");
+	fflush(stdout);
+	s = BackgroundSaveCustomerDB(d, "/nonexistent/customers");
+	result += CheckResult(s ? BackgroundSaveWait(s, 1, &st) : -1, -1);
+	result += CheckResult(access("/nonexistent/customers.tmp", F_OK) == 0,
+						  0);
+
+	unlink(path);
+	DestroyCustomerDB(d);
+
+	printf("\nCorrectness Test 14 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/* count the customers a cursor returns, -1 on failure */
+static int
+CountCustomers(DB_T d)
+{
+	struct CustomerView views[100];
+	CustomerCursor_T c;
+	int n, count = 0;
+
+	if ((c = OpenCustomerCursor(d)) == NULL)
+		return -1;
+	while ((n = NextCustomerBatch(c, views, 100)) > 0)
+		count += n;
+	CloseCustomerCursor(c);
+	return n < 0 ? -1 : count;
+}
+
+/* Correctness Test 15: a small buffer pool and a db file */
+int
+CorrectnessTest15() {
+
+	DB_T d;
+	struct CustomerDBOptions opt;
+	struct stat st;
+	int result, i, fd;
+	char path[] = "/tmp/customer_db_XXXXXX";
+	char id[32], name[32];
+	char longId[CUSTOMER_DISK_MAX_KEY_BYTES];
+	char longName[CUSTOMER_DISK_MAX_KEY_BYTES];
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 15:\n" \
+		   "  A small buffer pool and a db file\n" \
+		   "------------------------------------------------------\n");
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		printf("Can't create a file, cannot perform the test\n");
+		return -1;
+	}
+	close(fd);
+	memset(&opt, 0, sizeof(opt));
+	opt.path = path;
+	opt.cacheBytes = 64 * 1024;
+	d = CreateCustomerDBEx(&opt);
+	if (d == NULL) {
+		printf("CreateCustomerDBEx() failed, cannot perform the test\n");
+		unlink(path);
+		return -1;
+	}
+
+	printf("10000 customers through a 64 KiB pool\n");
+	for (i = 0; i < 10000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, i + 1) != 0)
+			result--;
+	}
+	for (i = 0; i < 10000; i += 7) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (GetPurchaseByID(d, id) != i + 1 ||
+			GetPurchaseByName(d, name) != i + 1)
+			result--;
+	}
+	result += CheckResult(RegisterCustomer(d, "id77", "new", 1), -1);
+	result += CheckResult(RegisterCustomer(d, "new", "name77", 1), -1);
+	result += CheckResult(GetPurchaseByID(d, "id10000"), -1);
+
+	printf("Unregistrations and UnregisterCustomersWhere()\n");
+	for (i = 0; i < 2500; i++) {
+		sprintf(id, "id%d", i);
+		if (UnregisterCustomerByID(d, id) != 0)
+			result--;
+	}
+	for (i = 2500; i < 5000; i += 2) {
+		sprintf(name, "name%d", i);
+		if (UnregisterCustomerByName(d, name) != 0)
+			result--;
+	}
+	result += CheckResult(UnregisterCustomersWhere(d, &OddPurchase), 2500);
+	result += CheckResult(GetSumCustomerPurchase(d, &OddPurchase), 0);
+	result += CheckResult(CountCustomers(d), 3750);
+	result += CheckResult(GetPurchaseByName(d, "name2500"), -1);
+	result += CheckResult(GetPurchaseByName(d, "name2501"), 2502);
+	DestroyCustomerDB(d);
+
+	if (stat(path, &st) == 0 && st.st_size > 0) {
+		printf("The db file opens again\n");
+		d = CreateCustomerDBEx(&opt);
+		result += CheckResult(d != NULL, 1);
+		if (d) {
+			result += CheckResult(CountCustomers(d), 3750);
+			result += CheckResult(GetPurchaseByID(d, "id9999"), 10000);
+			result += CheckResult(GetPurchaseByID(d, "id9998"), -1);
+			result += CheckResult(RegisterCustomer(d, "id0", "name0", 1), 0);
+
+			/* keys up to CUSTOMER_DISK_MAX_KEY_BYTES in all fit */
+			printf("Keys of %d bytes in all are the longest taken\n",
+				   CUSTOMER_DISK_MAX_KEY_BYTES);
+			memset(longId, 'i', sizeof(longId));
+			memset(longName, 'n', sizeof(longName));
+			longId[CUSTOMER_DISK_MAX_KEY_BYTES / 2] = '\0';
+			longName[CUSTOMER_DISK_MAX_KEY_BYTES / 2] = '\0';
+			result += CheckResult(RegisterCustomer(d, longId, longName, 7), 0);
+			result += CheckResult(GetPurchaseByName(d, longName), 7);
+			longId[CUSTOMER_DISK_MAX_KEY_BYTES / 2 - 1] = '\0';
+			longName[CUSTOMER_DISK_MAX_KEY_BYTES / 2] = 'n';
+			longName[CUSTOMER_DISK_MAX_KEY_BYTES / 2 + 2] = '\0';
+			result += CheckResult(RegisterCustomer(d, longId, longName, 8), -1);
+			result += CheckResult(GetPurchaseByID(d, longId), -1);
+			result += CheckResult(GetPurchaseByName(d, longName), -1);
+			DestroyCustomerDB(d);
+		}
+	}
+	else
+		printf("This engine keeps no db file\n");
+	unlink(path);
+
+	printf("\nCorrectness Test 15 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+int
+AllPurchases(const char *id, const char* name, const int purchase)
+{
+	return purchase;
+}
+
+/* eviction callback of test 16: count the evicted customers and add
+   up their purchases */
+struct EvictTally {
+	int count;
+	long purchases;
+	int keysBad;
+};
+
+void
+TallyEviction(void *ctx, const char *id, const char *name, int purchase)
+{
+	struct EvictTally *t = (struct EvictTally *)ctx;
+
+	t->count++;
+	t->purchases += purchase;
+	if (strncmp(id, "id", 2) != 0 || strcmp(id + 2, name + 4) != 0)
+		t->keysBad++;
+}
+
+/* Correctness Test 16: a memory limit with CLOCK eviction */
+int
+CorrectnessTest16() {
+
+	DB_T d;
+	struct CustomerDBOptions opt;
+	struct CustomerDBMemoryUsage usage;
+	struct CustomerDBStats st;
+	struct EvictTally tally;
+	int result, i, count, reported = 0;
+	long total = 0;
+	char id[32], name[32];
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 16:\n" \
+		   "  A memory limit with CLOCK eviction\n" \
+		   "------------------------------------------------------\n");
+
+	memset(&opt, 0, sizeof(opt));
+	opt.memoryLimit = 256 * 1024;
+	d = CreateCustomerDBEx(&opt);
+	if (d == NULL) {
+		printf("CreateCustomerDBEx() failed, cannot perform the test\n");
+		return -1;
+	}
+	memset(&tally, 0, sizeof(tally));
+	result += CheckResult(SetCustomerDBEvictCallback(NULL, TallyEviction,
+													 &tally), -1);
+	result += CheckResult(SetCustomerDBEvictCallback(d, TallyEviction,
+													 &tally), 0);
+	SetCustomerDBHook(d, CountUnregisterHook, &reported);
+
+	printf("10000 customers into 256 KiB, looking up id0 all along\n");
+	for (i = 0; i < 10000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, i + 1) != 0)
+			result--;
+		total += i + 1;
+		if (GetPurchaseByID(d, "id0") != 1)
+			result--;
+	}
+	SetCustomerDBHook(d, NULL, NULL);
+	GetCustomerDBMemoryUsage(d, &usage);
+	GetCustomerDBStats(d, &st);
+	count = CountCustomers(d);
+
+	if (st.evictions > 0) {
+		result += CheckResult(usage.total <= opt.memoryLimit, 1);
+		result += CheckResult(tally.count, (int)st.evictions);
+		result += CheckResult(reported, tally.count);
+		result += CheckResult(tally.keysBad, 0);
+		result += CheckResult(count + tally.count, 10000);
+		result += CheckResult(GetSumCustomerPurchase(d, &AllPurchases)
+							  + tally.purchases == total, 1);
+		result += CheckResult(GetPurchaseByID(d, "id0"), 1);
+		result += CheckResult(GetPurchaseByName(d, "name9999"), 10000);
+
+		printf("Evicted customers come back as new ones\n");
+		for (i = 1; i < 10000; i++) {
+			sprintf(id, "id%d", i);
+			if (GetPurchaseByID(d, id) < 0)
+				break;
+		}
+		sprintf(name, "name%d", i);
+		result += CheckResult(GetPurchaseByName(d, name), -1);
+		result += CheckResult(RegisterCustomer(d, id, name, 5), 0);
+		result += CheckResult(GetPurchaseByID(d, id), 5);
+	}
+	else {
+		printf("This engine has no memory limit\n");
+		result += CheckResult(count, 10000);
+		result += CheckResult(tally.count, 0);
+		result += CheckResult(reported, 0);
+	}
+	DestroyCustomerDB(d);
+
+	printf("\nCorrectness Test 16 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/* check that the rank of the answer v among the purchases first + step,
+   first + 2 * step, ..., first + count * step is within tol of q * count
+   (the sketch bounds the error in rank, not in value) */
+static int
+CheckQuantile(const char *what, double q, int v,
+			  int first, int step, int count, int tol)
+{
+	int rank = (v - first) / step;
+
+	if (rank < 0)
+		rank = 0;
+	if (rank > count)
+		rank = count;
+	if (rank >= q * count - tol && rank <= q * count + tol)
+		return 0;
+	printf("%s quantile %.2f is %d of rank %d, expected %.0f +- %d\n",
+		   what, q, v, rank, q * count, tol);
+	return -1;
+}
+
+/* Correctness Test 17: purchase quantiles from the sketch */
+int
+CorrectnessTest17() {
+
+	static const double qs[] = {0.0, 0.1, 0.25, 0.5, 0.9, 0.99, 1.0};
+	DB_T d;
+	QuantileSketch_T a, b;
+	int result, i, q, before[7];
+	char id[32], name[32];
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 17:\n" \
+		   "  Purchase quantiles from the sketch\n" \
+		   "------------------------------------------------------\n");
+
+	d = CreateCustomerDB();
+	if (d == NULL) {
+		printf("CreateCustomerDB() failed, cannot perform the test\n");
+		return -1;
+	}
+
+	printf("Empty db and invalid input\n");
+	result += CheckResult(GetPurchaseQuantile(NULL, 0.5), -1);
+	result += CheckResult(GetPurchaseQuantile(d, 0.5), -1);
+
+	printf("Exact answers on a few customers\n");
+	for (i = 0; i < 5; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		RegisterCustomer(d, id, name, (5 - i) * 10);
+	}
+	result += CheckResult(GetPurchaseQuantile(d, 0.0), 10);
+	result += CheckResult(GetPurchaseQuantile(d, 0.5), 30);
+	result += CheckResult(GetPurchaseQuantile(d, 1.0), 50);
+	result += CheckResult(GetPurchaseQuantile(d, -0.1), -1);
+	result += CheckResult(GetPurchaseQuantile(d, 1.1), -1);
+	UnregisterCustomerByID(d, "id2");
+	UnregisterCustomerByName(d, "name4");
+	result += CheckResult(GetPurchaseQuantile(d, 0.0), 20);
+	result += CheckResult(GetPurchaseQuantile(d, 1.0), 50);
+	for (i = 0; i < 5; i++) {
+		sprintf(id, "id%d", i);
+		UnregisterCustomerByID(d, id);
+	}
+	result += CheckResult(GetPurchaseQuantile(d, 0.5), -1);
+
+	/* purchases 1..10000, so the value at rank q * n is about q * n */
+	printf("10000 customers, within 2%% in rank\n");
+	for (i = 0; i < 10000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		RegisterCustomer(d, id, name, i + 1);
+	}
+	for (q = 0; q < 7; q++)
+		result += CheckQuantile("all", qs[q], GetPurchaseQuantile(d, qs[q]),
+								0, 1, 10000, 200);
+
+	printf("After removing the smallest 6000 (a rebuild)\n");
+	for (i = 0; i < 6000; i++) {
+		sprintf(id, "id%d", i);
+		UnregisterCustomerByID(d, id);
+	}
+	for (q = 0; q < 7; q++)
+		result += CheckQuantile("largest", qs[q],
+								GetPurchaseQuantile(d, qs[q]),
+								6000, 1, 4000, 120);
+
+	printf("After UnregisterCustomersWhere(odd purchases)\n");
+	result += CheckResult(UnregisterCustomersWhere(d, &OddPurchase), 2000);
+	for (q = 0; q < 7; q++)
+		result += CheckQuantile("even", qs[q], GetPurchaseQuantile(d, qs[q]),
+								6000, 2, 2000, 60);
+
+	printf("A frozen db keeps its answers\n");
+	for (q = 0; q < 7; q++)
+		before[q] = GetPurchaseQuantile(d, qs[q]);
+	if (FreezeCustomerDB(d) == 0) {
+		for (q = 0; q < 7; q++)
+			result += CheckResult(GetPurchaseQuantile(d, qs[q]), before[q]);
+	}
+	DestroyCustomerDB(d);
+
+	printf("Merged sketches answer for the union\n");
+	a = CreateQuantileSketch();
+	b = CreateQuantileSketch();
+	if (a == NULL || b == NULL) {
+		printf("CreateQuantileSketch() failed\n");
+		result--;
+	}
+	else {
+		for (i = 1; i <= 5000; i++) {
+			QuantileSketchAdd(a, i);
+			QuantileSketchAdd(b, 5000 + i);
+		}
+		QuantileSketchRemove(b, 10000);
+		result += CheckResult(QuantileSketchMerge(a, b), 0);
+		result += CheckResult((int)QuantileSketchCount(a), 9999);
+		for (q = 0; q < 7; q++)
+			result += CheckQuantile("merged", qs[q],
+									QuantileSketchQuery(a, qs[q]),
+									0, 1, 9999, 200);
+	}
+	DestroyQuantileSketch(a);
+	DestroyQuantileSketch(b);
+
+	printf("\nCorrectness Test 17 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/* check the group sums of attribute attr against the expected ones */
+static int
+CheckGroupSums(DB_T d, int attr, const long *expected, int count)
+{
+	long sums[CUSTOMER_ATTR_CODES];
+	int code, bad = 0;
+
+	if (CheckResult(GroupSumPurchaseBy(d, attr, sums), count) < 0)
+		return -1;
+	for (code = 0; code < CUSTOMER_ATTR_CODES; code++) {
+		if (sums[code] != expected[code]) {
+			printf("attribute %d code %d sums to %ld, expected %ld\n",
+				   attr, code, sums[code], expected[code]);
+			bad = -1;
+		}
+	}
+	return bad;
+}
+
+/* Correctness Test 18: attribute columns and group sums */
+int
+CorrectnessTest18() {
+
+	DB_T d;
+	struct CustomerDBOptions opt;
+	struct stat st;
+	long region[CUSTOMER_ATTR_CODES], segment[CUSTOMER_ATTR_CODES];
+	long sums[CUSTOMER_ATTR_CODES];
+	char path[] = "/tmp/customer_db_XXXXXX";
+	int result, i, fd, count;
+	char id[32], name[32];
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 18:\n" \
+		   "  Attribute columns and group sums\n" \
+		   "------------------------------------------------------\n");
+
+	printf("A db without attributes has none\n");
+	d = CreateCustomerDB();
+	if (d == NULL) {
+		printf("CreateCustomerDB() failed, cannot perform the test\n");
+		return -1;
+	}
+	RegisterCustomer(d, "id0", "name0", 1);
+	result += CheckResult(SetCustomerAttr(d, "id0", 0, 1), -1);
+	result += CheckResult(GetCustomerAttr(d, "id0", 0), -1);
+	result += CheckResult(GroupSumPurchaseBy(d, 0, sums), -1);
+	DestroyCustomerDB(d);
+
+	memset(&opt, 0, sizeof(opt));
+	opt.attrCount = 2;
+	opt.scanThreads = 2;
+	d = CreateCustomerDBEx(&opt);
+	if (d == NULL) {
+		printf("CreateCustomerDBEx() failed, cannot perform the test\n");
+		return -1;
+	}
+
+	/* region = i % 7 and segment = 200 + i % 3 for even i, 0 for odd */
+	printf("10000 customers in 7 regions and 4 segments\n");
+	memset(region, 0, sizeof(region));
+	memset(segment, 0, sizeof(segment));
+	for (i = 0; i < 10000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, i + 1) != 0 ||
+			SetCustomerAttr(d, id, 0, i % 7) != 0 ||
+			(i % 2 == 0 && SetCustomerAttr(d, id, 1, 200 + i % 3) != 0))
+			result--;
+		region[i % 7] += i + 1;
+		segment[i % 2 == 0 ? 200 + i % 3 : 0] += i + 1;
+	}
+	result += CheckResult(GetCustomerAttr(d, "id12", 0), 5);
+	result += CheckResult(GetCustomerAttr(d, "id12", 1), 200);
+	result += CheckResult(GetCustomerAttr(d, "id13", 1), 0);
+	result += CheckGroupSums(d, 0, region, 10000);
+	result += CheckGroupSums(d, 1, segment, 10000);
+
+	printf("Invalid input\n");
+	result += CheckResult(GroupSumPurchaseBy(NULL, 0, sums), -1);
+	result += CheckResult(GroupSumPurchaseBy(d, 2, sums), -1);
+	result += CheckResult(GroupSumPurchaseBy(d, -1, sums), -1);
+	result += CheckResult(SetCustomerAttr(d, "nobody", 0, 1), -1);
+	result += CheckResult(SetCustomerAttr(d, "id1", 2, 1), -1);
+	result += CheckResult(SetCustomerAttr(d, "id1", 0, CUSTOMER_ATTR_CODES),
+						  -1);
+	result += CheckResult(SetCustomerAttr(d, "id1", 0, -1), -1);
+	result += CheckResult(GetCustomerAttr(d, "nobody", 0), -1);
+	result += CheckResult(GetCustomerAttr(d, "id1", 0), 1);
+
+	printf("Removed customers leave the sums, new ones start at 0\n");
+	for (i = 0; i < 1000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if ((i % 2 == 0 ? UnregisterCustomerByID(d, id) :
+			 UnregisterCustomerByName(d, name)) != 0)
+			result--;
+		region[i % 7] -= i + 1;
+		segment[i % 2 == 0 ? 200 + i % 3 : 0] -= i + 1;
+	}
+	result += CheckResult(UnregisterCustomersWhere(d, &OddPurchase), 4500);
+	for (i = 1000; i < 10000; i += 2) { /* purchase i + 1 is odd */
+		region[i % 7] -= i + 1;
+		segment[200 + i % 3] -= i + 1;
+	}
+	count = 4500;
+	for (i = 0; i < 500; i++) {
+		sprintf(id, "new%d", i);
+		sprintf(name, "newname%d", i);
+		if (RegisterCustomer(d, id, name, 3) != 0)
+			result--;
+		region[0] += 3;
+		segment[0] += 3;
+		count++;
+	}
+	result += CheckResult(GetCustomerAttr(d, "new0", 0), 0);
+	result += CheckResult(GetCustomerAttr(d, "new499", 1), 0);
+	result += CheckGroupSums(d, 0, region, count);
+	result += CheckGroupSums(d, 1, segment, count);
+
+	printf("A frozen db keeps no attributes\n");
+	if (FreezeCustomerDB(d) == 0) {
+		result += CheckResult(GroupSumPurchaseBy(d, 0, sums), -1);
+		result += CheckResult(GetCustomerAttr(d, "id1001", 0), -1);
+		result += CheckResult(GetPurchaseByID(d, "id1001"), 1002);
+	}
+	DestroyCustomerDB(d);
+
+	printf("A db file keeps its attributes\n");
+	fd = mkstemp(path);
+	if (fd < 0) {
+		printf("Can't create a temporary file\n");
+		return -1;
+	}
+	close(fd);
+	unlink(path);
+	opt.path = path;
+	if ((d = CreateCustomerDBEx(&opt)) != NULL) {
+		RegisterCustomer(d, "id1", "name1", 10);
+		RegisterCustomer(d, "id2", "name2", 20);
+		SetCustomerAttr(d, "id2", 1, 9);
+		DestroyCustomerDB(d);
+	}
+	if (stat(path, &st) == 0 && st.st_size > 0) {
+		opt.attrCount = 0; /* the file knows */
+		d = CreateCustomerDBEx(&opt);
+		if (d == NULL) {
+			result--;
+		}
+		else {
+			result += CheckResult(GetCustomerAttr(d, "id2", 1), 9);
+			result += CheckResult(GroupSumPurchaseBy(d, 1, sums), 2);
+			result += CheckResult((int)(sums[0] * 100 + sums[9]), 1020);
+			DestroyCustomerDB(d);
+		}
+	}
+	else
+		printf("This engine keeps no db file\n");
+	unlink(path);
+
+	printf("\nCorrectness Test 18 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* Correctness Test 19: expansions split by several threads */
+int
+CorrectnessTest19() {
+
+	DB_T d;
+	struct CustomerDBOptions opt;
+	int result, i, num;
+	char id[32], name[32];
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 19:\n" \
+		   "  Expansions split by several threads\n" \
+		   "------------------------------------------------------\n");
+
+	memset(&opt, 0, sizeof(opt));
+	opt.expandThreads = 4;
+	d = CreateCustomerDBEx(&opt);
+	if (d == NULL) {
+		printf("CreateCustomerDBEx() failed, cannot perform the test\n");
+		return -1;
+	}
+
+	/* an engine splitting expansions by threads does so from 65536
+	   buckets on, which 100000 customers pass twice. the others only
+	   get the lookups checked, on fewer customers to keep the test
+	   short */
+	if (GetCustomerDBOptions(d, &opt) == 0 && opt.expandThreads > 1) {
+		num = 100000;
+		printf("%d customers, expanded by %d threads\n", num,
+			   opt.expandThreads);
+	}
+	else {
+		num = 10000;
+		printf("%d customers; this engine has no parallel expansion\n",
+			   num);
+	}
+	for (i = 0; i < num; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, 1 + i % 1000) != 0)
+			result--;
+	}
+	result += CheckResult(CountCustomers(d), num);
+
+	printf("Every customer is found by id and by name\n");
+	for (i = 0; i < num; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (GetPurchaseByID(d, id) != 1 + i % 1000 ||
+			GetPurchaseByName(d, name) != 1 + i % 1000)
+			result--;
+	}
+	result += CheckResult(result, 0);
+	result += CheckResult(GetPurchaseByID(d, "absent"), -1);
+	result += CheckResult(GetCustomerDBOptions(NULL, &opt), -1);
+	result += CheckResult(RegisterCustomer(d, "id99", "new", 1), -1);
+	result += CheckResult(RegisterCustomer(d, "new", "name99", 1), -1);
+	DestroyCustomerDB(d);
+
+	printf("\nCorrectness Test 19 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* Correctness Test 20: the wire protocol of customer_server */
+static int
+SameKey(const char *a, size_t aLen, const char *b, size_t bLen)
+{
+	if (a == NULL || b == NULL)
+		return a == b && aLen == bLen;
+	return aLen == bLen && memcmp(a, b, aLen) == 0;
+}
+
+int
+CorrectnessTest20() {
+
+	static const char binaryId[] = "id\0\377\n";
+	static const int results[] = { INT_MIN, -1, 0, 1, 63, 64, INT_MAX };
+	struct CustomerOp ops[8], op;
+	unsigned char buf[1024];
+	size_t len, at, first;
+	long used;
+	int result, i, n, wrong;
+	char longName[300];
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 20:\n" \
+		   "  Wire protocol of customer_server\n" \
+		   "------------------------------------------------------\n");
+
+	memset(longName, 'n', sizeof(longName));
+	memset(ops, 0, sizeof(ops));
+	ops[0].type = CUSTOMER_OP_REGISTER;
+	ops[0].id = binaryId;
+	ops[0].idLen = sizeof(binaryId) - 1;
+	ops[0].name = longName;
+	ops[0].nameLen = sizeof(longName);
+	ops[0].purchase = INT_MAX;
+	ops[1].type = CUSTOMER_OP_REGISTER;
+	ops[1].id = "";
+	ops[1].name = "";
+	ops[1].purchase = -1;
+	ops[2].type = CUSTOMER_OP_UNREGISTER_ID;
+	ops[2].id = "id1";
+	ops[2].idLen = 3;
+	ops[3].type = CUSTOMER_OP_UNREGISTER_NAME;
+	ops[3].name = "name1";
+	ops[3].nameLen = 5;
+	ops[4].type = CUSTOMER_OP_GET_ID;
+	ops[4].id = binaryId;
+	ops[4].idLen = sizeof(binaryId) - 1;
+	ops[5].type = CUSTOMER_OP_GET_NAME;
+	ops[5].name = longName;
+	ops[5].nameLen = sizeof(longName);
+	ops[6].type = CUSTOMER_OP_SUM;
+	ops[7].type = CUSTOMER_OP_REGISTER;
+	ops[7].id = "id7";
+	ops[7].idLen = 3;
+	ops[7].name = "name7";
+	ops[7].nameLen = 5;
+	ops[7].purchase = INT_MIN;
+
+	printf("Requests of every kind, back to back, decode as sent\n");
+	len = first = ProtoEncodeRequest(buf, &ops[0]);
+	for (i = 1; i < 8; i++)
+		len += ProtoEncodeRequest(buf + len, &ops[i]);
+	for (i = 0, at = 0, wrong = 0; i < 8; i++, at += (size_t)used) {
+		used = ProtoDecodeRequest(buf + at, len - at, &op);
+		if (used <= 0) {
+			wrong++;
+			break;
+		}
+		if (op.type != ops[i].type ||
+			!SameKey(op.id, op.idLen, ops[i].id, ops[i].idLen) ||
+			!SameKey(op.name, op.nameLen, ops[i].name, ops[i].nameLen) ||
+			op.purchase != ops[i].purchase)
+			wrong++;
+	}
+	result += CheckResult(wrong, 0);
+	result += CheckResult((int)(len - at), 0);
+
+	printf("Every cut-off request is incomplete\n");
+	for (n = 0, wrong = 0; n < (int)first; n++)
+		if (ProtoDecodeRequest(buf, (size_t)n, &op) != 0)
+			wrong++;
+	result += CheckResult(wrong, 0);
+
+	printf("Malformed requests are rejected\n");
+	buf[0] = 1; buf[1] = 0;                         /* no such op */
+	result += CheckResult((int)ProtoDecodeRequest(buf, 2, &op), -1);
+	buf[1] = CUSTOMER_OP_SUM + 1;
+	result += CheckResult((int)ProtoDecodeRequest(buf, 2, &op), -1);
+	buf[0] = 0;                                     /* empty body */
+	result += CheckResult((int)ProtoDecodeRequest(buf, 1, &op), -1);
+	buf[0] = 3; buf[1] = CUSTOMER_OP_GET_ID; buf[2] = 5; buf[3] = 'i';
+	result += CheckResult((int)ProtoDecodeRequest(buf, 4, &op), -1);
+	buf[0] = 3; buf[1] = CUSTOMER_OP_SUM;           /* bytes left over */
+	result += CheckResult((int)ProtoDecodeRequest(buf, 4, &op), -1);
+
+	printf("Answers decode as sent, and cut off are incomplete\n");
+	for (i = 0, len = 0; i < 7; i++)
+		len += ProtoEncodeResult(buf + len, results[i]);
+	for (i = 0, at = 0, wrong = 0; i < 7; i++, at += (size_t)used) {
+		used = ProtoDecodeResult(buf + at, len - at, &n);
+		if (used <= 0 || n != results[i])
+			wrong++;
+		if (used <= 0)
+			break;
+	}
+	result += CheckResult(wrong, 0);
+	result += CheckResult((int)(len - at), 0);
+	result += CheckResult((int)ProtoDecodeResult(buf, 1, &n), 0);
+	memset(buf, 0x80, 11);
+	buf[11] = 0;
+	result += CheckResult((int)ProtoDecodeResult(buf, 12, &n), -1);
+
+	printf("\nCorrectness Test 20 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* Correctness Test 21: results with CUSTOMER_DB_BLOOM_FILTER */
+int
+CorrectnessTest21() {
+
+	DB_T d;
+	struct CustomerDBOptions opt;
+	int result, i, expected, wrong, sum;
+	char id[32], name[32];
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 21:\n" \
+		   "  Results with CUSTOMER_DB_BLOOM_FILTER\n" \
+		   "------------------------------------------------------\n");
+
+	memset(&opt, 0, sizeof(opt));
+	opt.flags = CUSTOMER_DB_BLOOM_FILTER;
+	d = CreateCustomerDBEx(&opt);
+	if (d == NULL) {
+		printf("CreateCustomerDBEx() failed, cannot perform the test\n");
+		return -1;
+	}
+	if (GetCustomerDBOptions(d, &opt) == 0 &&
+		(opt.flags & CUSTOMER_DB_BLOOM_FILTER))
+		printf("Bloom filters on\n");
+	else
+		printf("This engine ignores the flag, the results are checked "
+			   "all the same\n");
+
+	/* 6000 customers outgrow the first filters several times */
+	printf("Register 6000 customers\n");
+	wrong = 0;
+	for (i = 0; i < 6000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, 1 + i % 1000) != 0)
+			wrong++;
+	}
+	result += CheckResult(wrong, 0);
+	result += CheckResult(CountCustomers(d), 6000);
+
+	printf("A registered id or name is rejected\n");
+	wrong = 0;
+	for (i = 0; i < 6000; i += 7) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, "other", 1) != -1 ||
+			RegisterCustomer(d, "other", name, 1) != -1)
+			wrong++;
+	}
+	result += CheckResult(wrong, 0);
+	result += CheckResult(CountCustomers(d), 6000);
+
+	printf("Absent keys are not found\n");
+	wrong = 0;
+	for (i = 0; i < 6000; i++) {
+		sprintf(id, "absent%d", i);
+		if (GetPurchaseByID(d, id) != -1 || GetPurchaseByName(d, id) != -1)
+			wrong++;
+	}
+	result += CheckResult(wrong, 0);
+
+	/* the deleted keys come to outnumber the live ones, which rebuilds
+	   the filters more than once; every live key must survive that */
+	printf("Unregister 5000 by id and by name, then the odd purchases\n");
+	wrong = 0;
+	for (i = 0; i < 5000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (((i % 2) ? UnregisterCustomerByName(d, name) :
+			 UnregisterCustomerByID(d, id)) != 0)
+			wrong++;
+	}
+	result += CheckResult(wrong, 0);
+	result += CheckResult(UnregisterCustomersWhere(d, &OddPurchase), 500);
+	result += CheckResult(CountCustomers(d), 500);
+
+	printf("Only the 500 customers left are found\n");
+	wrong = 0;
+	sum = 0;
+	for (i = 0; i < 6000; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		expected = (i >= 5000 && i % 2) ? 1 + i % 1000 : -1;
+		if (GetPurchaseByID(d, id) != expected ||
+			GetPurchaseByName(d, name) != expected)
+			wrong++;
+		if (expected > 0)
+			sum += expected;
+	}
+	result += CheckResult(wrong, 0);
+	result += CheckResult(GetSumCustomerPurchase(d, &AllPurchases), sum);
+
+	printf("Removed keys can be registered again, once\n");
+	wrong = 0;
+	for (i = 0; i < 5000; i += 3) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, 7) != 0 ||
+			RegisterCustomer(d, id, "other", 1) != -1 ||
+			RegisterCustomer(d, "other", name, 1) != -1 ||
+			GetPurchaseByID(d, id) != 7 || GetPurchaseByName(d, name) != 7)
+			wrong++;
+	}
+	result += CheckResult(wrong, 0);
+	result += CheckResult(CountCustomers(d), 500 + 1667);
+	DestroyCustomerDB(d);
+
+	printf("\nCorrectness Test 21 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* Correctness Test 22: results with CUSTOMER_DB_COMPRESS_KEYS */
+#define PACKED_CUSTOMERS 3000
+#define PACKED_SPECIALS 8
+
+/* write a key of len bytes starting with prefix, followed by words and
+   digits the way real keys repeat them */
+static void
+LongKey(char *key, const char *prefix, int len)
+{
+	static const char words[] = "order-2024-";
+	int n = sprintf(key, "%s", prefix);
+
+	for (; n < len; n++)
+		key[n] = words[n % (sizeof(words) - 1)];
+	key[len] = 0;
+}
+
+/* scan 'scanned' and check that 'other' holds the same customers */
+static int
+SameCustomers(DB_T scanned, DB_T other)
+{
+	struct CustomerView views[64];
+	CustomerCursor_T c;
+	int i, n, count = 0, wrong = 0;
+
+	if ((c = OpenCustomerCursor(scanned)) == NULL)
+		return -1;
+	while ((n = NextCustomerBatch(c, views, 64)) > 0) {
+		for (i = 0; i < n; i++) {
+			if (strlen(views[i].id) != views[i].idLen ||
+				strlen(views[i].name) != views[i].nameLen ||
+				GetPurchaseByIDN(other, views[i].id, views[i].idLen) !=
+				views[i].purchase ||
+				GetPurchaseByNameN(other, views[i].name, views[i].nameLen) !=
+				views[i].purchase)
+				wrong++;
+		}
+		count += n;
+	}
+	CloseCustomerCursor(c);
+	if (n < 0 || count != CountCustomers(other))
+		wrong++;
+	return wrong;
+}
+
+int
+CorrectnessTest22() {
+
+	DB_T plain, packed;
+	struct CustomerDBOptions opt;
+	int result, i, wrong;
+	char id[64], name[64];
+	static char ids[PACKED_SPECIALS][640], names[PACKED_SPECIALS][640];
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 22:\n" \
+		   "  Results with CUSTOMER_DB_COMPRESS_KEYS\n" \
+		   "------------------------------------------------------\n");
+
+	memset(&opt, 0, sizeof(opt));
+	plain = CreateCustomerDBEx(&opt);
+	opt.flags = CUSTOMER_DB_COMPRESS_KEYS;
+	packed = CreateCustomerDBEx(&opt);
+	if (plain == NULL || packed == NULL) {
+		printf("CreateCustomerDBEx() failed, cannot perform the test\n");
+		if (plain) DestroyCustomerDB(plain);
+		if (packed) DestroyCustomerDB(packed);
+		return -1;
+	}
+	if (GetCustomerDBOptions(packed, &opt) == 0 &&
+		(opt.flags & CUSTOMER_DB_COMPRESS_KEYS))
+		printf("Keys compressed\n");
+	else
+		printf("This engine ignores the flag, the results are checked "
+			   "all the same\n");
+
+	/* empty keys, and keys on both sides of the 255-byte length form
+	   and of the longest compressed key. the longest pair stays within
+	   CUSTOMER_DISK_MAX_KEY_BYTES */
+	strcpy(ids[0], "");
+	strcpy(names[0], "empty id");
+	strcpy(ids[1], "empty name");
+	strcpy(names[1], "");
+	LongKey(ids[2], "i254-", 254);
+	LongKey(names[2], "n254-", 254);
+	LongKey(ids[3], "i255-", 255);
+	LongKey(names[3], "n255-", 255);
+	LongKey(ids[4], "i256-", 256);
+	LongKey(names[4], "n256-", 256);
+	strcpy(ids[5], "short id");
+	LongKey(names[5], "n300-", 300);
+	LongKey(ids[6], "i600-", 600);
+	LongKey(names[6], "n390-", 390);
+	LongKey(ids[7], "i255 word-", 255);
+	strcpy(names[7], "short name");
+
+	printf("Every call gives the same result on both dbs\n");
+	printf("Register %d customers and %d with special keys\n",
+		   PACKED_CUSTOMERS, PACKED_SPECIALS);
+	wrong = 0;
+	for (i = 0; i < PACKED_CUSTOMERS; i++) {
+		sprintf(id, "CUS-%06d", i);
+		sprintf(name, "Customer %d of branch %d", i, i % 7);
+		if (RegisterCustomer(plain, id, name, 1 + i % 1000) !=
+			RegisterCustomer(packed, id, name, 1 + i % 1000))
+			wrong++;
+	}
+	for (i = 0; i < PACKED_SPECIALS; i++) {
+		if (RegisterCustomer(plain, ids[i], names[i], 1000 + i) != 0 ||
+			RegisterCustomer(packed, ids[i], names[i], 1000 + i) != 0)
+			wrong++;
+	}
+	result += CheckResult(wrong, 0);
+
+	printf("Duplicates are rejected\n");
+	wrong = 0;
+	for (i = 0; i < PACKED_SPECIALS; i++) {
+		if (RegisterCustomer(packed, ids[i], "other", 1) != -1 ||
+			RegisterCustomer(packed, "other", names[i], 1) != -1)
+			wrong++;
+	}
+	for (i = 0; i < PACKED_CUSTOMERS; i += 10) {
+		sprintf(id, "CUS-%06d", i);
+		sprintf(name, "Customer %d of branch %d", i, i % 7);
+		if (RegisterCustomer(packed, id, "other", 1) != -1 ||
+			RegisterCustomer(packed, "other", name, 1) != -1)
+			wrong++;
+	}
+	result += CheckResult(wrong, 0);
+
+	printf("Lookups, sums and scans\n");
+	wrong = 0;
+	for (i = 0; i < PACKED_CUSTOMERS; i++) {
+		sprintf(id, "CUS-%06d", i);
+		sprintf(name, "Customer %d of branch %d", i, i % 7);
+		if (GetPurchaseByID(packed, id) != GetPurchaseByID(plain, id) ||
+			GetPurchaseByName(packed, name) != GetPurchaseByName(plain, name))
+			wrong++;
+		/* a near miss differs from a stored key in one byte */
+		sprintf(id, "CUS-%06dx", i);
+		sprintf(name, "Customer %d of branch %d", i, i % 7 + 1);
+		if (GetPurchaseByID(packed, id) != GetPurchaseByID(plain, id) ||
+			GetPurchaseByName(packed, name) != GetPurchaseByName(plain, name))
+			wrong++;
+	}
+	for (i = 0; i < PACKED_SPECIALS; i++) {
+		if (GetPurchaseByID(packed, ids[i]) != 1000 + i ||
+			GetPurchaseByName(packed, names[i]) != 1000 + i)
+			wrong++;
+	}
+	result += CheckResult(wrong, 0);
+	result += CheckResult(GetPurchaseByID(packed, ids[2] + 1), -1);
+	result += CheckResult(GetSumCustomerPurchase(packed, &AllPurchases),
+						  GetSumCustomerPurchase(plain, &AllPurchases));
+	result += CheckResult(GetSumCustomerPurchase(packed, &IDStartsWithA),
+						  GetSumCustomerPurchase(plain, &IDStartsWithA));
+	result += CheckResult(SameCustomers(packed, plain), 0);
+	result += CheckResult(SameCustomers(plain, packed), 0);
+
+	printf("Unregister two thirds by id and by name\n");
+	wrong = 0;
+	for (i = 0; i < PACKED_CUSTOMERS; i++) {
+		sprintf(id, "CUS-%06d", i);
+		sprintf(name, "Customer %d of branch %d", i, i % 7);
+		if (i % 3 == 0 &&
+			UnregisterCustomerByID(packed, id) !=
+			UnregisterCustomerByID(plain, id))
+			wrong++;
+		if (i % 3 == 1 &&
+			UnregisterCustomerByName(packed, name) !=
+			UnregisterCustomerByName(plain, name))
+			wrong++;
+	}
+	for (i = 0; i < PACKED_SPECIALS; i += 2) {
+		if (UnregisterCustomerByID(packed, ids[i]) != 0 ||
+			UnregisterCustomerByID(plain, ids[i]) != 0 ||
+			UnregisterCustomerByName(packed, names[i + 1]) != 0 ||
+			UnregisterCustomerByName(plain, names[i + 1]) != 0)
+			wrong++;
+	}
+	result += CheckResult(wrong, 0);
+	result += CheckResult(UnregisterCustomerByID(packed, ids[0]), -1);
+	result += CheckResult(UnregisterCustomerByName(packed, names[1]), -1);
+	result += CheckResult(CountCustomers(packed), PACKED_CUSTOMERS / 3);
+	result += CheckResult(GetSumCustomerPurchase(packed, &AllPurchases),
+						  GetSumCustomerPurchase(plain, &AllPurchases));
+	result += CheckResult(SameCustomers(packed, plain), 0);
+
+	printf("Removed keys can be registered again\n");
+	wrong = 0;
+	for (i = 0; i < PACKED_SPECIALS; i++) {
+		if (RegisterCustomer(packed, ids[i], names[i], 7) != 0 ||
+			GetPurchaseByID(packed, ids[i]) != 7 ||
+			GetPurchaseByName(packed, names[i]) != 7)
+			wrong++;
+	}
+	result += CheckResult(wrong, 0);
+
+	DestroyCustomerDB(plain);
+	DestroyCustomerDB(packed);
+
+	printf("\nCorrectness Test 22 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* Correctness Test 23: calls through flat combining, synchronous and
+   pipelined, against the same calls run serially. each thread works on
+   its own customers, so every result but the race for "shared" is the
+   one of the serial run */
+#define FC_TEST_THREADS 4
+#define FC_TEST_KEYS 500           /* customers per thread */
+#define FC_TEST_OPS (2 + 8 * FC_TEST_KEYS)
+#define FC_TEST_DEPTH 16
+
+struct CombiningScript {
+	struct CustomerOp ops[FC_TEST_OPS];
+	int expected[FC_TEST_OPS];     /* results of the serial run */
+	char keys[FC_TEST_OPS][2][32];
+	int count;
+	int pipelined;
+	CombiningDB_T c;
+	int errors;                    /* refused or out of order calls */
+};
+
+static void
+AddScriptOp(struct CombiningScript *s, int type, const char *id,
+			const char *name, int purchase)
+{
+	struct CustomerOp *op = &s->ops[s->count];
+
+	memset(op, 0, sizeof(*op));
+	op->type = type;
+	if (id != NULL) {
+		op->idLen = sprintf(s->keys[s->count][0], "%s", id);
+		op->id = s->keys[s->count][0];
+	}
+	if (name != NULL) {
+		op->nameLen = sprintf(s->keys[s->count][1], "%s", name);
+		op->name = s->keys[s->count][1];
+	}
+	op->purchase = purchase;
+	op->result = -2;               /* no call returns this */
+	s->count++;
+}
+
+/* register customer i, try duplicates of its id and name, look it up,
+   remove it or miss an absent key, and register some again */
+static void
+AddCustomerScript(struct CombiningScript *s, int i)
+{
+	char id[32], name[32], other[32], absent[32];
+	int p = 1 + i % 1000;
+
+	sprintf(id, "id%d", i);
+	sprintf(name, "name%d", i);
+	sprintf(other, "other%d", i);
+	sprintf(absent, "absent%d", i);
+	AddScriptOp(s, CUSTOMER_OP_REGISTER, id, name, p);
+	AddScriptOp(s, CUSTOMER_OP_REGISTER, id, other, 1);
+	AddScriptOp(s, CUSTOMER_OP_REGISTER, other, name, 1);
+	AddScriptOp(s, CUSTOMER_OP_GET_ID, id, NULL, 0);
+	AddScriptOp(s, CUSTOMER_OP_GET_NAME, NULL, name, 0);
+	if (i % 3 == 0) {
+		AddScriptOp(s, CUSTOMER_OP_UNREGISTER_ID, id, NULL, 0);
+		AddScriptOp(s, CUSTOMER_OP_GET_NAME, NULL, name, 0);
+	}
+	else if (i % 3 == 1) {
+		AddScriptOp(s, CUSTOMER_OP_UNREGISTER_NAME, NULL, name, 0);
+		AddScriptOp(s, CUSTOMER_OP_GET_ID, id, NULL, 0);
+	}
+	else {
+		AddScriptOp(s, CUSTOMER_OP_UNREGISTER_ID, absent, NULL, 0);
+		AddScriptOp(s, CUSTOMER_OP_GET_NAME, NULL, absent, 0);
+	}
+	if (i % 6 == 0)
+		AddScriptOp(s, CUSTOMER_OP_REGISTER, id, name, p + 1);
+}
+
+/* make op directly on d */
+static int
+RunCustomerOp(DB_T d, const struct CustomerOp *op)
+{
+	switch (op->type) {
+	case CUSTOMER_OP_REGISTER:
+		return RegisterCustomerN(d, op->id, op->idLen, op->name,
+								 op->nameLen, op->purchase);
+	case CUSTOMER_OP_UNREGISTER_ID:
+		return UnregisterCustomerByIDN(d, op->id, op->idLen);
+	case CUSTOMER_OP_UNREGISTER_NAME:
+		return UnregisterCustomerByNameN(d, op->name, op->nameLen);
+	case CUSTOMER_OP_GET_ID:
+		return GetPurchaseByIDN(d, op->id, op->idLen);
+	default:
+		return GetPurchaseByNameN(d, op->name, op->nameLen);
+	}
+}
+
+/* make op through the synchronous calls of c */
+static int
+CombiningCall(CombiningDB_T c, int slot, const struct CustomerOp *op)
+{
+	switch (op->type) {
+	case CUSTOMER_OP_REGISTER:
+		return CombiningRegisterCustomer(c, slot, op->id, op->name,
+										 op->purchase);
+	case CUSTOMER_OP_UNREGISTER_ID:
+		return CombiningUnregisterCustomerByID(c, slot, op->id);
+	case CUSTOMER_OP_UNREGISTER_NAME:
+		return CombiningUnregisterCustomerByName(c, slot, op->name);
+	case CUSTOMER_OP_GET_ID:
+		return CombiningGetPurchaseByID(c, slot, op->id);
+	default:
+		return CombiningGetPurchaseByName(c, slot, op->name);
+	}
+}
+
+static void *
+CombiningScriptMain(void *arg)
+{
+	struct CombiningScript *s = (struct CombiningScript *)arg;
+	int slot, k, done = 0;
+
+	if ((slot = CombiningJoin(s->c)) < 0) {
+		s->errors++;
+		return NULL;
+	}
+	for (k = 0; k < s->count; k++) {
+		if (!s->pipelined) {
+			s->ops[k].result = CombiningCall(s->c, slot, &s->ops[k]);
+			done++;
+			continue;
+		}
+		/* calls come back in the order they were submitted */
+		if (k - done == FC_TEST_DEPTH &&
+			CombiningComplete(s->c, slot, 1) != &s->ops[done++])
+			s->errors++;
+		if (CombiningSubmit(s->c, slot, &s->ops[k]) < 0)
+			s->errors++;
+	}
+	while (done < k)
+		if (CombiningComplete(s->c, slot, 1) != &s->ops[done++])
+			s->errors++;
+	CombiningLeave(s->c, slot);
+	return NULL;
+}
+
+int
+CorrectnessTest23() {
+
+	struct CombiningScript *scripts, *s;
+	pthread_t threads[FC_TEST_THREADS];
+	unsigned long passes, calls;
+	CombiningDB_T c = NULL;
+	DB_T serial, d;
+	int result, t, i, k, wrong, winners, total;
+
+	result = 0;
+	printf("------------------------------------------------------\n" \
+		   "  Correctness Test 23:\n" \
+		   "  Calls through flat combining\n" \
+		   "------------------------------------------------------\n");
+
+	scripts = (struct CombiningScript *)calloc(FC_TEST_THREADS,
+											   sizeof(*scripts));
+	serial = CreateCustomerDB();
+	d = CreateCustomerDB();
+	if (d != NULL)
+		c = CreateCombiningDB(d, FC_TEST_THREADS);
+	if (scripts == NULL || serial == NULL || c == NULL) {
+		printf("Can't create the dbs, cannot perform the test\n");
+		free(scripts);
+		if (serial) DestroyCustomerDB(serial);
+		if (d) DestroyCustomerDB(d);
+		return -1;
+	}
+
+	/* every thread races to register "shared" first and looks it up
+	   last; customer i belongs to thread i % FC_TEST_THREADS */
+	total = 0;
+	for (t = 0; t < FC_TEST_THREADS; t++) {
+		s = &scripts[t];
+		AddScriptOp(s, CUSTOMER_OP_REGISTER, "shared", "shared", 1);
+		for (i = t; i < FC_TEST_THREADS * FC_TEST_KEYS; i += FC_TEST_THREADS)
+			AddCustomerScript(s, i);
+		AddScriptOp(s, CUSTOMER_OP_GET_ID, "shared", NULL, 0);
+		s->pipelined = t % 2;
+		s->c = c;
+		total += s->count;
+	}
+
+	printf("Run the %d calls of %d threads serially\n", total,
+		   FC_TEST_THREADS);
+	for (t = 0; t < FC_TEST_THREADS; t++)
+		for (k = 0; k < scripts[t].count; k++)
+			scripts[t].expected[k] = RunCustomerOp(serial, &scripts[t].ops[k]);
+
+	printf("Run them through flat combining, %d threads synchronous and "
+		   "%d pipelined %d deep\n", (FC_TEST_THREADS + 1) / 2,
+		   FC_TEST_THREADS / 2, FC_TEST_DEPTH);
+	for (t = 0; t < FC_TEST_THREADS; t++)
+		pthread_create(&threads[t], NULL, CombiningScriptMain, &scripts[t]);
+	for (t = 0; t < FC_TEST_THREADS; t++)
+		pthread_join(threads[t], NULL);
+
+	printf("Every call returns the serial result, one thread registers "
+		   "\"shared\"\n");
+	wrong = winners = 0;
+	for (t = 0; t < FC_TEST_THREADS; t++) {
+		s = &scripts[t];
+		wrong += s->errors;
+		if (s->ops[0].result == 0)
+			winners++;
+		else if (s->ops[0].result != -1)
+			wrong++;
+		for (k = 1; k < s->count; k++)
+			if (s->ops[k].result != s->expected[k])
+				wrong++;
+	}
+	result += CheckResult(wrong, 0);
+	result += CheckResult(winners, 1);
+	CombiningStats(c, &passes, &calls);
+	printf("%lu calls in %lu combining passes\n", calls, passes);
+	result += CheckResult((int)calls, total);
+	DestroyCombiningDB(c);
+
+	printf("The db holds the customers of the serial run\n");
+	result += CheckResult(SameCustomers(d, serial), 0);
+	result += CheckResult(SameCustomers(serial, d), 0);
+	result += CheckResult(GetSumCustomerPurchase(d, &AllPurchases),
+						  GetSumCustomerPurchase(serial, &AllPurchases));
+
+	DestroyCustomerDB(serial);
+	DestroyCustomerDB(d);
+	free(scripts);
+
+	printf("\nCorrectness Test 23 %s\n\n",
+		   (result >= 0)? "PASSED" : "FAILED!");
+
+	return (result >= 0)? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
 float
 timedifference_msec(struct timeval* t0, struct timeval* t1)
 {
-    return (t1->tv_sec - t0->tv_sec) * 1000.0f
-		+ (t1->tv_usec - t0->tv_usec) / 1000.0f;
+    return (t1->tv_sec - t0->tv_sec) * 1000.0f
+		+ (t1->tv_usec - t0->tv_usec) / 1000.0f;
+}
+/*--------------------------------------------------------------------*/
+/* start the hardware counters (if any) and then the phase timer */
+void
+StartPhase(struct PerfCounters *pc, struct timeval *start)
+{
+	if (pc != NULL)
+		PerfCountersStart(pc);
+	gettimeofday(start, NULL);
+}
+/*--------------------------------------------------------------------*/
+/* stop the phase timer and then the hardware counters (if any) */
+void
+StopPhase(struct PerfCounters *pc, struct timeval *end)
+{
+	gettimeofday(end, NULL);
+	if (pc != NULL)
+		PerfCountersStop(pc);
+}
+/*--------------------------------------------------------------------*/
+/* print the counters of the last phase divided by 'ops' operations */
+void
+PrintPhaseCounters(struct PerfCounters *pc, int ops)
+{
+	int i;
+
+	if (pc == NULL || ops <= 0)
+		return;
+
+	for (i = 0; i < PERF_NUM_EVENTS; i++) {
+		if (pc->fd[i] < 0)
+			printf("  %-12s %14s\n", PerfCounterName(i), "n/a");
+		else
+			printf("  %-12s %14.2f /op\n", PerfCounterName(i),
+				   (double)pc->value[i] / ops);
+	}
+	if (pc->fd[PERF_CYCLES] >= 0 && pc->fd[PERF_INSTRUCTIONS] >= 0
+		&& pc->value[PERF_CYCLES] > 0)
+		printf("  %-12s %14.2f\n", "IPC",
+			   (double)pc->value[PERF_INSTRUCTIONS]
+			   / pc->value[PERF_CYCLES]);
+	printf("\n");
+}
+/*--------------------------------------------------------------------*/
+/* print the engine statistics of d */
+void
+PrintStats(DB_T d)
+{
+	struct CustomerDBStats st;
+	int i;
+
+	if (GetCustomerDBStats(d, &st) < 0) {
+		printf("GetCustomerDBStats() failed\n");
+		return;
+	}
+	printf("[Engine statistics]\n");
+	printf("  lookups %lu (hits %lu, misses %lu), %.2f entries compared"
+		   " per lookup\n", st.lookups, st.hits, st.misses,
+		   st.lookups ? (double)st.probes / st.lookups : 0.0);
+	printf("  inserts %lu, deletes %lu, resizes %lu (%f ms)\n",
+		   st.inserts, st.deletes, st.resizes, st.expansionMs);
+	if (st.filtered)
+		printf("  table walks skipped by Bloom filters %lu\n", st.filtered);
+	if (st.pageHits + st.pageReads)
+		printf("  buffer pool hits %.2f%%, %lu pages read, %lu written\n",
+			   100.0 * st.pageHits / (st.pageHits + st.pageReads),
+			   st.pageReads, st.pageWrites);
+	printf("  id chains:   avg %.2f, max %d\n", st.avgIdChain, st.maxIdChain);
+	printf("  name chains: avg %.2f, max %d\n",
+		   st.avgNameChain, st.maxNameChain);
+	printf("  buckets holding   id         name\n");
+	for (i = 0; i < CUSTOMER_STATS_HIST; i++)
+		printf("  %2d%s %17lu %12lu\n", i,
+			   (i == CUSTOMER_STATS_HIST - 1) ? "+" : " ",
+			   st.idHistogram[i], st.nameHistogram[i]);
+	printf("\n");
+}
+/*--------------------------------------------------------------------*/
+int
+OddNumber(const char *id, const char* name, const int purchase)
+{
+	const char *p = name + 4;
+
+	if ((atoi(p) % 2) == 1)
+		return purchase;
+
+	return 0;
+}
+/*--------------------------------------------------------------------*/
+/* Performance Test
+   If 'counters' is non-zero, every phase is also measured with the
+   hardware performance counters and reported per operation.
+   If 'trace_path' is not NULL, every call is recorded to that file. */
+void
+PerformanceTest(int num, int counters, const char *trace_path,
+				const char *id_format) {
+
+	DB_T d;
+	int sum, i, res;
+	char name[100];
+	char id[100];
+	struct timeval start, end;
+	double elapsed;
+	struct PerfCounters counter_set, *pc = NULL;
+	CustomerTrace_T trace = NULL;
+
+	printf("---------------------------------------------------\n" \
+		   "  Performance Test\n" \
+		   "---------------------------------------------------\n\n");
+
+	if (counters) {
+		pc = &counter_set;
+		if (PerfCountersOpen(pc) == 0) {
+			printf("Hardware performance counters are not available,\n"
+				   "reporting elapsed time only\n\n");
+			pc = NULL;
+		}
+	}
+
+	d = CreateCustomerDB();
+	if (d == NULL) {
+		printf("CreateCustomerDB() failed, cannot perform the test\n");
+		return;
+	}
+	if (trace_path != NULL) {
+		if ((trace = OpenTraceWriter(trace_path)) == NULL) {
+			DestroyCustomerDB(d);
+			return;
+		}
+		SetCustomerDBHook(d, TraceHook, trace);
+	}
+
+	/*----------------------- Test 1 ----------------------*/
+	printf("[Test 1] Register %d users with RegisterCustomer()\n", num);
+	/* start timer */
+	StartPhase(pc, &start);
+	/* run test */
+	for (i = 0; i < num; i++) {
+		sprintf(name, "name%d", i);
+		sprintf(id, id_format, i);
+		if (RegisterCustomer(d, id, name, 10) < 0) {
+			printf("RegisterCustomer returns error\n");
+			return;
+		}
+	}
+	/* stop timer and calulate elapsed time*/
+	StopPhase(pc, &end);
+	elapsed = timedifference_msec(&start, &end);
+	printf("Finished registering %d users\n", num);
+	printf("[elapsed time: %f ms]\n\n", elapsed);
+	PrintPhaseCounters(pc, num);
+
+	/*----------------------- Test 2 ----------------------*/
+	printf("[Test 2] Total sum of purchase of %d users\n"\
+		   "         with GetPurchaseByName()\n", num);
+	/* start timer */
+	StartPhase(pc, &start);
+	/* run test */
+	sum = 0;
+	for (i = 0; i < num; i++) {
+		sprintf(name, "name%d", i);
+		if ((res = GetPurchaseByName(d, name)) > 0)
+			sum += res;
+	}
+	/* stop timer and calulate elapsed time*/
+	StopPhase(pc, &end);
+	elapsed = timedifference_msec(&start, &end);
+	printf("Finished calculating the total sum = %d\n", sum);
+	printf("[elapsed time: %f ms]\n\n", elapsed);
+	PrintPhaseCounters(pc, num);
+
+	/*----------------------- Test 3 ----------------------*/
+	printf("[Test 3] Total sum of purchase of %d users\n"\
+		   "         with GetPurchaseByID()\n", num);
+	/* start timer */
+	StartPhase(pc, &start);
+	/* run test */
+	sum = 0;
+	for (i = 0; i < num; i++) {
+		sprintf(id, id_format, i);
+		if ((res = GetPurchaseByID(d, id)) > 0)
+			sum += res;
+	}
+	/* stop timer and calulate elapsed time*/
+	StopPhase(pc, &end);
+	elapsed = timedifference_msec(&start, &end);
+	printf("Finished calculating the total sum = %d\n", sum);
+	printf("[elapsed time: %f ms]\n\n", elapsed);
+	PrintPhaseCounters(pc, num);
+
+	/*----------------------- Test 4 ----------------------*/
+	printf("[Test 4] Total sum of purchase of odd number users\n"\
+		   "         with GetSumCustomerPurchase()\n");
+	/* start timer */
+	StartPhase(pc, &start);
+	/* run test */
+	sum = GetSumCustomerPurchase(d, OddNumber);
+	/* stop timer and calulate elapsed time*/
+	StopPhase(pc, &end);
+	elapsed = timedifference_msec(&start, &end);
+	printf("Finished calculating the odd number user sum = %d\n", sum);
+	printf("[elapsed time: %f ms]\n\n", elapsed);
+	PrintPhaseCounters(pc, num);
+	PrintStats(d);
+
+	/*----------------------- Test 5 ----------------------*/
+	printf("[Test 5] Unregister all the %d users\n"\
+		   "         with UnregisterCustomerByName()\n", num);
+	/* start timer */
+	StartPhase(pc, &start);
+	/* run test */
+	for (i = 0; i < num; i++) {
+		sprintf(name, "name%d", i);
+		assert(UnregisterCustomerByName(d, name) == 0);
+	}
+	/* stop timer and calulate elapsed time*/
+	StopPhase(pc, &end);
+	elapsed = timedifference_msec(&start, &end);
+	printf("Finished unregistering %d users\n", num);
+	printf("[elapsed time: %f ms]\n\n", elapsed);
+	PrintPhaseCounters(pc, num);
+
+
+	DestroyCustomerDB(d);
+	if (pc != NULL)
+		PerfCountersClose(pc);
+	if (trace != NULL) {
+		if (CloseTrace(trace) < 0)
+			printf("Writing the trace %s failed\n", trace_path);
+		else
+			printf("Recorded all calls to %s\n", trace_path);
+	}
+}
+
+/*--------------------------------------------------------------------*/
+/* xorshift step of the data generator of the memory test */
+unsigned int
+NextRandom(unsigned int *state)
+{
+	unsigned int x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+/*--------------------------------------------------------------------*/
+static const char *first_names[] = {
+	"Li", "Ana", "Omar", "Maria", "James", "Sofia", "Oliver", "Fatima",
+	"Mohammed", "Charlotte", "Jun", "Elena", "Naol", "Alexander",
+	"Min-jun", "Isabella"
+};
+static const char *last_names[] = {
+	"Wu", "Kim", "Lee", "Smith", "Garcia", "Müller", "Nguyen", "Okafor",
+	"Johnson", "Erega", "Rodriguez", "Kowalski", "Fernandes",
+	"Papadopoulos", "Van der Berg", "Abdullahi"
+};
+#define NUM_FIRST_NAMES (sizeof(first_names) / sizeof(first_names[0]))
+#define NUM_LAST_NAMES (sizeof(last_names) / sizeof(last_names[0]))
+/*--------------------------------------------------------------------*/
+/* Write the id and name of user 'i' of the memory test data set.
+   Ids are a mix of account numbers, structured codes and e-mail
+   addresses, names are "first last" with a disambiguating number;
+   everything depends only on 'i' so that the set can be regenerated. */
+void
+MakeRealisticCustomer(int i, char *id, char *name)
+{
+	unsigned int state = 2463534242U ^ (unsigned int)i * 2654435761U;
+	unsigned int r, kind;
+	const char *first, *last;
+
+	NextRandom(&state);
+	r = NextRandom(&state);
+	first = first_names[r % NUM_FIRST_NAMES];
+	last = last_names[(r >> 8) % NUM_LAST_NAMES];
+	kind = (r >> 16) % 100;
+
+	if (kind < 55)          /* account number, 7 to 10 digits */
+		sprintf(id, "%0*d", 7 + (int)((r >> 24) % 4), i);
+	else if (kind < 85)     /* structured customer code */
+		sprintf(id, "CUS-%04X-%06d", NextRandom(&state) & 0xffff, i);
+	else                    /* e-mail address */
+		sprintf(id, "%s.%s%d@example.com", first, last, i);
+
+	sprintf(name, "%s %s %d", first, last, i);
+}
+/*--------------------------------------------------------------------*/
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+/* bytes handed out by malloc, including blocks served by mmap */
+size_t
+HeapInUse(void)
+{
+	struct mallinfo2 mi = mallinfo2();
+	return mi.uordblks + mi.hblkhd;
+}
+#endif
+/*--------------------------------------------------------------------*/
+/* print process and engine memory figures for 'count' customers */
+void
+PrintMemoryUsage(DB_T d, int count, size_t heap_base)
+{
+	struct CustomerDBMemoryUsage u;
+	struct rusage ru;
+	long pages = 0, resident = 0;
+	FILE *fp;
+
+	getrusage(RUSAGE_SELF, &ru);
+	if ((fp = fopen("/proc/self/statm", "r")) != NULL) {
+		if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(fp);
+	}
+	printf("  peak RSS          %12ld KB\n", ru.ru_maxrss);
+	printf("  current RSS       %12ld KB\n",
+		   resident * (sysconf(_SC_PAGESIZE) / 1024));
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	printf("  heap in use       %12zu bytes\n", HeapInUse() - heap_base);
+#else
+	(void)heap_base;
+#endif
+
+	if (GetCustomerDBMemoryUsage(d, &u) < 0) {
+		printf("GetCustomerDBMemoryUsage() failed\n");
+		return;
+	}
+	printf("  engine total      %12zu bytes\n", u.total);
+	if (count <= 0)
+		return;
+	printf("  bytes / customer  %12.1f\n", (double)u.total / count);
+	printf("    records         %12.1f\n", (double)u.records / count);
+	printf("    key strings     %12.1f\n", (double)u.keys / count);
+	printf("    bucket arrays   %12.1f\n", (double)u.buckets / count);
+	printf("    alloc overhead  %12.1f\n", (double)u.overhead / count);
+}
+/*--------------------------------------------------------------------*/
+/* Memory Test: load 'num' customers with realistic key lengths and
+   report the footprint after loading and after deleting half of them */
+void
+MemoryTest(int num)
+{
+	DB_T d;
+	int i;
+	char name[128];
+	char id[128];
+	size_t heap_base = 0;
+
+	printf("---------------------------------------------------\n" \
+		   "  Memory Test\n" \
+		   "---------------------------------------------------\n\n");
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	heap_base = HeapInUse();
+#endif
+	d = CreateCustomerDB();
+	if (d == NULL) {
+		printf("CreateCustomerDB() failed, cannot perform the test\n");
+		return;
+	}
+
+	for (i = 0; i < num; i++) {
+		MakeRealisticCustomer(i, id, name);
+		if (RegisterCustomer(d, id, name, 1 + i % 1000) < 0) {
+			printf("RegisterCustomer returns error\n");
+			DestroyCustomerDB(d);
+			return;
+		}
+	}
+	printf("[After registering %d users]\n", num);
+	PrintMemoryUsage(d, num, heap_base);
+
+	for (i = 0; i < num; i += 2) {
+		MakeRealisticCustomer(i, id, name);
+		assert(UnregisterCustomerByID(d, id) == 0);
+	}
+	printf("\n[After unregistering %d users]\n", (num + 1) / 2);
+	PrintMemoryUsage(d, num / 2, heap_base);
+	printf("\n");
+
+	DestroyCustomerDB(d);
+}
+
+/*--------------------------------------------------------------------*/
+/* monotonic clock in nanoseconds */
+unsigned long long
+NowNsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/*--------------------------------------------------------------------*/
+int
+CompareLatency(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return (x > y) - (x < y);
+}
+/*--------------------------------------------------------------------*/
+/* Replay Test: play the calls recorded in 'path' against a new DB,
+   either back to back or (if 'paced') at the recorded timing, and report
+   throughput and per-call latency. GetSumCustomerPurchase is replayed
+   with a plain sum since the traced callback is unknown. */
+void
+ReplayTest(const char *path, int paced)
+{
+	static const char *op_names[] = {
+		"", "register", "unregister-id", "unregister-name",
+		"get-id", "get-name", "sum"
+	};
+	DB_T d;
+	CustomerTrace_T trace;
+	struct TraceRecord rec;
+	unsigned long long *lat = NULL, *tmp, start, t0, t1, total;
+	unsigned long long op_count[CUSTOMER_OP_SUM + 1] = { 0 };
+	unsigned long long op_time[CUSTOMER_OP_SUM + 1] = { 0 };
+	size_t n = 0, size = 0;
+	int res, status, mismatches = 0;
+
+	printf("---------------------------------------------------\n" \
+		   "  Replay Test (%s)\n" \
+		   "---------------------------------------------------\n\n",
+		   paced ? "recorded pacing" : "as fast as possible");
+
+	if ((trace = OpenTraceReader(path)) == NULL)
+		return;
+	d = CreateCustomerDB();
+	if (d == NULL) {
+		printf("CreateCustomerDB() failed, cannot perform the test\n");
+		CloseTrace(trace);
+		return;
+	}
+
+	start = NowNsec();
+	while ((status = ReadTraceRecord(trace, &rec)) == 1) {
+		if (n == size) {
+			size = size ? 2 * size : 4096;
+			tmp = realloc(lat, size * sizeof(*lat));
+			if (tmp == NULL) {
+				printf("Out of memory for %zu latencies\n", size);
+				break;
+			}
+			lat = tmp;
+		}
+		if (paced)
+			while (NowNsec() - start < rec.timestamp)
+				;
+
+		t0 = NowNsec();
+		switch (rec.type) {
+		case CUSTOMER_OP_REGISTER:
+			res = RegisterCustomerN(d, rec.id, rec.idLen, rec.name,
+									rec.nameLen, rec.purchase);
+			break;
+		case CUSTOMER_OP_UNREGISTER_ID:
+			res = UnregisterCustomerByIDN(d, rec.id, rec.idLen);
+			break;
+		case CUSTOMER_OP_UNREGISTER_NAME:
+			res = UnregisterCustomerByNameN(d, rec.name, rec.nameLen);
+			break;
+		case CUSTOMER_OP_GET_ID:
+			res = GetPurchaseByIDN(d, rec.id, rec.idLen);
+			break;
+		case CUSTOMER_OP_GET_NAME:
+			res = GetPurchaseByNameN(d, rec.name, rec.nameLen);
+			break;
+		default:
+			res = rec.result = GetSumCustomerPurchase(d, AllPurchases);
+			break;
+		}
+		t1 = NowNsec();
+
+		lat[n++] = t1 - t0;
+		op_count[rec.type]++;
+		op_time[rec.type] += t1 - t0;
+		if (res != rec.result)
+			mismatches++;
+	}
+	total = NowNsec() - start;
+	if (status < 0)
+		printf("Trace %s is corrupt, stopped after %zu calls\n", path, n);
+
+	printf("Replayed %zu calls in %f ms (%.0f calls/s)\n", n,
+		   total / 1e6, n ? n / (total / 1e9) : 0.0);
+	printf("Results different from the trace: %d\n\n", mismatches);
+	for (res = CUSTOMER_OP_REGISTER; res <= CUSTOMER_OP_SUM; res++)
+		if (op_count[res] > 0)
+			printf("  %-16s %10llu calls %12.1f ns avg\n", op_names[res],
+				   op_count[res], (double)op_time[res] / op_count[res]);
+	if (n > 0) {
+		qsort(lat, n, sizeof(*lat), CompareLatency);
+		printf("\n  latency p50 %llu ns, p90 %llu ns, p99 %llu ns,"
+			   " p99.9 %llu ns, max %llu ns\n\n",
+			   lat[n / 2], lat[n * 9 / 10], lat[n * 99 / 100],
+			   lat[n * 999 / 1000], lat[n - 1]);
+	}
+	PrintStats(d);
+
+	free(lat);
+	DestroyCustomerDB(d);
+	CloseTrace(trace);
+}
+
+/*--------------------------------------------------------------------*/
+/* Compression Test: load 'num' realistic customers with and without
+   CUSTOMER_DB_COMPRESS_KEYS and compare bytes per customer and the
+   time of a lookup by id and by name, for keys drawn at random */
+#define COMPRESSION_SAMPLES 100000
+void
+CompressionTest(int num)
+{
+	struct CustomerDBOptions options;
+	struct CustomerDBMemoryUsage u;
+	DB_T d;
+	int i, mode, errors, samples;
+	unsigned int state = 12345;
+	unsigned long long start, idNs, nameNs;
+	char name[128];
+	char id[128];
+	char **ids, **names;
+	int *expected;
+
+	printf("---------------------------------------------------\n" \
+		   "  Compression Test\n" \
+		   "---------------------------------------------------\n\n");
+
+	/* the keys to look up are generated up front, out of the timing */
+	samples = (num < COMPRESSION_SAMPLES)? num : COMPRESSION_SAMPLES;
+	ids = (char **)calloc(samples, sizeof(char *));
+	names = (char **)calloc(samples, sizeof(char *));
+	expected = (int *)calloc(samples, sizeof(int));
+	if (ids == NULL || names == NULL || expected == NULL) {
+		printf("Can't allocate the lookup keys, cannot perform the test\n");
+		goto out;
+	}
+	for (i = 0; i < samples; i++) {
+		int k = (int)(NextRandom(&state) % (unsigned int)num);
+		MakeRealisticCustomer(k, id, name);
+		ids[i] = strdup(id);
+		names[i] = strdup(name);
+		expected[i] = 1 + k % 1000;
+		if (ids[i] == NULL || names[i] == NULL) {
+			printf("Can't allocate the lookup keys, cannot perform the test\n");
+			goto out;
+		}
+	}
+
+	printf("  keys          bytes/customer   keys/customer" \
+		   "   ns/id lookup  ns/name lookup\n");
+	for (mode = 0; mode < 2; mode++) {
+		memset(&options, 0, sizeof(options));
+		options.flags = mode ? CUSTOMER_DB_COMPRESS_KEYS : 0;
+		d = CreateCustomerDBEx(&options);
+		if (d == NULL) {
+			printf("CreateCustomerDBEx() failed, cannot perform the test\n");
+			goto out;
+		}
+		/* an engine without compression ignores the flag and leaves it
+		   out of its applied options */
+		if (mode && (GetCustomerDBOptions(d, &options) != 0 ||
+					 !(options.flags & CUSTOMER_DB_COMPRESS_KEYS))) {
+			printf("  %-12s not supported by this engine\n", "compressed");
+			DestroyCustomerDB(d);
+			break;
+		}
+		for (i = 0; i < num; i++) {
+			MakeRealisticCustomer(i, id, name);
+			if (RegisterCustomer(d, id, name, 1 + i % 1000) < 0) {
+				printf("RegisterCustomer returns error\n");
+				DestroyCustomerDB(d);
+				goto out;
+			}
+		}
+
+		if (GetCustomerDBMemoryUsage(d, &u) < 0)
+			memset(&u, 0, sizeof(u));
+
+		errors = 0;
+		start = NowNsec();
+		for (i = 0; i < samples; i++)
+			if (GetPurchaseByID(d, ids[i]) != expected[i])
+				errors++;
+		idNs = NowNsec() - start;
+		start = NowNsec();
+		for (i = 0; i < samples; i++)
+			if (GetPurchaseByName(d, names[i]) != expected[i])
+				errors++;
+		nameNs = NowNsec() - start;
+
+		printf("  %-12s %15.1f %15.1f %15.1f %15.1f\n",
+			   mode ? "compressed" : "plain", (double)u.total / num,
+			   (double)u.keys / num, (double)idNs / samples,
+			   (double)nameNs / samples);
+		if (errors)
+			printf("  %d lookups returned a wrong purchase!\n", errors);
+		DestroyCustomerDB(d);
+	}
+	printf("\n");
+
+ out:
+	for (i = 0; ids && names && i < samples; i++) {
+		free(ids[i]);
+		free(names[i]);
+	}
+	free(ids);
+	free(names);
+	free(expected);
+}
+/*--------------------------------------------------------------------*/
+/* Filter Test: with and without CUSTOMER_DB_BLOOM_FILTER, register 'num'
+   customers, look up 'num' absent and 'num' present ids, then remove
+   every other customer (forcing filter rebuilds) and check the rest */
+void
+FilterTest(int num)
+{
+	struct CustomerDBOptions options;
+	DB_T d;
+	int i, mode, errors;
+	unsigned long long start, regNs, missNs, hitNs;
+	char name[128];
+	char id[128];
+
+	printf("---------------------------------------------------\n" \
+		   "  Filter Test\n" \
+		   "---------------------------------------------------\n\n");
+	printf("  filter     ns/register   ns/miss    ns/hit\n");
+	for (mode = 0; mode < 2; mode++) {
+		memset(&options, 0, sizeof(options));
+		options.flags = mode ? CUSTOMER_DB_BLOOM_FILTER : 0;
+		d = CreateCustomerDBEx(&options);
+		if (d == NULL) {
+			printf("CreateCustomerDBEx() failed, cannot perform the test\n");
+			return;
+		}
+		/* an engine without filters ignores the flag and leaves it out
+		   of its applied options */
+		if (mode && (GetCustomerDBOptions(d, &options) != 0 ||
+					 !(options.flags & CUSTOMER_DB_BLOOM_FILTER))) {
+			printf("  %-6s not supported by this engine\n", "on");
+			DestroyCustomerDB(d);
+			break;
+		}
+		errors = 0;
+		start = NowNsec();
+		for (i = 0; i < num; i++) {
+			sprintf(id, "id%d", i);
+			sprintf(name, "name%d", i);
+			if (RegisterCustomer(d, id, name, 1 + i % 1000) < 0)
+				errors++;
+		}
+		regNs = NowNsec() - start;
+		start = NowNsec();
+		for (i = 0; i < num; i++) {
+			sprintf(id, "absent%d", i);
+			if (GetPurchaseByID(d, id) != -1)
+				errors++;
+		}
+		missNs = NowNsec() - start;
+		start = NowNsec();
+		for (i = 0; i < num; i++) {
+			sprintf(id, "id%d", i);
+			if (GetPurchaseByID(d, id) != 1 + i % 1000)
+				errors++;
+		}
+		hitNs = NowNsec() - start;
+
+		for (i = 0; i < num; i += 2) {
+			sprintf(name, "name%d", i);
+			if (UnregisterCustomerByName(d, name) < 0)
+				errors++;
+		}
+		for (i = 0; i < num; i++) {
+			sprintf(id, "id%d", i);
+			sprintf(name, "name%d", i);
+			if (GetPurchaseByID(d, id) != ((i % 2) ? 1 + i % 1000 : -1) ||
+				GetPurchaseByName(d, name) != ((i % 2) ? 1 + i % 1000 : -1))
+				errors++;
+		}
+
+		printf("  %-6s %15.1f %9.1f %9.1f\n", mode ? "on" : "off",
+			   (double)regNs / num, (double)missNs / num,
+			   (double)hitNs / num);
+		if (errors)
+			printf("  %d calls returned a wrong result!\n", errors);
+		if (mode)
+			PrintStats(d);
+		DestroyCustomerDB(d);
+	}
+	printf("\n");
+}
+/*--------------------------------------------------------------------*/
+/* Freeze Test: register 'num' customers, then compare bytes per customer
+   and id/name lookup time before and after FreezeCustomerDB(), and time
+   saving the frozen db and mapping it back */
+void
+FreezeTest(int num)
+{
+	struct CustomerDBMemoryUsage u;
+	DB_T d, loaded;
+	int i, k, phase, errors = 0;
+	unsigned int state;
+	unsigned long long start, idNs, nameNs, freezeNs, loadNs;
+	char path[] = "/tmp/customer_frozen_XXXXXX";
+	char name[128];
+	char id[128];
+	int fd;
+
+	printf("---------------------------------------------------\n" \
+		   "  Freeze Test\n" \
+		   "---------------------------------------------------\n\n");
+	d = CreateCustomerDB();
+	if (d == NULL) {
+		printf("CreateCustomerDB() failed, cannot perform the test\n");
+		return;
+	}
+	for (i = 0; i < num; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, 1 + i % 1000) < 0)
+			errors++;
+	}
+
+	printf("  db            bytes/customer   ns/id lookup  ns/name lookup\n");
+	for (phase = 0; phase < 2; phase++) {
+		/* random order, so that no engine gains from insertion order */
+		state = 12345;
+		start = NowNsec();
+		for (i = 0; i < num; i++) {
+			k = (int)(NextRandom(&state) % (unsigned int)num);
+			sprintf(id, "id%d", k);
+			if (GetPurchaseByID(d, id) != 1 + k % 1000)
+				errors++;
+		}
+		idNs = NowNsec() - start;
+		start = NowNsec();
+		for (i = 0; i < num; i++) {
+			k = (int)(NextRandom(&state) % (unsigned int)num);
+			sprintf(name, "name%d", k);
+			if (GetPurchaseByName(d, name) != 1 + k % 1000)
+				errors++;
+		}
+		nameNs = NowNsec() - start;
+		if (GetCustomerDBMemoryUsage(d, &u) < 0)
+			memset(&u, 0, sizeof(u));
+		printf("  %-12s %15.1f %14.1f %15.1f\n",
+			   phase ? "frozen" : "mutable", (double)u.total / num,
+			   (double)idNs / num, (double)nameNs / num);
+
+		if (phase == 0) {
+			start = NowNsec();
+			if (FreezeCustomerDB(d) < 0) {
+				printf("FreezeCustomerDB() failed\n");
+				DestroyCustomerDB(d);
+				return;
+			}
+			freezeNs = NowNsec() - start;
+		}
+	}
+	printf("\n  freeze %.2f ms\n", freezeNs / 1e6);
+
+	fd = mkstemp(path);
+	if (fd >= 0) {
+		close(fd);
+		if (SaveFrozenCustomerDB(d, path) < 0)
+			errors++;
+		start = NowNsec();
+		loaded = LoadFrozenCustomerDB(path);
+		loadNs = NowNsec() - start;
+		if (loaded == NULL)
+			errors++;
+		else {
+			printf("  load (mmap) %.3f ms\n", loadNs / 1e6);
+			if (GetPurchaseByID(loaded, "id0") != 1)
+				errors++;
+			DestroyCustomerDB(loaded);
+		}
+		unlink(path);
+	}
+	if (errors)
+		printf("  %d calls returned a wrong result!\n", errors);
+	printf("\n");
+	DestroyCustomerDB(d);
+}
+/*--------------------------------------------------------------------*/
+/* Combining Test: COMBINING_THREADS threads register 'num' customers,
+   look each one up and unregister them, sharing one db through a mutex,
+   through flat combining with synchronous calls, and with calls
+   pipelined COMBINING_PIPELINE deep */
+#define COMBINING_THREADS 4
+#define COMBINING_PIPELINE 16
+
+struct CombiningWorker {
+	int mode;             /* 0 mutex, 1 combining, 2 pipelined */
+	int first;            /* customers first, first + step, ... < num */
+	int step;
+	int num;
+	DB_T d;
+	pthread_mutex_t *lock;
+	CombiningDB_T c;
+	int errors;
+};
+
+static int
+ExpectedResult(int phase, int i)
+{
+	/* phase 0 registers, 1 looks up by id, 2 unregisters by name */
+	return (phase == 1) ? 1 + i % 1000 : 0;
+}
+
+static int
+PipelinedResultOK(const struct CustomerOp *op)
+{
+	return op->result == ((op->type == CUSTOMER_OP_GET_ID) ? op->purchase : 0);
+}
+
+static void *
+CombiningWorkerMain(void *arg)
+{
+	struct CombiningWorker *w = (struct CombiningWorker *)arg;
+	struct CustomerOp ops[COMBINING_PIPELINE], *op;
+	char ids[COMBINING_PIPELINE][32], names[COMBINING_PIPELINE][32];
+	int phase, i, k, slot = -1, pending, result;
+
+	if (w->mode)
+		slot = CombiningJoin(w->c);
+	for (phase = 0; phase < 3; phase++) {
+		pending = 0;
+		for (i = w->first, k = 0; i < w->num; i += w->step) {
+			if (w->mode == 2) {
+				/* completions come back in order, so the oldest op,
+				   ops[k], is the one to wait for once all are out */
+				if (pending == COMBINING_PIPELINE) {
+					op = CombiningComplete(w->c, slot, 1);
+					pending--;
+					if (!PipelinedResultOK(op))
+						w->errors++;
+				}
+				op = &ops[k];
+				memset(op, 0, sizeof(*op));
+				op->type = (phase == 0) ? CUSTOMER_OP_REGISTER :
+					(phase == 1) ? CUSTOMER_OP_GET_ID :
+					CUSTOMER_OP_UNREGISTER_NAME;
+				op->idLen = sprintf(ids[k], "id%d", i);
+				op->nameLen = sprintf(names[k], "name%d", i);
+				op->id = ids[k];
+				op->name = names[k];
+				/* lookups carry their expected result in purchase */
+				op->purchase = (phase == 1) ? ExpectedResult(phase, i) :
+					(phase == 0) ? 1 + i % 1000 : 0;
+				if (CombiningSubmit(w->c, slot, op) < 0)
+					w->errors++;
+				else
+					pending++;
+				k = (k + 1) % COMBINING_PIPELINE;
+				continue;
+			}
+			sprintf(ids[0], "id%d", i);
+			sprintf(names[0], "name%d", i);
+			if (w->mode == 0)
+				pthread_mutex_lock(w->lock);
+			if (phase == 0)
+				result = w->mode ?
+					CombiningRegisterCustomer(w->c, slot, ids[0], names[0],
+											  1 + i % 1000) :
+					RegisterCustomer(w->d, ids[0], names[0], 1 + i % 1000);
+			else if (phase == 1)
+				result = w->mode ?
+					CombiningGetPurchaseByID(w->c, slot, ids[0]) :
+					GetPurchaseByID(w->d, ids[0]);
+			else
+				result = w->mode ?
+					CombiningUnregisterCustomerByName(w->c, slot, names[0]) :
+					UnregisterCustomerByName(w->d, names[0]);
+			if (w->mode == 0)
+				pthread_mutex_unlock(w->lock);
+			if (result != ExpectedResult(phase, i))
+				w->errors++;
+		}
+		while (pending > 0) {
+			op = CombiningComplete(w->c, slot, 1);
+			pending--;
+			if (!PipelinedResultOK(op))
+				w->errors++;
+		}
+	}
+	if (w->mode)
+		CombiningLeave(w->c, slot);
+	return NULL;
+}
+
+void
+CombiningTest(int num)
+{
+	static const char *modes[] = { "mutex", "combining", "pipelined" };
+	struct CombiningWorker workers[COMBINING_THREADS];
+	pthread_t threads[COMBINING_THREADS];
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	unsigned long passes, calls;
+	unsigned long long start, ns;
+	CombiningDB_T c;
+	DB_T d;
+	int mode, t, errors;
+
+	printf("---------------------------------------------------\n" \
+		   "  Combining Test (%d threads)\n" \
+		   "---------------------------------------------------\n\n",
+		   COMBINING_THREADS);
+	printf("  sharing       ns/call   calls/pass\n");
+	for (mode = 0; mode < 3; mode++) {
+		d = CreateCustomerDB();
+		c = d ? CreateCombiningDB(d, COMBINING_THREADS) : NULL;
+		if (c == NULL) {
+			printf("CreateCombiningDB() failed, cannot perform the test\n");
+			DestroyCustomerDB(d);
+			return;
+		}
+		start = NowNsec();
+		for (t = 0; t < COMBINING_THREADS; t++) {
+			workers[t].mode = mode;
+			workers[t].first = t;
+			workers[t].step = COMBINING_THREADS;
+			workers[t].num = num;
+			workers[t].d = d;
+			workers[t].lock = &lock;
+			workers[t].c = c;
+			workers[t].errors = 0;
+			pthread_create(&threads[t], NULL, CombiningWorkerMain,
+						   &workers[t]);
+		}
+		errors = 0;
+		for (t = 0; t < COMBINING_THREADS; t++) {
+			pthread_join(threads[t], NULL);
+			errors += workers[t].errors;
+		}
+		ns = NowNsec() - start;
+		CombiningStats(c, &passes, &calls);
+		if (mode)
+			printf("  %-10s %10.1f %12.1f\n", modes[mode],
+				   (double)ns / (3.0 * num),
+				   passes ? (double)calls / passes : 0.0);
+		else
+			printf("  %-10s %10.1f %12s\n", modes[mode],
+				   (double)ns / (3.0 * num), "-");
+		if (errors)
+			printf("  %d calls returned a wrong result!\n", errors);
+		DestroyCombiningDB(c);
+		DestroyCustomerDB(d);
+	}
+	printf("\n");
+}
+/*--------------------------------------------------------------------*/
+/* Expansion Test: register 'num' customers with table expansions done
+   by the registering thread alone and split over EXPAND_TEST_THREADS
+   threads, and compare the time spent expanding */
+#define EXPAND_TEST_THREADS 4
+
+void
+ExpandTest(int num)
+{
+	struct CustomerDBOptions options;
+	struct CustomerDBStats stats;
+	DB_T d;
+	int i, mode, errors;
+	unsigned long long start, regNs;
+	char name[128];
+	char id[128];
+
+	printf("---------------------------------------------------\n" \
+		   "  Expansion Test\n" \
+		   "---------------------------------------------------\n\n");
+	printf("  threads   ns/register   resizes   expansion ms\n");
+	for (mode = 0; mode < 2; mode++) {
+		memset(&options, 0, sizeof(options));
+		options.expandThreads = mode ? EXPAND_TEST_THREADS : 1;
+		d = CreateCustomerDBEx(&options);
+		if (d == NULL) {
+			printf("CreateCustomerDBEx() failed, cannot perform the test\n");
+			return;
+		}
+		errors = 0;
+		start = NowNsec();
+		for (i = 0; i < num; i++) {
+			sprintf(id, "id%d", i);
+			sprintf(name, "name%d", i);
+			if (RegisterCustomer(d, id, name, 1 + i % 1000) < 0)
+				errors++;
+		}
+		regNs = NowNsec() - start;
+		for (i = 0; i < num; i++) {
+			sprintf(id, "id%d", i);
+			sprintf(name, "name%d", i);
+			if (GetPurchaseByID(d, id) != 1 + i % 1000 ||
+				GetPurchaseByName(d, name) != 1 + i % 1000)
+				errors++;
+		}
+		if (GetCustomerDBStats(d, &stats) < 0)
+			memset(&stats, 0, sizeof(stats));
+		printf("  %-7d %13.1f %9lu %14.2f\n", options.expandThreads,
+			   (double)regNs / num, stats.resizes, stats.expansionMs);
+		if (errors)
+			printf("  %d calls returned a wrong result!\n", errors);
+		DestroyCustomerDB(d);
+	}
+	printf("\n");
 }
 /*--------------------------------------------------------------------*/
-int
-OddNumber(const char *id, const char* name, const int purchase)
+/* Purge Test: register 'num' customers and remove the half with an odd
+   purchase, once by collecting their names with a cursor and calling
+   UnregisterCustomerByName() on each, once with UnregisterCustomersWhere() */
+void
+PurgeTest(int num)
 {
-	const char *p = name + 4;
-
-	if ((atoi(p) % 2) == 1)
-		return purchase;
+	struct CustomerView views[256];
+	CustomerCursor_T c;
+	DB_T d;
+	char **names;
+	int i, n, mode, count, removed, errors = 0;
+	unsigned long long start, ns;
+	char name[128];
+	char id[128];
 
-	return 0;
+	printf("---------------------------------------------------\n" \
+		   "  Purge Test\n" \
+		   "---------------------------------------------------\n\n");
+	names = (char **)malloc(num * sizeof(char *));
+	if (names == NULL) {
+		printf("malloc() failed, cannot perform the test\n");
+		return;
+	}
+	printf("  method               removed   ms\n");
+	for (mode = 0; mode < 2; mode++) {
+		d = CreateCustomerDB();
+		if (d == NULL) {
+			printf("CreateCustomerDB() failed, cannot perform the test\n");
+			free(names);
+			return;
+		}
+		for (i = 0; i < num; i++) {
+			sprintf(id, "id%d", i);
+			sprintf(name, "name%d", i);
+			if (RegisterCustomer(d, id, name, 1 + i % 1000) < 0)
+				errors++;
+		}
+		start = NowNsec();
+		if (mode == 0) {
+			count = removed = 0;
+			c = OpenCustomerCursor(d);
+			while (c && (n = NextCustomerBatch(c, views, 256)) > 0)
+				for (i = 0; i < n; i++)
+					if (OddPurchase(NULL, NULL, views[i].purchase))
+						names[count++] = strdup(views[i].name);
+			CloseCustomerCursor(c);
+			for (i = 0; i < count; i++) {
+				if (UnregisterCustomerByName(d, names[i]) == 0)
+					removed++;
+				free(names[i]);
+			}
+		}
+		else
+			removed = UnregisterCustomersWhere(d, &OddPurchase);
+		ns = NowNsec() - start;
+		printf("  %-19s %8d %7.2f\n",
+			   mode ? "where" : "collect + by name", removed, ns / 1e6);
+		for (i = 0; i < num; i += 7) {
+			sprintf(id, "id%d", i);
+			if (GetPurchaseByID(d, id) != ((i % 2) ? 1 + i % 1000 : -1))
+				errors++;
+		}
+		DestroyCustomerDB(d);
+	}
+	if (errors)
+		printf("  %d calls returned a wrong result!\n", errors);
+	printf("\n");
+	free(names);
 }
 /*--------------------------------------------------------------------*/
-/* Performance Test */
+/* Disk Test: register 'num' customers in a db file, then open it again
+   with buffer pools of a fraction of the file and time lookups by id,
+   uniform over all the customers and skewed 90% to the tenth from
+   num/10 to num/5, whose ids sort next to each other (for num a power
+   of ten). Each run is timed after one untimed run that warms the pool
+   up */
 void
-PerformanceTest(int num) {
-
+DiskTest(int num)
+{
+	static const int percent[] = { 100, 25, 5 };
+	struct CustomerDBOptions opt;
+	struct CustomerDBStats before, after;
+	struct stat st;
 	DB_T d;
-	int sum, i, res;
-	char name[100];
-	char id[100];
-	struct timeval start, end;
-	double elapsed;
+	int i, k, p, hot, pass, errors = 0;
+	unsigned int state = 12345;
+	unsigned long long start, ns = 0;
+	unsigned long hits, reads;
+	char path[] = "/tmp/customer_db_XXXXXX";
+	char name[128];
+	char id[128];
+	int fd;
 
 	printf("---------------------------------------------------\n" \
-		   "  Performance Test\n" \
+		   "  Disk Test\n" \
 		   "---------------------------------------------------\n\n");
-
-	d = CreateCustomerDB();
+	fd = mkstemp(path);
+	if (fd < 0) {
+		printf("Can't create a file, cannot perform the test\n");
+		return;
+	}
+	close(fd);
+	memset(&opt, 0, sizeof(opt));
+	opt.path = path;
+	d = CreateCustomerDBEx(&opt);
 	if (d == NULL) {
-		printf("CreateCustomerDB() failed, cannot perform the test\n");
+		printf("CreateCustomerDBEx() failed, cannot perform the test\n");
+		unlink(path);
 		return;
 	}
-
-	/*----------------------- Test 1 ----------------------*/
-	printf("[Test 1] Register %d users with RegisterCustomer()\n", num);
-	/* start timer */
-	gettimeofday(&start, NULL);
-	/* run test */
 	for (i = 0; i < num; i++) {
-		sprintf(name, "name%d", i);
 		sprintf(id, "id%d", i);
-		if (RegisterCustomer(d, id, name, 10) < 0) {
-			printf("RegisterCustomer returns error\n");
-			return;
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, 1 + i % 1000) < 0)
+			errors++;
+	}
+	DestroyCustomerDB(d);
+	if (stat(path, &st) < 0 || st.st_size == 0) {
+		printf("  this engine keeps no db file\n\n");
+		unlink(path);
+		return;
+	}
+
+	printf("  %d customers, db file %.1f MB\n\n", num, st.st_size / 1e6);
+	printf("  pool    keys      ns/lookup  pool hits  pages read\n");
+	for (p = 0; p < (int)(sizeof(percent) / sizeof(percent[0])); p++) {
+		for (hot = 0; hot < 2; hot++) {
+			opt.cacheBytes = (size_t)st.st_size * percent[p] / 100;
+			if ((d = CreateCustomerDBEx(&opt)) == NULL) {
+				errors++;
+				continue;
+			}
+			for (pass = 0; pass < 2; pass++) {
+				GetCustomerDBStats(d, &before);
+				start = NowNsec();
+				for (i = 0; i < num; i++) {
+					k = (int)(NextRandom(&state) % (unsigned int)num);
+					if (hot && num >= 10 && NextRandom(&state) % 10 != 0)
+						k = num / 10 + k % (num / 10);
+					sprintf(id, "id%d", k);
+					if (GetPurchaseByID(d, id) != 1 + k % 1000)
+						errors++;
+				}
+				ns = NowNsec() - start;
+				GetCustomerDBStats(d, &after);
+			}
+			hits = after.pageHits - before.pageHits;
+			reads = after.pageReads - before.pageReads;
+			printf("  %3d%%    %-9s %9.1f %9.2f%% %11lu\n", percent[p],
+				   hot ? "90/10" : "uniform", (double)ns / num,
+				   hits + reads ? 100.0 * hits / (hits + reads) : 0.0,
+				   reads);
+			DestroyCustomerDB(d);
 		}
 	}
-	/* stop timer and calulate elapsed time*/
-	gettimeofday(&end, NULL);
-	elapsed = timedifference_msec(&start, &end);
-	printf("Finished registering %d users\n", num);
-	printf("[elapsed time: %f ms]\n\n", elapsed);
+	unlink(path);
+	if (errors)
+		printf("  %d calls returned a wrong result!\n", errors);
+	printf("\n");
+}
+/*--------------------------------------------------------------------*/
+/* Cache Test: measure the memory of 'num' customers, then use dbs
+   limited to a fraction of it as a cache in front of them: each request
+   looks a customer up by id and registers it on a miss. Requests are
+   uniform or go 90% to a tenth of the customers; each run is timed
+   after one untimed run that fills the cache */
+void
+CacheTest(int num)
+{
+	static const int percent[] = { 50, 25, 10 };
+	struct CustomerDBOptions opt;
+	struct CustomerDBMemoryUsage usage;
+	struct CustomerDBStats before, after;
+	DB_T d;
+	int i, k, p, hot, pass, errors = 0;
+	unsigned int state = 12345;
+	unsigned long long start, ns = 0;
+	unsigned long hits, misses;
+	char name[128];
+	char id[128];
 
-	/*----------------------- Test 2 ----------------------*/
-	printf("[Test 2] Total sum of purchase of %d users\n"\
-		   "         with GetPurchaseByName()\n", num);
-	/* start timer */
-	gettimeofday(&start, NULL);
-	/* run test */
-	sum = 0;
+	printf("---------------------------------------------------\n" \
+		   "  Cache Test\n" \
+		   "---------------------------------------------------\n\n");
+	if ((d = CreateCustomerDB()) == NULL) {
+		printf("CreateCustomerDB() failed, cannot perform the test\n");
+		return;
+	}
 	for (i = 0; i < num; i++) {
+		sprintf(id, "id%d", i);
 		sprintf(name, "name%d", i);
-		if ((res = GetPurchaseByName(d, name)) > 0)
-			sum += res;
+		if (RegisterCustomer(d, id, name, 1 + i % 1000) < 0)
+			errors++;
 	}
-	/* stop timer and calulate elapsed time*/
-	gettimeofday(&end, NULL);
-	elapsed = timedifference_msec(&start, &end);
-	printf("Finished calculating the total sum = %d\n", sum);
-	printf("[elapsed time: %f ms]\n\n", elapsed);
+	GetCustomerDBMemoryUsage(d, &usage);
+	DestroyCustomerDB(d);
+	printf("  %d customers take %.1f MB\n\n", num, usage.total / 1e6);
 
-	/*----------------------- Test 3 ----------------------*/
-	printf("[Test 3] Total sum of purchase of %d users\n"\
-		   "         with GetPurchaseByID()\n", num);
-	/* start timer */
-	gettimeofday(&start, NULL);
-	/* run test */
-	sum = 0;
-	for (i = 0; i < num; i++) {
-		sprintf(id, "id%d", i);
-		if ((res = GetPurchaseByID(d, id)) > 0)
-			sum += res;
+	printf("  limit   keys      ns/request      hits  evictions\n");
+	memset(&opt, 0, sizeof(opt));
+	for (p = 0; p < (int)(sizeof(percent) / sizeof(percent[0])); p++) {
+		for (hot = 0; hot < 2; hot++) {
+			opt.memoryLimit = usage.total * percent[p] / 100;
+			if ((d = CreateCustomerDBEx(&opt)) == NULL) {
+				errors++;
+				continue;
+			}
+			for (pass = 0; pass < 2; pass++) {
+				GetCustomerDBStats(d, &before);
+				start = NowNsec();
+				for (i = 0; i < num; i++) {
+					k = (int)(NextRandom(&state) % (unsigned int)num);
+					if (hot && num >= 10 && NextRandom(&state) % 10 != 0)
+						k %= num / 10;
+					sprintf(id, "id%d", k);
+					if (GetPurchaseByID(d, id) >= 0)
+						continue;
+					sprintf(name, "name%d", k);
+					if (RegisterCustomer(d, id, name, 1 + k % 1000) < 0)
+						errors++;
+				}
+				ns = NowNsec() - start;
+				GetCustomerDBStats(d, &after);
+			}
+			hits = after.hits - before.hits;
+			misses = after.misses - before.misses;
+			printf("  %3d%%    %-9s %9.1f %8.2f%% %10lu\n", percent[p],
+				   hot ? "90/10" : "uniform", (double)ns / num,
+				   hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+				   after.evictions - before.evictions);
+			DestroyCustomerDB(d);
+		}
 	}
-	/* stop timer and calulate elapsed time*/
-	gettimeofday(&end, NULL);
-	elapsed = timedifference_msec(&start, &end);
-	printf("Finished calculating the total sum = %d\n", sum);
-	printf("[elapsed time: %f ms]\n\n", elapsed);
+	if (errors)
+		printf("  %d calls returned a wrong result!\n", errors);
+	printf("\n");
+}
+/*--------------------------------------------------------------------*/
+/* purchases gathered by CollectPurchase() for the quantile test, which
+   a GetSumCustomerPurchase() callback can only reach through globals */
+static int *collected;
+static int collectedCount;
 
-	/*----------------------- Test 4 ----------------------*/
-	printf("[Test 4] Total sum of purchase of odd number users\n"\
-		   "         with GetSumCustomerPurchase()\n");
-	/* start timer */
-	gettimeofday(&start, NULL);
-	/* run test */
-	sum = GetSumCustomerPurchase(d, OddNumber);
-	/* stop timer and calulate elapsed time*/
-	gettimeofday(&end, NULL);
-	elapsed = timedifference_msec(&start, &end);
-	printf("Finished calculating the odd number user sum = %d\n", sum);
-	printf("[elapsed time: %f ms]\n\n", elapsed);
+int
+CollectPurchase(const char *id, const char *name, const int purchase)
+{
+	collected[collectedCount++] = purchase;
+	return 0;
+}
 
-	/*----------------------- Test 5 ----------------------*/
-	printf("[Test 5] Unregister all the %d users\n"\
-		   "         with UnregisterCustomerByName()\n", num);
-	/* start timer */
-	gettimeofday(&start, NULL);
-	/* run test */
+int
+ComparePurchases(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Quantile Test: register 'num' customers with random purchases, then
+   compare the median and p95 of a full scan and sort with
+   GetPurchaseQuantile(), alone and after a change (its first query
+   after a change sorts the sketch) */
+void
+QuantileTest(int num)
+{
+	static const double qs[] = { 0.5, 0.95 };
+	struct CustomerDBMemoryUsage usage;
+	DB_T d;
+	int i, k, q, v, rank, errors = 0;
+	int exact[2], sketch[2];
+	unsigned int state = 12345;
+	unsigned long long start, scanNs, queryNs, changeNs;
+	char name[128];
+	char id[128];
+
+	printf("---------------------------------------------------\n" \
+		   "  Quantile Test\n" \
+		   "---------------------------------------------------\n\n");
+	d = CreateCustomerDB();
+	collected = (int *)malloc(num * sizeof(int));
+	if (d == NULL || collected == NULL) {
+		printf("Can't allocate the db, cannot perform the test\n");
+		DestroyCustomerDB(d);
+		free(collected);
+		return;
+	}
 	for (i = 0; i < num; i++) {
+		sprintf(id, "id%d", i);
 		sprintf(name, "name%d", i);
-		assert(UnregisterCustomerByName(d, name) == 0);
+		if (RegisterCustomer(d, id, name,
+							 1 + (int)(NextRandom(&state) % 100000)) < 0)
+			errors++;
 	}
-	/* stop timer and calulate elapsed time*/
-	gettimeofday(&end, NULL);
-	elapsed = timedifference_msec(&start, &end);
-	printf("Finished unregistering %d users\n", num);
-	printf("[elapsed time: %f ms]\n\n", elapsed);
 
+	/* the way it was done: collect every purchase and sort */
+	start = NowNsec();
+	collectedCount = 0;
+	GetSumCustomerPurchase(d, &CollectPurchase);
+	qsort(collected, collectedCount, sizeof(int), ComparePurchases);
+	for (q = 0; q < 2; q++)
+		exact[q] = collected[(int)(qs[q] * (collectedCount - 1))];
+	scanNs = NowNsec() - start;
+
+	start = NowNsec();
+	for (i = 0; i < 1000; i++)
+		for (q = 0; q < 2; q++)
+			sketch[q] = GetPurchaseQuantile(d, qs[q]);
+	queryNs = NowNsec() - start;
 
+	/* each round unregisters and re-registers a customer first */
+	start = NowNsec();
+	for (i = 0; i < 1000; i++) {
+		k = (int)(NextRandom(&state) % (unsigned int)num);
+		sprintf(id, "id%d", k);
+		sprintf(name, "name%d", k);
+		v = GetPurchaseByID(d, id);
+		if (UnregisterCustomerByID(d, id) < 0 ||
+			RegisterCustomer(d, id, name, v) < 0)
+			errors++;
+		for (q = 0; q < 2; q++)
+			if (GetPurchaseQuantile(d, qs[q]) < 0)
+				errors++;
+	}
+	changeNs = NowNsec() - start;
+	GetCustomerDBMemoryUsage(d, &usage);
+
+	printf("  %d customers\n\n", num);
+	printf("  scan and sort          %12.1f us for both\n", scanNs / 1e3);
+	printf("  GetPurchaseQuantile    %12.1f ns a query\n",
+		   queryNs / 2000.0);
+	printf("  change, then both      %12.1f us a round\n\n",
+		   changeNs / 1e6);
+	for (q = 0; q < 2; q++) {
+		/* rank of the sketch's answer among the sorted purchases */
+		for (rank = 0; rank < collectedCount &&
+				 collected[rank] < sketch[q]; rank++)
+			;
+		printf("  p%-3d exact %6d sketch %6d rank error %.2f%%\n",
+			   (int)(qs[q] * 100), exact[q], sketch[q],
+			   100.0 * (rank - qs[q] * (collectedCount - 1)) /
+			   collectedCount);
+	}
+	printf("\n  memory %.1f MB\n", usage.total / 1e6);
+	if (errors)
+		printf("  %d calls returned a wrong result!\n", errors);
+	printf("\n");
+	free(collected);
 	DestroyCustomerDB(d);
 }
+/*--------------------------------------------------------------------*/
+/* the region map and the sums of JoinRegion(), which a
+   GetSumCustomerPurchase() callback can only reach through globals */
+static DB_T regionMap;
+static long *joinSums;
+
+int
+JoinRegion(const char *id, const char *name, const int purchase)
+{
+	int region = GetPurchaseByID(regionMap, id) - 1;
+
+	if (region >= 0)
+		joinSums[region] += purchase;
+	return 0;
+}
+
+/* Group Test: register 'num' customers in 64 regions, then sum the
+   purchases by region the old way, through a GetSumCustomerPurchase()
+   callback looking each customer up in a separate id -> region db, and
+   with GroupSumPurchaseBy() on 1 and 4 threads */
+void
+GroupTest(int num)
+{
+	static const int threads[] = { 1, 4 };
+	struct CustomerDBOptions opt;
+	long join[CUSTOMER_ATTR_CODES], sums[CUSTOMER_ATTR_CODES];
+	DB_T d;
+	int i, t, k, region, errors = 0;
+	unsigned int state;
+	unsigned long long start, ns;
+	char name[128];
+	char id[128];
+
+	printf("---------------------------------------------------\n" \
+		   "  Group Test\n" \
+		   "---------------------------------------------------\n\n");
+	memset(&opt, 0, sizeof(opt));
+	opt.attrCount = 1;
+	memset(join, 0, sizeof(join));
+	joinSums = join;
+	printf("  %d customers in 64 regions\n\n", num);
+	for (t = 0; t < 2; t++) {
+		opt.scanThreads = threads[t];
+		d = CreateCustomerDBEx(&opt);
+		if (t == 0)
+			regionMap = CreateCustomerDB();
+		if (d == NULL || (t == 0 && regionMap == NULL)) {
+			printf("Can't create the dbs, cannot perform the test\n");
+			DestroyCustomerDB(d);
+			DestroyCustomerDB(regionMap);
+			return;
+		}
+		state = 12345;
+		for (i = 0; i < num; i++) {
+			sprintf(id, "id%d", i);
+			sprintf(name, "name%d", i);
+			region = (int)(NextRandom(&state) % 64);
+			if (RegisterCustomer(d, id, name,
+								 1 + (int)(NextRandom(&state) % 1000)) < 0 ||
+				SetCustomerAttr(d, id, 0, region) < 0 ||
+				(t == 0 && RegisterCustomer(regionMap, id, name,
+											region + 1) < 0))
+				errors++;
+		}
+
+		if (t == 0) {
+			start = NowNsec();
+			GetSumCustomerPurchase(d, &JoinRegion);
+			ns = NowNsec() - start;
+			printf("  callback and map lookup   %10.2f ms\n", ns / 1e6);
+			DestroyCustomerDB(regionMap);
+			regionMap = NULL;
+		}
+
+		start = NowNsec();
+		for (k = 0; k < 10; k++)
+			if (GroupSumPurchaseBy(d, 0, sums) != num)
+				errors++;
+		ns = (NowNsec() - start) / 10;
+		printf("  GroupSumPurchaseBy, %d %s %10.2f ms\n", threads[t],
+			   threads[t] == 1 ? "thread " : "threads", ns / 1e6);
+		if (memcmp(sums, join, sizeof(sums)) != 0)
+			errors++;
+		DestroyCustomerDB(d);
+	}
+	if (errors)
+		printf("  %d calls returned a wrong result!\n", errors);
+	printf("\n");
+}
+/*--------------------------------------------------------------------*/
+/* Save Test: register 'num' customers and save them with
+   BackgroundSaveCustomerDB() while this process keeps unregistering and
+   re-registering random customers, then run the same churn as long
+   without a save to compare its rate */
+void
+SaveTest(int num)
+{
+	struct BackgroundSaveStats st;
+	BackgroundSave_T s;
+	DB_T d;
+	int i, k, r, phase, errors = 0;
+	unsigned int state = 12345;
+	unsigned long long start, ns, saveNs = 0;
+	long ops[2];
+	char path[] = "/tmp/customer_save_XXXXXX";
+	char name[128];
+	char id[128];
+	int fd;
+
+	printf("---------------------------------------------------\n" \
+		   "  Save Test\n" \
+		   "---------------------------------------------------\n\n");
+	d = CreateCustomerDB();
+	fd = mkstemp(path);
+	if (d == NULL || fd < 0) {
+		printf("Can't create a db and a file, cannot perform the test\n");
+		DestroyCustomerDB(d);
+		return;
+	}
+	close(fd);
+	for (i = 0; i < num; i++) {
+		sprintf(id, "id%d", i);
+		sprintf(name, "name%d", i);
+		if (RegisterCustomer(d, id, name, 1 + i % 1000) < 0)
+			errors++;
+	}
 
+	for (phase = 0; phase < 2; phase++) {
+		s = NULL;
+		if (phase == 0) {
+			fflush(stdout);
+			if ((s = BackgroundSaveCustomerDB(d, path)) == NULL) {
+				printf("BackgroundSaveCustomerDB() failed\n");
+				break;
+			}
+		}
+		ops[phase] = 0;
+		start = NowNsec();
+		do {
+			for (i = 0; i < 64; i++) {
+				k = (int)(NextRandom(&state) % (unsigned int)num);
+				sprintf(id, "id%d", k);
+				sprintf(name, "name%d", k);
+				if (UnregisterCustomerByID(d, id) < 0 ||
+					RegisterCustomer(d, id, name, 1 + k % 1000) < 0)
+					errors++;
+			}
+			ops[phase] += 128;
+			ns = NowNsec() - start;
+		} while (phase == 0 ? (r = BackgroundSaveWait(s, 0, &st)) == 1
+				 : ns < saveNs);
+		if (phase == 0) {
+			saveNs = ns;
+			if (r < 0) {
+				printf("The background save failed\n");
+				break;
+			}
+			printf("  fork %.2f ms, save %.1f ms, %zu customers, %.1f MB\n",
+				   st.forkMs, st.saveMs, st.customers, st.bytes / 1e6);
+			printf("  pages copied %zu, still shared %zu\n",
+				   st.copiedPages, st.sharedPages);
+		}
+		printf("  churn %-16s %10.0f calls/s\n",
+			   phase ? "without a save" : "during the save",
+			   ops[phase] / (ns / 1e9));
+	}
+	unlink(path);
+	if (errors)
+		printf("  %d calls returned a wrong result!\n", errors);
+	printf("\n");
+	DestroyCustomerDB(d);
+}
 /*--------------------------------------------------------------------*/
 int
 main(int argc, const char *argv[])
 {
-	int res[5], i;
+	int res[23], i;
 
 	/* ./testclient -c : run all the correctness tests */
 	if (argc == 2 && strcmp("-c", argv[1]) == 0) {
@@ -490,8 +4170,26 @@ main(int argc, const char *argv[])
 		res[2] = CorrectnessTest3();
 		res[3] = CorrectnessTest4();
 		res[4] = CorrectnessTest5();
+		res[5] = CorrectnessTest6();
+		res[6] = CorrectnessTest7();
+		res[7] = CorrectnessTest8();
+		res[8] = CorrectnessTest9();
+		res[9] = CorrectnessTest10();
+		res[10] = CorrectnessTest11();
+		res[11] = CorrectnessTest12();
+		res[12] = CorrectnessTest13();
+		res[13] = CorrectnessTest14();
+		res[14] = CorrectnessTest15();
+		res[15] = CorrectnessTest16();
+		res[16] = CorrectnessTest17();
+		res[17] = CorrectnessTest18();
+		res[18] = CorrectnessTest19();
+		res[19] = CorrectnessTest20();
+		res[20] = CorrectnessTest21();
+		res[21] = CorrectnessTest22();
+		res[22] = CorrectnessTest23();
 
-		for (i = 0; i < 5; i++)
+		for (i = 0; i < 23; i++)
 			printf("Test %d %s\n", i + 1,
 				   (res[i] == 0)? "PASSED" : "FAILED");
 
@@ -509,6 +4207,42 @@ main(int argc, const char *argv[])
 			CorrectnessTest4();
 		else if (atoi(argv[2]) == 5)
 			CorrectnessTest5();
+		else if (atoi(argv[2]) == 6)
+			CorrectnessTest6();
+		else if (atoi(argv[2]) == 7)
+			CorrectnessTest7();
+		else if (atoi(argv[2]) == 8)
+			CorrectnessTest8();
+		else if (atoi(argv[2]) == 9)
+			CorrectnessTest9();
+		else if (atoi(argv[2]) == 10)
+			CorrectnessTest10();
+		else if (atoi(argv[2]) == 11)
+			CorrectnessTest11();
+		else if (atoi(argv[2]) == 12)
+			CorrectnessTest12();
+		else if (atoi(argv[2]) == 13)
+			CorrectnessTest13();
+		else if (atoi(argv[2]) == 14)
+			CorrectnessTest14();
+		else if (atoi(argv[2]) == 15)
+			CorrectnessTest15();
+		else if (atoi(argv[2]) == 16)
+			CorrectnessTest16();
+		else if (atoi(argv[2]) == 17)
+			CorrectnessTest17();
+		else if (atoi(argv[2]) == 18)
+			CorrectnessTest18();
+		else if (atoi(argv[2]) == 19)
+			CorrectnessTest19();
+		else if (atoi(argv[2]) == 20)
+			CorrectnessTest20();
+		else if (atoi(argv[2]) == 21)
+			CorrectnessTest21();
+		else if (atoi(argv[2]) == 22)
+			CorrectnessTest22();
+		else if (atoi(argv[2]) == 23)
+			CorrectnessTest23();
 		else
 			goto error;
 		return 0;
@@ -517,16 +4251,181 @@ main(int argc, const char *argv[])
 	else if (argc == 3 && strcmp("-p", argv[1]) == 0) {
 		int n = atoi(argv[2]);
 		if (n > 0)
-			PerformanceTest(n);
+			PerformanceTest(n, 0, NULL, "id%d");
+
+		return 0;
+	}
+	/* ./testclient -t file num : run the performance test and record
+	   every call to a trace file */
+	else if (argc == 4 && strcmp("-t", argv[1]) == 0) {
+		int n = atoi(argv[3]);
+		if (n > 0)
+			PerformanceTest(n, 0, argv[2], "id%d");
+
+		return 0;
+	}
+	/* ./testclient -r file : replay a trace as fast as possible
+	   ./testclient -R file : replay a trace at the recorded pacing */
+	else if (argc == 3 && (strcmp("-r", argv[1]) == 0
+						   || strcmp("-R", argv[1]) == 0)) {
+		ReplayTest(argv[2], argv[1][1] == 'R');
+		return 0;
+	}
+	/* ./testclient -z num : compare key compression on and off */
+	else if (argc == 3 && strcmp("-z", argv[1]) == 0) {
+		int n = atoi(argv[2]);
+		if (n > 0)
+			CompressionTest(n);
+
+		return 0;
+	}
+	/* ./testclient -b num : compare Bloom filters on and off */
+	else if (argc == 3 && strcmp("-b", argv[1]) == 0) {
+		int n = atoi(argv[2]);
+		if (n > 0)
+			FilterTest(n);
+
+		return 0;
+	}
+	/* ./testclient -f num : compare lookups before and after freezing */
+	else if (argc == 3 && strcmp("-f", argv[1]) == 0) {
+		int n = atoi(argv[2]);
+		if (n > 0)
+			FreezeTest(n);
+
+		return 0;
+	}
+	/* ./testclient -w num : compare mutex and flat-combining sharing */
+	else if (argc == 3 && strcmp("-w", argv[1]) == 0) {
+		int n = atoi(argv[2]);
+		if (n > 0)
+			CombiningTest(n);
+
+		return 0;
+	}
+	/* ./testclient -x num : compare serial and parallel expansions */
+	else if (argc == 3 && strcmp("-x", argv[1]) == 0) {
+		int n = atoi(argv[2]);
+		if (n > 0)
+			ExpandTest(n);
+
+		return 0;
+	}
+	/* ./testclient -u num : compare ways of removing half the customers */
+	else if (argc == 3 && strcmp("-u", argv[1]) == 0) {
+		int n = atoi(argv[2]);
+		if (n > 0)
+			PurgeTest(n);
+
+		return 0;
+	}
+	/* ./testclient -d num : time lookups with pools smaller than the db */
+	else if (argc == 3 && strcmp("-d", argv[1]) == 0) {
+		int n = atoi(argv[2]);
+		if (n > 0)
+			DiskTest(n);
+
+		return 0;
+	}
+	/* ./testclient -e num : use a memory-limited db as a cache */
+	else if (argc == 3 && strcmp("-e", argv[1]) == 0) {
+		int n = atoi(argv[2]);
+		if (n > 0)
+			CacheTest(n);
+
+		return 0;
+	}
+	/* ./testclient -q num : time quantiles from the sketch and by sorting */
+	else if (argc == 3 && strcmp("-q", argv[1]) == 0) {
+		int n = atoi(argv[2]);
+		if (n > 0)
+			QuantileTest(n);
+
+		return 0;
+	}
+	/* ./testclient -g num : time sums by region with and without the
+	   attribute columns */
+	else if (argc == 3 && strcmp("-g", argv[1]) == 0) {
+		int n = atoi(argv[2]);
+		if (n > 0)
+			GroupTest(n);
+
+		return 0;
+	}
+	/* ./testclient -s num : churn the db during a background save */
+	else if (argc == 3 && strcmp("-s", argv[1]) == 0) {
+		int n = atoi(argv[2]);
+		if (n > 0)
+			SaveTest(n);
+
+		return 0;
+	}
+	/* ./testclient -m num : run the memory test */
+	else if (argc == 3 && strcmp("-m", argv[1]) == 0) {
+		int n = atoi(argv[2]);
+		if (n > 0)
+			MemoryTest(n);
+
+		return 0;
+	}
+	/* ./testclient -P num : run the performance test with hardware
+	   performance counters */
+	else if (argc == 3 && strcmp("-P", argv[1]) == 0) {
+		int n = atoi(argv[2]);
+		if (n > 0)
+			PerformanceTest(n, 1, NULL, "id%d");
+
+		return 0;
+	}
+	/* ./testclient -n num : run the performance test with plain
+	   decimal ids */
+	else if (argc == 3 && strcmp("-n", argv[1]) == 0) {
+		int n = atoi(argv[2]);
+		if (n > 0)
+			PerformanceTest(n, 0, NULL, "%d");
 
 		return 0;
 	}
 
  error:
 	printf("Usage:  %s -c      run all the correctness tests\n"  	\
-		   "        %s -c 3    run the correctness test 3 (1~5)\n"	\
+		   "        %s -c 3    run the correctness test 3 (1~23)\n"	\
 		   "        %s -p 2000 run performance test with data set"	\
-		   " of 2000 users", argv[0], argv[0], argv[0]);
+		   " of 2000 users\n"										\
+		   "        %s -P 2000 same, with hardware performance counters"	\
+		   " per operation\n"										\
+		   "        %s -n 2000 run performance test with decimal ids"	\
+		   " (\"17\", not \"id17\")\n"								\
+		   "        %s -m 2000 report memory footprint of 2000 users\n"	\
+		   "        %s -z 2000 compare memory and lookup time with"	\
+		   " key compression on and off\n"							\
+		   "        %s -b 2000 compare registration and lookup time"	\
+		   " with Bloom filters on and off\n"						\
+		   "        %s -f 2000 compare lookups before and after"		\
+		   " FreezeCustomerDB()\n"									\
+		   "        %s -w 2000 compare mutex and flat-combining sharing"	\
+		   " across threads\n"											\
+		   "        %s -x 2000 compare table expansion by one and by"	\
+		   " 4 threads\n"												\
+		   "        %s -u 2000 compare one-by-one and predicate"		\
+		   " unregistration\n"											\
+		   "        %s -d 2000 time lookups with buffer pools smaller"	\
+		   " than the db file\n"										\
+		   "        %s -s 2000 churn the db during a background"		\
+		   " save\n"													\
+		   "        %s -e 2000 use dbs limited to a part of the memory"	\
+		   " as caches\n"												\
+		   "        %s -q 2000 compare quantiles from the sketch with"	\
+		   " a scan and sort\n"											\
+		   "        %s -g 2000 compare sums by region through a callback"	\
+		   " and by attribute\n"										\
+		   "        %s -t f 2000 run performance test, trace calls"		\
+		   " to file f\n"												\
+		   "        %s -r f    replay trace f as fast as possible\n"		\
+		   "        %s -R f    replay trace f at the recorded pacing\n",
+		   argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
+		   argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
+		   argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
 
 	return 0;
 }
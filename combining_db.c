@@ -0,0 +1,290 @@
+/*
+ * Program: combining_db.c
+ *
+ * Description:
+ * ------------
+ * Flat combining over the public customer_manager API (see
+ * combining_db.h). Every joined thread owns a slot holding a ring of
+ * posted calls: the owner appends at 'head', the combiner runs them and
+ * advances 'done', and the owner hands them back at 'tail'. 'done' sits
+ * on its own cache line, so posting a call and running it only move the
+ * slot's lines between the two threads; the DB's own lines stay with
+ * the combiner. The combiner role is a mutex taken with trylock: a
+ * thread waiting for its call either runs everybody's calls itself or
+ * spins on its own 'done'.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "combining_db.h"
+
+#define CACHE_LINE 64
+#define MAX_PASSES 4        /* rescans of the slots while calls arrive */
+#define SPINS_PER_YIELD 64  /* busy polls before giving up the cpu */
+
+struct Slot {
+  struct CustomerOp *ops[COMBINING_QUEUE_DEPTH];
+  unsigned long head;             /* calls submitted (owner) */
+  unsigned long tail;             /* calls returned (owner) */
+  int inUse;
+  unsigned long done __attribute__((aligned(CACHE_LINE)));
+                                  /* calls run (combiner) */
+} __attribute__((aligned(CACHE_LINE)));
+
+struct CombiningDB {
+  DB_T db;
+  int maxThreads;
+  int slotsUsed;                  /* highest joined slot + 1 */
+  pthread_mutex_t lock;           /* held by the combiner */
+  unsigned long passes;           /* under lock */
+  unsigned long calls;
+  struct Slot *slots;
+};
+/*--------------------------------------------------------------------*/
+CombiningDB_T
+CreateCombiningDB(DB_T d, int maxThreads)
+{
+  CombiningDB_T c;
+  void *mem;
+
+  if (d == NULL || maxThreads <= 0) {
+    fprintf(stderr, "Error: invalid argument to CreateCombiningDB\n");
+    return NULL;
+  }
+  c = (CombiningDB_T)calloc(1, sizeof(struct CombiningDB));
+  if (c == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the combining db\n");
+    return NULL;
+  }
+  if (posix_memalign(&mem, CACHE_LINE,
+                     (size_t)maxThreads * sizeof(struct Slot)) != 0) {
+    fprintf(stderr, "Error: Can't allocate a memory for the combining db\n");
+    free(c);
+    return NULL;
+  }
+  c->slots = (struct Slot *)mem;
+  memset(c->slots, 0, (size_t)maxThreads * sizeof(struct Slot));
+  c->db = d;
+  c->maxThreads = maxThreads;
+  pthread_mutex_init(&c->lock, NULL);
+  return c;
+}
+/*--------------------------------------------------------------------*/
+void
+DestroyCombiningDB(CombiningDB_T c)
+{
+  if (c == NULL) return;
+  pthread_mutex_destroy(&c->lock);
+  free(c->slots);
+  free(c);
+}
+/*--------------------------------------------------------------------*/
+int
+CombiningJoin(CombiningDB_T c)
+{
+  int i, used, expected;
+
+  if (c == NULL) return -1;
+  for (i = 0; i < c->maxThreads; i++) {
+    expected = 0;
+    if (__atomic_compare_exchange_n(&c->slots[i].inUse, &expected, 1, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      break;
+  }
+  if (i == c->maxThreads) {
+    fprintf(stderr, "Error: all %d combining slots are taken\n",
+            c->maxThreads);
+    return -1;
+  }
+  used = __atomic_load_n(&c->slotsUsed, __ATOMIC_RELAXED);
+  while (used < i + 1 &&
+         !__atomic_compare_exchange_n(&c->slotsUsed, &used, i + 1, 0,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  return i;
+}
+/*--------------------------------------------------------------------*/
+void
+CombiningLeave(CombiningDB_T c, int slot)
+{
+  if (c == NULL || slot < 0 || slot >= c->maxThreads) return;
+  __atomic_store_n(&c->slots[slot].inUse, 0, __ATOMIC_RELEASE);
+}
+/*--------------------------------------------------------------------*/
+static void run_op(DB_T d, struct CustomerOp *op)
+{
+  switch (op->type) {
+  case CUSTOMER_OP_REGISTER:
+    op->result = RegisterCustomerN(d, op->id, op->idLen, op->name,
+                                   op->nameLen, op->purchase);
+    break;
+  case CUSTOMER_OP_UNREGISTER_ID:
+    op->result = UnregisterCustomerByIDN(d, op->id, op->idLen);
+    break;
+  case CUSTOMER_OP_UNREGISTER_NAME:
+    op->result = UnregisterCustomerByNameN(d, op->name, op->nameLen);
+    break;
+  case CUSTOMER_OP_GET_ID:
+    op->result = GetPurchaseByIDN(d, op->id, op->idLen);
+    break;
+  case CUSTOMER_OP_GET_NAME:
+    op->result = GetPurchaseByNameN(d, op->name, op->nameLen);
+    break;
+  }
+}
+/*--------------------------------------------------------------------*/
+static void combine(CombiningDB_T c)
+
+/* Run the posted calls of every slot, rescanning while new ones keep
+   arriving. Called with c->lock held. */
+{
+  struct Slot *s;
+  unsigned long done, head, ran;
+  int i, used, pass;
+
+  for (pass = 0; pass < MAX_PASSES; pass++) {
+    ran = 0;
+    used = __atomic_load_n(&c->slotsUsed, __ATOMIC_ACQUIRE);
+    for (i = 0; i < used; i++) {
+      s = &c->slots[i];
+      done = s->done;
+      head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+      while (done < head) {
+        run_op(c->db, s->ops[done % COMBINING_QUEUE_DEPTH]);
+        done++;
+        __atomic_store_n(&s->done, done, __ATOMIC_RELEASE);
+        ran++;
+      }
+    }
+    if (ran == 0) break;
+    c->passes++;
+    c->calls += ran;
+  }
+}
+/*--------------------------------------------------------------------*/
+int
+CombiningSubmit(CombiningDB_T c, int slot, struct CustomerOp *op)
+{
+  struct Slot *s;
+
+  if (c == NULL || slot < 0 || slot >= c->maxThreads || op == NULL ||
+      op->type < CUSTOMER_OP_REGISTER || op->type > CUSTOMER_OP_GET_NAME) {
+    fprintf(stderr, "Error: invalid argument to CombiningSubmit\n");
+    return -1;
+  }
+  s = &c->slots[slot];
+  if (s->head - s->tail >= COMBINING_QUEUE_DEPTH) return -1;
+  s->ops[s->head % COMBINING_QUEUE_DEPTH] = op;
+  __atomic_store_n(&s->head, s->head + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+struct CustomerOp *
+CombiningComplete(CombiningDB_T c, int slot, int wait)
+{
+  struct Slot *s;
+  int spins = 0;
+
+  if (c == NULL || slot < 0 || slot >= c->maxThreads) return NULL;
+  s = &c->slots[slot];
+  if (s->tail == s->head) return NULL;
+
+  for (;;) {
+    if (__atomic_load_n(&s->done, __ATOMIC_ACQUIRE) > s->tail)
+      return s->ops[s->tail++ % COMBINING_QUEUE_DEPTH];
+    if (pthread_mutex_trylock(&c->lock) == 0) {
+      combine(c);
+      pthread_mutex_unlock(&c->lock);
+      continue;
+    }
+    if (!wait) return NULL;
+    if (++spins % SPINS_PER_YIELD == 0)
+      sched_yield();
+  }
+}
+/*--------------------------------------------------------------------*/
+static int sync_call(CombiningDB_T c, int slot, struct CustomerOp *op)
+
+/* Submit op, wait for it and return its result */
+{
+  if (CombiningSubmit(c, slot, op) < 0) return -1;
+  CombiningComplete(c, slot, 1);
+  return op->result;
+}
+/*--------------------------------------------------------------------*/
+int
+CombiningRegisterCustomer(CombiningDB_T c, int slot, const char *id,
+                          const char *name, const int purchase)
+{
+  struct CustomerOp op;
+
+  memset(&op, 0, sizeof(op));
+  op.type = CUSTOMER_OP_REGISTER;
+  op.id = id;
+  op.idLen = id ? strlen(id) : 0;
+  op.name = name;
+  op.nameLen = name ? strlen(name) : 0;
+  op.purchase = purchase;
+  return sync_call(c, slot, &op);
+}
+/*--------------------------------------------------------------------*/
+int
+CombiningUnregisterCustomerByID(CombiningDB_T c, int slot, const char *id)
+{
+  struct CustomerOp op;
+
+  memset(&op, 0, sizeof(op));
+  op.type = CUSTOMER_OP_UNREGISTER_ID;
+  op.id = id;
+  op.idLen = id ? strlen(id) : 0;
+  return sync_call(c, slot, &op);
+}
+/*--------------------------------------------------------------------*/
+int
+CombiningUnregisterCustomerByName(CombiningDB_T c, int slot,
+                                  const char *name)
+{
+  struct CustomerOp op;
+
+  memset(&op, 0, sizeof(op));
+  op.type = CUSTOMER_OP_UNREGISTER_NAME;
+  op.name = name;
+  op.nameLen = name ? strlen(name) : 0;
+  return sync_call(c, slot, &op);
+}
+/*--------------------------------------------------------------------*/
+int
+CombiningGetPurchaseByID(CombiningDB_T c, int slot, const char *id)
+{
+  struct CustomerOp op;
+
+  memset(&op, 0, sizeof(op));
+  op.type = CUSTOMER_OP_GET_ID;
+  op.id = id;
+  op.idLen = id ? strlen(id) : 0;
+  return sync_call(c, slot, &op);
+}
+/*--------------------------------------------------------------------*/
+int
+CombiningGetPurchaseByName(CombiningDB_T c, int slot, const char *name)
+{
+  struct CustomerOp op;
+
+  memset(&op, 0, sizeof(op));
+  op.type = CUSTOMER_OP_GET_NAME;
+  op.name = name;
+  op.nameLen = name ? strlen(name) : 0;
+  return sync_call(c, slot, &op);
+}
+/*--------------------------------------------------------------------*/
+void
+CombiningStats(CombiningDB_T c, unsigned long *passes, unsigned long *calls)
+{
+  pthread_mutex_lock(&c->lock);
+  if (passes) *passes = c->passes;
+  if (calls) *calls = c->calls;
+  pthread_mutex_unlock(&c->lock);
+}
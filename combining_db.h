@@ -0,0 +1,76 @@
+#ifndef COMBINING_DB_H
+#define COMBINING_DB_H
+
+/* combining_db.h */
+/* Share one DB_T between threads by flat combining. Each thread joins
+   once and gets a slot; it posts its calls into the slot instead of
+   taking a lock around the DB. Whichever thread finds the combiner
+   lock free runs the posted calls of every slot in one pass, so the
+   tables stay in that thread's cache while the others only touch
+   their own slot.
+
+     CombiningDB_T c = CreateCombiningDB(d, 8);
+     int slot = CombiningJoin(c);                     (per thread)
+     CombiningRegisterCustomer(c, slot, id, name, purchase);
+     CombiningLeave(c, slot);
+
+   Calls can also be pipelined: CombiningSubmit() posts a call and
+   returns at once, CombiningComplete() hands the calls back in the
+   order they were submitted once they have run.
+
+   The DB itself is not locked. While a CombiningDB_T is in use, no
+   thread may call the DB directly. GetSumCustomerPurchase() and the
+   other calls taking no keys are not posted; make them when the
+   threads are done. */
+
+#include "customer_manager.h"
+
+typedef struct CombiningDB *CombiningDB_T;
+
+/* calls a slot can have submitted and not yet completed */
+#define COMBINING_QUEUE_DEPTH 32
+
+/* share d between at most maxThreads joined threads, NULL on failure.
+   d stays the caller's */
+CombiningDB_T CreateCombiningDB(DB_T d, int maxThreads);
+
+/* free c (not its DB). every thread must have left */
+void DestroyCombiningDB(CombiningDB_T c);
+
+/* claim a slot for the calling thread. return the slot, -1 if all
+   maxThreads slots are taken */
+int CombiningJoin(CombiningDB_T c);
+
+/* give the slot back. its submitted calls must have completed */
+void CombiningLeave(CombiningDB_T c, int slot);
+
+/* post op (type CUSTOMER_OP_REGISTER, _UNREGISTER_ID/NAME or
+   _GET_ID/NAME, with its keys and purchase) for execution. op and its
+   keys must stay valid until CombiningComplete() returns it, with
+   op->result set. return 0 on success, -1 on an invalid op or if
+   COMBINING_QUEUE_DEPTH calls of the slot are outstanding */
+int CombiningSubmit(CombiningDB_T c, int slot, struct CustomerOp *op);
+
+/* return the oldest submitted op of the slot if it has run, combining
+   pending calls if no other thread does. with wait, block until it has
+   run. return NULL if nothing is outstanding or (without wait) the op
+   has not run yet */
+struct CustomerOp *CombiningComplete(CombiningDB_T c, int slot, int wait);
+
+/* synchronous calls: submit one op and wait for its result. the slot
+   must have no outstanding calls */
+int CombiningRegisterCustomer(CombiningDB_T c, int slot, const char *id,
+                              const char *name, const int purchase);
+int CombiningUnregisterCustomerByID(CombiningDB_T c, int slot,
+                                    const char *id);
+int CombiningUnregisterCustomerByName(CombiningDB_T c, int slot,
+                                      const char *name);
+int CombiningGetPurchaseByID(CombiningDB_T c, int slot, const char *id);
+int CombiningGetPurchaseByName(CombiningDB_T c, int slot, const char *name);
+
+/* report the combining passes that ran at least one call and the calls
+   they ran; calls / passes is the average batch */
+void CombiningStats(CombiningDB_T c, unsigned long *passes,
+                    unsigned long *calls);
+
+#endif /* end of COMBINING_DB_H */
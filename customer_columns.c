@@ -0,0 +1,244 @@
+/*
+ * Program: customer_columns.c
+ *
+ * Description:
+ * ------------
+ * Dense purchase and attribute columns (see customer_columns.h). Every
+ * column is a plain array of `alloc` entries that grows by doubling;
+ * new rows start free, with every code 0. Rows handed out by
+ * CustomerColumnsNewRow() come from a stack of the rows given back,
+ * then from the end of the columns. A group sum touches 4 bytes of
+ * purchase and 1 byte of code per row, in order, with the sums of the
+ * 256 codes (2 KiB) staying in the L1 cache; each thread adds into sums
+ * of its own, which the caller adds up at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "customer_columns.h"
+
+#define MIN_ROWS 1024           /* rows allocated first */
+#define MAX_SCAN_THREADS 64
+#define PARALLEL_SUM_MIN_ROWS (1 << 16) /* rows per thread worth starting */
+
+struct CustomerColumns {
+  int *purchase;                /* purchase of each row, 0 if free */
+  unsigned char *code[CUSTOMER_MAX_ATTRS]; /* codes of each attribute */
+  int attrCount;
+  int threads;                  /* threads of a group sum */
+  int rows;                     /* rows ever used; the rest are free */
+  int alloc;                    /* rows allocated */
+  int *freeRows;                /* rows given back to NewRow */
+  int nFree;
+  int freeAlloc;
+};
+
+/* One range of rows of a group sum and its result */
+struct SumRange {
+  const int *purchase;
+  const unsigned char *code;
+  int from, to;
+  int count;
+  long sums[CUSTOMER_ATTR_CODES];
+};
+/*--------------------------------------------------------------------*/
+CustomerColumns_T
+CreateCustomerColumns(int attrCount, int threads)
+{
+  CustomerColumns_T c;
+
+  if (attrCount < 1 || attrCount > CUSTOMER_MAX_ATTRS) return NULL;
+  c = (CustomerColumns_T)calloc(1, sizeof(struct CustomerColumns));
+  if (c == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the columns\n");
+    return NULL;
+  }
+  c->attrCount = attrCount;
+  c->threads = threads < 1 ? 1 :
+    threads < MAX_SCAN_THREADS ? threads : MAX_SCAN_THREADS;
+  return c;
+}
+/*--------------------------------------------------------------------*/
+void
+DestroyCustomerColumns(CustomerColumns_T c)
+{
+  int a;
+
+  if (c == NULL) return;
+  free(c->purchase);
+  for (a = 0; a < c->attrCount; a++) free(c->code[a]);
+  free(c->freeRows);
+  free(c);
+}
+/*--------------------------------------------------------------------*/
+static int grow(CustomerColumns_T c, int row)
+
+/* Make the columns hold row. Return 0 or -1 (c is then unchanged but
+   for columns already grown, whose new rows are free). */
+{
+  int alloc = c->alloc ? c->alloc : MIN_ROWS, a;
+  void *p;
+
+  while (alloc <= row) alloc *= 2;
+  p = realloc(c->purchase, (size_t)alloc * sizeof(int));
+  if (p == NULL) goto fail;
+  c->purchase = (int *)p;
+  memset(c->purchase + c->alloc, 0, (size_t)(alloc - c->alloc) * sizeof(int));
+  for (a = 0; a < c->attrCount; a++) {
+    p = realloc(c->code[a], (size_t)alloc);
+    if (p == NULL) goto fail;
+    c->code[a] = (unsigned char *)p;
+    memset(c->code[a] + c->alloc, 0, (size_t)(alloc - c->alloc));
+  }
+  c->alloc = alloc;
+  return 0;
+
+ fail:
+  fprintf(stderr, "Error: Can't allocate columns of %d rows\n", alloc);
+  return -1;
+}
+/*--------------------------------------------------------------------*/
+int
+CustomerColumnsSet(CustomerColumns_T c, int row, int purchase)
+{
+  int a;
+
+  if (c == NULL || row < 0 || purchase <= 0) return -1;
+  if (row >= c->alloc && grow(c, row) < 0) return -1;
+  c->purchase[row] = purchase;
+  for (a = 0; a < c->attrCount; a++) c->code[a][row] = 0;
+  if (row >= c->rows) c->rows = row + 1;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+void
+CustomerColumnsClear(CustomerColumns_T c, int row)
+{
+  if (c == NULL || row < 0 || row >= c->rows) return;
+  c->purchase[row] = 0;
+}
+/*--------------------------------------------------------------------*/
+int
+CustomerColumnsNewRow(CustomerColumns_T c, int purchase)
+{
+  int row;
+
+  if (c == NULL) return -1;
+  row = c->nFree > 0 ? c->freeRows[c->nFree - 1] : c->rows;
+  if (CustomerColumnsSet(c, row, purchase) < 0) return -1;
+  if (c->nFree > 0) c->nFree--;
+  return row;
+}
+/*--------------------------------------------------------------------*/
+void
+CustomerColumnsFreeRow(CustomerColumns_T c, int row)
+{
+  int *p;
+
+  if (c == NULL || row < 0 || row >= c->rows) return;
+  c->purchase[row] = 0;
+  if (c->nFree == c->freeAlloc) {
+    p = (int *)realloc(c->freeRows, (size_t)(c->freeAlloc ? 2 * c->freeAlloc
+                                             : MIN_ROWS) * sizeof(int));
+    if (p == NULL) return; /* the row stays free, just never reused */
+    c->freeRows = p;
+    c->freeAlloc = c->freeAlloc ? 2 * c->freeAlloc : MIN_ROWS;
+  }
+  c->freeRows[c->nFree++] = row;
+}
+/*--------------------------------------------------------------------*/
+int
+CustomerColumnsSetAttr(CustomerColumns_T c, int row, int attr, int code)
+{
+  if (c == NULL || row < 0 || row >= c->rows) return -1;
+  if (attr < 0 || attr >= c->attrCount) return -1;
+  if (code < 0 || code >= CUSTOMER_ATTR_CODES) return -1;
+  c->code[attr][row] = (unsigned char)code;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+CustomerColumnsGetAttr(CustomerColumns_T c, int row, int attr)
+{
+  if (c == NULL || row < 0 || row >= c->rows) return -1;
+  if (attr < 0 || attr >= c->attrCount) return -1;
+  return c->code[attr][row];
+}
+/*--------------------------------------------------------------------*/
+static void *sum_range(void *arg)
+
+/* Add up the purchases of the rows of one range by code. */
+{
+  struct SumRange *r = (struct SumRange *)arg;
+  const int *purchase = r->purchase;
+  const unsigned char *code = r->code;
+  int i, count = 0;
+
+  memset(r->sums, 0, sizeof(r->sums));
+  for (i = r->from; i < r->to; i++) {
+    if (purchase[i] > 0) {
+      r->sums[code[i]] += purchase[i];
+      count++;
+    }
+  }
+  r->count = count;
+  return NULL;
+}
+/*--------------------------------------------------------------------*/
+int
+CustomerColumnsGroupSum(CustomerColumns_T c, int attr,
+                        long out[CUSTOMER_ATTR_CODES])
+{
+  struct SumRange ranges[MAX_SCAN_THREADS];
+  pthread_t threads[MAX_SCAN_THREADS];
+  int started[MAX_SCAN_THREADS];
+  int workers, t, k, count = 0;
+
+  if (c == NULL || out == NULL) return -1;
+  if (attr < 0 || attr >= c->attrCount) return -1;
+
+  workers = c->rows / PARALLEL_SUM_MIN_ROWS;
+  if (workers > c->threads) workers = c->threads;
+  if (workers < 1) workers = 1;
+  for (t = 0; t < workers; t++) {
+    ranges[t].purchase = c->purchase;
+    ranges[t].code = c->code[attr];
+    ranges[t].from = (int)((long)c->rows * t / workers);
+    ranges[t].to = (int)((long)c->rows * (t + 1) / workers);
+  }
+  /* a range whose thread cannot be started is summed by the caller */
+  for (t = 1; t < workers; t++)
+    started[t] = pthread_create(&threads[t], NULL, sum_range,
+                                &ranges[t]) == 0;
+  sum_range(&ranges[0]);
+  for (t = 1; t < workers; t++) {
+    if (started[t]) pthread_join(threads[t], NULL);
+    else sum_range(&ranges[t]);
+  }
+
+  memset(out, 0, CUSTOMER_ATTR_CODES * sizeof(long));
+  for (t = 0; t < workers; t++) {
+    for (k = 0; k < CUSTOMER_ATTR_CODES; k++) out[k] += ranges[t].sums[k];
+    count += ranges[t].count;
+  }
+  return count;
+}
+/*--------------------------------------------------------------------*/
+void
+CustomerColumnsGetOptions(CustomerColumns_T c,
+                          struct CustomerDBOptions *options)
+{
+  options->attrCount = c ? c->attrCount : 0;
+  options->scanThreads = c ? c->threads : 0;
+}
+/*--------------------------------------------------------------------*/
+size_t
+CustomerColumnsMemory(CustomerColumns_T c)
+{
+  if (c == NULL) return 0;
+  return sizeof(struct CustomerColumns) +
+         (size_t)c->alloc * (sizeof(int) + (size_t)c->attrCount) +
+         (size_t)c->freeAlloc * sizeof(int);
+}
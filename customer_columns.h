@@ -0,0 +1,71 @@
+#ifndef CUSTOMER_COLUMNS_H
+#define CUSTOMER_COLUMNS_H
+
+/* customer_columns.h */
+/* Dense columns of the customers of a db for GroupSumPurchaseBy(): the
+   purchases, and one byte of attribute code per customer and attribute,
+   each in an array indexed by a row number. A purchase of 0 marks a row
+   without a customer. The engine either numbers the rows itself (a slot
+   or record index that never moves) or takes them from the columns:
+
+     row = CustomerColumnsNewRow(c, purchase);   or
+     CustomerColumnsSet(c, slot, purchase);
+     CustomerColumnsSetAttr(c, row, REGION, 7);
+     n = CustomerColumnsGroupSum(c, REGION, sums);
+     CustomerColumnsFreeRow(c, row);             or
+     CustomerColumnsClear(c, slot);
+
+   A group sum reads the two columns front to back, split into ranges
+   among threads once they are long enough. */
+
+#include <stddef.h>
+#include "customer_manager.h"
+
+typedef struct CustomerColumns *CustomerColumns_T;
+
+/* create columns for attrCount attributes (1 .. CUSTOMER_MAX_ATTRS)
+   whose group sums use up to threads threads. return NULL on invalid
+   input or allocation failure */
+CustomerColumns_T CreateCustomerColumns(int attrCount, int threads);
+
+/* free the columns */
+void DestroyCustomerColumns(CustomerColumns_T c);
+
+/* store a customer with purchase (> 0) in row, its codes all 0. return
+   0, -1 on allocation failure */
+int CustomerColumnsSet(CustomerColumns_T c, int row, int purchase);
+
+/* mark row free */
+void CustomerColumnsClear(CustomerColumns_T c, int row);
+
+/* store a customer with purchase (> 0) in a free row, reusing the rows
+   that CustomerColumnsFreeRow() gave back first. return the row, -1 on
+   allocation failure */
+int CustomerColumnsNewRow(CustomerColumns_T c, int purchase);
+
+/* mark a row of CustomerColumnsNewRow() free for it to hand out again */
+void CustomerColumnsFreeRow(CustomerColumns_T c, int row);
+
+/* set attribute attr of the customer in row to code. return 0, -1 if
+   attr or code is out of range */
+int CustomerColumnsSetAttr(CustomerColumns_T c, int row, int attr, int code);
+
+/* return the code of attribute attr of the customer in row, -1 if attr
+   is out of range */
+int CustomerColumnsGetAttr(CustomerColumns_T c, int row, int attr);
+
+/* fill out[code] with the sum of the purchases of the customers whose
+   attribute attr is code. return the number of customers, -1 if attr is
+   out of range */
+int CustomerColumnsGroupSum(CustomerColumns_T c, int attr,
+                            long out[CUSTOMER_ATTR_CODES]);
+
+/* set the attrCount and scanThreads of options to those of c, 0 if c
+   is NULL */
+void CustomerColumnsGetOptions(CustomerColumns_T c,
+                               struct CustomerDBOptions *options);
+
+/* return the bytes held by the columns */
+size_t CustomerColumnsMemory(CustomerColumns_T c);
+
+#endif /* end of CUSTOMER_COLUMNS_H */
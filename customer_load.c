@@ -0,0 +1,494 @@
+/*
+ * Program: customer_load.c
+ *
+ * Description:
+ * ------------
+ * Load generator for customer_server. It opens many connections and
+ * keeps up to 'depth' requests in flight on each one, writing a
+ * connection's new requests with one write and timing every request
+ * from that write to its answer. Answers come back in order, so each
+ * connection keeps the send times of its requests in a ring.
+ *
+ * The run has two phases: registering 'customers' customers spread
+ * over the connections, then 'requests' calls of which 'reads' percent
+ * are lookups by id of random customers and the rest registrations of
+ * new ones. Each phase reports its throughput, latency percentiles and
+ * the calls that failed.
+ *
+ * With -t it checks a freshly started server instead: one connection
+ * sends a script of calls of every kind back to back, some with names
+ * landing on other shards than their ids, and every answer must match
+ * the one expected.
+ *
+ * Usage: customer_load [-u path | -p port] [-c connections] [-d depth]
+ *                      [-k customers] [-n requests] [-r reads%] [-t]
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "customer_manager.h"
+#include "customer_protocol.h"
+
+#define DEFAULT_SOCKET "/tmp/customer_server.sock"
+#define READ_CHUNK (1 << 16)
+#define KEY_SIZE 32
+#define CHECK_CUSTOMERS 20000     /* enough removals by id for a sweep */
+
+struct Conn {
+  int fd;
+  int index;
+  unsigned char *out;        /* requests not yet written */
+  size_t outLen, outSent;
+  unsigned char *in;         /* answer bytes not yet decoded */
+  size_t inLen;
+  double *sentAt;            /* ring of send times, 'depth' entries */
+  long quota;                /* requests to make in this phase */
+  long issued, answered;
+  int done;                  /* all answered */
+};
+
+static struct Conn *conns;
+static int nConns = 16;
+static int depth = 16;
+static int readPercent = 90;
+static long customers = 100000;
+static long nextCustomer;    /* next new customer of the mixed phase */
+static float *latencies;     /* microseconds, one per answer */
+static long nLatencies;
+static long failures;
+static unsigned long seed = 88172645463325252UL;
+/*--------------------------------------------------------------------*/
+static double now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+/*--------------------------------------------------------------------*/
+static unsigned long next_random(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+/*--------------------------------------------------------------------*/
+static int connect_to(const char *path, int port)
+{
+  struct sockaddr_un un;
+  struct sockaddr_in in;
+  int fd, one = 1;
+
+  if (port > 0) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_port = htons((unsigned short)port);
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&in, sizeof(in)) < 0) goto fail;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  } else {
+    if (strlen(path) >= sizeof(un.sun_path)) return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strcpy(un.sun_path, path);
+    if (connect(fd, (struct sockaddr *)&un, sizeof(un)) < 0) goto fail;
+  }
+  return fd;
+
+ fail:
+  close(fd);
+  return -1;
+}
+/*--------------------------------------------------------------------*/
+static void queue_request(struct Conn *c, int phase, double now)
+
+/* Append the next request of c to its output buffer. In the loading
+   phase connection k registers customers k, k + nConns, ... */
+{
+  struct CustomerOp op;
+  char id[KEY_SIZE], name[KEY_SIZE];
+  long i;
+
+  memset(&op, 0, sizeof(op));
+  if (phase == 0 || (long)(next_random() % 100) >= readPercent) {
+    i = phase == 0 ? c->index + c->issued * nConns : nextCustomer++;
+    op.type = CUSTOMER_OP_REGISTER;
+    op.idLen = (size_t)sprintf(id, "id%ld", i);
+    op.nameLen = (size_t)sprintf(name, "name%ld", i);
+    op.name = name;
+    op.purchase = (int)(i % 1000) + 1;
+  } else {
+    op.type = CUSTOMER_OP_GET_ID;
+    op.idLen = (size_t)sprintf(id, "id%ld",
+                               (long)(next_random() % customers));
+  }
+  op.id = id;
+  c->outLen += ProtoEncodeRequest(c->out + c->outLen, &op);
+  c->sentAt[c->issued % depth] = now;
+  c->issued++;
+}
+/*--------------------------------------------------------------------*/
+static int pump(struct Conn *c, int phase)
+
+/* Top up the requests in flight on c and write what the socket takes.
+   Return 0 or -1 on a broken connection. */
+{
+  double now = now_us();
+  ssize_t n;
+
+  memmove(c->out, c->out + c->outSent, c->outLen - c->outSent);
+  c->outLen -= c->outSent;
+  c->outSent = 0;
+  while (c->issued < c->quota && c->issued - c->answered < depth)
+    queue_request(c, phase, now);
+  while (c->outSent < c->outLen) {
+    n = send(c->fd, c->out + c->outSent, c->outLen - c->outSent,
+             MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      return -1;
+    }
+    c->outSent += (size_t)n;
+  }
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int drain(struct Conn *c)
+
+/* Read the answers that arrived on c and time them. Return 0 or -1 on
+   a broken connection. */
+{
+  double now;
+  ssize_t n;
+  size_t at;
+  long used;
+  int result;
+
+  n = recv(c->fd, c->in + c->inLen, READ_CHUNK, MSG_DONTWAIT);
+  if (n < 0) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+  if (n == 0) return -1;
+  c->inLen += (size_t)n;
+  now = now_us();
+  for (at = 0; (used = ProtoDecodeResult(c->in + at, c->inLen - at,
+                                         &result)) > 0; at += (size_t)used) {
+    if (c->answered == c->issued) return -1; /* an answer too many */
+    latencies[nLatencies++] = (float)(now - c->sentAt[c->answered % depth]);
+    if (result < 0) failures++;
+    c->answered++;
+  }
+  if (used < 0) return -1;
+  memmove(c->in, c->in + at, c->inLen - at);
+  c->inLen -= at;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int compare_float(const void *a, const void *b)
+{
+  float x = *(const float *)a, y = *(const float *)b;
+  return (x > y) - (x < y);
+}
+/*--------------------------------------------------------------------*/
+static int run_phase(const char *title, int phase, long requests)
+
+/* Spread requests over the connections, run them to the last answer
+   and print the numbers. Return 0 or -1 on a broken connection. */
+{
+  struct epoll_event ev, events[64];
+  int epfd, i, n, left = 0;
+  long total = 0;
+  double start, ms;
+
+  if ((epfd = epoll_create1(0)) < 0) return -1;
+  nLatencies = failures = 0;
+  for (i = 0; i < nConns; i++) {
+    conns[i].quota = requests / nConns + (i < requests % nConns);
+    conns[i].issued = conns[i].answered = 0;
+    conns[i].done = 0;
+    total += conns[i].quota;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &conns[i];
+    epoll_ctl(epfd, EPOLL_CTL_ADD, conns[i].fd, &ev);
+  }
+
+  start = now_us();
+  for (i = 0; i < nConns; i++) {
+    if (pump(&conns[i], phase) < 0) goto broken;
+    if (conns[i].quota > 0) left++;
+  }
+  while (left > 0) {
+    n = epoll_wait(epfd, events, 64, 1000);
+    for (i = 0; i < n; i++) {
+      struct Conn *c = (struct Conn *)events[i].data.ptr;
+      if (drain(c) < 0 || pump(c, phase) < 0) goto broken;
+      if (!c->done && c->answered == c->quota && c->quota > 0) {
+        c->done = 1;
+        left--;
+      }
+    }
+    for (i = 0; i < nConns; i++) /* finish partial writes */
+      if (conns[i].outSent < conns[i].outLen && pump(&conns[i], phase) < 0)
+        goto broken;
+  }
+  ms = (now_us() - start) / 1000.0;
+  close(epfd);
+
+  qsort(latencies, nLatencies, sizeof(float), compare_float);
+  printf("%s: %ld requests in %.1f ms, %.0f requests/s, %ld failed\n",
+         title, total, ms, total / (ms / 1000.0), failures);
+  if (nLatencies > 0)
+    printf("  latency us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           latencies[nLatencies / 2], latencies[nLatencies * 9 / 10],
+           latencies[nLatencies * 99 / 100], latencies[nLatencies - 1]);
+  return 0;
+
+ broken:
+  fprintf(stderr, "Error: a connection to the server broke\n");
+  close(epfd);
+  return -1;
+}
+/*--------------------------------------------------------------------*/
+struct Script {
+  unsigned char *out;        /* the requests */
+  size_t outLen, outCap;
+  int *expected;             /* the answer of each request */
+  long count, cap;
+};
+/*--------------------------------------------------------------------*/
+static int add(struct Script *s, int type, const char *id, const char *name,
+               int purchase, int expected)
+
+/* Append a request and its expected answer to s. Return 0 or -1. */
+{
+  struct CustomerOp op;
+  size_t need;
+  void *p;
+
+  memset(&op, 0, sizeof(op));
+  op.type = type;
+  op.id = id;
+  op.idLen = id ? strlen(id) : 0;
+  op.name = name;
+  op.nameLen = name ? strlen(name) : 0;
+  op.purchase = purchase;
+
+  need = s->outLen + PROTO_REQUEST_OVERHEAD + op.idLen + op.nameLen;
+  if (need > s->outCap) {
+    if ((p = realloc(s->out, 2 * need)) == NULL) return -1;
+    s->out = (unsigned char *)p;
+    s->outCap = 2 * need;
+  }
+  if (s->count == s->cap) {
+    p = realloc(s->expected, sizeof(int) * (s->cap ? 2 * s->cap : 1024));
+    if (p == NULL) return -1;
+    s->expected = (int *)p;
+    s->cap = s->cap ? 2 * s->cap : 1024;
+  }
+  s->outLen += ProtoEncodeRequest(s->out + s->outLen, &op);
+  s->expected[s->count++] = expected;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int check_server(const char *path, int port)
+
+/* Run the script of -t against a fresh server. Return the number of
+   wrong answers, -1 if the script can't be run. */
+{
+  struct Script s;
+  unsigned char *in;
+  char id[KEY_SIZE], name[KEY_SIZE];
+  size_t sent = 0, inLen = 0, at;
+  long answered = 0, used;
+  int fd, i, result, errors = 0, failed = 0;
+  ssize_t n;
+
+  memset(&s, 0, sizeof(s));
+  failed |= add(&s, CUSTOMER_OP_REGISTER, "id0", "name0", 5, 0);
+  failed |= add(&s, CUSTOMER_OP_REGISTER, "id1", "name1", 7, 0);
+  failed |= add(&s, CUSTOMER_OP_REGISTER, "id0", "nameX", 1, -1);
+  failed |= add(&s, CUSTOMER_OP_REGISTER, "idX", "name0", 1, -1);
+  failed |= add(&s, CUSTOMER_OP_GET_ID, "id0", NULL, 0, 5);
+  failed |= add(&s, CUSTOMER_OP_GET_NAME, NULL, "name1", 0, 7);
+  failed |= add(&s, CUSTOMER_OP_GET_NAME, NULL, "nameX", 0, -1);
+  /* a removal by id leaves the name free for another id */
+  failed |= add(&s, CUSTOMER_OP_UNREGISTER_ID, "id0", NULL, 0, 0);
+  failed |= add(&s, CUSTOMER_OP_UNREGISTER_ID, "id0", NULL, 0, -1);
+  failed |= add(&s, CUSTOMER_OP_GET_NAME, NULL, "name0", 0, -1);
+  failed |= add(&s, CUSTOMER_OP_REGISTER, "id2", "name0", 9, 0);
+  failed |= add(&s, CUSTOMER_OP_GET_NAME, NULL, "name0", 0, 9);
+  failed |= add(&s, CUSTOMER_OP_UNREGISTER_NAME, NULL, "name1", 0, 0);
+  failed |= add(&s, CUSTOMER_OP_UNREGISTER_NAME, NULL, "name1", 0, -1);
+  failed |= add(&s, CUSTOMER_OP_GET_ID, "id1", NULL, 0, -1);
+  failed |= add(&s, CUSTOMER_OP_REGISTER, "id1", "name1", 3, 0);
+  failed |= add(&s, CUSTOMER_OP_SUM, NULL, NULL, 0, 12);
+
+  /* customers removed by id, their names then taken by new ids */
+  for (i = 0; i < CHECK_CUSTOMERS; i++) {
+    sprintf(id, "c%d", i);
+    sprintf(name, "n%d", i);
+    failed |= add(&s, CUSTOMER_OP_REGISTER, id, name, i % 1000 + 1, 0);
+  }
+  for (i = 0; i < CHECK_CUSTOMERS; i++) {
+    sprintf(id, "c%d", i);
+    failed |= add(&s, CUSTOMER_OP_UNREGISTER_ID, id, NULL, 0, 0);
+  }
+  for (i = 0; i < CHECK_CUSTOMERS; i++) {
+    sprintf(id, "d%d", i);
+    sprintf(name, "n%d", i);
+    failed |= add(&s, CUSTOMER_OP_GET_NAME, NULL, name, 0, -1);
+    failed |= add(&s, CUSTOMER_OP_REGISTER, id, name, i % 7 + 1, 0);
+    failed |= add(&s, CUSTOMER_OP_GET_NAME, NULL, name, 0, i % 7 + 1);
+    if (i % 2)
+      failed |= add(&s, CUSTOMER_OP_UNREGISTER_NAME, NULL, name, 0, 0);
+  }
+  for (i = 0; i < CHECK_CUSTOMERS; i += 2) {
+    sprintf(id, "d%d", i);
+    failed |= add(&s, CUSTOMER_OP_GET_ID, id, NULL, 0, i % 7 + 1);
+  }
+
+  in = (unsigned char *)malloc(READ_CHUNK);
+  if (failed || in == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the script\n");
+    errors = -1;
+    goto out;
+  }
+  if ((fd = connect_to(path, port)) < 0) {
+    perror("Error: Can't connect to the server");
+    errors = -1;
+    goto out;
+  }
+
+  /* the answers are far smaller than the server's backlog limit, so
+     they can wait until every request is written */
+  while (sent < s.outLen) {
+    n = send(fd, s.out + sent, s.outLen - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    sent += (size_t)n;
+  }
+  while (sent == s.outLen && answered < s.count) {
+    n = recv(fd, in + inLen, READ_CHUNK - inLen, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    inLen += (size_t)n;
+    for (at = 0; answered < s.count &&
+         (used = ProtoDecodeResult(in + at, inLen - at, &result)) > 0;
+         at += (size_t)used, answered++) {
+      if (result != s.expected[answered]) {
+        if (errors++ < 10)
+          printf("request %ld: result %d, expected %d\n", answered,
+                 result, s.expected[answered]);
+      }
+    }
+    memmove(in, in + at, inLen - at);
+    inLen -= at;
+  }
+  close(fd);
+  if (answered < s.count) {
+    fprintf(stderr, "Error: the server answered %ld of %ld requests\n",
+            answered, s.count);
+    errors = -1;
+    goto out;
+  }
+  printf("%ld requests, %d wrong answers\n", s.count, errors);
+
+ out:
+  free(s.out);
+  free(s.expected);
+  free(in);
+  return errors;
+}
+/*--------------------------------------------------------------------*/
+int
+main(int argc, char *argv[])
+{
+  const char *path = DEFAULT_SOCKET;
+  long requests = 1000000;
+  int port = 0, check = 0, opt, i;
+
+  while ((opt = getopt(argc, argv, "u:p:c:d:k:n:r:t")) != -1) {
+    switch (opt) {
+    case 'u': path = optarg; break;
+    case 'p': port = atoi(optarg); break;
+    case 'c': nConns = atoi(optarg); break;
+    case 'd': depth = atoi(optarg); break;
+    case 'k': customers = atol(optarg); break;
+    case 'n': requests = atol(optarg); break;
+    case 'r': readPercent = atoi(optarg); break;
+    case 't': check = 1; break;
+    default:
+      fprintf(stderr, "Usage: %s [-u path | -p port] [-c connections]"
+              " [-d depth]\n       [-k customers] [-n requests]"
+              " [-r reads%%] [-t]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (check) {
+    i = check_server(path, port);
+    printf("Server check %s\n", i == 0 ? "PASSED" : "FAILED!");
+    return i == 0 ? 0 : 1;
+  }
+  if (nConns < 1 || depth < 1 || customers < 1 || requests < 0) {
+    fprintf(stderr, "Error: invalid argument\n");
+    return 1;
+  }
+
+  conns = (struct Conn *)calloc(nConns, sizeof(struct Conn));
+  latencies = (float *)malloc(sizeof(float) *
+                              (customers > requests ? customers : requests));
+  if (conns == NULL || latencies == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the connections\n");
+    return 1;
+  }
+  for (i = 0; i < nConns; i++) {
+    conns[i].index = i;
+    conns[i].fd = connect_to(path, port);
+    conns[i].out = (unsigned char *)malloc(
+      (size_t)depth * (PROTO_REQUEST_OVERHEAD + 2 * KEY_SIZE));
+    conns[i].in = (unsigned char *)malloc(READ_CHUNK +
+                                          (size_t)depth * PROTO_MAX_RESULT);
+    conns[i].sentAt = (double *)malloc(sizeof(double) * depth);
+    if (conns[i].fd < 0) {
+      perror("Error: Can't connect to the server");
+      return 1;
+    }
+    if (conns[i].out == NULL || conns[i].in == NULL ||
+        conns[i].sentAt == NULL) {
+      fprintf(stderr, "Error: Can't allocate a memory for a connection\n");
+      return 1;
+    }
+  }
+  printf("%d connections, %d requests in flight on each\n", nConns, depth);
+
+  nextCustomer = customers;
+  if (run_phase("register", 0, customers) < 0 ||
+      run_phase("mixed", 1, requests) < 0)
+    return 1;
+
+  for (i = 0; i < nConns; i++) {
+    close(conns[i].fd);
+    free(conns[i].out);
+    free(conns[i].in);
+    free(conns[i].sentAt);
+  }
+  free(conns);
+  free(latencies);
+  return 0;
+}
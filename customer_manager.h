@@ -6,6 +6,8 @@
  **********************/
 /* customer_manager.h */
 
+#include <stddef.h>
+
 /* forward type definition for DB_T */
 /* "struct DB" should be defined in customer_manager1.c or
    customer_manger2.c */
@@ -18,9 +20,71 @@ typedef int (*FUNCPTR_T)(const char* id, const char* name,
 /* create and return a db structure */
 DB_T CreateCustomerDB(void);
 
+/* options of CreateCustomerDBEx(); zero means the default everywhere.
+   an engine ignores the flags it does not implement */
+struct CustomerDBOptions {
+  unsigned int flags;   /* CUSTOMER_DB_* */
+  int expandThreads;    /* threads rehashing a large table on expansion
+                           (customer_manager2); 0 or 1: the caller alone */
+  const char *shmName;  /* build the db in the POSIX shared-memory segment
+                           of this name ("/name") for AttachCustomerDB()
+                           (customer_manager3); NULL: private memory */
+  const char *path;     /* file holding the db, opened again if it holds
+                           one (customer_manager5); NULL: a temporary file */
+  size_t cacheBytes;    /* buffer pool for the pages of the file
+                           (customer_manager5); 0: 64 MiB */
+  size_t memoryLimit;   /* cache mode: evict customers so that the total
+                           of GetCustomerDBMemoryUsage() stays within
+                           this many bytes (customer_manager2); 0: no
+                           limit */
+  int attrCount;        /* extra attribute columns, each holding a code
+                           below CUSTOMER_ATTR_CODES per customer (at most
+                           CUSTOMER_MAX_ATTRS). a db file opened again
+                           keeps the count it was created with
+                           (customer_manager5); 0: none */
+  int scanThreads;      /* threads splitting GroupSumPurchaseBy()
+                           (customer_manager1-4); 0 or 1: the caller
+                           alone */
+};
+
+/* most attribute columns of a db, and the number of codes of one */
+#define CUSTOMER_MAX_ATTRS 8
+#define CUSTOMER_ATTR_CODES 256
+
+/* store ids and names dictionary-compressed (customer_manager3) */
+#define CUSTOMER_DB_COMPRESS_KEYS 0x1
+
+/* answer most lookups of absent keys from Bloom filters (customer_manager2) */
+#define CUSTOMER_DB_BLOOM_FILTER 0x2
+
+/* create a db with the given options (NULL: same as CreateCustomerDB) */
+DB_T CreateCustomerDBEx(const struct CustomerDBOptions *options);
+
+/* fill 'options' with the options d applies: the flags its engine
+   implements and the threads, sizes and counts in use, 0 for what the
+   engine ignores. path and shmName are not kept and come back NULL.
+   return 0 on success, -1 on invalid input */
+int GetCustomerDBOptions(DB_T d, struct CustomerDBOptions *options);
+
+/* map the shared-memory db that another process created with
+   CreateCustomerDBEx() and options->shmName read-only, NULL on failure
+   or in an engine without shared-memory dbs. lookups and
+   GetSumCustomerPurchase read the segment in place, retrying when the
+   creator changed it meanwhile (GetSumCustomerPurchase then calls fp
+   again from the first customer); every call that changes the db
+   returns -1, and so does NextCustomerBatch. the creator can't be
+   frozen.
+   DestroyCustomerDB() unmaps it */
+DB_T AttachCustomerDB(const char *shmName);
+
 /* destory db and its associated memory */
 void DestroyCustomerDB(DB_T d);
 
+/* bytes of id, name and attribute codes that one customer of
+   customer_manager5 may take together; it refuses longer ones. the
+   other engines take keys of any length */
+#define CUSTOMER_DISK_MAX_KEY_BYTES 1000
+
 /* register a customer with (name, id, purchase) */
 int  RegisterCustomer(DB_T d, const char *id,
 		      const char *name, const int purchase);
@@ -41,4 +105,194 @@ int GetPurchaseByName(DB_T d, const char* name);
    and return the sum of all fp function calls */
 int GetSumCustomerPurchase(DB_T d, FUNCPTR_T fp);
 
+/* unregister every customer for which pred returns non-zero, in one
+   sweep over the db. each removal is reported to the hook as an
+   unregistration by id. return the number of customers removed, -1 on
+   invalid input or a frozen db */
+int UnregisterCustomersWhere(DB_T d, FUNCPTR_T pred);
+
+/* variants of the calls above taking each key as a (pointer, length)
+   pair: the key bytes need not be NUL-terminated and are hashed and
+   compared by length and memcmp, without being scanned or copied */
+int RegisterCustomerN(DB_T d, const char *id, size_t idLen,
+                      const char *name, size_t nameLen, const int purchase);
+int UnregisterCustomerByIDN(DB_T d, const char *id, size_t idLen);
+int UnregisterCustomerByNameN(DB_T d, const char *name, size_t nameLen);
+int GetPurchaseByIDN(DB_T d, const char *id, size_t idLen);
+int GetPurchaseByNameN(DB_T d, const char *name, size_t nameLen);
+
+/* register a customer whose id and name are malloc()ed by the caller.
+   on success the db owns both buffers and frees them itself (right away
+   if it keeps the key elsewhere); on failure they stay the caller's */
+int RegisterCustomerTakeOwnership(DB_T d, char *id, char *name,
+                                  const int purchase);
+
+/* register a customer whose id and name were returned by
+   StringPoolIntern() (string_pool.h). on success the db holds its own
+   reference on each key until the customer is unregistered */
+int RegisterCustomerPooled(DB_T d, const char *id, const char *name,
+                           const int purchase);
+
+/* one customer returned by NextCustomerBatch(). the keys are
+   NUL-terminated and stay valid until the next NextCustomerBatch() on
+   the same cursor or the next change of the db, whichever comes first */
+struct CustomerView {
+  const char *id;
+  size_t idLen;
+  const char *name;
+  size_t nameLen;
+  int purchase;
+};
+
+typedef struct CustomerCursor *CustomerCursor_T;
+
+/* start a scan over the customers of d, NULL on failure. a cursor holds
+   no lock: the db may change between batches. customers present for the
+   whole scan are returned (customer_manager4 may miss or repeat some
+   when the db changes during the scan); customers added or removed
+   meanwhile may or may not be */
+CustomerCursor_T OpenCustomerCursor(DB_T d);
+
+/* fill views with up to max customers that the scan has not returned
+   yet. return the number filled, 0 once the scan is complete, -1 on
+   invalid input or if d was frozen since the cursor was opened */
+int NextCustomerBatch(CustomerCursor_T c, struct CustomerView *views,
+                      int max);
+
+/* end a scan and free the cursor (its db stays) */
+void CloseCustomerCursor(CustomerCursor_T c);
+
+/* turn d into an immutable copy of its customers, indexed by minimal
+   perfect hashes over ids and names (frozen_db.h). lookups and
+   GetSumCustomerPurchase work as before; registrations and
+   unregistrations return -1. return 0 on success, -1 on failure, in
+   which case d is unchanged */
+int FreezeCustomerDB(DB_T d);
+
+/* write the frozen db d to path. return 0 on success, -1 if d is not
+   frozen or on I/O failure */
+int SaveFrozenCustomerDB(DB_T d, const char *path);
+
+/* map a file written by SaveFrozenCustomerDB() read-only and return it
+   as a frozen db, NULL on failure */
+DB_T LoadFrozenCustomerDB(const char *path);
+
+/* return a purchase whose rank among the purchases of d is about q
+   times the number of customers (0 <= q <= 1; 0.5 is the median), to
+   within about 1.5% of them. the answer comes from a quantile sketch
+   that every change updates (quantile_sketch.h), not from a scan.
+   return -1 if d is empty or attached, or if q is out of range */
+int GetPurchaseQuantile(DB_T d, double q);
+
+/* set attribute 'attr' (0 <= attr < options->attrCount) of the customer
+   with 'id' to 'code' (0 <= code < CUSTOMER_ATTR_CODES). a customer
+   starts with every code 0. attributes are not reported to the hook, so
+   traces and change feeds carry none. return 0, -1 if there is no such
+   customer, on invalid input or in a frozen or attached db */
+int SetCustomerAttr(DB_T d, const char *id, int attr, int code);
+
+/* return the code of attribute 'attr' of the customer with 'id', -1 if
+   there is no such customer, on invalid input or in a frozen or
+   attached db */
+int GetCustomerAttr(DB_T d, const char *id, int attr);
+
+/* add up the purchases of the customers of d by their code of attribute
+   'attr': out[code] gets the sum of the customers with that code, for
+   every code. the in-memory engines keep the purchases and the codes
+   in dense columns (customer_columns.h) and sum them in one pass, split
+   among options->scanThreads threads; customer_manager5 keeps the codes
+   in its id leaves and walks them. return the number of customers counted,
+   -1 on invalid input or in a frozen or attached db (frozen images keep
+   no attributes) */
+int GroupSumPurchaseBy(DB_T d, int attr, long out[CUSTOMER_ATTR_CODES]);
+
+/* memory held by a db, as accounted by the engine itself (in bytes) */
+struct CustomerDBMemoryUsage {
+  size_t records;   /* customer records */
+  size_t keys;      /* id and name strings */
+  size_t buckets;   /* bucket arrays and unused record slots */
+  size_t overhead;  /* allocator headers and size rounding */
+  size_t total;     /* all of the above plus the db structure itself */
+};
+
+/* fill 'usage' with the memory currently held by 'd'.
+   return 0 on success, -1 on invalid input */
+int GetCustomerDBMemoryUsage(DB_T d, struct CustomerDBMemoryUsage *usage);
+
+/* kinds of calls reported to a db hook */
+enum {
+  CUSTOMER_OP_REGISTER = 1,
+  CUSTOMER_OP_UNREGISTER_ID,
+  CUSTOMER_OP_UNREGISTER_NAME,
+  CUSTOMER_OP_GET_ID,
+  CUSTOMER_OP_GET_NAME,
+  CUSTOMER_OP_SUM
+};
+
+/* one finished API call; keys are NULL when the call has none and are
+   not necessarily NUL-terminated */
+struct CustomerOp {
+  int type;              /* CUSTOMER_OP_* */
+  const char *id;
+  size_t idLen;
+  const char *name;
+  size_t nameLen;
+  int purchase;          /* register only */
+  int result;            /* value returned to the caller */
+};
+
+/* hook function pointer type definition */
+typedef void (*HOOKFUNC_T)(void *ctx, const struct CustomerOp *op);
+
+/* call 'hook' with 'ctx' after every API call on 'd' (NULL removes it).
+   return 0 on success, -1 on invalid input */
+int SetCustomerDBHook(DB_T d, HOOKFUNC_T hook, void *ctx);
+
+/* eviction callback function pointer type definition. the keys are
+   NUL-terminated and valid only during the call */
+typedef void (*EVICTFUNC_T)(void *ctx, const char *id, const char *name,
+                            int purchase);
+
+/* call 'fn' with 'ctx' for every customer that the memory limit of 'd'
+   evicts, just before it is removed (NULL removes it). fn must not call
+   into d. each eviction is also reported to the hook as an
+   unregistration by id. engines without a memory limit never call fn.
+   return 0 on success, -1 on invalid input */
+int SetCustomerDBEvictCallback(DB_T d, EVICTFUNC_T fn, void *ctx);
+
+/* number of bucket-occupancy histogram entries: buckets holding
+   0, 1, ..., CUSTOMER_STATS_HIST-2 and CUSTOMER_STATS_HIST-1 or more
+   customers */
+#define CUSTOMER_STATS_HIST 8
+
+/* engine statistics. The counters are collected on every call unless
+   the engine is compiled with -DCUSTOMER_DB_NO_STATS; the table shape is
+   computed when the statistics are requested. Engines without buckets
+   report zero chain lengths and an empty histogram. */
+struct CustomerDBStats {
+  unsigned long lookups;      /* GetPurchaseByID/Name calls */
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long probes;       /* entries compared by all lookups */
+  unsigned long inserts;      /* successful registrations */
+  unsigned long deletes;      /* successful unregistrations */
+  unsigned long resizes;      /* table expansions */
+  unsigned long filtered;     /* table walks skipped by a Bloom filter */
+  unsigned long pageHits;     /* pages found in the buffer pool */
+  unsigned long pageReads;    /* pages read from the db file */
+  unsigned long pageWrites;   /* dirty pages written back */
+  unsigned long evictions;    /* customers evicted by the memory limit */
+  double expansionMs;         /* time spent in expansions */
+  double avgIdChain;          /* average length of non-empty id chains */
+  double avgNameChain;        /* average length of non-empty name chains */
+  int maxIdChain;
+  int maxNameChain;
+  unsigned long idHistogram[CUSTOMER_STATS_HIST];
+  unsigned long nameHistogram[CUSTOMER_STATS_HIST];
+};
+
+/* fill 'stats' with the statistics of 'd'.
+   return 0 on success, -1 on invalid input */
+int GetCustomerDBStats(DB_T d, struct CustomerDBStats *stats);
+
 #endif /* end of CUSTOMER_MANAGER_H */
@@ -23,32 +23,127 @@
  *    and `GetPurchaseByName`).
  * 5. Includes a utility to calculate the total sum of customer purchases (`GetSumCustomerPurchase`), 
  *    using a function pointer to allow customized calculations.
+ * 6. Every public call is reported to an optional hook (`SetCustomerDBHook`), e.g. for
+ *    tracing; the operations themselves live in static functions.
+ * 7. Keeps track of its own memory (`GetCustomerDBMemoryUsage`): key bytes and allocator
+ *    overhead are accounted on every allocation, the rest is derived from the array size.
+ * 8. Keys of up to `SMALL_STRING_INLINE` bytes are stored inside the array slot with
+ *    their length (small_string.h); only longer keys get a heap copy. Comparisons check
+ *    the length before `memcmp`, and a free slot is marked by a zero purchase.
+ *    `RegisterCustomerTakeOwnership` and `RegisterCustomerPooled` keep the caller's
+ *    malloc()ed or interned (string_pool.h) long keys instead of copying them.
+ * 9. Counts lookups, hits, misses, compared entries, inserts, deletes and expansions
+ *    (`GetCustomerDBStats`); build with -DCUSTOMER_DB_NO_STATS to remove the counting.
+ *    The array has no buckets, so chain lengths and the histogram stay zero.
+ * 10. Cursors (`OpenCustomerCursor`/`NextCustomerBatch`) walk the array by index;
+ *    since slots never move, a scan survives changes to the DB between batches.
+ * 11. `UnregisterCustomersWhere` frees every customer matching a predicate in one
+ *    pass over the array.
+ * 12. `GetPurchaseQuantile` answers from a KLL sketch of the purchases
+ *    (quantile_sketch.h) that registrations and unregistrations update.
+ * 13. With `attrCount` attributes, the codes and a copy of the purchases live in
+ *    columns indexed by array slot (customer_columns.h), which `GroupSumPurchaseBy`
+ *    reads front to back without touching the slots.
 */
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include "customer_manager.h"
+#include "small_string.h"
+#include "frozen_db.h"
+#include "quantile_sketch.h"
+#include "customer_columns.h"
 #define UNIT_ARRAY_SIZE 1024
 
+/* statistics counters of the DB (compiled out with CUSTOMER_DB_NO_STATS) */
+#ifndef CUSTOMER_DB_NO_STATS
+#define STAT_ADD(d, field, n) ((d)->stats.field += (n))
+#else
+#define STAT_ADD(d, field, n) ((void)(n))
+#endif
+
 struct UserInfo {
-  char *name;                // customer name
-  char *id;                  // customer id
-  int purchase;              // purchase amount (> 0)
+  struct SmallString name;   // customer name
+  struct SmallString id;     // customer id
+  int purchase;              // purchase amount (> 0), 0 for a free slot
 };
 struct DB {
   struct UserInfo *pArray;   // pointer to the array
   int curArrSize;            // current array size (max # of elements)
   int numItems;              // # of stored items, needed to determine
+  size_t keyBytes;           // bytes of the id and name strings on the heap
+  size_t allocOverhead;      // allocator headers and rounding of our blocks
+  HOOKFUNC_T hook;           // called after every API call (may be NULL)
+  void *hookCtx;             // first argument of hook
+  FrozenDB_T frozen;         // read-only contents once frozen (or NULL)
+  QuantileSketch_T quantiles; // sketch of the purchases
+  CustomerColumns_T columns; // attributes by slot (NULL: none)
+  struct CustomerDBStats stats; // counters, updated through STAT_ADD
 };
 /*--------------------------------------------------------------------*/
+static double now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+/*--------------------------------------------------------------------*/
+static size_t alloc_overhead(void *p, size_t size)
+
+/* Return the bytes the allocator spends on top of the 'size'-byte
+   block 'p': its chunk header and the rounding of the block size. */
+{
+#ifdef __GLIBC__
+  return malloc_usable_size(p) + sizeof(size_t) - size;
+#else
+  (void)p; (void)size;
+  return 0;
+#endif
+}
+/*--------------------------------------------------------------------*/
+static void account_key(DB_T d, struct SmallString *key, int sign)
+
+/* Add (sign > 0) or remove (sign < 0) the heap copy of 'key', if it
+   has one, to/from the memory accounting of d. Pooled keys are shared
+   with the pool and not counted. */
+{
+  size_t len, extra;
+
+  if (!SmallStringIsHeap(key)) return; /* stored in the slot itself */
+  if (SmallStringIsPooled(key)) return;
+  len = key->len + 1;
+  extra = alloc_overhead((void *)SmallStringData(key), len);
+
+  if (sign > 0) {
+    d->keyBytes += len;
+    d->allocOverhead += extra;
+  }
+  else {
+    d->keyBytes -= len;
+    d->allocOverhead -= extra;
+  }
+}
+/*--------------------------------------------------------------------*/
 DB_T
 CreateCustomerDB(void)
+{
+  return CreateCustomerDBEx(NULL);
+}
+/*--------------------------------------------------------------------*/
+DB_T
+CreateCustomerDBEx(const struct CustomerDBOptions *options)
 { 
   DB_T d;
+
   d = (DB_T) calloc(1, sizeof(struct DB));
   if (d == NULL) {
     fprintf(stderr, "Error: Can't allocate a memory for DB_T\n");
@@ -63,8 +158,27 @@ CreateCustomerDB(void)
     free(d);
     return NULL;
   }
+  d->quantiles = CreateQuantileSketch();
+  if (d->quantiles == NULL) {
+    free(d->pArray);
+    free(d);
+    return NULL;
+  }
+  if (options != NULL && options->attrCount > 0) {
+    d->columns = CreateCustomerColumns(options->attrCount,
+                                       options->scanThreads);
+    if (d->columns == NULL) {
+      fprintf(stderr, "Error: Can't create %d attribute columns\n",
+              options->attrCount);
+      DestroyQuantileSketch(d->quantiles);
+      free(d->pArray);
+      free(d);
+      return NULL;
+    }
+  }
+  d->allocOverhead = alloc_overhead(d, sizeof(struct DB)) +
+    alloc_overhead(d->pArray, d->curArrSize * sizeof(struct UserInfo));
   return d;
-  return NULL;
 }
 /*--------------------------------------------------------------------*/
 void DestroyCustomerDB(DB_T d) {
@@ -75,25 +189,54 @@ void DestroyCustomerDB(DB_T d) {
     for (int i = 0; i < d->curArrSize && processedItems < d->numItems; i++) {
         curr = &d->pArray[i];
         /* Check if the current entry is valid */
-        if (curr->id != NULL && curr->name != NULL) {
-          /* Free allocated memory for the valid user's name and id */
-          free(curr->name);
-          free(curr->id);
+        if (curr->purchase != 0) {
+          /* Free the heap copies of the valid user's name and id */
+          SmallStringFree(&curr->name);
+          SmallStringFree(&curr->id);
           processedItems++; /* Increment the count of processed valid items */
         }
     }
 
     /* Free the array and the database structure */
     free(d->pArray);
+    DestroyFrozenDB(d->frozen);
+    DestroyQuantileSketch(d->quantiles);
+    DestroyCustomerColumns(d->columns);
     free(d);
 }
 
 /*--------------------------------------------------------------------*/
-int 
-RegisterCustomer(DB_T d, const char *id, const char *name, const int purchase)
+static void quantile_removed(DB_T d, int purchase)
+
+/* Uncount the purchase of a removed customer, rebuilding the sketch
+   once the removals outnumber the customers left. */
+{
+  if (QuantileSketchRemove(d->quantiles, purchase) == 1)
+    QuantileSketchRebuild(d->quantiles, d);
+}
+/*--------------------------------------------------------------------*/
+static int frozen_lookup(DB_T d, int byName, const char *key, size_t len)
+
+/* Look the len-byte id (or name, if byName) up in the frozen image of
+   d, counting it like a table lookup. */
+{
+  int purchase = FrozenGetPurchase(d->frozen, byName, key, len);
+
+  STAT_ADD(d, lookups, 1);
+  STAT_ADD(d, probes, 1);
+  if (purchase < 0) STAT_ADD(d, misses, 1);
+  else STAT_ADD(d, hits, 1);
+  return purchase;
+}
+/*--------------------------------------------------------------------*/
+static int
+register_customer(DB_T d, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, const int purchase,
+                  int how)
 {
   /* Treat invalid input as failure */
   if (d == NULL || id == NULL || name == NULL || purchase <= 0) return -1; 
+  if (d->frozen) return -1; /* frozen dbs are read-only */
 
   struct UserInfo *curr,*temp; /* Iterator, temporary pointer for expansion*/
   int n=d->numItems;  /*  To check whether the user already exist */
@@ -103,22 +246,34 @@ RegisterCustomer(DB_T d, const char *id, const char *name, const int purchase)
     /* Checking whether the user already exist */ 
     for (int i = 0; i < d->numItems; i++) {
       curr = &d->pArray[i];
-      if (strcmp(curr->id, id) == 0 || strcmp(curr->name, name) == 0) {
+      if (SmallStringEqual(&curr->id, id, idLen) ||
+          SmallStringEqual(&curr->name, name, nameLen)) {
         return -1;  /* Duplicate id or name found */
       }
     }
 
     /* Expand and store */
+    double expandStart = now_ms();
+    d->allocOverhead -= alloc_overhead(d->pArray,
+                                       d->curArrSize * sizeof(struct UserInfo));
     temp = realloc(d->pArray, (d->curArrSize + UNIT_ARRAY_SIZE) * sizeof(struct UserInfo));
     
     /* Check the allocaton status */
     if (temp == NULL) {
       fprintf(stderr, "Error: Can't allocate a memory for expansion of the array\n");
+      d->allocOverhead += alloc_overhead(d->pArray,
+                                         d->curArrSize * sizeof(struct UserInfo));
       return -1; 
     }
     /* Update the array pointer and size */ 
     d->pArray = temp;
     d->curArrSize += UNIT_ARRAY_SIZE;
+    d->allocOverhead += alloc_overhead(d->pArray,
+                                       d->curArrSize * sizeof(struct UserInfo));
+    memset(d->pArray + d->curArrSize - UNIT_ARRAY_SIZE, 0,
+           UNIT_ARRAY_SIZE * sizeof(struct UserInfo)); /* all slots free */
+    STAT_ADD(d, resizes, 1);
+    STAT_ADD(d, expansionMs, now_ms() - expandStart);
   }
   else{ /* Array not full */ 
 
@@ -128,67 +283,79 @@ RegisterCustomer(DB_T d, const char *id, const char *name, const int purchase)
     */
     for (int i = 0; i < n; i++) {
       curr = &d->pArray[i];
-      if(curr->id==NULL || curr->name==NULL) { /* Last position to store found! */
+      if(curr->purchase == 0) { /* Last position to store found! */
         n++; /* Expanding the search space */
         if(flag==0) {
           last=i; /* Keep position to store */
           flag++; /* flag that the position found */
         }
       }
-      else if (strcmp(curr->id, id) == 0 || strcmp(curr->name, name) == 0) {
+      else if (SmallStringEqual(&curr->id, id, idLen) ||
+               SmallStringEqual(&curr->name, name, nameLen)) {
         return -1;  /* Duplicate ID or name found */
       }
     }
       
   }
   /* Registering new item */ 
-  d->pArray[last].name= strdup(name);
-  if (d->pArray[last].name == NULL) {  /* strdup failed */ 
+  if (d->columns && CustomerColumnsSet(d->columns, last, purchase) < 0)
+    return -1;
+  if (SmallStringStore(&d->pArray[last].name, name, nameLen, how) < 0) {
     fprintf(stderr, "Error: Can't allocate a memory for name of the new item\n");
+    CustomerColumnsClear(d->columns, last);
     return -1;
   } 
       
-  d->pArray[last].id = strdup(id);
-  if (d->pArray[last].id == NULL) {
+  if (SmallStringStore(&d->pArray[last].id, id, idLen, how) < 0) {
     fprintf(stderr, "Error: Can't allocate a memory for id of the new item\n");
-    free(d->pArray[last].name);  // Free previously allocated name
-    d->pArray[last].name = NULL;
-    return -1;  /* strdup failed */
+    SmallStringUndo(&d->pArray[last].name, how);  // Drop the stored name
+    CustomerColumnsClear(d->columns, last);
+    return -1;  /* allocation failed */
   }
   d->pArray[last].purchase = purchase;
+  account_key(d, &d->pArray[last].id, 1);
+  account_key(d, &d->pArray[last].name, 1);
 
   /* Size adjustement for the database */
   d->numItems++; 
+  STAT_ADD(d, inserts, 1);
+  QuantileSketchAdd(d->quantiles, purchase);
 
   return 0; /* Register success! */
 }
 /*--------------------------------------------------------------------*/
-int UnregisterCustomerByID(DB_T d, const char *id) {
+static int unregister_by_id(DB_T d, const char *id, size_t idLen) {
   struct UserInfo* curr; /* Current iterator */
+  int purchase;          /* of the removed user */
 
   if (d == NULL || id == NULL) return -1; /* Treat invalid input as failure */
+  if (d->frozen) return -1; /* frozen dbs are read-only */
 
   int processedItems = 0; /* Tracks the number of valid items processed */
   for (int i = 0; i < d->curArrSize && processedItems < d->numItems; i++) {
     curr = &d->pArray[i];
 
-    if (curr->id == NULL || curr->name == NULL) continue;
+    if (curr->purchase == 0) continue;
 
     /* Increment processed items count for each valid entry checked */
     processedItems++;
 
-    if (strcmp(curr->id, id) == 0) { /* ID found */ 
-      /* Free the allocated memory for id and name */
-      free(curr->id);
-      free(curr->name);
+    if (SmallStringEqual(&curr->id, id, idLen)) { /* ID found */ 
+      /* Free the heap copies of long ids and names */
+      account_key(d, &curr->id, -1);
+      account_key(d, &curr->name, -1);
+      SmallStringFree(&curr->id);
+      SmallStringFree(&curr->name);
 
-      /* Nullifying for efficient re-registration later */
-      curr->id = NULL;
-      curr->name = NULL;
+      /* Marking the slot free for efficient re-registration later */
+      purchase = curr->purchase;
       curr->purchase = 0;
+      CustomerColumnsClear(d->columns, i);
 
       /* Update the number of items */ 
       d->numItems--;  
+      STAT_ADD(d, deletes, 1);
+      quantile_removed(d, purchase);
 
       return 0; /* User unregistered successfully */
     }
@@ -197,34 +364,40 @@ int UnregisterCustomerByID(DB_T d, const char *id) {
 }
 
 /*--------------------------------------------------------------------*/
-int
-UnregisterCustomerByName(DB_T d, const char *name)
+static int
+unregister_by_name(DB_T d, const char *name, size_t nameLen)
 {
   struct UserInfo* curr; /* Current iterator */
+  int purchase;          /* of the removed user */
 
   if (d == NULL || name == NULL) return -1; /* Treat invalid input as failure */
+  if (d->frozen) return -1; /* frozen dbs are read-only */
 
   int processedItems = 0; /* Tracks the number of valid items processed */
   for (int i = 0; i < d->curArrSize && processedItems < d->numItems; i++) {
     curr = &d->pArray[i];
 
-    if (curr->id == NULL || curr->name == NULL) continue;
+    if (curr->purchase == 0) continue;
 
     /* Increment processed items count for each valid entry checked */
     processedItems++;
 
-    if (strcmp(curr->name, name) == 0) { /* ID found */ 
-      /* Free the allocated memory for id and name */
-      free(curr->id);
-      free(curr->name);
+    if (SmallStringEqual(&curr->name, name, nameLen)) { /* ID found */ 
+      /* Free the heap copies of long ids and names */
+      account_key(d, &curr->id, -1);
+      account_key(d, &curr->name, -1);
+      SmallStringFree(&curr->id);
+      SmallStringFree(&curr->name);
 
-      /* Nullifying for efficient re-registration later */
-      curr->id = NULL;
-      curr->name = NULL;
+      /* Marking the slot free for efficient re-registration later */
+      purchase = curr->purchase;
       curr->purchase = 0;
+      CustomerColumnsClear(d->columns, i);
 
       /* Update the number of items */ 
       d->numItems--;  
+      STAT_ADD(d, deletes, 1);
+      quantile_removed(d, purchase);
 
       return 0; /* User unregistered successfully */
     }
@@ -233,54 +406,65 @@ UnregisterCustomerByName(DB_T d, const char *name)
 }
 
 /*--------------------------------------------------------------------*/
-int GetPurchaseByID(DB_T d, const char* id) {  
+static int get_purchase_by_id(DB_T d, const char* id, size_t idLen) {  
   struct UserInfo* curr; /* Current iterator */
   if (d == NULL || id == NULL) return -1; /* Treat invalid input as failure */
+  if (d->frozen) return frozen_lookup(d, 0, id, idLen);
+  STAT_ADD(d, lookups, 1);
 
   int processedItems = 0; /* Tracks the number of valid items processed */
   for (int i = 0; i < d->curArrSize && processedItems < d->numItems; i++) {
     curr = &d->pArray[i];
 
-    if (curr->id == NULL || curr->name == NULL) continue;
+    if (curr->purchase == 0) continue;
 
     /* Increment processed items count for each valid entry checked */
     processedItems++;
 
     /* Check if the current entry matches the given ID */
-    if (strcmp(curr->id, id) == 0) { /* User ID exists */
+    STAT_ADD(d, probes, 1);
+    if (SmallStringEqual(&curr->id, id, idLen)) { /* User ID exists */
+      STAT_ADD(d, hits, 1);
       return curr->purchase; /* Return the purchase amount */
     }
   }
+  STAT_ADD(d, misses, 1);
   return -1; /* No user with such ID */
 }
 
 /*--------------------------------------------------------------------*/
-int
-GetPurchaseByName(DB_T d, const char* name)
+static int
+get_purchase_by_name(DB_T d, const char* name, size_t nameLen)
 {
   struct UserInfo* curr; /* Current iterator */
   if (d == NULL || name == NULL) return -1; /* Treat invalid input as failure */
+  if (d->frozen) return frozen_lookup(d, 1, name, nameLen);
+  STAT_ADD(d, lookups, 1);
 
   int processedItems = 0; /* Tracks the number of valid items processed */
   for (int i = 0; i < d->curArrSize && processedItems < d->numItems; i++) {
     curr = &d->pArray[i];
 
-    if (curr->id == NULL || curr->name == NULL) continue;
+    if (curr->purchase == 0) continue;
 
     /* Increment processed items count for each valid entry checked */
     processedItems++;
 
     /* Check if the current entry matches the given ID */
-    if (strcmp(curr->name, name) == 0) { /* User name exists */
+    STAT_ADD(d, probes, 1);
+    if (SmallStringEqual(&curr->name, name, nameLen)) { /* User name exists */
+      STAT_ADD(d, hits, 1);
       return curr->purchase; /* Return the purchase amount */
     }
   }
+  STAT_ADD(d, misses, 1);
   return -1; /* No user with such name */
 }
 /*--------------------------------------------------------------------*/
-int GetSumCustomerPurchase(DB_T d, FUNCPTR_T fp) {
+static int get_sum_customer_purchase(DB_T d, FUNCPTR_T fp) {
   struct UserInfo* curr; /* Current iterator */
   if (d == NULL || fp == NULL) return -1; /* Treat invalid input as failure */
+  if (d->frozen) return FrozenSum(d->frozen, fp);
 
   int total = 0; /* Purchase accumulated here */
   int processedItems = 0; /* Tracks the number of valid items processed */
@@ -288,13 +472,429 @@ int GetSumCustomerPurchase(DB_T d, FUNCPTR_T fp) {
   for (int i = 0; i < d->curArrSize && processedItems < d->numItems; i++) {
     curr = &d->pArray[i];
 
-    if (curr->id == NULL || curr->name == NULL) continue;
+    if (curr->purchase == 0) continue;
 
     /* Increment processed items count for each valid entry checked */
     processedItems++;
 
     /* Accumulate the result of fp applied to the current entry */
-    total += fp(curr->id, curr->name, curr->purchase);
+    total += fp(SmallStringData(&curr->id), SmallStringData(&curr->name),
+                curr->purchase);
   }
   return total; /* Return accumulated sum */
-}
\ No newline at end of file
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBOptions(DB_T d, struct CustomerDBOptions *options)
+{
+  if (d == NULL || options == NULL) return -1;
+  memset(options, 0, sizeof(*options));
+  CustomerColumnsGetOptions(d->columns, options);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBMemoryUsage(DB_T d, struct CustomerDBMemoryUsage *usage)
+{
+  if (d == NULL || usage == NULL) return -1; /* Treat invalid input as failure */
+
+  /* Occupied slots are records, the free ones are the array's slack */
+  usage->records = (size_t)d->numItems * sizeof(struct UserInfo) +
+                   CustomerColumnsMemory(d->columns);
+  usage->buckets = (size_t)(d->curArrSize - d->numItems) * sizeof(struct UserInfo) +
+                   QuantileSketchMemory(d->quantiles);
+  usage->keys = d->keyBytes;
+  usage->overhead = d->allocOverhead;
+  if (d->frozen) { /* the image replaces the (empty) tables */
+    size_t records, keys, index;
+    FrozenMemory(d->frozen, &records, &keys, &index);
+    usage->records += records;
+    usage->keys += keys;
+    usage->buckets += index;
+  }
+  usage->total = sizeof(struct DB) + usage->records + usage->buckets +
+                 usage->keys + usage->overhead;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+GetPurchaseQuantile(DB_T d, double q)
+{
+  if (d == NULL) return -1;
+  return QuantileSketchQuery(d->quantiles, q);
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBStats(DB_T d, struct CustomerDBStats *stats)
+{
+  if (d == NULL || stats == NULL) return -1; /* Treat invalid input as failure */
+
+  /* Only counters: the array has no chains to measure */
+  *stats = d->stats;
+  stats->avgIdChain = stats->avgNameChain = 0.0;
+  stats->maxIdChain = stats->maxNameChain = 0;
+  memset(stats->idHistogram, 0, sizeof(stats->idHistogram));
+  memset(stats->nameHistogram, 0, sizeof(stats->nameHistogram));
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int report(DB_T d, int type, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, int purchase, int result)
+
+/* Pass a finished API call to the hook of d, if one is installed,
+   and return its result unchanged. */
+{
+  struct CustomerOp op;
+
+  if (d == NULL || d->hook == NULL) return result;
+
+  op.type = type;
+  op.id = id;
+  op.idLen = id ? idLen : 0;
+  op.name = name;
+  op.nameLen = name ? nameLen : 0;
+  op.purchase = purchase;
+  op.result = result;
+  d->hook(d->hookCtx, &op);
+  return result;
+}
+/*--------------------------------------------------------------------*/
+int
+SetCustomerDBHook(DB_T d, HOOKFUNC_T hook, void *ctx)
+{
+  if (d == NULL) return -1;
+  d->hook = hook;
+  d->hookCtx = ctx;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+/* No memory limit here: nothing is ever evicted, so fn is never called */
+int
+SetCustomerDBEvictCallback(DB_T d, EVICTFUNC_T fn, void *ctx)
+{
+  (void)fn; (void)ctx;
+  return d == NULL ? -1 : 0;
+}
+/*--------------------------------------------------------------------*/
+/* Public entry points: run the operation, then report it to the hook.
+   The NUL-terminated variants measure their keys and call the ...N
+   variants. */
+int
+RegisterCustomerN(DB_T d, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, const int purchase)
+{
+  return report(d, CUSTOMER_OP_REGISTER, id, idLen, name, nameLen, purchase,
+                register_customer(d, id, idLen, name, nameLen, purchase,
+                                  SMALL_STRING_COPY));
+}
+
+int
+RegisterCustomerTakeOwnership(DB_T d, char *id, char *name, const int purchase)
+{
+  size_t idLen = id ? strlen(id) : 0, nameLen = name ? strlen(name) : 0;
+  int result;
+
+  result = report(d, CUSTOMER_OP_REGISTER, id, idLen, name, nameLen, purchase,
+                  register_customer(d, id, idLen, name, nameLen, purchase,
+                                    SMALL_STRING_ADOPT));
+  if (result == 0) { /* short keys were copied into the slot */
+    if (idLen <= SMALL_STRING_INLINE) free(id);
+    if (nameLen <= SMALL_STRING_INLINE) free(name);
+  }
+  return result;
+}
+
+int
+RegisterCustomerPooled(DB_T d, const char *id, const char *name,
+                       const int purchase)
+{
+  size_t idLen = StringPoolLength(id), nameLen = StringPoolLength(name);
+
+  return report(d, CUSTOMER_OP_REGISTER, id, idLen, name, nameLen, purchase,
+                register_customer(d, id, idLen, name, nameLen, purchase,
+                                  SMALL_STRING_SHARE));
+}
+
+int
+UnregisterCustomerByIDN(DB_T d, const char *id, size_t idLen)
+{
+  return report(d, CUSTOMER_OP_UNREGISTER_ID, id, idLen, NULL, 0, 0,
+                unregister_by_id(d, id, idLen));
+}
+
+int
+UnregisterCustomerByNameN(DB_T d, const char *name, size_t nameLen)
+{
+  return report(d, CUSTOMER_OP_UNREGISTER_NAME, NULL, 0, name, nameLen, 0,
+                unregister_by_name(d, name, nameLen));
+}
+
+int
+GetPurchaseByIDN(DB_T d, const char *id, size_t idLen)
+{
+  return report(d, CUSTOMER_OP_GET_ID, id, idLen, NULL, 0, 0,
+                get_purchase_by_id(d, id, idLen));
+}
+
+int
+GetPurchaseByNameN(DB_T d, const char *name, size_t nameLen)
+{
+  return report(d, CUSTOMER_OP_GET_NAME, NULL, 0, name, nameLen, 0,
+                get_purchase_by_name(d, name, nameLen));
+}
+
+int
+RegisterCustomer(DB_T d, const char *id, const char *name, const int purchase)
+{
+  return RegisterCustomerN(d, id, id ? strlen(id) : 0,
+                           name, name ? strlen(name) : 0, purchase);
+}
+
+int
+UnregisterCustomerByID(DB_T d, const char *id)
+{
+  return UnregisterCustomerByIDN(d, id, id ? strlen(id) : 0);
+}
+
+int
+UnregisterCustomerByName(DB_T d, const char *name)
+{
+  return UnregisterCustomerByNameN(d, name, name ? strlen(name) : 0);
+}
+
+int
+GetPurchaseByID(DB_T d, const char* id)
+{
+  return GetPurchaseByIDN(d, id, id ? strlen(id) : 0);
+}
+
+int
+GetPurchaseByName(DB_T d, const char* name)
+{
+  return GetPurchaseByNameN(d, name, name ? strlen(name) : 0);
+}
+
+int
+GetSumCustomerPurchase(DB_T d, FUNCPTR_T fp)
+{
+  return report(d, CUSTOMER_OP_SUM, NULL, 0, NULL, 0, 0,
+                get_sum_customer_purchase(d, fp));
+}
+/*--------------------------------------------------------------------*/
+/* Bulk removal in one pass over the array. Every removed customer is
+   reported to the hook as an unregistration by id, so that a trace
+   replays to the same contents. The quantile sketch is rebuilt, if
+   due, after the pass. */
+int
+UnregisterCustomersWhere(DB_T d, FUNCPTR_T pred)
+{
+  struct UserInfo* curr; /* Current iterator */
+  int removed = 0, rebuild = 0;
+
+  if (d == NULL || pred == NULL) return -1; /* Treat invalid input as failure */
+  if (d->frozen) return -1; /* frozen dbs are read-only */
+
+  for (int i = 0; i < d->curArrSize; i++) {
+    curr = &d->pArray[i];
+    if (curr->purchase == 0) continue;
+    if (!pred(SmallStringData(&curr->id), SmallStringData(&curr->name),
+              curr->purchase))
+      continue;
+
+    report(d, CUSTOMER_OP_UNREGISTER_ID, SmallStringData(&curr->id),
+           curr->id.len, NULL, 0, 0, 0);
+    account_key(d, &curr->id, -1);
+    account_key(d, &curr->name, -1);
+    SmallStringFree(&curr->id);
+    SmallStringFree(&curr->name);
+    if (QuantileSketchRemove(d->quantiles, curr->purchase) == 1) rebuild = 1;
+    curr->purchase = 0;
+    CustomerColumnsClear(d->columns, i);
+    d->numItems--;
+    STAT_ADD(d, deletes, 1);
+    removed++;
+  }
+  if (rebuild) QuantileSketchRebuild(d->quantiles, d);
+  return removed;
+}
+/*--------------------------------------------------------------------*/
+static int find_slot(DB_T d, const char *id, size_t idLen)
+
+/* Return the slot of the customer with the idLen-byte id, -1 if there
+   is none. */
+{
+  int processedItems = 0; /* Tracks the number of valid items processed */
+
+  for (int i = 0; i < d->curArrSize && processedItems < d->numItems; i++) {
+    if (d->pArray[i].purchase == 0) continue;
+    processedItems++;
+    if (SmallStringEqual(&d->pArray[i].id, id, idLen)) return i;
+  }
+  return -1;
+}
+/*--------------------------------------------------------------------*/
+/* Attributes: d->columns is indexed by array slot. A frozen db has
+   none, as its image keeps only ids, names and purchases. */
+int
+SetCustomerAttr(DB_T d, const char *id, int attr, int code)
+{
+  int slot;
+
+  if (d == NULL || id == NULL || d->columns == NULL) return -1;
+  if ((slot = find_slot(d, id, strlen(id))) < 0) return -1;
+  return CustomerColumnsSetAttr(d->columns, slot, attr, code);
+}
+
+int
+GetCustomerAttr(DB_T d, const char *id, int attr)
+{
+  int slot;
+
+  if (d == NULL || id == NULL || d->columns == NULL) return -1;
+  if ((slot = find_slot(d, id, strlen(id))) < 0) return -1;
+  return CustomerColumnsGetAttr(d->columns, slot, attr);
+}
+
+int
+GroupSumPurchaseBy(DB_T d, int attr, long out[CUSTOMER_ATTR_CODES])
+{
+  if (d == NULL || d->columns == NULL) return -1;
+  return CustomerColumnsGroupSum(d->columns, attr, out);
+}
+/*--------------------------------------------------------------------*/
+/* Cursors: the position is an array index. Unregistered slots are only
+   marked free, so a slot never changes places while a scan is open. */
+struct CustomerCursor {
+  DB_T d;
+  uint64_t pos;              // next array slot (byte offset when frozen)
+  int frozen;                // the db was frozen when the scan started
+};
+/*--------------------------------------------------------------------*/
+static int next_batch(CustomerCursor_T c, struct CustomerView *views, int max)
+{
+  DB_T d = c->d;
+  struct UserInfo *curr;
+  int n = 0;
+
+  for (; n < max && c->pos < (uint64_t)d->curArrSize; c->pos++) {
+    curr = &d->pArray[c->pos];
+    if (curr->purchase == 0) continue;
+    views[n].id = SmallStringData(&curr->id);
+    views[n].idLen = curr->id.len;
+    views[n].name = SmallStringData(&curr->name);
+    views[n].nameLen = curr->name.len;
+    views[n].purchase = curr->purchase;
+    n++;
+  }
+  return n;
+}
+/*--------------------------------------------------------------------*/
+CustomerCursor_T
+OpenCustomerCursor(DB_T d)
+{
+  CustomerCursor_T c;
+
+  if (d == NULL) return NULL;
+  c = (CustomerCursor_T)calloc(1, sizeof(struct CustomerCursor));
+  if (c == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the cursor\n");
+    return NULL;
+  }
+  c->d = d;
+  c->frozen = (d->frozen != NULL);
+  return c;
+}
+/*--------------------------------------------------------------------*/
+int
+NextCustomerBatch(CustomerCursor_T c, struct CustomerView *views, int max)
+{
+  if (c == NULL || views == NULL || max <= 0) return -1;
+  if (c->frozen != (c->d->frozen != NULL)) return -1;
+  if (c->frozen) return FrozenNextBatch(c->d->frozen, &c->pos, views, max);
+  return next_batch(c, views, max);
+}
+/*--------------------------------------------------------------------*/
+void
+CloseCustomerCursor(CustomerCursor_T c)
+{
+  free(c);
+}
+/*--------------------------------------------------------------------*/
+/* Frozen dbs (frozen_db.h): the customers are copied into an image
+   with minimal perfect hashes, then the tables are swapped for the
+   empty ones of a fresh db and the old contents are destroyed. */
+int
+FreezeCustomerDB(DB_T d)
+{
+  FrozenBuilder_T b;
+  FrozenDB_T f;
+  DB_T fresh;
+  struct DB old;
+  int i;
+
+  if (d == NULL || d->frozen) return -1;
+  if ((b = CreateFrozenBuilder()) == NULL) return -1;
+  for (i = 0; i < d->curArrSize; i++) {
+    struct UserInfo *curr = &d->pArray[i];
+    if (curr->purchase == 0) continue; /* free slot */
+    if (FrozenBuilderAdd(b, SmallStringData(&curr->id), curr->id.len,
+                         SmallStringData(&curr->name), curr->name.len,
+                         curr->purchase) < 0) {
+      DestroyFrozenBuilder(b);
+      return -1;
+    }
+  }
+  if ((f = FrozenBuild(b)) == NULL) return -1;
+
+  fresh = CreateCustomerDB();
+  if (fresh == NULL) {
+    DestroyFrozenDB(f);
+    return -1;
+  }
+  old = *d;
+  *d = *fresh;
+  d->hook = old.hook;
+  d->hookCtx = old.hookCtx;
+  d->stats = old.stats;
+  d->frozen = f;
+  d->quantiles = old.quantiles; /* the purchases are the same */
+  old.quantiles = fresh->quantiles;
+  *fresh = old;
+  DestroyCustomerDB(fresh);
+  return 0;
+}
+
+int
+SaveFrozenCustomerDB(DB_T d, const char *path)
+{
+  if (d == NULL || d->frozen == NULL) return -1;
+  return FrozenSave(d->frozen, path);
+}
+
+DB_T
+LoadFrozenCustomerDB(const char *path)
+{
+  FrozenDB_T f;
+  DB_T d;
+
+  if ((f = FrozenLoad(path)) == NULL) return NULL;
+  d = CreateCustomerDB();
+  if (d == NULL) {
+    DestroyFrozenDB(f);
+    return NULL;
+  }
+  d->frozen = f;
+  if (QuantileSketchRebuild(d->quantiles, d) < 0) {
+    DestroyCustomerDB(d);
+    return NULL;
+  }
+  return d;
+}
+
+DB_T
+AttachCustomerDB(const char *shmName)
+{
+  (void)shmName;
+  fprintf(stderr, "Error: customer_manager1 has no shared-memory dbs\n");
+  return NULL;
+}
@@ -31,41 +31,141 @@
  *       customer based on either ID or name.
  *    - `GetSumCustomerPurchase`: Calculates the sum of all customer purchases, using a 
  *       function pointer (`FUNCPTR_T`) to customize the calculation.
+ *
+ * 5. **Hook**:
+ *    - `SetCustomerDBHook`: Every public call is reported to an optional hook after it
+ *       finished (e.g. for tracing). The operations live in static functions and the
+ *       public entry points at the end of the file wrap them.
+ *
+ * 6. **Memory Accounting**:
+ *    - `GetCustomerDBMemoryUsage`: Reports the bytes held by records, key strings,
+ *       bucket arrays and allocator overhead. Keys and overhead are accounted on every
+ *       allocation and release; records and buckets follow from the counts.
+ *
+ * 7. **Key Storage**:
+ *    - IDs and names of up to `SMALL_STRING_INLINE` bytes are stored inside the record
+ *      together with their length (see small_string.h); only longer keys get a heap
+ *      copy. Key comparisons check the length first and then `memcmp` the bytes that
+ *      arrived with the record, so a chain walk costs one cache miss per node.
+ *    - `RegisterCustomerTakeOwnership` adopts the caller's malloc()ed long keys and
+ *      `RegisterCustomerPooled` takes references on interned ones (string_pool.h)
+ *      instead of copying them; a tag in the SmallString says how to release them.
+ *
+ * 8. **Statistics**:
+ *    - `GetCustomerDBStats`: Returns lookup/insert/delete/resize counters and the
+ *       shape of both tables (chain lengths, bucket-occupancy histogram). Counting is
+ *       a few increments per call; build with -DCUSTOMER_DB_NO_STATS to remove it.
+ *
+ * 9. **Numeric IDs**:
+ *    - IDs that are canonical decimal numbers (digits only, no leading zero, below
+ *      2^64) are parsed once and indexed as `uint64_t` in a separate open-addressing
+ *      table (`numTable`, linear probing, integer hash, no string compare). Other IDs
+ *      stay in `iTable`. Every record is in `nTable`, so whole-table walks use it.
+ *
+ * 10. **Bloom Filters** (`CUSTOMER_DB_BLOOM_FILTER`):
+ *    - A blocked Bloom filter over all ids and one over all names (bloom_filter.h)
+ *      answer most lookups, unregistrations and duplicate checks of absent keys
+ *      without touching a chain. Filters cannot forget, so they are rebuilt from
+ *      `nTable` when the table outgrows them or deleted keys outnumber live ones.
+ *
+ * 11. **Parallel Expansion** (`expandThreads` option):
+ *    - Bucket counts are powers of two, so doubling splits old bucket i into new
+ *      buckets i and i + n and nothing else. An expansion of a table with at least
+ *      `PARALLEL_EXPAND_MIN_BUCKETS` buckets hands each of `expandThreads` threads a
+ *      contiguous range of old buckets; each one builds its share of the new
+ *      `iTable` and `nTable` heads, and no two touch the same bucket or link.
+ *
+ * 12. **Cursors**:
+ *    - `OpenCustomerCursor`/`NextCustomerBatch` walk `nTable` a chain at a time in
+ *      reverse-bit order of the bucket index, so a scan spanning expansions visits
+ *      every bucket of the old table exactly once through its split halves.
+ *
+ * 13. **Bulk Removal**: `UnregisterCustomersWhere` sweeps `nTable` once, unlinking
+ *    the customers matching a predicate, then `iTable` once for the marked ones.
+ *
+ * 14. **Cache Mode** (`memoryLimit` option):
+ *    - Lookups set a reference bit in the record. When a registration takes the
+ *      memory total over the limit, a CLOCK hand sweeps `nTable` a bucket at a time,
+ *      clearing set bits and evicting the customers whose bit was already clear
+ *      from both tables, until the total is back under the limit. Evictions go to
+ *      `SetCustomerDBEvictCallback` and to the hook as unregistrations by id.
+ *
+ * 15. **Quantiles**: `GetPurchaseQuantile` answers from a KLL sketch of the purchases
+ *    (quantile_sketch.h) that every registration, unregistration and eviction updates.
+ *
+ * 16. **Attributes** (`attrCount` option):
+ *    - Each record holds a row of the attribute columns (customer_columns.h), which
+ *      also keep a copy of its purchase, so `GroupSumPurchaseBy` reads two arrays
+ *      front to back, split among `scanThreads` threads, instead of chasing chains.
+ *      Removed records give their rows back for the next registrations.
  */
 
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include "customer_manager.h"
+#include "small_string.h"
+#include "frozen_db.h"
+#include "bloom_filter.h"
+#include "quantile_sketch.h"
+#include "customer_columns.h"
 #define MAX_BUCKET_COUNT 1048576
 #define LOAD_FACTOR 0.75
 #define HASH_MULTIPLIER 65599
+#define NUM_INITIAL_SLOTS 1024
+#define NUM_LOAD_FACTOR 0.75
+#define FILTER_MIN_KEYS 1024
+#define PARALLEL_EXPAND_MIN_BUCKETS 65536
+#define MAX_EXPAND_THREADS 64
+
+/* Statistics counters of the DB (compiled out with CUSTOMER_DB_NO_STATS) */
+#ifndef CUSTOMER_DB_NO_STATS
+#define STAT_ADD(d, field, n) ((d)->stats.field += (n))
+#else
+#define STAT_ADD(d, field, n) ((void)(n))
+#endif
 
 int iBucketCount=1024;
 /*--------------------------------------------------------------------*/
-static int hash_function(const char *pcKey, int iBucketCount)
+static int hash_function(const char *pcKey, size_t len, int iBucketCount)
 
-/* Return a hash code for pcKey that is between 0 and iBucketCount-1,
-  inclusive. Adapted from the EE209 lecture notes. */
+/* Return a hash code for the len-byte pcKey that is between 0 and
+  iBucketCount-1, inclusive. Adapted from the EE209 lecture notes. */
 {
-  int i;
+  size_t i;
   unsigned int uiHash = 0U;
-  for (i = 0; pcKey[i] != '\0'; i++)
+  for (i = 0; i < len; i++)
     uiHash = uiHash * (unsigned int)HASH_MULTIPLIER
           + (unsigned int)pcKey[i];
   return (int)(uiHash % (unsigned int)iBucketCount);
 }
 /*--------------------------------------------------------------------*/
 struct UserInfo {
-  char *name;                // customer name
-  char *id;                  // customer id
-  int purchase;              // purchase amount (> 0)
   struct UserInfo* iNext;  // Next item in id linked list
   struct UserInfo* nNext;  // Next item in name linked list
+  int purchase;              // purchase amount (> 0)
+  unsigned referenced : 1;   // looked up since the clock hand passed
+  unsigned row : 31;         // row in d->columns (if any)
+  struct SmallString id;     // customer id
+  struct SmallString name;   // customer name
+};
+
+/* Slot of the numeric id index; usr is NULL for an empty slot */
+struct NumSlot {
+  uint64_t id;               /* parsed customer id */
+  struct UserInfo *usr;      /* its record */
+  int purchase;              /* copy of usr->purchase, so that a lookup
+                                does not touch the record */
 };
 
 struct DB {
@@ -73,12 +173,316 @@ struct DB {
   struct UserInfo** nTable;/* Pointer to the Name HashTable */
   int iBucketCount;   
   int numItems; /*For expansion. Assumption: Both hashtables expan at the same time */        
+  struct NumSlot *numTable; /* Index of numeric ids (NULL until the first) */
+  size_t numSlots;      /* Slots in numTable, a power of two */
+  size_t numIds;        /* Records indexed by numTable instead of iTable */
+  size_t keyBytes;      /* Bytes of the id and name strings on the heap */
+  size_t allocOverhead; /* Allocator headers and rounding of our blocks */
+  HOOKFUNC_T hook;      /* Called after every API call (may be NULL) */
+  void *hookCtx;        /* First argument of hook */
+  BloomFilter_T idFilter;   /* Every id and every name ever added since */
+  BloomFilter_T nameFilter; /* the last rebuild (NULL unless enabled) */
+  size_t filterStale;   /* Deletions since the filters were rebuilt */
+  int expandThreads;    /* Threads sharing an expansion (1: the caller) */
+  FrozenDB_T frozen;         /* read-only contents once frozen (or NULL) */
+  size_t memoryLimit;   /* Cache mode: bytes to stay within (0: none) */
+  int clockHand;        /* nTable bucket the eviction sweep looks at next */
+  EVICTFUNC_T evict;    /* Called for every evicted customer (may be NULL) */
+  void *evictCtx;       /* First argument of evict */
+  QuantileSketch_T quantiles; /* Sketch of the purchases */
+  CustomerColumns_T columns; /* Attributes by record row (NULL: none) */
+  struct CustomerDBStats stats; /* Counters, updated through STAT_ADD */
 };
 /*--------------------------------------------------------------------*/
+static double now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+/*--------------------------------------------------------------------*/
+static size_t alloc_overhead(void *p, size_t size)
+
+/* Return the bytes the allocator spends on top of the 'size'-byte
+   block 'p': its chunk header and the rounding of the block size. */
+{
+#ifdef __GLIBC__
+  return malloc_usable_size(p) + sizeof(size_t) - size;
+#else
+  (void)p; (void)size;
+  return 0;
+#endif
+}
+/*--------------------------------------------------------------------*/
+static void account_user(DB_T d, struct UserInfo *usr, int sign)
+
+/* Add (sign > 0) or remove (sign < 0) the record usr and the heap
+   copies of its long keys to/from the memory accounting of d. Pooled
+   keys are shared with the pool and not counted. */
+{
+  size_t keys = 0;
+  size_t extra = alloc_overhead(usr, sizeof(struct UserInfo));
+
+  if (SmallStringIsHeap(&usr->id) && !SmallStringIsPooled(&usr->id)) {
+    keys += usr->id.len + 1;
+    extra += alloc_overhead((void *)SmallStringData(&usr->id), usr->id.len + 1);
+  }
+  if (SmallStringIsHeap(&usr->name) && !SmallStringIsPooled(&usr->name)) {
+    keys += usr->name.len + 1;
+    extra += alloc_overhead((void *)SmallStringData(&usr->name),
+                            usr->name.len + 1);
+  }
+
+  if (sign > 0) {
+    d->keyBytes += keys;
+    d->allocOverhead += extra;
+  }
+  else {
+    d->keyBytes -= keys;
+    d->allocOverhead -= extra;
+  }
+}
+/*--------------------------------------------------------------------*/
+static void free_user(struct UserInfo *usr)
+
+/* Release the record usr and the heap copies of its keys */
+{
+  SmallStringFree(&usr->id);
+  SmallStringFree(&usr->name);
+  free(usr);
+}
+/*--------------------------------------------------------------------*/
+static void discard_user(struct UserInfo *usr, int how)
+
+/* Release the record usr of a registration that failed, handing keys
+   stored with SmallStringStore(..., how) back to the caller */
+{
+  SmallStringUndo(&usr->id, how);
+  SmallStringUndo(&usr->name, how);
+  free(usr);
+}
+/*--------------------------------------------------------------------*/
+static int parse_numeric_id(const char *id, size_t len, uint64_t *value)
+
+/* Return 1 and store the number in *value if the len-byte id is a
+   canonical decimal number (digits only, no leading zero, below 2^64),
+   0 otherwise. Other spellings such as "007" stay string ids. */
+{
+  uint64_t v = 0;
+  unsigned int digit;
+  size_t i;
+
+  if (len == 0 || len > 20 || (id[0] == '0' && len > 1)) return 0;
+  for (i = 0; i < len; i++) {
+    digit = (unsigned int)((unsigned char)id[i] - '0');
+    if (digit > 9 || v > (UINT64_MAX - digit) / 10) return 0;
+    v = v * 10 + digit;
+  }
+  *value = v;
+  return 1;
+}
+/*--------------------------------------------------------------------*/
+static size_t num_hash(uint64_t id, size_t slots)
+
+/* Return the home slot of id in a numTable of 'slots' slots
+   (the murmur3 64-bit finalizer) */
+{
+  id ^= id >> 33;
+  id *= 0xff51afd7ed558ccdULL;
+  id ^= id >> 33;
+  id *= 0xc4ceb9fe1a85ec53ULL;
+  id ^= id >> 33;
+  return (size_t)id & (slots - 1);
+}
+/*--------------------------------------------------------------------*/
+static struct NumSlot *num_find(DB_T d, uint64_t id)
+
+/* Return the numTable slot holding id, or NULL */
+{
+  size_t i;
+
+  if (d->numTable == NULL) return NULL;
+  for (i = num_hash(id, d->numSlots); d->numTable[i].usr;
+       i = (i + 1) & (d->numSlots - 1)) {
+    STAT_ADD(d, probes, 1);
+    if (d->numTable[i].id == id) return &d->numTable[i];
+  }
+  return NULL;
+}
+/*--------------------------------------------------------------------*/
+static int num_resize(DB_T d, size_t slots)
+
+/* Rehash numTable into 'slots' slots. Return 0 on success, -1 if the
+   new table can't be allocated (the old one is kept). */
+{
+  struct NumSlot *table, *old = d->numTable;
+  size_t i, j;
+
+  table = (struct NumSlot *)calloc(slots, sizeof(struct NumSlot));
+  if (table == NULL) {
+    fprintf(stderr, "Error: Can't allocate a numeric id table of size %zu\n",
+            slots);
+    return -1;
+  }
+  for (i = 0; old && i < d->numSlots; i++) {
+    if (old[i].usr == NULL) continue;
+    for (j = num_hash(old[i].id, slots); table[j].usr; j = (j + 1) & (slots - 1))
+      ;
+    table[j] = old[i];
+  }
+  if (old) {
+    d->allocOverhead -= alloc_overhead(old, d->numSlots * sizeof(struct NumSlot));
+    free(old);
+  }
+  d->numTable = table;
+  d->numSlots = slots;
+  d->allocOverhead += alloc_overhead(table, slots * sizeof(struct NumSlot));
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int num_insert(DB_T d, uint64_t id, struct UserInfo *usr)
+
+/* Add id (not yet in the index) for usr, growing numTable as needed.
+   Return 0 on success, -1 on allocation failure. */
+{
+  size_t i;
+
+  if (d->numTable == NULL || d->numIds + 1 > NUM_LOAD_FACTOR * d->numSlots) {
+    if (num_resize(d, d->numTable ? 2 * d->numSlots : NUM_INITIAL_SLOTS) < 0)
+      return -1;
+  }
+  for (i = num_hash(id, d->numSlots); d->numTable[i].usr;
+       i = (i + 1) & (d->numSlots - 1))
+    ;
+  d->numTable[i].id = id;
+  d->numTable[i].usr = usr;
+  d->numTable[i].purchase = usr->purchase;
+  d->numIds++;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static void num_remove(DB_T d, struct NumSlot *slot)
+
+/* Empty slot of numTable and shift the following entries of its probe
+   run back, so that lookups never need tombstones. */
+{
+  size_t mask = d->numSlots - 1;
+  size_t hole = (size_t)(slot - d->numTable), i, home;
+
+  for (i = (hole + 1) & mask; d->numTable[i].usr; i = (i + 1) & mask) {
+    home = num_hash(d->numTable[i].id, d->numSlots);
+    /* move i into the hole unless its home lies in (hole, i] */
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      d->numTable[hole] = d->numTable[i];
+      hole = i;
+    }
+  }
+  d->numTable[hole].usr = NULL;
+  d->numIds--;
+}
+/*--------------------------------------------------------------------*/
+static void unlink_id(DB_T d, struct UserInfo *usr)
+
+/* Remove usr from its id index: numTable if its id is numeric, iTable
+   otherwise. usr must be in it. */
+{
+  struct UserInfo *curr;
+  uint64_t numId;
+  int iKey;
+
+  if (parse_numeric_id(SmallStringData(&usr->id), usr->id.len, &numId)) {
+    num_remove(d, num_find(d, numId));
+    return;
+  }
+  iKey = hash_function(SmallStringData(&usr->id), usr->id.len,
+                       d->iBucketCount);
+  curr = d->iTable[iKey];
+  if (curr == usr) { /* The item to be deleted is at front */
+    d->iTable[iKey] = usr->iNext;
+    return;
+  }
+  while (curr->iNext != usr) /* Moving curr's next untill it is equal usr */
+    curr = curr->iNext;
+  curr->iNext = usr->iNext; /* Adjust the list */
+}
+/*--------------------------------------------------------------------*/
+static void filter_rebuild(DB_T d, size_t keys)
+
+/* Replace both Bloom filters by new ones sized for 'keys' keys that hold
+   exactly the current records. On allocation failure the old filters
+   stay: they still contain every key, only with more false positives. */
+{
+  BloomFilter_T idFilter, nameFilter;
+  struct UserInfo *curr;
+  int i, processedItems = 0;
+
+  idFilter = CreateBloomFilter(keys);
+  nameFilter = CreateBloomFilter(keys);
+  if (idFilter == NULL || nameFilter == NULL) {
+    DestroyBloomFilter(idFilter);
+    DestroyBloomFilter(nameFilter);
+    return;
+  }
+  for (i = 0; i < d->iBucketCount && processedItems < d->numItems; i++) {
+    for (curr = d->nTable[i]; curr; curr = curr->nNext) {
+      BloomAdd(idFilter, BloomHash(SmallStringData(&curr->id), curr->id.len));
+      BloomAdd(nameFilter,
+               BloomHash(SmallStringData(&curr->name), curr->name.len));
+      processedItems++;
+    }
+  }
+  DestroyBloomFilter(d->idFilter);
+  DestroyBloomFilter(d->nameFilter);
+  d->idFilter = idFilter;
+  d->nameFilter = nameFilter;
+  d->filterStale = 0;
+}
+/*--------------------------------------------------------------------*/
+static int filter_rejects(DB_T d, BloomFilter_T filter, const char *key,
+                          size_t len)
+
+/* Return 1 if filter is enabled and says key was never added, in which
+   case the table needs no walk. */
+{
+  if (filter == NULL || BloomMayContain(filter, BloomHash(key, len)))
+    return 0;
+  STAT_ADD(d, filtered, 1);
+  return 1;
+}
+/*--------------------------------------------------------------------*/
+static void filter_deleted(DB_T d)
+
+/* Note a deletion. Filters cannot forget keys, so they are rebuilt once
+   the deleted keys outnumber the live ones. */
+{
+  if (d->idFilter == NULL) return;
+  d->filterStale++;
+  if (d->filterStale >= FILTER_MIN_KEYS &&
+      d->filterStale > (size_t)d->numItems)
+    filter_rebuild(d, d->numItems > FILTER_MIN_KEYS / 2 ?
+                      2 * (size_t)d->numItems : FILTER_MIN_KEYS);
+}
+/*--------------------------------------------------------------------*/
+static void quantile_removed(DB_T d, int purchase)
+
+/* Uncount the purchase of a removed customer, rebuilding the sketch
+   once the removals outnumber the customers left. */
+{
+  if (QuantileSketchRemove(d->quantiles, purchase) == 1)
+    QuantileSketchRebuild(d->quantiles, d);
+}
+/*--------------------------------------------------------------------*/
 DB_T
 CreateCustomerDB(void)
+{
+  return CreateCustomerDBEx(NULL);
+}
+/*--------------------------------------------------------------------*/
+DB_T
+CreateCustomerDBEx(const struct CustomerDBOptions *options)
 { 
   DB_T d;
+
   d = (DB_T) calloc(1, sizeof(struct DB));
   if (d == NULL) { /* Allocation failed */
     fprintf(stderr, "Error: Can't allocate a memory for DB_T\n");
@@ -105,6 +509,44 @@ CreateCustomerDB(void)
     return NULL;
   }
   d->numItems=0; /* Number of already stored item initializtion */
+  d->expandThreads = 1;
+  if (options != NULL) d->memoryLimit = options->memoryLimit;
+  if (options != NULL && options->expandThreads > 1)
+    d->expandThreads = options->expandThreads < MAX_EXPAND_THREADS ?
+      options->expandThreads : MAX_EXPAND_THREADS;
+
+  /* Optional Bloom filters in front of both tables */
+  if (options != NULL && (options->flags & CUSTOMER_DB_BLOOM_FILTER)) {
+    d->idFilter = CreateBloomFilter(FILTER_MIN_KEYS);
+    d->nameFilter = CreateBloomFilter(FILTER_MIN_KEYS);
+    if (d->idFilter == NULL || d->nameFilter == NULL) {
+      DestroyBloomFilter(d->idFilter);
+      DestroyBloomFilter(d->nameFilter);
+      free(d->iTable);
+      free(d->nTable);
+      free(d);
+      return NULL;
+    }
+  }
+  d->quantiles = CreateQuantileSketch();
+  if (d->quantiles == NULL) {
+    DestroyCustomerDB(d);
+    return NULL;
+  }
+  if (options != NULL && options->attrCount > 0) {
+    d->columns = CreateCustomerColumns(options->attrCount,
+                                       options->scanThreads);
+    if (d->columns == NULL) {
+      fprintf(stderr, "Error: Can't create %d attribute columns\n",
+              options->attrCount);
+      DestroyCustomerDB(d);
+      return NULL;
+    }
+  }
+  d->allocOverhead =
+    alloc_overhead(d, sizeof(struct DB)) +
+    alloc_overhead(d->iTable, d->iBucketCount * sizeof(struct UserInfo*)) +
+    alloc_overhead(d->nTable, d->iBucketCount * sizeof(struct UserInfo*));
   return d;
 }
 /*--------------------------------------------------------------------*/
@@ -115,19 +557,16 @@ void DestroyCustomerDB(DB_T d) {
 
   if (d == NULL) return; /* No need to destroy an empty database */
 
-  /* Iterate over each bucket until all filled items are processed */
+  /* Iterate over each bucket until all filled items are processed.
+     Every record is in the name table, numeric ids or not. */
   for (int i = 0; i < d->iBucketCount && processedItems < d->numItems; i++) {
-    curr = d->iTable[i];
+    curr = d->nTable[i];
     while (curr) { /* Iterate the linked list for the current bucket */
-      /* Free the current user's information */
-      free(curr->id);
-      free(curr->name);
-
       /* Move to the next user before releasing the current memory */
-      next = curr->iNext;
+      next = curr->nNext;
 
       /* Release the current user's memory */
-      free(curr);
+      free_user(curr);
       curr = next; /* Update to the next user */
       
       processedItems++; /* Increment the count of processed items */
@@ -137,32 +576,186 @@ void DestroyCustomerDB(DB_T d) {
     }
   }
 
-  /* Release both ID and name tables */
+  /* Release both ID and name tables and the numeric id index */
   free(d->iTable);
   free(d->nTable);
+  free(d->numTable);
+  DestroyBloomFilter(d->idFilter);
+  DestroyBloomFilter(d->nameFilter);
+  DestroyFrozenDB(d->frozen);
+  DestroyQuantileSketch(d->quantiles);
+  DestroyCustomerColumns(d->columns);
   free(d);
 }
 
 /*--------------------------------------------------------------------*/
-int 
-RegisterCustomer(DB_T d, const char *id, const char *name, const int purchase){
+static int frozen_lookup(DB_T d, int byName, const char *key, size_t len)
+
+/* Look the len-byte id (or name, if byName) up in the frozen image of
+   d, counting it like a table lookup. */
+{
+  int purchase = FrozenGetPurchase(d->frozen, byName, key, len);
+
+  STAT_ADD(d, lookups, 1);
+  STAT_ADD(d, probes, 1);
+  if (purchase < 0) STAT_ADD(d, misses, 1);
+  else STAT_ADD(d, hits, 1);
+  return purchase;
+}
+/*--------------------------------------------------------------------*/
+struct ExpandRange {
+  struct UserInfo **oldI, **oldN;   /* tables being split */
+  struct UserInfo **newI, **newN;   /* tables of twice the size */
+  int oldCount;
+  int from, to;                     /* old buckets [from, to) */
+};
+/*--------------------------------------------------------------------*/
+static void *split_buckets(void *arg)
+
+/* Move the records of the old buckets [from, to) of both tables into
+   the doubled tables. Old bucket i only feeds new buckets i and
+   i + oldCount, so ranges can be split by different threads at once.
+   Chains keep their order. */
+{
+  struct ExpandRange *r = (struct ExpandRange *)arg;
+  struct UserInfo *curr, **lo, **hi;
+  int i, newCount = 2 * r->oldCount;
+
+  for (i = r->from; i < r->to; i++) {
+    lo = &r->newI[i];
+    hi = &r->newI[i + r->oldCount];
+    for (curr = r->oldI[i]; curr; curr = curr->iNext) {
+      if (hash_function(SmallStringData(&curr->id), curr->id.len,
+                        newCount) == i) {
+        *lo = curr;
+        lo = &curr->iNext;
+      }
+      else {
+        *hi = curr;
+        hi = &curr->iNext;
+      }
+    }
+    *lo = *hi = NULL;
+
+    lo = &r->newN[i];
+    hi = &r->newN[i + r->oldCount];
+    for (curr = r->oldN[i]; curr; curr = curr->nNext) {
+      if (hash_function(SmallStringData(&curr->name), curr->name.len,
+                        newCount) == i) {
+        *lo = curr;
+        lo = &curr->nNext;
+      }
+      else {
+        *hi = curr;
+        hi = &curr->nNext;
+      }
+    }
+    *lo = *hi = NULL;
+  }
+  return NULL;
+}
+/*--------------------------------------------------------------------*/
+static int expand_tables(DB_T d)
+
+/* Double both tables. Large tables are split by d->expandThreads
+   threads, the caller taking the first range. Return 0 on success, -1
+   on failure (d is unchanged). */
+{
+  struct ExpandRange ranges[MAX_EXPAND_THREADS];
+  pthread_t threads[MAX_EXPAND_THREADS];
+  int started[MAX_EXPAND_THREADS];
+  struct UserInfo **iTableTempo, **nTableTempo;
+  int newBucketCount = 2 * d->iBucketCount;
+  int workers = 1, t;
+
+  /* Memory allocation for the new tables. Every bucket is written by
+     the split, so they need not be zeroed. */
+  iTableTempo = (struct UserInfo **)malloc(newBucketCount * sizeof(struct UserInfo*));
+  if (!iTableTempo) {
+    fprintf(stderr, "Error: Memory failure to expand to the tables of size %d\n",
+            newBucketCount);
+    return -1;
+  }
+  nTableTempo = (struct UserInfo **)malloc(newBucketCount * sizeof(struct UserInfo*));
+  if (!nTableTempo) {
+    fprintf(stderr, "Error: Memory failure to expand to the tables of size %d\n",
+            newBucketCount);
+    free(iTableTempo);
+    return -1;
+  }
+
+  if (d->iBucketCount >= PARALLEL_EXPAND_MIN_BUCKETS)
+    workers = d->expandThreads;
+  for (t = 0; t < workers; t++) {
+    ranges[t].oldI = d->iTable;
+    ranges[t].oldN = d->nTable;
+    ranges[t].newI = iTableTempo;
+    ranges[t].newN = nTableTempo;
+    ranges[t].oldCount = d->iBucketCount;
+    ranges[t].from = (int)((long)d->iBucketCount * t / workers);
+    ranges[t].to = (int)((long)d->iBucketCount * (t + 1) / workers);
+  }
+  /* a range whose thread cannot be started is split by the caller */
+  for (t = 1; t < workers; t++)
+    started[t] = pthread_create(&threads[t], NULL, split_buckets,
+                                &ranges[t]) == 0;
+  split_buckets(&ranges[0]);
+  for (t = 1; t < workers; t++) {
+    if (started[t]) pthread_join(threads[t], NULL);
+    else split_buckets(&ranges[t]);
+  }
+
+  /* Free the old tables and assign the new ones */
+  d->allocOverhead -=
+    alloc_overhead(d->iTable, d->iBucketCount * sizeof(struct UserInfo*)) +
+    alloc_overhead(d->nTable, d->iBucketCount * sizeof(struct UserInfo*));
+  free(d->iTable);
+  free(d->nTable);
+  d->iTable = iTableTempo;
+  d->nTable = nTableTempo;
+  d->iBucketCount = newBucketCount;
+  d->allocOverhead +=
+    alloc_overhead(d->iTable, d->iBucketCount * sizeof(struct UserInfo*)) +
+    alloc_overhead(d->nTable, d->iBucketCount * sizeof(struct UserInfo*));
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int
+register_customer(DB_T d, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, const int purchase,
+                  int how){
 
-  struct UserInfo *curr,*next, *newUsr;  /* For traversing linkedlist*/
-  struct UserInfo **iTableTempo, **nTableTempo; /* Temporary tables during expansion */
-  int iKey, nKey; /* Hash keys */
+  struct UserInfo *curr, *newUsr;  /* For traversing linkedlist*/
+  int iKey = 0, nKey; /* Hash keys */
+  uint64_t numId;     /* Parsed id, if it is numeric */
+  int numeric;
 
   if (d == NULL || id == NULL || name == NULL || purchase <= 0) return -1; 
+  if (d->frozen) return -1; /* frozen dbs are read-only */
 
-  /* Checking whether the item already exist or not */
-  iKey = hash_function(id, d->iBucketCount);
-  for (curr = d->iTable[iKey]; curr; curr = curr->iNext){
-    if (strcmp(curr->id, id) == 0 || strcmp(curr->name, name) == 0) {
-      return -1;  /* Duplicate id or name found */
+  /* Checking whether the item already exist or not. A key the filter
+     has never seen cannot be a duplicate, so its walk is skipped. */
+  numeric = parse_numeric_id(id, idLen, &numId);
+  if (filter_rejects(d, d->idFilter, id, idLen)) {
+    if (!numeric) iKey = hash_function(id, idLen, d->iBucketCount);
+  }
+  else if (numeric) {
+    if (num_find(d, numId)) return -1;  /* Duplicate id found */
+  }
+  else {
+    iKey = hash_function(id, idLen, d->iBucketCount);
+    for (curr = d->iTable[iKey]; curr; curr = curr->iNext){
+      if (SmallStringEqual(&curr->id, id, idLen) ||
+          SmallStringEqual(&curr->name, name, nameLen)) {
+        return -1;  /* Duplicate id or name found */
+      }
     }
   }
-  nKey = hash_function(name, d->iBucketCount);
-  for (curr = d->nTable[nKey]; curr; curr = curr->nNext) {
-    if (strcmp(curr->id, id) == 0 || strcmp(curr->name, name) == 0) {
+  nKey = hash_function(name, nameLen, d->iBucketCount);
+  for (curr = filter_rejects(d, d->nameFilter, name, nameLen) ?
+         NULL : d->nTable[nKey]; curr; curr = curr->nNext) {
+    if (SmallStringEqual(&curr->id, id, idLen) ||
+        SmallStringEqual(&curr->name, name, nameLen)) {
       return -1;  /* Duplicate id or name found */
     }
   }
@@ -174,137 +767,124 @@ RegisterCustomer(DB_T d, const char *id, const char *name, const int purchase){
     return -1; 
   }
 
-  newUsr->id = strdup(id);
-  if (newUsr->id == NULL) {
+  if (SmallStringStore(&newUsr->id, id, idLen, how) < 0) {
     fprintf(stderr, "Error: Unable to allocate memory for user ID.\n");
     free(newUsr); /* Clean up previously allocated memory */
     return -1; 
   }
 
-  newUsr->name = strdup(name);
-  if (newUsr->name == NULL) {
+  if (SmallStringStore(&newUsr->name, name, nameLen, how) < 0) {
     fprintf(stderr, "Error: Unable to allocate memory for user name.\n");
-    free(newUsr->id); /* Clean up previously allocated memory */
+    SmallStringUndo(&newUsr->id, how); /* Clean up the stored id */
     free(newUsr);
     return -1; 
   }
   newUsr->purchase = purchase;
+  newUsr->referenced = 1; /* a new customer survives one clock round */
+  if (d->columns) {
+    int row = CustomerColumnsNewRow(d->columns, purchase);
+    if (row < 0) {
+      discard_user(newUsr, how);
+      return -1;
+    }
+    newUsr->row = (unsigned)row;
+  }
   
   if ((d->numItems >= LOAD_FACTOR * d->iBucketCount)  
                             && (d->iBucketCount < MAX_BUCKET_COUNT)){ /* Expand */
  
-    /* Memory allocation for the new tables */
-    int newBucketCount = 2 * d->iBucketCount;
-    iTableTempo= (struct UserInfo **)calloc(newBucketCount, sizeof(struct UserInfo*));
-    if (!iTableTempo) {
-      fprintf(stderr, "Error: Memory failure to expand to the tables of size %d\n",
-        newBucketCount); 
-        free(newUsr->id);
-        free(newUsr->name);
-        free(newUsr);  
+    double expandStart = now_ms();
+    if (expand_tables(d) < 0) {
+      CustomerColumnsFreeRow(d->columns, newUsr->row);
+      discard_user(newUsr, how);
       return -1;
     }
 
-    nTableTempo = (struct UserInfo **)calloc(newBucketCount, sizeof(struct UserInfo*));
-    if (!nTableTempo) {
-      fprintf(stderr, "Error: Memory failure to expand to the tables of size %d\n",
-        newBucketCount);
-      free(iTableTempo); 
-      free(newUsr->id);
-      free(newUsr->name);
-      free(newUsr); 
+    /* Hash keys of newUsr in expanded tables */
+    if (!numeric) iKey=hash_function(id, idLen, d->iBucketCount);
+    nKey=hash_function(name, nameLen, d->iBucketCount);
+    STAT_ADD(d, resizes, 1);
+    STAT_ADD(d, expansionMs, now_ms() - expandStart);
+  }
+
+  /* Link newUsr into its id index and the name table */
+  if (numeric) {
+    if (num_insert(d, numId, newUsr) < 0) {
+      CustomerColumnsFreeRow(d->columns, newUsr->row);
+      discard_user(newUsr, how);
       return -1;
-    } 
-    int processedItems = 0;  /* Tracks the number of valid items processed */
-    for (int i = 0; i < d->iBucketCount && processedItems < d->numItems; i++) {
-      curr = d->iTable[i];
-      while (curr) {
-        /* Calculate new hash keys for expanded table size */
-        int iKey = hash_function(curr->id, newBucketCount);
-        int nKey = hash_function(curr->name, newBucketCount);
-
-        /* Save the next pointer before moving current item */
-        next = curr->iNext;
-
-        /* Insert current item into the new tables */
-        curr->iNext = iTableTempo[iKey];
-        curr->nNext = nTableTempo[nKey];
-        iTableTempo[iKey] = curr;
-        nTableTempo[nKey] = curr;
-
-        /* Move to the next item */
-        curr = next;
-
-        /* Increment processed items count */
-        processedItems++;
-
-        /* Exit early if all items have been processed */
-        if (processedItems >= d->numItems) break;
-      }
     }
-
-    /* Free the old tables and assign the new ones */ 
-    free(d->iTable);
-    free(d->nTable); 
-    d->iTable = iTableTempo;
-    d->nTable = nTableTempo;
-    d->iBucketCount = newBucketCount;
-
-    /* Insert newUsr in expanded tables */
-    iKey=hash_function(id, d->iBucketCount);
-    nKey=hash_function(name,d->iBucketCount);
-    newUsr->nNext= d->nTable[nKey];
-    newUsr->iNext= d->iTable[iKey];
-    d->iTable[iKey]= newUsr;
-    d->nTable[nKey]= newUsr;  
   }
-  else{ 
-    newUsr->nNext= d->nTable[nKey];
+  else {
     newUsr->iNext= d->iTable[iKey];
     d->iTable[iKey]= newUsr;
-    d->nTable[nKey]= newUsr;
   }
+  newUsr->nNext= d->nTable[nKey];
+  d->nTable[nKey]= newUsr;
+  account_user(d, newUsr, 1);
   d->numItems++;
+  STAT_ADD(d, inserts, 1);
+  QuantileSketchAdd(d->quantiles, purchase);
+
+  if (d->idFilter) {
+    BloomAdd(d->idFilter, BloomHash(id, idLen));
+    BloomAdd(d->nameFilter, BloomHash(name, nameLen));
+    if ((size_t)d->numItems > BloomCapacity(d->idFilter))
+      filter_rebuild(d, 2 * (size_t)d->numItems);
+  }
   return 0;
 }
 /*--------------------------------------------------------------------*/
-int
-UnregisterCustomerByID(DB_T d, const char *id)
+static int
+unregister_by_id(DB_T d, const char *id, size_t idLen)
 {
   struct UserInfo* delUsr=NULL; /* Pointer to item that is being unregistered*/
   struct UserInfo *next, *curr; /* For traversing the linked list */                           
+  struct NumSlot *slot;
   int iKey,nKey; /* Keeps hash keys */
+  int purchase;  /* of the deleted item */
+  uint64_t numId;
   
   if (d == NULL || id == NULL) return -1; /* Nothing to delete */
+  if (d->frozen) return -1; /* frozen dbs are read-only */
+  if (filter_rejects(d, d->idFilter, id, idLen)) return -1; /* never added */
 
-  /*Find the hash value for the id*/
-  iKey=hash_function(id, d->iBucketCount);
+  if (parse_numeric_id(id, idLen, &numId)) { /* numeric id index */
+    if ((slot = num_find(d, numId)) == NULL) return -1; /* id doesn't exist */
+    delUsr = slot->usr;
+    num_remove(d, slot);
+  }
+  else {
+    /*Find the hash value for the id*/
+    iKey=hash_function(id, idLen, d->iBucketCount);
 
-  if(d->iTable[iKey]==NULL) return -1; /* id doesn't exist */
+    if(d->iTable[iKey]==NULL) return -1; /* id doesn't exist */
 
-  /* Check front of list */
-  if (strcmp(d->iTable[iKey]->id, id) == 0) { 
-    delUsr = d->iTable[iKey];
-    d->iTable[iKey] = delUsr->iNext; /* Adjusting the id table */
-  } 
-  else {  
-    /* Traverse the linked list to find the item */
-    curr = d->iTable[iKey];
-    next = curr->iNext;
-    while (next) {
-        if (strcmp(next->id, id) == 0) {
-            delUsr = next;
-            curr->iNext = delUsr->iNext; /* Remove from iTable list */
-            break;
-        }
-        curr = next;
-        next = curr->iNext;
+    /* Check front of list */
+    if (SmallStringEqual(&d->iTable[iKey]->id, id, idLen)) { 
+      delUsr = d->iTable[iKey];
+      d->iTable[iKey] = delUsr->iNext; /* Adjusting the id table */
+    } 
+    else {  
+      /* Traverse the linked list to find the item */
+      curr = d->iTable[iKey];
+      next = curr->iNext;
+      while (next) {
+          if (SmallStringEqual(&next->id, id, idLen)) {
+              delUsr = next;
+              curr->iNext = delUsr->iNext; /* Remove from iTable list */
+              break;
+          }
+          curr = next;
+          next = curr->iNext;
+      }
     }
+    if(!delUsr) return -1; /* Item to be deleted is not found */
   }
-  if(!delUsr) return -1; /* Item to be deleted is not found */
 
   /*Find the hash value for the name*/
-  nKey=hash_function(delUsr->name, d->iBucketCount);
+  nKey=hash_function(SmallStringData(&delUsr->name), delUsr->name.len,
+                     d->iBucketCount);
 
  /* Adjusting the nTable before releasing the memory */
   curr=d->nTable[nKey];
@@ -319,31 +899,38 @@ UnregisterCustomerByID(DB_T d, const char *id)
   }
 
   /*  Freeing the memory of to be deleted item */
-  free(delUsr->id);
-  free(delUsr->name);
-  free(delUsr);
+  purchase = delUsr->purchase;
+  account_user(d, delUsr, -1);
+  CustomerColumnsFreeRow(d->columns, delUsr->row);
+  free_user(delUsr);
 
   /* Adjusting the database's number of items */
   d->numItems--;
+  STAT_ADD(d, deletes, 1);
+  filter_deleted(d);
+  quantile_removed(d, purchase);
   return 0;
 }
 /*--------------------------------------------------------------------*/
-int
-UnregisterCustomerByName(DB_T d, const char *name)
+static int
+unregister_by_name(DB_T d, const char *name, size_t nameLen)
 {
   struct UserInfo* delUsr=NULL; /* Pointer to item that is being unregistered*/
   struct UserInfo *next, *curr; /* For traversing the linked list */                           
-  int iKey,nKey; /* Keeps hash keys */
+  int nKey; /* Keeps hash keys */
+  int purchase; /* of the deleted item */
 
   if (d == NULL || name == NULL) return -1; /* Nothing to delete */
+  if (d->frozen) return -1; /* frozen dbs are read-only */
+  if (filter_rejects(d, d->nameFilter, name, nameLen)) return -1;
 
   /*Find the hash value for the id*/
-  nKey=hash_function(name, d->iBucketCount);
+  nKey=hash_function(name, nameLen, d->iBucketCount);
   
   if(d->nTable[nKey]==NULL) return -1; /* name doesn't exist */
 
   /* Check front of list */
-  if(strcmp(d->nTable[nKey]->name,name)==0){ 
+  if(SmallStringEqual(&d->nTable[nKey]->name, name, nameLen)){ 
     delUsr=d->nTable[nKey];
     d->nTable[nKey]=delUsr->nNext;  /* Adjusting the iTable */
   }
@@ -351,7 +938,7 @@ UnregisterCustomerByName(DB_T d, const char *name)
     curr=d->nTable[nKey];
     next=curr->nNext;
     while(next){  /* Iterate the linked list until finding the item*/
-      if (strcmp(next->name ,name)==0){
+      if (SmallStringEqual(&next->name, name, nameLen)){
         delUsr=next;
         curr->nNext=delUsr->nNext;
         break;
@@ -362,83 +949,688 @@ UnregisterCustomerByName(DB_T d, const char *name)
   }
   if(!delUsr) return -1; /* Item to be deleted is not found */
 
-  /*Find the hash value for the id */
-  iKey=hash_function(delUsr->id, d->iBucketCount);
-
-  /* Adjusting the iTable before releasing the memory */
-  curr=d->iTable[iKey];
-  if(curr==delUsr) { /* The item to be deleted is at front */
-      d->iTable[iKey]=delUsr->iNext;
-  }
-  else{ /* Moving curr's next untill it is equal delUsr */
-      while(curr->iNext!=delUsr){
-        curr=curr->iNext;
-      }
-      curr->iNext=delUsr->iNext; /* Adjust the list */
-  }
+  /* Adjusting the id index before releasing the memory */
+  unlink_id(d, delUsr);
   /* Freeing the memory of to be deleted item */
-  free(delUsr->id);
-  free(delUsr->name);
-  free(delUsr);
+  purchase = delUsr->purchase;
+  account_user(d, delUsr, -1);
+  CustomerColumnsFreeRow(d->columns, delUsr->row);
+  free_user(delUsr);
 
   /* Adjusting the database's number of items */
   d->numItems--;
+  STAT_ADD(d, deletes, 1);
+  filter_deleted(d);
+  quantile_removed(d, purchase);
   return 0;
 }
 /*--------------------------------------------------------------------*/
-int
-GetPurchaseByID(DB_T d, const char* id)
+static int
+get_purchase_by_id(DB_T d, const char* id, size_t idLen)
 {  
   struct UserInfo* curr; /* Iterator */
+  struct NumSlot *slot;
   int iKey;
+  uint64_t numId;
   if (d == NULL || id == NULL) return -1; /* Invalid inputs */
+  if (d->frozen) return frozen_lookup(d, 0, id, idLen);
+
+  STAT_ADD(d, lookups, 1);
+  if (filter_rejects(d, d->idFilter, id, idLen)) {
+    STAT_ADD(d, misses, 1);
+    return -1;
+  }
+  if (parse_numeric_id(id, idLen, &numId)) { /* numeric id index */
+    if ((slot = num_find(d, numId)) == NULL) {
+      STAT_ADD(d, misses, 1);
+      return -1;
+    }
+    STAT_ADD(d, hits, 1);
+    if (d->memoryLimit) slot->usr->referenced = 1;
+    return slot->purchase;
+  }
 
   /* Hash values of the id */
-  iKey=hash_function(id, d->iBucketCount);
+  iKey=hash_function(id, idLen, d->iBucketCount);
 
   curr=d->iTable[iKey];
   while(curr){ /* Iterating the id list */
-    if (strcmp(curr->id,id)==0) return curr->purchase;
+    STAT_ADD(d, probes, 1);
+    if (SmallStringEqual(&curr->id, id, idLen)) {
+      STAT_ADD(d, hits, 1);
+      if (d->memoryLimit) curr->referenced = 1;
+      return curr->purchase;
+    }
     curr=curr->iNext;
   }
+  STAT_ADD(d, misses, 1);
   return -1; /* No item of such id */ 
 }
 
 /*--------------------------------------------------------------------*/
-int
-GetPurchaseByName(DB_T d, const char* name)
+static int
+get_purchase_by_name(DB_T d, const char* name, size_t nameLen)
 { 
   struct UserInfo* curr; /* Iterator */
   int nKey;
   if (d == NULL || name == NULL) return -1; /* Invalid inputs */
+  if (d->frozen) return frozen_lookup(d, 1, name, nameLen);
 
   /* Hash values of the name */
-  nKey=hash_function(name, d->iBucketCount);
+  nKey=hash_function(name, nameLen, d->iBucketCount);
 
+  STAT_ADD(d, lookups, 1);
+  if (filter_rejects(d, d->nameFilter, name, nameLen)) {
+    STAT_ADD(d, misses, 1);
+    return -1;
+  }
   curr=d->nTable[nKey];
   while(curr){ /* Iterating the name list */
-    if (strcmp(curr->name,name)==0) return curr->purchase;
+    STAT_ADD(d, probes, 1);
+    if (SmallStringEqual(&curr->name, name, nameLen)) {
+      STAT_ADD(d, hits, 1);
+      if (d->memoryLimit) curr->referenced = 1;
+      return curr->purchase;
+    }
     curr=curr->nNext;
   }
+  STAT_ADD(d, misses, 1);
   return -1; /* No item of such name */
 }
 
 /*--------------------------------------------------------------------*/
-int GetSumCustomerPurchase(DB_T d, FUNCPTR_T fp) {
+static int get_sum_customer_purchase(DB_T d, FUNCPTR_T fp) {
   struct UserInfo *curr; /* Iterator */
   int processedItems = 0, i = 0, total = 0;
 
   if (d == NULL || fp == NULL) return -1; /* Invalid inputs */
+  if (d->frozen) return FrozenSum(d->frozen, fp);
 
-  /* Iterate through each bucket until all filled items are processed */
+  /* Iterate through each bucket until all filled items are processed.
+     The name table holds every record, numeric ids included. */
   while (processedItems < d->numItems) {
-    curr = d->iTable[i];
+    curr = d->nTable[i];
     while (curr) {
-      total += fp(curr->id, curr->name, curr->purchase);
+      total += fp(SmallStringData(&curr->id), SmallStringData(&curr->name),
+                  curr->purchase);
       processedItems++; /* Increment count for each valid entry processed */
-      curr = curr->iNext;
+      curr = curr->nNext;
     }
     i++;
   }
   return total;
-}
\ No newline at end of file
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBOptions(DB_T d, struct CustomerDBOptions *options)
+{
+  if (d == NULL || options == NULL) return -1;
+  memset(options, 0, sizeof(*options));
+  if (d->idFilter) options->flags |= CUSTOMER_DB_BLOOM_FILTER;
+  options->expandThreads = d->expandThreads;
+  options->memoryLimit = d->memoryLimit;
+  CustomerColumnsGetOptions(d->columns, options);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBMemoryUsage(DB_T d, struct CustomerDBMemoryUsage *usage)
+{
+  if (d == NULL || usage == NULL) return -1; /* Invalid inputs */
+
+  usage->records = (size_t)d->numItems * sizeof(struct UserInfo) +
+                   CustomerColumnsMemory(d->columns);
+  usage->keys = d->keyBytes;
+  /* Both the id and the name table have iBucketCount heads */
+  usage->buckets = 2 * (size_t)d->iBucketCount * sizeof(struct UserInfo*) +
+                   d->numSlots * sizeof(struct NumSlot) +
+                   BloomMemory(d->idFilter) + BloomMemory(d->nameFilter) +
+                   QuantileSketchMemory(d->quantiles);
+  usage->overhead = d->allocOverhead;
+  if (d->frozen) { /* the image replaces the (empty) tables */
+    size_t records, keys, index;
+    FrozenMemory(d->frozen, &records, &keys, &index);
+    usage->records += records;
+    usage->keys += keys;
+    usage->buckets += index;
+  }
+  usage->total = sizeof(struct DB) + usage->records + usage->keys +
+                 usage->buckets + usage->overhead;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+GetPurchaseQuantile(DB_T d, double q)
+{
+  if (d == NULL) return -1;
+  return QuantileSketchQuery(d->quantiles, q);
+}
+/*--------------------------------------------------------------------*/
+static struct UserInfo *find_user(DB_T d, const char *id, size_t idLen)
+
+/* Return the record of the customer with the idLen-byte id, or NULL */
+{
+  struct UserInfo *curr;
+  struct NumSlot *slot;
+  uint64_t numId;
+
+  if (parse_numeric_id(id, idLen, &numId)) {
+    slot = num_find(d, numId);
+    return slot ? slot->usr : NULL;
+  }
+  for (curr = d->iTable[hash_function(id, idLen, d->iBucketCount)]; curr;
+       curr = curr->iNext)
+    if (SmallStringEqual(&curr->id, id, idLen)) return curr;
+  return NULL;
+}
+/*--------------------------------------------------------------------*/
+/* Attributes: every record names its row of d->columns. A frozen db
+   has no columns, as its image keeps only ids, names and purchases. */
+int
+SetCustomerAttr(DB_T d, const char *id, int attr, int code)
+{
+  struct UserInfo *usr;
+
+  if (d == NULL || id == NULL || d->columns == NULL) return -1;
+  if ((usr = find_user(d, id, strlen(id))) == NULL) return -1;
+  return CustomerColumnsSetAttr(d->columns, usr->row, attr, code);
+}
+
+int
+GetCustomerAttr(DB_T d, const char *id, int attr)
+{
+  struct UserInfo *usr;
+
+  if (d == NULL || id == NULL || d->columns == NULL) return -1;
+  if ((usr = find_user(d, id, strlen(id))) == NULL) return -1;
+  return CustomerColumnsGetAttr(d->columns, usr->row, attr);
+}
+
+int
+GroupSumPurchaseBy(DB_T d, int attr, long out[CUSTOMER_ATTR_CODES])
+{
+  if (d == NULL || d->columns == NULL) return -1;
+  return CustomerColumnsGroupSum(d->columns, attr, out);
+}
+/*--------------------------------------------------------------------*/
+static void chain_stats(struct UserInfo **table, int bucketCount, int byName,
+                        unsigned long *hist, double *avg, int *max)
+
+/* Walk every bucket of table (linked through nNext if byName, iNext
+   otherwise) and fill its occupancy histogram, the average length of
+   the non-empty chains and the longest chain. */
+{
+  struct UserInfo *curr;
+  unsigned long used = 0, items = 0;
+  int i, len;
+
+  *max = 0;
+  for (i = 0; i < bucketCount; i++) {
+    len = 0;
+    for (curr = table[i]; curr; curr = byName ? curr->nNext : curr->iNext)
+      len++;
+    hist[len < CUSTOMER_STATS_HIST ? len : CUSTOMER_STATS_HIST - 1]++;
+    if (len > 0) used++;
+    if (len > *max) *max = len;
+    items += len;
+  }
+  *avg = used ? (double)items / used : 0.0;
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBStats(DB_T d, struct CustomerDBStats *stats)
+{
+  if (d == NULL || stats == NULL) return -1; /* Invalid inputs */
+
+  *stats = d->stats;
+  memset(stats->idHistogram, 0, sizeof(stats->idHistogram));
+  memset(stats->nameHistogram, 0, sizeof(stats->nameHistogram));
+  chain_stats(d->iTable, d->iBucketCount, 0, stats->idHistogram,
+              &stats->avgIdChain, &stats->maxIdChain);
+  chain_stats(d->nTable, d->iBucketCount, 1, stats->nameHistogram,
+              &stats->avgNameChain, &stats->maxNameChain);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int report(DB_T d, int type, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, int purchase, int result)
+
+/* Pass a finished API call to the hook of d, if one is installed,
+   and return its result unchanged. */
+{
+  struct CustomerOp op;
+
+  if (d == NULL || d->hook == NULL) return result;
+
+  op.type = type;
+  op.id = id;
+  op.idLen = id ? idLen : 0;
+  op.name = name;
+  op.nameLen = name ? nameLen : 0;
+  op.purchase = purchase;
+  op.result = result;
+  d->hook(d->hookCtx, &op);
+  return result;
+}
+/*--------------------------------------------------------------------*/
+int
+SetCustomerDBHook(DB_T d, HOOKFUNC_T hook, void *ctx)
+{
+  if (d == NULL) return -1;
+  d->hook = hook;
+  d->hookCtx = ctx;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+SetCustomerDBEvictCallback(DB_T d, EVICTFUNC_T fn, void *ctx)
+{
+  if (d == NULL) return -1;
+  d->evict = fn;
+  d->evictCtx = ctx;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static void evict_customer(DB_T d, struct UserInfo *usr)
+
+/* Pass usr, already unlinked from nTable, to the evict callback, remove
+   it from its id index, report it to the hook and free it. */
+{
+  int purchase = usr->purchase;
+
+  if (d->evict)
+    d->evict(d->evictCtx, SmallStringData(&usr->id),
+             SmallStringData(&usr->name), usr->purchase);
+  unlink_id(d, usr);
+  report(d, CUSTOMER_OP_UNREGISTER_ID, SmallStringData(&usr->id),
+         usr->id.len, NULL, 0, 0, 0);
+  account_user(d, usr, -1);
+  CustomerColumnsFreeRow(d->columns, usr->row);
+  free_user(usr);
+  d->numItems--;
+  STAT_ADD(d, evictions, 1);
+  filter_deleted(d);
+  quantile_removed(d, purchase);
+}
+/*--------------------------------------------------------------------*/
+static void evict_to_limit(DB_T d)
+
+/* Cache mode: sweep nTable from the clock hand a bucket at a time until
+   the memory total of d is within its limit. A customer looked up since
+   the hand last passed loses its reference bit and stays; the others of
+   the bucket are evicted, so a sweep may free a little more than
+   needed. The last customer stays whatever the limit. */
+{
+  struct CustomerDBMemoryUsage usage;
+  struct UserInfo *curr, **link;
+
+  if (d->memoryLimit == 0) return;
+  while (d->numItems > 1 && GetCustomerDBMemoryUsage(d, &usage) == 0 &&
+         usage.total > d->memoryLimit) {
+    for (link = &d->nTable[d->clockHand]; (curr = *link) != NULL; ) {
+      if (curr->referenced) {
+        curr->referenced = 0;
+        link = &curr->nNext;
+      }
+      else {
+        *link = curr->nNext;
+        evict_customer(d, curr);
+      }
+    }
+    /* bucket counts are powers of two */
+    d->clockHand = (d->clockHand + 1) & (d->iBucketCount - 1);
+  }
+}
+/*--------------------------------------------------------------------*/
+/* Public entry points: run the operation, then report it to the hook.
+   The NUL-terminated variants measure their keys and call the ...N
+   variants. A registration is reported before the evictions it causes. */
+int
+RegisterCustomerN(DB_T d, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, const int purchase)
+{
+  int result;
+
+  result = report(d, CUSTOMER_OP_REGISTER, id, idLen, name, nameLen, purchase,
+                  register_customer(d, id, idLen, name, nameLen, purchase,
+                                    SMALL_STRING_COPY));
+  if (result == 0) evict_to_limit(d);
+  return result;
+}
+
+int
+RegisterCustomerTakeOwnership(DB_T d, char *id, char *name, const int purchase)
+{
+  size_t idLen = id ? strlen(id) : 0, nameLen = name ? strlen(name) : 0;
+  int result;
+
+  result = report(d, CUSTOMER_OP_REGISTER, id, idLen, name, nameLen, purchase,
+                  register_customer(d, id, idLen, name, nameLen, purchase,
+                                    SMALL_STRING_ADOPT));
+  if (result == 0) { /* short keys were copied into the record */
+    if (idLen <= SMALL_STRING_INLINE) free(id);
+    if (nameLen <= SMALL_STRING_INLINE) free(name);
+    evict_to_limit(d);
+  }
+  return result;
+}
+
+int
+RegisterCustomerPooled(DB_T d, const char *id, const char *name,
+                       const int purchase)
+{
+  size_t idLen = StringPoolLength(id), nameLen = StringPoolLength(name);
+  int result;
+
+  result = report(d, CUSTOMER_OP_REGISTER, id, idLen, name, nameLen, purchase,
+                  register_customer(d, id, idLen, name, nameLen, purchase,
+                                    SMALL_STRING_SHARE));
+  if (result == 0) evict_to_limit(d);
+  return result;
+}
+
+int
+UnregisterCustomerByIDN(DB_T d, const char *id, size_t idLen)
+{
+  return report(d, CUSTOMER_OP_UNREGISTER_ID, id, idLen, NULL, 0, 0,
+                unregister_by_id(d, id, idLen));
+}
+
+int
+UnregisterCustomerByNameN(DB_T d, const char *name, size_t nameLen)
+{
+  return report(d, CUSTOMER_OP_UNREGISTER_NAME, NULL, 0, name, nameLen, 0,
+                unregister_by_name(d, name, nameLen));
+}
+
+int
+GetPurchaseByIDN(DB_T d, const char *id, size_t idLen)
+{
+  return report(d, CUSTOMER_OP_GET_ID, id, idLen, NULL, 0, 0,
+                get_purchase_by_id(d, id, idLen));
+}
+
+int
+GetPurchaseByNameN(DB_T d, const char *name, size_t nameLen)
+{
+  return report(d, CUSTOMER_OP_GET_NAME, NULL, 0, name, nameLen, 0,
+                get_purchase_by_name(d, name, nameLen));
+}
+
+int
+RegisterCustomer(DB_T d, const char *id, const char *name, const int purchase)
+{
+  return RegisterCustomerN(d, id, id ? strlen(id) : 0,
+                           name, name ? strlen(name) : 0, purchase);
+}
+
+int
+UnregisterCustomerByID(DB_T d, const char *id)
+{
+  return UnregisterCustomerByIDN(d, id, id ? strlen(id) : 0);
+}
+
+int
+UnregisterCustomerByName(DB_T d, const char *name)
+{
+  return UnregisterCustomerByNameN(d, name, name ? strlen(name) : 0);
+}
+
+int
+GetPurchaseByID(DB_T d, const char* id)
+{
+  return GetPurchaseByIDN(d, id, id ? strlen(id) : 0);
+}
+
+int
+GetPurchaseByName(DB_T d, const char* name)
+{
+  return GetPurchaseByNameN(d, name, name ? strlen(name) : 0);
+}
+
+int
+GetSumCustomerPurchase(DB_T d, FUNCPTR_T fp)
+{
+  return report(d, CUSTOMER_OP_SUM, NULL, 0, NULL, 0, 0,
+                get_sum_customer_purchase(d, fp));
+}
+/*--------------------------------------------------------------------*/
+/* Bulk removal: one sweep of nTable evaluates pred and unlinks the
+   matches onto a private list (through nNext, marking them with a zero
+   purchase), one sweep of iTable unlinks the marked records, and the
+   list is freed. Numeric ids leave numTable through num_remove(). Every
+   removed customer is reported to the hook as an unregistration by id,
+   so a trace replays to the same contents. The quantile sketch is
+   rebuilt, if due, once the list is freed. */
+int
+UnregisterCustomersWhere(DB_T d, FUNCPTR_T pred)
+{
+  struct UserInfo *doomed = NULL, *curr, **link;
+  struct NumSlot *slot;
+  uint64_t numId;
+  int i, removed = 0, rebuild = 0;
+
+  if (d == NULL || pred == NULL) return -1;
+  if (d->frozen) return -1; /* frozen dbs are read-only */
+
+  for (i = 0; i < d->iBucketCount; i++) {
+    for (link = &d->nTable[i]; (curr = *link) != NULL; ) {
+      if (pred(SmallStringData(&curr->id), SmallStringData(&curr->name),
+               curr->purchase)) {
+        *link = curr->nNext;
+        curr->nNext = doomed;
+        if (QuantileSketchRemove(d->quantiles, curr->purchase) == 1)
+          rebuild = 1;
+        curr->purchase = 0;
+        doomed = curr;
+        removed++;
+      }
+      else
+        link = &curr->nNext;
+    }
+  }
+  if (removed == 0) return 0;
+
+  for (i = 0; i < d->iBucketCount; i++) {
+    for (link = &d->iTable[i]; (curr = *link) != NULL; ) {
+      if (curr->purchase == 0)
+        *link = curr->iNext;
+      else
+        link = &curr->iNext;
+    }
+  }
+
+  while ((curr = doomed) != NULL) {
+    doomed = curr->nNext;
+    if (parse_numeric_id(SmallStringData(&curr->id), curr->id.len, &numId) &&
+        (slot = num_find(d, numId)) != NULL)
+      num_remove(d, slot);
+    report(d, CUSTOMER_OP_UNREGISTER_ID, SmallStringData(&curr->id),
+           curr->id.len, NULL, 0, 0, 0);
+    account_user(d, curr, -1);
+    CustomerColumnsFreeRow(d->columns, curr->row);
+    free_user(curr);
+    d->numItems--;
+    STAT_ADD(d, deletes, 1);
+    filter_deleted(d);
+  }
+  if (rebuild) QuantileSketchRebuild(d->quantiles, d);
+  return removed;
+}
+/*--------------------------------------------------------------------*/
+/* Cursors walk nTable, which holds every record, a bucket at a time in
+   reverse-bit order of the bucket index: the cursor counts up from the
+   high bit down. Doubling splits bucket i into i and i + n, which both
+   come after everything already visited in that order, so a scan that
+   spans expansions neither misses nor repeats a bucket. A batch takes
+   whole chains; only a chain longer than the whole batch is split. */
+struct CustomerCursor {
+  DB_T d;
+  uint64_t pos;         /* next bucket, bit-reversed (byte offset if frozen) */
+  int skip;             /* records of that chain already returned */
+  int skipCount;        /* bucket count when skip was set */
+  int done;
+  int frozen;           /* the db was frozen when the scan started */
+};
+/*--------------------------------------------------------------------*/
+static uint64_t reverse_bits(uint64_t v)
+{
+  v = ((v >> 1) & 0x5555555555555555ULL) | ((v & 0x5555555555555555ULL) << 1);
+  v = ((v >> 2) & 0x3333333333333333ULL) | ((v & 0x3333333333333333ULL) << 2);
+  v = ((v >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((v & 0x0F0F0F0F0F0F0F0FULL) << 4);
+  v = ((v >> 8) & 0x00FF00FF00FF00FFULL) | ((v & 0x00FF00FF00FF00FFULL) << 8);
+  v = ((v >> 16) & 0x0000FFFF0000FFFFULL) | ((v & 0x0000FFFF0000FFFFULL) << 16);
+  return (v >> 32) | (v << 32);
+}
+/*--------------------------------------------------------------------*/
+static int next_batch(CustomerCursor_T c, struct CustomerView *views, int max)
+{
+  DB_T d = c->d;
+  uint64_t mask = (uint64_t)d->iBucketCount - 1;
+  struct UserInfo *curr;
+  int n = 0, len, k;
+
+  if (c->skip && c->skipCount != d->iBucketCount)
+    c->skip = 0;     /* the chain was split since: return it again */
+
+  while (!c->done && n < max) {
+    curr = d->nTable[c->pos & mask];
+    for (len = 0; curr; curr = curr->nNext) len++;
+    if (len - c->skip > max - n && n > 0)
+      break;         /* leave the chain to the next batch */
+
+    k = 0;
+    for (curr = d->nTable[c->pos & mask]; curr && n < max;
+         curr = curr->nNext, k++) {
+      if (k < c->skip) continue;
+      views[n].id = SmallStringData(&curr->id);
+      views[n].idLen = curr->id.len;
+      views[n].name = SmallStringData(&curr->name);
+      views[n].nameLen = curr->name.len;
+      views[n].purchase = curr->purchase;
+      n++;
+    }
+    if (curr) {      /* chain longer than the batch */
+      c->skip = k;
+      c->skipCount = d->iBucketCount;
+      break;
+    }
+    c->skip = 0;
+
+    /* increment the reversed bucket index */
+    c->pos = reverse_bits(reverse_bits(c->pos | ~mask) + 1);
+    if (c->pos == 0) c->done = 1;
+  }
+  return n;
+}
+/*--------------------------------------------------------------------*/
+CustomerCursor_T
+OpenCustomerCursor(DB_T d)
+{
+  CustomerCursor_T c;
+
+  if (d == NULL) return NULL;
+  c = (CustomerCursor_T)calloc(1, sizeof(struct CustomerCursor));
+  if (c == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the cursor\n");
+    return NULL;
+  }
+  c->d = d;
+  c->frozen = (d->frozen != NULL);
+  return c;
+}
+/*--------------------------------------------------------------------*/
+int
+NextCustomerBatch(CustomerCursor_T c, struct CustomerView *views, int max)
+{
+  if (c == NULL || views == NULL || max <= 0) return -1;
+  if (c->frozen != (c->d->frozen != NULL)) return -1;
+  if (c->frozen) return FrozenNextBatch(c->d->frozen, &c->pos, views, max);
+  return next_batch(c, views, max);
+}
+/*--------------------------------------------------------------------*/
+void
+CloseCustomerCursor(CustomerCursor_T c)
+{
+  free(c);
+}
+/*--------------------------------------------------------------------*/
+/* Frozen dbs (frozen_db.h): the customers are copied into an image
+   with minimal perfect hashes, then the tables are swapped for the
+   empty ones of a fresh db and the old contents are destroyed. */
+int
+FreezeCustomerDB(DB_T d)
+{
+  FrozenBuilder_T b;
+  FrozenDB_T f;
+  DB_T fresh;
+  struct DB old;
+  struct UserInfo *curr;
+  int i;
+
+  if (d == NULL || d->frozen) return -1;
+  if ((b = CreateFrozenBuilder()) == NULL) return -1;
+  for (i = 0; i < d->iBucketCount; i++) { /* every record is in nTable */
+    for (curr = d->nTable[i]; curr; curr = curr->nNext) {
+      if (FrozenBuilderAdd(b, SmallStringData(&curr->id), curr->id.len,
+                           SmallStringData(&curr->name), curr->name.len,
+                           curr->purchase) < 0) {
+        DestroyFrozenBuilder(b);
+        return -1;
+      }
+    }
+  }
+  if ((f = FrozenBuild(b)) == NULL) return -1;
+
+  fresh = CreateCustomerDB();
+  if (fresh == NULL) {
+    DestroyFrozenDB(f);
+    return -1;
+  }
+  old = *d;
+  *d = *fresh;
+  d->hook = old.hook;
+  d->hookCtx = old.hookCtx;
+  d->stats = old.stats;
+  d->frozen = f;
+  d->quantiles = old.quantiles; /* the purchases are the same */
+  old.quantiles = fresh->quantiles;
+  *fresh = old;
+  DestroyCustomerDB(fresh);
+  return 0;
+}
+
+int
+SaveFrozenCustomerDB(DB_T d, const char *path)
+{
+  if (d == NULL || d->frozen == NULL) return -1;
+  return FrozenSave(d->frozen, path);
+}
+
+DB_T
+LoadFrozenCustomerDB(const char *path)
+{
+  FrozenDB_T f;
+  DB_T d;
+
+  if ((f = FrozenLoad(path)) == NULL) return NULL;
+  d = CreateCustomerDB();
+  if (d == NULL) {
+    DestroyFrozenDB(f);
+    return NULL;
+  }
+  d->frozen = f;
+  if (QuantileSketchRebuild(d->quantiles, d) < 0) {
+    DestroyCustomerDB(d);
+    return NULL;
+  }
+  return d;
+}
+
+DB_T
+AttachCustomerDB(const char *shmName)
+{
+  (void)shmName;
+  fprintf(stderr, "Error: customer_manager2 has no shared-memory dbs\n");
+  return NULL;
+}
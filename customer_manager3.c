@@ -0,0 +1,1568 @@
+/*
+ * Program: customer_manager3.c
+ *
+ * Description:
+ * ------------
+ * This program implements the customer management system with the same two hash
+ * indexes as customer_manager2.c (`iTable` for IDs and `nTable` for names), but with a
+ * compact memory layout:
+ *
+ *    - All records live in one growable array and refer to each other by 32-bit
+ *      indices instead of 8-byte pointers. Index 0 is never used, so 0 means "none"
+ *      and freshly calloc'ed bucket arrays are empty.
+ *    - IDs and names are stored back to back in one growable string heap and records
+ *      keep 32-bit offsets into it. Every key is prefixed with its length (one byte,
+ *      or 0xFF followed by a 4-byte length for keys of 255 bytes and more) and
+ *      NUL-terminated, so it can be handed to `FUNCPTR_T` as is.
+ *    - Both bucket arrays hold 32-bit record indices.
+ *
+ * A record is 20 bytes plus its keys (each with a 1- or 5-byte length and a NUL),
+ * and a bucket 4 bytes. customer_manager2.c has an 88-byte record with keys of up to
+ * 27 bytes inline, 8-byte buckets, and a malloc header for each record and longer
+ * key. So for short keys a customer takes roughly half the memory here, and more
+ * customers fit in each cache level. The price is a 4G limit on the number of
+ * records and on the size of the string heap.
+ *
+ * Functionality:
+ * --------------
+ * 1. **Database Creation and Destruction**: `CreateCustomerDB`, `DestroyCustomerDB`.
+ *
+ * 2. **Registration and Expansion**:
+ *    - `RegisterCustomer`: Takes a record from the free list (or the end of the array),
+ *      appends both keys to the string heap and links the record into both tables.
+ *      The tables double when the load factor exceeds 75%.
+ *
+ * 3. **Unregistration**: `UnregisterCustomerByID`, `UnregisterCustomerByName` unlink
+ *    the record from both tables and put it on the free list. Its keys become garbage
+ *    in the string heap, which is compacted once garbage is half of it.
+ *
+ * 4. **Retrieval and Calculation**: `GetPurchaseByID`, `GetPurchaseByName` and
+ *    `GetSumCustomerPurchase`, the latter walking the record array in order.
+ *
+ * 5. **Hook, Memory Accounting and Statistics**: `SetCustomerDBHook`,
+ *    `GetCustomerDBMemoryUsage` and `GetCustomerDBStats` behave as in
+ *    customer_manager2.c. Unused heap space is reported as allocator overhead.
+ *
+ * 6. **Key Compression**: created with `CUSTOMER_DB_COMPRESS_KEYS`, keys shorter than
+ *    `KEY_BUF_SIZE` are stored dictionary-coded (key_dict.h): words and separators
+ *    become codes in a shared dictionary, digit runs are packed two per byte. The raw
+ *    length stays in front, so chain walks reject most candidates without decoding;
+ *    the rest are compared item by item while decoding, without a copy. Hashing and
+ *    `FUNCPTR_T` get keys decoded into stack buffers.
+ *
+ * 7. **Key Ownership**: keys always live in the string heap, so
+ *    `RegisterCustomerTakeOwnership` copies the caller's buffers and frees them, and
+ *    `RegisterCustomerPooled` copies interned keys without holding a reference.
+ *
+ * 8. **Cursors**: `OpenCustomerCursor`/`NextCustomerBatch` walk the record array by
+ *    index, decoding compressed keys into a buffer of the cursor.
+ *
+ * 9. **Bulk Removal**: `UnregisterCustomersWhere` marks the matching records in one
+ *    pass over the array, unlinks them in one sweep of each table and frees them.
+ *
+ * 10. **Shared Memory**: created with `shmName`, the record array, string heap and
+ *    tables are blocks of a POSIX shared-memory segment (shm_segment.h). Records
+ *    already use indices and heap offsets, so only the four array offsets and the
+ *    counters are published, in the segment's root, at the end of every write.
+ *    `AttachCustomerDB` maps the segment read-only in another process; its lookups
+ *    walk the chains in place under the segment's sequence lock, checking every
+ *    index and offset against the mapping. Keys are not compressed in this mode,
+ *    since the dictionary would live in the creator's private memory.
+ *
+ * 11. **Quantiles**: `GetPurchaseQuantile` answers from a KLL sketch of the purchases
+ *    (quantile_sketch.h) that registrations and unregistrations update. The sketch
+ *    is private memory too, so an attached db has none and answers -1.
+ *
+ * 12. **Attributes** (`attrCount` option): the codes and a copy of the purchases live
+ *    in columns indexed by record (customer_columns.h), in private memory as well, so
+ *    `GroupSumPurchaseBy` reads two arrays front to back instead of the records.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include "customer_manager.h"
+#include "murmurhash.h"
+#include "string_pool.h"
+#include "key_dict.h"
+#include "frozen_db.h"
+#include "shm_segment.h"
+#include "quantile_sketch.h"
+#include "customer_columns.h"
+#define INITIAL_BUCKET_COUNT 1024
+#define INITIAL_RECORD_COUNT 1024
+#define INITIAL_HEAP_SIZE 16384
+#define LOAD_FACTOR 0.75
+#define NIL 0U                    /* "no record" / "no key" */
+#define ID_SEED 0x9747b28cU       /* murmurhash seeds of the two tables */
+#define NAME_SEED 0x5bd1e995U
+#define LONG_KEY 0xFF             /* length byte of keys >= 255 bytes */
+#define KEY_BUF_SIZE 256          /* compressed keys are shorter than this */
+
+/* Statistics counters of the DB (compiled out with CUSTOMER_DB_NO_STATS) */
+#ifndef CUSTOMER_DB_NO_STATS
+#define STAT_ADD(d, field, n) ((d)->stats.field += (n))
+#else
+#define STAT_ADD(d, field, n) ((void)(n))
+#endif
+
+/*--------------------------------------------------------------------*/
+struct UserInfo {
+  uint32_t id;               /* Heap offset of the customer id */
+  uint32_t name;             /* Heap offset of the customer name */
+  uint32_t iNext;            /* Next record in id chain (next free record) */
+  uint32_t nNext;            /* Next record in name chain */
+  int purchase;              /* Purchase amount (> 0), 0 for a free record */
+};
+
+struct DB {
+  struct UserInfo *recs;     /* Record array, recs[0] is unused */
+  uint32_t recCount;         /* Records handed out so far, including recs[0] */
+  uint32_t recCap;           /* Allocated records */
+  uint32_t freeList;         /* Unregistered records, chained through iNext */
+
+  char *heap;                /* String heap, heap[0] is unused */
+  uint32_t heapUsed;         /* Bytes handed out so far */
+  uint32_t heapCap;          /* Allocated bytes */
+  uint32_t heapGarbage;      /* Bytes of keys of unregistered records */
+  KeyDict_T dict;            /* Dictionary of compressed keys, or NULL */
+
+  uint32_t *iTable;          /* ID hash table of record indices */
+  uint32_t *nTable;          /* Name hash table of record indices */
+  uint32_t iBucketCount;     /* Buckets per table, a power of two */
+  uint32_t numItems;         /* Registered customers */
+
+  size_t allocOverhead;      /* Allocator headers and rounding of our blocks */
+  HOOKFUNC_T hook;           /* Called after every API call (may be NULL) */
+  void *hookCtx;             /* First argument of hook */
+  FrozenDB_T frozen;         /* read-only contents once frozen (or NULL) */
+  ShmSegment_T shm;          /* Segment holding the arrays (or NULL) */
+  int attached;              /* Read-only view of another process's db */
+  QuantileSketch_T quantiles; /* Sketch of the purchases (NULL if attached) */
+  CustomerColumns_T columns; /* Attributes by record (NULL: none) */
+  struct CustomerDBStats stats; /* Counters, updated through STAT_ADD */
+};
+
+/* State of a shared db published at ShmRoot() at the end of each write:
+   segment offsets of the arrays and the counters that bound them */
+struct ShmRoot {
+  uint64_t recs, heap, iTable, nTable;
+  uint32_t recCount, recCap;
+  uint32_t heapUsed, heapCap, heapGarbage;
+  uint32_t iBucketCount, numItems;
+};
+/*--------------------------------------------------------------------*/
+static double now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+/*--------------------------------------------------------------------*/
+static size_t alloc_overhead(void *p, size_t size)
+
+/* Return the bytes the allocator spends on top of the 'size'-byte
+   block 'p': its chunk header and the rounding of the block size. */
+{
+#ifdef __GLIBC__
+  return malloc_usable_size(p) + sizeof(size_t) - size;
+#else
+  (void)p; (void)size;
+  return 0;
+#endif
+}
+/*--------------------------------------------------------------------*/
+static size_t block_overhead(DB_T d, void *p, size_t size)
+
+/* alloc_overhead() of an array of d; blocks of a shared segment have
+   none, its unused space is accounted as a whole */
+{
+  return d->shm ? 0 : alloc_overhead(p, size);
+}
+/*--------------------------------------------------------------------*/
+static void *db_alloc(DB_T d, size_t size, int zero)
+
+/* Allocate an array of d: from its segment if it is shared, from the
+   heap otherwise. Zero it if zero. */
+{
+  void *p;
+
+  if (d->shm == NULL) return zero ? calloc(1, size) : malloc(size);
+  p = ShmAlloc(d->shm, size);
+  if (p != NULL && zero) memset(p, 0, size);
+  return p;
+}
+/*--------------------------------------------------------------------*/
+static void db_free(DB_T d, void *p, size_t size)
+{
+  if (d->shm) ShmFree(d->shm, p, size);
+  else free(p);
+}
+/*--------------------------------------------------------------------*/
+static void *grow_array(DB_T d, void *p, size_t oldSize, size_t newSize)
+
+/* realloc() the block p of oldSize bytes to newSize bytes, keeping the
+   allocator overhead of d up to date. Return NULL on failure, in which
+   case p is unchanged. */
+{
+  void *q;
+  size_t oldOverhead;
+
+  if (d->shm) { /* the segment has no realloc */
+    if ((q = ShmAlloc(d->shm, newSize)) == NULL) return NULL;
+    memcpy(q, p, oldSize);
+    ShmFree(d->shm, p, oldSize);
+    return q;
+  }
+  oldOverhead = p ? alloc_overhead(p, oldSize) : 0;
+  q = realloc(p, newSize);
+  if (q == NULL) return NULL;
+  d->allocOverhead += alloc_overhead(q, newSize) - oldOverhead;
+  return q;
+}
+/*--------------------------------------------------------------------*/
+static const unsigned char *get_len(const unsigned char *p, size_t *len)
+
+/* Read the length prefix at p into *len and return the bytes after it */
+{
+  uint32_t n;
+
+  if (*p != LONG_KEY) {
+    *len = *p;
+    return p + 1;
+  }
+  memcpy(&n, p + 1, sizeof(n));
+  *len = n;
+  return p + 1 + sizeof(n);
+}
+/*--------------------------------------------------------------------*/
+static unsigned char *put_len(unsigned char *p, size_t len)
+
+/* Write the length prefix of len at p and return the bytes after it */
+{
+  uint32_t n = (uint32_t)len;
+
+  if (len < LONG_KEY) {
+    *p = (unsigned char)len;
+    return p + 1;
+  }
+  *p = LONG_KEY;
+  memcpy(p + 1, &n, sizeof(n));
+  return p + 1 + sizeof(n);
+}
+/*--------------------------------------------------------------------*/
+static size_t len_size(size_t len)
+{
+  return len < LONG_KEY ? 1 : 1 + sizeof(uint32_t);
+}
+/*--------------------------------------------------------------------*/
+static int compressed(DB_T d, size_t len)
+
+/* Return non-zero if a key of len bytes is stored compressed in d:
+   its length prefix is followed by the encoded length and bytes
+   instead of the key and a NUL */
+{
+  return d->dict != NULL && len < KEY_BUF_SIZE;
+}
+/*--------------------------------------------------------------------*/
+static const char *key_at(DB_T d, uint32_t off, size_t *len, char *buf)
+
+/* Return the NUL-terminated key stored at heap offset off and its
+   length in *len. A compressed key is decoded into buf (KEY_BUF_SIZE
+   bytes), any other one is returned in place. */
+{
+  const unsigned char *p = get_len((const unsigned char *)d->heap + off, len);
+  size_t encLen;
+
+  if (!compressed(d, *len)) return (const char *)p;
+  p = get_len(p, &encLen);
+  KeyDictDecode(d->dict, p, encLen, buf);
+  return buf;
+}
+/*--------------------------------------------------------------------*/
+static size_t key_size(DB_T d, uint32_t off)
+
+/* Return the heap bytes taken by the key stored at off */
+{
+  const unsigned char *p;
+  size_t len, encLen;
+
+  p = get_len((const unsigned char *)d->heap + off, &len);
+  if (!compressed(d, len)) return len_size(len) + len + 1;
+  get_len(p, &encLen);
+  return len_size(len) + len_size(encLen) + encLen;
+}
+/*--------------------------------------------------------------------*/
+static int key_equal(DB_T d, uint32_t off, const char *key, size_t len)
+
+/* The length is checked first, so most candidates are rejected
+   without looking at a compressed key. The rest is decoded item by
+   item against key, up to the first difference. */
+{
+  size_t storedLen, encLen;
+  const unsigned char *stored;
+
+  stored = get_len((const unsigned char *)d->heap + off, &storedLen);
+  if (storedLen != len) return 0;
+  if (!compressed(d, len)) return memcmp(stored, key, len) == 0;
+  stored = get_len(stored, &encLen);
+  return KeyDictEqual(d->dict, stored, encLen, key, len);
+}
+/*--------------------------------------------------------------------*/
+static uint32_t hash_key(const char *key, size_t len, uint32_t seed)
+{
+  return murmurhash(key, (uint32_t)len, seed);
+}
+/*--------------------------------------------------------------------*/
+static int compact_heap(DB_T d)
+
+/* Copy the keys of all registered customers into a fresh heap, dropping
+   the garbage left by unregistered ones. Return 0 on success, -1 if the
+   new heap can't be allocated (the old one stays valid). */
+{
+  char *heap;
+  uint32_t i, used = 1, cap = d->heapCap;
+  size_t size;
+
+  heap = (char *)db_alloc(d, cap, 0);
+  if (heap == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for heap compaction\n");
+    return -1;
+  }
+  heap[0] = '\0';
+  for (i = 1; i < d->recCount; i++) {
+    struct UserInfo *r = &d->recs[i];
+    if (r->purchase == 0) continue;
+
+    size = key_size(d, r->id);
+    memcpy(heap + used, d->heap + r->id, size);
+    r->id = used;
+    used += (uint32_t)size;
+
+    size = key_size(d, r->name);
+    memcpy(heap + used, d->heap + r->name, size);
+    r->name = used;
+    used += (uint32_t)size;
+  }
+  d->allocOverhead -= block_overhead(d, d->heap, d->heapCap);
+  db_free(d, d->heap, d->heapCap);
+  d->heap = heap;
+  d->allocOverhead += block_overhead(d, d->heap, cap);
+  d->heapUsed = used;
+  d->heapGarbage = 0;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static uint32_t store_key(DB_T d, const char *key, size_t len)
+
+/* Append key (len bytes) to the string heap, growing it if needed,
+   compressed if d compresses keys of that length. Return its offset,
+   or NIL on failure. */
+{
+  size_t size, encLen = 0;
+  uint32_t off;
+  unsigned char *p;
+  unsigned char enc[KEY_DICT_MAX_ENCODED(KEY_BUF_SIZE)];
+
+  if (compressed(d, len)) {
+    encLen = KeyDictEncode(d->dict, key, len, enc);
+    size = len_size(len) + len_size(encLen) + encLen;
+  }
+  else {
+    size = len_size(len) + len + 1;
+  }
+
+  if (len > UINT32_MAX || (uint64_t)d->heapUsed + size > UINT32_MAX) {
+    fprintf(stderr, "Error: String heap is full\n");
+    return NIL;
+  }
+  if (d->heapUsed + size > d->heapCap) {
+    uint64_t cap = (uint64_t)d->heapCap * 2;
+    char *heap;
+
+    while (cap < d->heapUsed + size) cap *= 2;
+    if (cap > UINT32_MAX) cap = UINT32_MAX;
+    heap = (char *)grow_array(d, d->heap, d->heapCap, (size_t)cap);
+    if (heap == NULL) {
+      fprintf(stderr, "Error: Can't allocate a memory for the string heap\n");
+      return NIL;
+    }
+    d->heap = heap;
+    d->heapCap = (uint32_t)cap;
+  }
+
+  off = d->heapUsed;
+  p = put_len((unsigned char *)d->heap + off, len);
+  if (compressed(d, len)) {
+    p = put_len(p, encLen);
+    memcpy(p, enc, encLen);
+  }
+  else {
+    memcpy(p, key, len);
+    p[len] = '\0';
+  }
+  d->heapUsed += (uint32_t)size;
+  return off;
+}
+/*--------------------------------------------------------------------*/
+static void release_key(DB_T d, uint32_t off)
+{
+  d->heapGarbage += (uint32_t)key_size(d, off);
+}
+/*--------------------------------------------------------------------*/
+static uint32_t alloc_record(DB_T d)
+
+/* Return the index of an unused record, growing the record array if
+   needed, or NIL on failure. */
+{
+  uint32_t i;
+
+  if (d->freeList != NIL) {
+    i = d->freeList;
+    d->freeList = d->recs[i].iNext;
+    return i;
+  }
+  if (d->recCount == d->recCap) {
+    struct UserInfo *recs;
+    uint32_t cap;
+
+    if (d->recCap >= UINT32_MAX / 2) {
+      fprintf(stderr, "Error: Record array is full\n");
+      return NIL;
+    }
+    cap = d->recCap * 2;
+    recs = (struct UserInfo *)grow_array(d, d->recs,
+                                         d->recCap * sizeof(struct UserInfo),
+                                         cap * sizeof(struct UserInfo));
+    if (recs == NULL) {
+      fprintf(stderr, "Error: Can't allocate a memory for %u records\n", cap);
+      return NIL;
+    }
+    d->recs = recs;
+    d->recCap = cap;
+  }
+  return d->recCount++;
+}
+/*--------------------------------------------------------------------*/
+static void free_record(DB_T d, uint32_t i)
+
+/* Release the keys of record i and put it on the free list. Compact
+   the string heap once half of it is garbage. */
+{
+  struct UserInfo *r = &d->recs[i];
+
+  release_key(d, r->id);
+  release_key(d, r->name);
+  r->purchase = 0;
+  r->id = r->name = NIL;
+  r->nNext = NIL;
+  r->iNext = d->freeList;
+  d->freeList = i;
+  CustomerColumnsClear(d->columns, (int)i);
+
+  if (d->heapGarbage > INITIAL_HEAP_SIZE && d->heapGarbage > d->heapUsed / 2)
+    compact_heap(d); /* on failure we just keep the garbage for now */
+}
+/*--------------------------------------------------------------------*/
+static int expand(DB_T d)
+
+/* Double both hash tables and relink every registered record.
+   Return 0 on success, -1 on allocation failure (tables unchanged). */
+{
+  uint32_t *iTable, *nTable;
+  uint32_t newCount = d->iBucketCount * 2, mask = newCount - 1, i;
+  size_t len;
+  const char *key;
+  char buf[KEY_BUF_SIZE];
+  double expandStart = now_ms();
+
+  iTable = (uint32_t *)db_alloc(d, newCount * sizeof(uint32_t), 1);
+  if (iTable == NULL) {
+    fprintf(stderr, "Error: Memory failure to expand to the tables of size %u\n",
+            newCount);
+    return -1;
+  }
+  nTable = (uint32_t *)db_alloc(d, newCount * sizeof(uint32_t), 1);
+  if (nTable == NULL) {
+    fprintf(stderr, "Error: Memory failure to expand to the tables of size %u\n",
+            newCount);
+    db_free(d, iTable, newCount * sizeof(uint32_t));
+    return -1;
+  }
+
+  /* Records are all in one array: relink them in array order */
+  for (i = 1; i < d->recCount; i++) {
+    struct UserInfo *r = &d->recs[i];
+    uint32_t h;
+    if (r->purchase == 0) continue;
+
+    key = key_at(d, r->id, &len, buf);
+    h = hash_key(key, len, ID_SEED) & mask;
+    r->iNext = iTable[h];
+    iTable[h] = i;
+
+    key = key_at(d, r->name, &len, buf);
+    h = hash_key(key, len, NAME_SEED) & mask;
+    r->nNext = nTable[h];
+    nTable[h] = i;
+  }
+
+  d->allocOverhead -=
+    block_overhead(d, d->iTable, d->iBucketCount * sizeof(uint32_t)) +
+    block_overhead(d, d->nTable, d->iBucketCount * sizeof(uint32_t));
+  db_free(d, d->iTable, d->iBucketCount * sizeof(uint32_t));
+  db_free(d, d->nTable, d->iBucketCount * sizeof(uint32_t));
+  d->iTable = iTable;
+  d->nTable = nTable;
+  d->iBucketCount = newCount;
+  d->allocOverhead +=
+    block_overhead(d, d->iTable, newCount * sizeof(uint32_t)) +
+    block_overhead(d, d->nTable, newCount * sizeof(uint32_t));
+
+  STAT_ADD(d, resizes, 1);
+  STAT_ADD(d, expansionMs, now_ms() - expandStart);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static uint32_t *find_id(DB_T d, const char *id, size_t len)
+
+/* Return the link (bucket head or iNext field) that points to the
+   record with the given id, or to NIL at the end of its chain if there
+   is none. */
+{
+  uint32_t *link = &d->iTable[hash_key(id, len, ID_SEED) &
+                              (d->iBucketCount - 1)];
+
+  while (*link != NIL && !key_equal(d, d->recs[*link].id, id, len))
+    link = &d->recs[*link].iNext;
+  return link;
+}
+/*--------------------------------------------------------------------*/
+static uint32_t *find_name(DB_T d, const char *name, size_t len)
+
+/* Same as find_id, for the name chain */
+{
+  uint32_t *link = &d->nTable[hash_key(name, len, NAME_SEED) &
+                              (d->iBucketCount - 1)];
+
+  while (*link != NIL && !key_equal(d, d->recs[*link].name, name, len))
+    link = &d->recs[*link].nNext;
+  return link;
+}
+/*--------------------------------------------------------------------*/
+static void unlink_record(DB_T d, uint32_t *link, int byName)
+
+/* Remove the record *link points to from the chain it was found in
+   (name chain if byName, id chain otherwise), then from the other
+   chain, and free it. */
+{
+  uint32_t i = *link, *other;
+  struct UserInfo *r = &d->recs[i];
+  int purchase = r->purchase;
+  size_t len;
+  const char *key;
+  char buf[KEY_BUF_SIZE];
+
+  if (byName) {
+    *link = r->nNext;
+    key = key_at(d, r->id, &len, buf);
+    other = &d->iTable[hash_key(key, len, ID_SEED) & (d->iBucketCount - 1)];
+    while (*other != i) other = &d->recs[*other].iNext;
+    *other = r->iNext;
+  }
+  else {
+    *link = r->iNext;
+    key = key_at(d, r->name, &len, buf);
+    other = &d->nTable[hash_key(key, len, NAME_SEED) & (d->iBucketCount - 1)];
+    while (*other != i) other = &d->recs[*other].nNext;
+    *other = r->nNext;
+  }
+  free_record(d, i);
+  d->numItems--;
+  STAT_ADD(d, deletes, 1);
+
+  /* rebuild the sketch once the removals outnumber the customers left */
+  if (QuantileSketchRemove(d->quantiles, purchase) == 1)
+    QuantileSketchRebuild(d->quantiles, d);
+}
+/*--------------------------------------------------------------------*/
+static void shm_write_begin(DB_T d)
+
+/* Start a change of a shared db: its readers wait or retry until the
+   matching shm_write_end() */
+{
+  if (d != NULL && d->shm != NULL && !d->attached) ShmWriteBegin(d->shm);
+}
+/*--------------------------------------------------------------------*/
+static void shm_write_end(DB_T d)
+
+/* Publish where the arrays of a shared db are now and how far they are
+   used, then end the change */
+{
+  struct ShmRoot *r;
+
+  if (d == NULL || d->shm == NULL || d->attached) return;
+  r = (struct ShmRoot *)ShmRoot(d->shm);
+  r->recs = ShmOffset(d->shm, d->recs);
+  r->heap = ShmOffset(d->shm, d->heap);
+  r->iTable = ShmOffset(d->shm, d->iTable);
+  r->nTable = ShmOffset(d->shm, d->nTable);
+  r->recCount = d->recCount;
+  r->recCap = d->recCap;
+  r->heapUsed = d->heapUsed;
+  r->heapCap = d->heapCap;
+  r->heapGarbage = d->heapGarbage;
+  r->iBucketCount = d->iBucketCount;
+  r->numItems = d->numItems;
+  ShmWriteEnd(d->shm);
+}
+/*--------------------------------------------------------------------*/
+DB_T
+CreateCustomerDB(void)
+{
+  return CreateCustomerDBEx(NULL);
+}
+/*--------------------------------------------------------------------*/
+DB_T
+CreateCustomerDBEx(const struct CustomerDBOptions *options)
+{
+  DB_T d;
+
+  d = (DB_T) calloc(1, sizeof(struct DB));
+  if (d == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for DB_T\n");
+    return NULL;
+  }
+  d->iBucketCount = INITIAL_BUCKET_COUNT;
+  d->recCap = INITIAL_RECORD_COUNT;
+  d->heapCap = INITIAL_HEAP_SIZE;
+  if (options && options->shmName) {
+    if ((d->shm = ShmCreate(options->shmName)) == NULL) {
+      free(d);
+      return NULL;
+    }
+  }
+
+  d->iTable = (uint32_t *)db_alloc(d, d->iBucketCount * sizeof(uint32_t), 1);
+  d->nTable = (uint32_t *)db_alloc(d, d->iBucketCount * sizeof(uint32_t), 1);
+  d->recs = (struct UserInfo *)db_alloc(d, d->recCap * sizeof(struct UserInfo),
+                                        1);
+  d->heap = (char *)db_alloc(d, d->heapCap, 0);
+  if (options && (options->flags & CUSTOMER_DB_COMPRESS_KEYS) && !d->shm)
+    d->dict = CreateKeyDict();
+  if (d->iTable == NULL || d->nTable == NULL || d->recs == NULL ||
+      d->heap == NULL ||
+      (options && (options->flags & CUSTOMER_DB_COMPRESS_KEYS) && !d->shm &&
+       d->dict == NULL)) {
+    fprintf(stderr, "Error: Can't allocate a memory for the tables\n");
+    if (d->shm) {
+      ShmClose(d->shm);
+    } else {
+      free(d->iTable);
+      free(d->nTable);
+      free(d->recs);
+      free(d->heap);
+      DestroyKeyDict(d->dict);
+    }
+    free(d);
+    return NULL;
+  }
+  d->recCount = 1;  /* recs[0] is the NIL record */
+  d->heap[0] = '\0';
+  d->heapUsed = 1;  /* offset 0 is the NIL key */
+  if ((d->quantiles = CreateQuantileSketch()) == NULL) {
+    DestroyCustomerDB(d);
+    return NULL;
+  }
+  if (options && options->attrCount > 0) {
+    d->columns = CreateCustomerColumns(options->attrCount,
+                                       options->scanThreads);
+    if (d->columns == NULL) {
+      fprintf(stderr, "Error: Can't create %d attribute columns\n",
+              options->attrCount);
+      DestroyCustomerDB(d);
+      return NULL;
+    }
+  }
+
+  d->allocOverhead =
+    alloc_overhead(d, sizeof(struct DB)) +
+    block_overhead(d, d->iTable, d->iBucketCount * sizeof(uint32_t)) +
+    block_overhead(d, d->nTable, d->iBucketCount * sizeof(uint32_t)) +
+    block_overhead(d, d->recs, d->recCap * sizeof(struct UserInfo)) +
+    block_overhead(d, d->heap, d->heapCap);
+  shm_write_begin(d); /* publish the empty db */
+  shm_write_end(d);
+  return d;
+}
+/*--------------------------------------------------------------------*/
+DB_T
+AttachCustomerDB(const char *shmName)
+{
+  DB_T d;
+
+  d = (DB_T) calloc(1, sizeof(struct DB));
+  if (d == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for DB_T\n");
+    return NULL;
+  }
+  if ((d->shm = ShmAttach(shmName)) == NULL) {
+    free(d);
+    return NULL;
+  }
+  d->attached = 1;
+  return d;
+}
+/*--------------------------------------------------------------------*/
+void
+DestroyCustomerDB(DB_T d)
+{
+  if (d == NULL) return; /* No need to destroy an empty database */
+
+  /* Records and keys are not allocated one by one */
+  if (d->shm) {
+    ShmClose(d->shm); /* unmaps the arrays, or our view of them */
+  } else {
+    free(d->iTable);
+    free(d->nTable);
+    free(d->recs);
+    free(d->heap);
+  }
+  DestroyKeyDict(d->dict);
+  DestroyFrozenDB(d->frozen);
+  DestroyQuantileSketch(d->quantiles);
+  DestroyCustomerColumns(d->columns);
+  free(d);
+}
+/*--------------------------------------------------------------------*/
+static int frozen_lookup(DB_T d, int byName, const char *key, size_t len)
+
+/* Look the len-byte id (or name, if byName) up in the frozen image of
+   d, counting it like a table lookup. */
+{
+  int purchase = FrozenGetPurchase(d->frozen, byName, key, len);
+
+  STAT_ADD(d, lookups, 1);
+  STAT_ADD(d, probes, 1);
+  if (purchase < 0) STAT_ADD(d, misses, 1);
+  else STAT_ADD(d, hits, 1);
+  return purchase;
+}
+/*--------------------------------------------------------------------*/
+static uint32_t shm_load(const uint32_t *p)
+
+/* Read a field another process may be writing: exactly once, so that
+   a value checked against the bounds is the value used */
+{
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+/*--------------------------------------------------------------------*/
+static int shm_root(DB_T d, struct ShmRoot *r)
+
+/* Copy the published state of an attached db into r and check that
+   its arrays lie inside the mapping. Return 0 if they do, -1 if a
+   write in progress left it inconsistent. */
+{
+  memcpy(r, ShmRoot(d->shm), sizeof(*r));
+  if (r->iBucketCount == 0 || (r->iBucketCount & (r->iBucketCount - 1)) ||
+      r->recCount > r->recCap || r->heapUsed > r->heapCap)
+    return -1;
+  if (!ShmContains(d->shm, r->recs,
+                   (uint64_t)r->recCap * sizeof(struct UserInfo)) ||
+      !ShmContains(d->shm, r->heap, r->heapCap) ||
+      !ShmContains(d->shm, r->iTable,
+                   (uint64_t)r->iBucketCount * sizeof(uint32_t)) ||
+      !ShmContains(d->shm, r->nTable,
+                   (uint64_t)r->iBucketCount * sizeof(uint32_t)))
+    return -1;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static const char *shm_key(const struct ShmRoot *r, const char *heap,
+                           uint32_t off, size_t *len)
+
+/* Return the key at heap offset off of an attached db and its length
+   in *len, or NULL if it doesn't fit in the heap */
+{
+  const unsigned char *p = (const unsigned char *)heap + off;
+  size_t room;
+
+  if (off == NIL || off >= r->heapCap) return NULL;
+  room = r->heapCap - off;
+  if (*p == LONG_KEY && room < 1 + sizeof(uint32_t)) return NULL;
+  p = get_len(p, len);
+  room -= len_size(*len);
+  return *len < room ? (const char *)p : NULL; /* key and its NUL */
+}
+/*--------------------------------------------------------------------*/
+static int shm_find(DB_T d, const struct ShmRoot *r, int byName,
+                    const char *key, size_t len, uint32_t h)
+
+/* Walk the chain of key in the arrays r describes. The walk is bounded
+   by numItems, so a chain a concurrent write left cyclic ends too. */
+{
+  const struct UserInfo *recs = ShmPointer(d->shm, r->recs);
+  const char *heap = ShmPointer(d->shm, r->heap), *stored;
+  const uint32_t *table = ShmPointer(d->shm, byName ? r->nTable : r->iTable);
+  uint32_t i, steps;
+  size_t storedLen;
+  int purchase;
+
+  i = shm_load(&table[h & (r->iBucketCount - 1)]);
+  for (steps = 0; i != NIL && i < r->recCount && steps <= r->numItems;
+       steps++) {
+    STAT_ADD(d, probes, 1);
+    stored = shm_key(r, heap,
+                     shm_load(byName ? &recs[i].name : &recs[i].id),
+                     &storedLen);
+    if (stored && storedLen == len && memcmp(stored, key, len) == 0) {
+      purchase = __atomic_load_n(&recs[i].purchase, __ATOMIC_RELAXED);
+      return purchase > 0 ? purchase : -1;
+    }
+    i = shm_load(byName ? &recs[i].nNext : &recs[i].iNext);
+  }
+  return -1;
+}
+/*--------------------------------------------------------------------*/
+static int shm_lookup(DB_T d, int byName, const char *key, size_t len)
+
+/* Look the len-byte id (or name, if byName) up in an attached db,
+   repeating the walk until no write overlapped it */
+{
+  struct ShmRoot r;
+  uint32_t h = hash_key(key, len, byName ? NAME_SEED : ID_SEED);
+  uint64_t seq;
+  int purchase;
+
+  STAT_ADD(d, lookups, 1);
+  do {
+    seq = ShmReadBegin(d->shm);
+    purchase = shm_root(d, &r) < 0 ? -1 : shm_find(d, &r, byName, key,
+                                                   len, h);
+  } while (ShmReadRetry(d->shm, seq));
+  if (purchase < 0) STAT_ADD(d, misses, 1);
+  else STAT_ADD(d, hits, 1);
+  return purchase;
+}
+/*--------------------------------------------------------------------*/
+static int shm_copy_key(const struct ShmRoot *r, const char *heap,
+                        uint32_t off, char **buf, size_t *bufSize)
+
+/* Copy the key at heap offset off of an attached db into *buf, growing
+   it as needed, so that fp never sees bytes a write is changing.
+   Return -1 if the key doesn't fit in the heap or *buf can't grow. */
+{
+  const char *key;
+  size_t len;
+
+  if ((key = shm_key(r, heap, off, &len)) == NULL) return -1;
+  if (len + 1 > *bufSize) {
+    char *p = (char *)realloc(*buf, len + 1);
+    if (p == NULL) return -1;
+    *buf = p;
+    *bufSize = len + 1;
+  }
+  memcpy(*buf, key, len);
+  (*buf)[len] = '\0';
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int shm_sum(DB_T d, FUNCPTR_T fp)
+
+/* GetSumCustomerPurchase() of an attached db: walk the record array in
+   place, copying each customer's keys out before calling fp, and
+   start over if a write overlapped the walk */
+{
+  struct ShmRoot r;
+  const struct UserInfo *recs;
+  const char *heap;
+  char *id = NULL, *name = NULL;
+  size_t idSize = 0, nameSize = 0;
+  uint64_t seq;
+  uint32_t i;
+  int total, purchase;
+
+  do {
+    seq = ShmReadBegin(d->shm);
+    total = 0;
+    if (shm_root(d, &r) < 0) continue;
+    recs = ShmPointer(d->shm, r.recs);
+    heap = ShmPointer(d->shm, r.heap);
+    for (i = 1; i < r.recCount; i++) {
+      purchase = __atomic_load_n(&recs[i].purchase, __ATOMIC_RELAXED);
+      if (purchase <= 0) continue;
+      if (shm_copy_key(&r, heap, shm_load(&recs[i].id), &id, &idSize) < 0 ||
+          shm_copy_key(&r, heap, shm_load(&recs[i].name),
+                       &name, &nameSize) < 0)
+        break;
+      if (ShmReadRetry(d->shm, seq)) break; /* don't pass on torn keys */
+      total += fp(id, name, purchase);
+    }
+  } while (ShmReadRetry(d->shm, seq));
+  free(id);
+  free(name);
+  return total;
+}
+/*--------------------------------------------------------------------*/
+static void shm_counters(DB_T d)
+
+/* Copy the counters of the creator's db into the attached db d (its
+   arrays stay unmapped in d) */
+{
+  struct ShmRoot r;
+  uint64_t seq;
+
+  do {
+    seq = ShmReadBegin(d->shm);
+    memcpy(&r, ShmRoot(d->shm), sizeof(r));
+  } while (ShmReadRetry(d->shm, seq));
+  d->recCount = r.recCount;
+  d->recCap = r.recCap;
+  d->heapUsed = r.heapUsed;
+  d->heapCap = r.heapCap;
+  d->heapGarbage = r.heapGarbage;
+  d->iBucketCount = r.iBucketCount;
+  d->numItems = r.numItems;
+}
+/*--------------------------------------------------------------------*/
+static int
+register_customer(DB_T d, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, const int purchase)
+{
+  uint32_t *iLink, *nLink, i, idOff, nameOff;
+  struct UserInfo *r;
+
+  if (d == NULL || id == NULL || name == NULL || purchase <= 0) return -1;
+  if (d->frozen || d->attached) return -1; /* read-only db */
+
+  /* Checking whether the id or the name already exist */
+  if (*find_id(d, id, idLen) != NIL || *find_name(d, name, nameLen) != NIL)
+    return -1;
+
+  /* Expand first so that the new record goes straight to its final
+     bucket; a failed expansion only leaves the chains longer */
+  if (d->numItems >= LOAD_FACTOR * d->iBucketCount &&
+      d->iBucketCount < (1U << 31))
+    expand(d);
+
+  if ((i = alloc_record(d)) == NIL) return -1;
+  if ((d->columns && CustomerColumnsSet(d->columns, (int)i, purchase) < 0) ||
+      (idOff = store_key(d, id, idLen)) == NIL) {
+    CustomerColumnsClear(d->columns, (int)i);
+    d->recs[i].iNext = d->freeList; /* Give the record back */
+    d->freeList = i;
+    return -1;
+  }
+  if ((nameOff = store_key(d, name, nameLen)) == NIL) {
+    release_key(d, idOff);
+    CustomerColumnsClear(d->columns, (int)i);
+    d->recs[i].iNext = d->freeList;
+    d->freeList = i;
+    return -1;
+  }
+
+  /* Link the record at the front of both chains */
+  iLink = &d->iTable[hash_key(id, idLen, ID_SEED) & (d->iBucketCount - 1)];
+  nLink = &d->nTable[hash_key(name, nameLen, NAME_SEED) &
+                     (d->iBucketCount - 1)];
+  r = &d->recs[i];
+  r->id = idOff;
+  r->name = nameOff;
+  r->purchase = purchase;
+  r->iNext = *iLink;
+  r->nNext = *nLink;
+  *iLink = i;
+  *nLink = i;
+
+  d->numItems++;
+  STAT_ADD(d, inserts, 1);
+  QuantileSketchAdd(d->quantiles, purchase);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int
+unregister_by_id(DB_T d, const char *id, size_t idLen)
+{
+  uint32_t *link;
+
+  if (d == NULL || id == NULL) return -1; /* Nothing to delete */
+  if (d->frozen || d->attached) return -1; /* read-only db */
+
+  link = find_id(d, id, idLen);
+  if (*link == NIL) return -1; /* id doesn't exist */
+  unlink_record(d, link, 0);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int
+unregister_by_name(DB_T d, const char *name, size_t nameLen)
+{
+  uint32_t *link;
+
+  if (d == NULL || name == NULL) return -1; /* Nothing to delete */
+  if (d->frozen || d->attached) return -1; /* read-only db */
+
+  link = find_name(d, name, nameLen);
+  if (*link == NIL) return -1; /* name doesn't exist */
+  unlink_record(d, link, 1);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int
+get_purchase_by_id(DB_T d, const char *id, size_t len)
+{
+  uint32_t i;
+
+  if (d == NULL || id == NULL) return -1; /* Invalid inputs */
+  if (d->frozen) return frozen_lookup(d, 0, id, len);
+  if (d->attached) return shm_lookup(d, 0, id, len);
+
+  STAT_ADD(d, lookups, 1);
+  i = d->iTable[hash_key(id, len, ID_SEED) & (d->iBucketCount - 1)];
+  while (i != NIL) { /* Iterating the id chain */
+    STAT_ADD(d, probes, 1);
+    if (key_equal(d, d->recs[i].id, id, len)) {
+      STAT_ADD(d, hits, 1);
+      return d->recs[i].purchase;
+    }
+    i = d->recs[i].iNext;
+  }
+  STAT_ADD(d, misses, 1);
+  return -1; /* No item of such id */
+}
+/*--------------------------------------------------------------------*/
+static int
+get_purchase_by_name(DB_T d, const char *name, size_t len)
+{
+  uint32_t i;
+
+  if (d == NULL || name == NULL) return -1; /* Invalid inputs */
+  if (d->frozen) return frozen_lookup(d, 1, name, len);
+  if (d->attached) return shm_lookup(d, 1, name, len);
+
+  STAT_ADD(d, lookups, 1);
+  i = d->nTable[hash_key(name, len, NAME_SEED) & (d->iBucketCount - 1)];
+  while (i != NIL) { /* Iterating the name chain */
+    STAT_ADD(d, probes, 1);
+    if (key_equal(d, d->recs[i].name, name, len)) {
+      STAT_ADD(d, hits, 1);
+      return d->recs[i].purchase;
+    }
+    i = d->recs[i].nNext;
+  }
+  STAT_ADD(d, misses, 1);
+  return -1; /* No item of such name */
+}
+/*--------------------------------------------------------------------*/
+static int
+get_sum_customer_purchase(DB_T d, FUNCPTR_T fp)
+{
+  uint32_t i;
+  size_t len;
+  int total = 0;
+  char idBuf[KEY_BUF_SIZE], nameBuf[KEY_BUF_SIZE];
+
+  if (d == NULL || fp == NULL) return -1; /* Invalid inputs */
+  if (d->frozen) return FrozenSum(d->frozen, fp);
+  if (d->attached) return shm_sum(d, fp);
+
+  /* The record array is dense: walk it in order and skip free records */
+  for (i = 1; i < d->recCount; i++) {
+    struct UserInfo *r = &d->recs[i];
+    if (r->purchase == 0) continue;
+    total += fp(key_at(d, r->id, &len, idBuf),
+                key_at(d, r->name, &len, nameBuf), r->purchase);
+  }
+  return total;
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBOptions(DB_T d, struct CustomerDBOptions *options)
+{
+  if (d == NULL || options == NULL) return -1;
+  memset(options, 0, sizeof(*options));
+  if (d->dict) options->flags |= CUSTOMER_DB_COMPRESS_KEYS;
+  CustomerColumnsGetOptions(d->columns, options);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBMemoryUsage(DB_T d, struct CustomerDBMemoryUsage *usage)
+{
+  if (d == NULL || usage == NULL) return -1; /* Invalid inputs */
+  if (d->attached) shm_counters(d); /* the creator's current counters */
+
+  usage->records = (size_t)d->numItems * sizeof(struct UserInfo) +
+                   CustomerColumnsMemory(d->columns);
+  usage->keys = d->heapUsed - 1 - d->heapGarbage + KeyDictMemory(d->dict);
+  usage->buckets = 2 * (size_t)d->iBucketCount * sizeof(uint32_t) +
+                   (size_t)(d->recCap - d->numItems) * sizeof(struct UserInfo) +
+                   QuantileSketchMemory(d->quantiles);
+  /* Garbage and unused heap space count as allocator overhead */
+  usage->overhead = d->allocOverhead + 1 + d->heapGarbage +
+                    (d->heapCap - d->heapUsed);
+  if (d->shm) { /* and so does the segment space between the arrays */
+    size_t unused;
+    ShmMemory(d->shm, NULL, &unused);
+    usage->overhead += unused;
+  }
+  if (d->frozen) { /* the image replaces the (empty) tables */
+    size_t records, keys, index;
+    FrozenMemory(d->frozen, &records, &keys, &index);
+    usage->records += records;
+    usage->keys += keys;
+    usage->buckets += index;
+  }
+  usage->total = sizeof(struct DB) + usage->records + usage->keys +
+                 usage->buckets + usage->overhead;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+GetPurchaseQuantile(DB_T d, double q)
+{
+  if (d == NULL) return -1;
+  return QuantileSketchQuery(d->quantiles, q);
+}
+/*--------------------------------------------------------------------*/
+/* Attributes: d->columns is indexed by record. An attached db has no
+   columns (they are the creator's private memory), and neither has a
+   frozen one, as its image keeps only ids, names and purchases. */
+int
+SetCustomerAttr(DB_T d, const char *id, int attr, int code)
+{
+  uint32_t i;
+
+  if (d == NULL || id == NULL || d->columns == NULL) return -1;
+  if ((i = *find_id(d, id, strlen(id))) == NIL) return -1;
+  return CustomerColumnsSetAttr(d->columns, (int)i, attr, code);
+}
+
+int
+GetCustomerAttr(DB_T d, const char *id, int attr)
+{
+  uint32_t i;
+
+  if (d == NULL || id == NULL || d->columns == NULL) return -1;
+  if ((i = *find_id(d, id, strlen(id))) == NIL) return -1;
+  return CustomerColumnsGetAttr(d->columns, (int)i, attr);
+}
+
+int
+GroupSumPurchaseBy(DB_T d, int attr, long out[CUSTOMER_ATTR_CODES])
+{
+  if (d == NULL || d->columns == NULL) return -1;
+  return CustomerColumnsGroupSum(d->columns, attr, out);
+}
+/*--------------------------------------------------------------------*/
+static void chain_stats(DB_T d, const uint32_t *table, int byName,
+                        unsigned long *hist, double *avg, int *max)
+
+/* Walk every bucket of table and fill its occupancy histogram, the
+   average length of the non-empty chains and the longest chain. */
+{
+  unsigned long used = 0, items = 0;
+  uint32_t b, i;
+  int len;
+
+  *max = 0;
+  for (b = 0; b < d->iBucketCount; b++) {
+    len = 0;
+    for (i = table[b]; i != NIL;
+         i = byName ? d->recs[i].nNext : d->recs[i].iNext)
+      len++;
+    hist[len < CUSTOMER_STATS_HIST ? len : CUSTOMER_STATS_HIST - 1]++;
+    if (len > 0) used++;
+    if (len > *max) *max = len;
+    items += len;
+  }
+  *avg = used ? (double)items / used : 0.0;
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBStats(DB_T d, struct CustomerDBStats *stats)
+{
+  if (d == NULL || stats == NULL) return -1; /* Invalid inputs */
+
+  *stats = d->stats;
+  memset(stats->idHistogram, 0, sizeof(stats->idHistogram));
+  memset(stats->nameHistogram, 0, sizeof(stats->nameHistogram));
+  if (d->attached) return 0; /* the chains are the creator's */
+  chain_stats(d, d->iTable, 0, stats->idHistogram,
+              &stats->avgIdChain, &stats->maxIdChain);
+  chain_stats(d, d->nTable, 1, stats->nameHistogram,
+              &stats->avgNameChain, &stats->maxNameChain);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int report(DB_T d, int type, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, int purchase, int result)
+
+/* Pass a finished API call to the hook of d, if one is installed,
+   and return its result unchanged. */
+{
+  struct CustomerOp op;
+
+  if (d == NULL || d->hook == NULL) return result;
+
+  op.type = type;
+  op.id = id;
+  op.idLen = id ? idLen : 0;
+  op.name = name;
+  op.nameLen = name ? nameLen : 0;
+  op.purchase = purchase;
+  op.result = result;
+  d->hook(d->hookCtx, &op);
+  return result;
+}
+/*--------------------------------------------------------------------*/
+int
+SetCustomerDBHook(DB_T d, HOOKFUNC_T hook, void *ctx)
+{
+  if (d == NULL) return -1;
+  d->hook = hook;
+  d->hookCtx = ctx;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+/* No memory limit here: nothing is ever evicted, so fn is never called */
+int
+SetCustomerDBEvictCallback(DB_T d, EVICTFUNC_T fn, void *ctx)
+{
+  (void)fn; (void)ctx;
+  return d == NULL ? -1 : 0;
+}
+/*--------------------------------------------------------------------*/
+/* Public entry points: run the operation, then report it to the hook.
+   The NUL-terminated variants measure their keys and call the ...N
+   variants. Changes of a shared db are bracketed for its readers. */
+int
+RegisterCustomerN(DB_T d, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, const int purchase)
+{
+  int result;
+
+  shm_write_begin(d);
+  result = register_customer(d, id, idLen, name, nameLen, purchase);
+  shm_write_end(d);
+  return report(d, CUSTOMER_OP_REGISTER, id, idLen, name, nameLen, purchase,
+                result);
+}
+
+int
+RegisterCustomerTakeOwnership(DB_T d, char *id, char *name, const int purchase)
+{
+  int result = RegisterCustomer(d, id, name, purchase);
+
+  if (result == 0) { /* both keys were copied into the string heap */
+    free(id);
+    free(name);
+  }
+  return result;
+}
+
+int
+RegisterCustomerPooled(DB_T d, const char *id, const char *name,
+                       const int purchase)
+{
+  /* the string heap keeps its own copy, no reference is held */
+  return RegisterCustomerN(d, id, StringPoolLength(id),
+                           name, StringPoolLength(name), purchase);
+}
+
+int
+UnregisterCustomerByIDN(DB_T d, const char *id, size_t idLen)
+{
+  int result;
+
+  shm_write_begin(d);
+  result = unregister_by_id(d, id, idLen);
+  shm_write_end(d);
+  return report(d, CUSTOMER_OP_UNREGISTER_ID, id, idLen, NULL, 0, 0, result);
+}
+
+int
+UnregisterCustomerByNameN(DB_T d, const char *name, size_t nameLen)
+{
+  int result;
+
+  shm_write_begin(d);
+  result = unregister_by_name(d, name, nameLen);
+  shm_write_end(d);
+  return report(d, CUSTOMER_OP_UNREGISTER_NAME, NULL, 0, name, nameLen, 0,
+                result);
+}
+
+int
+GetPurchaseByIDN(DB_T d, const char *id, size_t idLen)
+{
+  return report(d, CUSTOMER_OP_GET_ID, id, idLen, NULL, 0, 0,
+                get_purchase_by_id(d, id, idLen));
+}
+
+int
+GetPurchaseByNameN(DB_T d, const char *name, size_t nameLen)
+{
+  return report(d, CUSTOMER_OP_GET_NAME, NULL, 0, name, nameLen, 0,
+                get_purchase_by_name(d, name, nameLen));
+}
+
+int
+RegisterCustomer(DB_T d, const char *id, const char *name, const int purchase)
+{
+  return RegisterCustomerN(d, id, id ? strlen(id) : 0,
+                           name, name ? strlen(name) : 0, purchase);
+}
+
+int
+UnregisterCustomerByID(DB_T d, const char *id)
+{
+  return UnregisterCustomerByIDN(d, id, id ? strlen(id) : 0);
+}
+
+int
+UnregisterCustomerByName(DB_T d, const char *name)
+{
+  return UnregisterCustomerByNameN(d, name, name ? strlen(name) : 0);
+}
+
+int
+GetPurchaseByID(DB_T d, const char* id)
+{
+  return GetPurchaseByIDN(d, id, id ? strlen(id) : 0);
+}
+
+int
+GetPurchaseByName(DB_T d, const char* name)
+{
+  return GetPurchaseByNameN(d, name, name ? strlen(name) : 0);
+}
+
+int
+GetSumCustomerPurchase(DB_T d, FUNCPTR_T fp)
+{
+  return report(d, CUSTOMER_OP_SUM, NULL, 0, NULL, 0, 0,
+                get_sum_customer_purchase(d, fp));
+}
+/*--------------------------------------------------------------------*/
+/* Bulk removal: one pass over the record array evaluates pred and marks
+   the matches with a negative purchase, one sweep of each table unlinks
+   the marked records, and a last pass frees them. Every removed
+   customer is reported to the hook as an unregistration by id, so a
+   trace replays to the same contents. The quantile sketch is rebuilt,
+   if due, at the end. */
+int
+UnregisterCustomersWhere(DB_T d, FUNCPTR_T pred)
+{
+  uint32_t i, *link;
+  size_t len;
+  int removed = 0, rebuild = 0;
+  char idBuf[KEY_BUF_SIZE], nameBuf[KEY_BUF_SIZE];
+  const char *id;
+
+  if (d == NULL || pred == NULL) return -1; /* Invalid inputs */
+  if (d->frozen || d->attached) return -1; /* read-only db */
+
+  shm_write_begin(d); /* marking already hides customers from readers */
+  for (i = 1; i < d->recCount; i++) {
+    struct UserInfo *r = &d->recs[i];
+    if (r->purchase <= 0) continue;
+    if (pred(key_at(d, r->id, &len, idBuf),
+             key_at(d, r->name, &len, nameBuf), r->purchase)) {
+      if (QuantileSketchRemove(d->quantiles, r->purchase) == 1) rebuild = 1;
+      r->purchase = -1;
+      removed++;
+    }
+  }
+  if (removed == 0) {
+    shm_write_end(d);
+    return 0;
+  }
+
+  for (i = 0; i < d->iBucketCount; i++) {
+    for (link = &d->iTable[i]; *link != NIL; ) {
+      if (d->recs[*link].purchase < 0) *link = d->recs[*link].iNext;
+      else link = &d->recs[*link].iNext;
+    }
+    for (link = &d->nTable[i]; *link != NIL; ) {
+      if (d->recs[*link].purchase < 0) *link = d->recs[*link].nNext;
+      else link = &d->recs[*link].nNext;
+    }
+  }
+
+  for (i = 1; i < d->recCount; i++) {
+    if (d->recs[i].purchase >= 0) continue;
+    id = key_at(d, d->recs[i].id, &len, idBuf);
+    report(d, CUSTOMER_OP_UNREGISTER_ID, id, len, NULL, 0, 0, 0);
+    free_record(d, i);
+    d->numItems--;
+    STAT_ADD(d, deletes, 1);
+  }
+  if (rebuild) QuantileSketchRebuild(d->quantiles, d);
+  shm_write_end(d);
+  return removed;
+}
+/*--------------------------------------------------------------------*/
+/* Cursors walk the record array by index. Unregistered records only go
+   to the free list, so no record moves while a scan is open. Compressed
+   keys are decoded into the cursor's buffer, which is why views live
+   only until the next batch. */
+struct CustomerCursor {
+  DB_T d;
+  uint64_t pos;              /* next record (byte offset when frozen) */
+  int frozen;                /* the db was frozen when the scan started */
+  char *buf;                 /* decoded keys of the last batch */
+  size_t bufSize;
+};
+/*--------------------------------------------------------------------*/
+static int next_batch(CustomerCursor_T c, struct CustomerView *views, int max)
+{
+  DB_T d = c->d;
+  struct UserInfo *r;
+  char *buf = NULL;
+  int n = 0;
+
+  if (d->dict != NULL) {
+    size_t need = 2 * (size_t)max * KEY_BUF_SIZE;
+    if (need > c->bufSize) {
+      char *p = (char *)realloc(c->buf, need);
+      if (p == NULL) {
+        fprintf(stderr, "Error: Can't allocate a memory for the cursor\n");
+        return -1;
+      }
+      c->buf = p;
+      c->bufSize = need;
+    }
+    buf = c->buf;
+  }
+
+  if (c->pos == 0) c->pos = 1;     /* recs[0] is unused */
+  for (; n < max && c->pos < d->recCount; c->pos++) {
+    r = &d->recs[c->pos];
+    if (r->purchase == 0) continue;
+    views[n].id = key_at(d, r->id, &views[n].idLen,
+                         buf ? buf + 2 * n * KEY_BUF_SIZE : NULL);
+    views[n].name = key_at(d, r->name, &views[n].nameLen,
+                           buf ? buf + (2 * n + 1) * KEY_BUF_SIZE : NULL);
+    views[n].purchase = r->purchase;
+    n++;
+  }
+  return n;
+}
+/*--------------------------------------------------------------------*/
+CustomerCursor_T
+OpenCustomerCursor(DB_T d)
+{
+  CustomerCursor_T c;
+
+  if (d == NULL) return NULL;
+  c = (CustomerCursor_T)calloc(1, sizeof(struct CustomerCursor));
+  if (c == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the cursor\n");
+    return NULL;
+  }
+  c->d = d;
+  c->frozen = (d->frozen != NULL);
+  return c;
+}
+/*--------------------------------------------------------------------*/
+int
+NextCustomerBatch(CustomerCursor_T c, struct CustomerView *views, int max)
+{
+  if (c == NULL || views == NULL || max <= 0 || c->d->attached) return -1;
+  if (c->frozen != (c->d->frozen != NULL)) return -1;
+  if (c->frozen) return FrozenNextBatch(c->d->frozen, &c->pos, views, max);
+  return next_batch(c, views, max);
+}
+/*--------------------------------------------------------------------*/
+void
+CloseCustomerCursor(CustomerCursor_T c)
+{
+  if (c == NULL) return;
+  free(c->buf);
+  free(c);
+}
+/*--------------------------------------------------------------------*/
+/* Frozen dbs (frozen_db.h): the customers are copied into an image
+   with minimal perfect hashes, then the tables are swapped for the
+   empty ones of a fresh db and the old contents are destroyed. */
+int
+FreezeCustomerDB(DB_T d)
+{
+  FrozenBuilder_T b;
+  FrozenDB_T f;
+  DB_T fresh;
+  struct DB old;
+  char idBuf[KEY_BUF_SIZE], nameBuf[KEY_BUF_SIZE];
+  uint32_t i;
+
+  if (d == NULL || d->frozen || d->shm) return -1;
+  if ((b = CreateFrozenBuilder()) == NULL) return -1;
+  for (i = 1; i < d->recCount; i++) {
+    struct UserInfo *r = &d->recs[i];
+    const char *id, *name;
+    size_t idLen, nameLen;
+
+    if (r->purchase == 0) continue; /* free record */
+    id = key_at(d, r->id, &idLen, idBuf);
+    name = key_at(d, r->name, &nameLen, nameBuf);
+    if (FrozenBuilderAdd(b, id, idLen, name, nameLen, r->purchase) < 0) {
+      DestroyFrozenBuilder(b);
+      return -1;
+    }
+  }
+  if ((f = FrozenBuild(b)) == NULL) return -1;
+
+  fresh = CreateCustomerDB();
+  if (fresh == NULL) {
+    DestroyFrozenDB(f);
+    return -1;
+  }
+  old = *d;
+  *d = *fresh;
+  d->hook = old.hook;
+  d->hookCtx = old.hookCtx;
+  d->stats = old.stats;
+  d->frozen = f;
+  d->quantiles = old.quantiles; /* the purchases are the same */
+  old.quantiles = fresh->quantiles;
+  *fresh = old;
+  DestroyCustomerDB(fresh);
+  return 0;
+}
+
+int
+SaveFrozenCustomerDB(DB_T d, const char *path)
+{
+  if (d == NULL || d->frozen == NULL) return -1;
+  return FrozenSave(d->frozen, path);
+}
+
+DB_T
+LoadFrozenCustomerDB(const char *path)
+{
+  FrozenDB_T f;
+  DB_T d;
+
+  if ((f = FrozenLoad(path)) == NULL) return NULL;
+  d = CreateCustomerDB();
+  if (d == NULL) {
+    DestroyFrozenDB(f);
+    return NULL;
+  }
+  d->frozen = f;
+  if (QuantileSketchRebuild(d->quantiles, d) < 0) {
+    DestroyCustomerDB(d);
+    return NULL;
+  }
+  return d;
+}
@@ -0,0 +1,1273 @@
+/*
+ * Program: customer_manager4.c
+ *
+ * Description:
+ * ------------
+ * This program implements the customer management system with two bucketized cuckoo
+ * hash tables, one indexing the records by ID and one by name, so that the cost of a
+ * lookup is bounded no matter how the keys hash:
+ *
+ *    - A bucket is one 64-byte cache line with 4 slots. A slot holds a 32-bit
+ *      fingerprint of its key's hash and a pointer to the record.
+ *    - Every key has exactly two candidate buckets. The first comes from the low bits
+ *      of its 64-bit hash; the second is the first XORed with a mix of the
+ *      fingerprint, so either bucket can be computed from the other without the key
+ *      ("partial-key" cuckoo hashing).
+ *    - A few keys that found no room overflow into a small stash that is scanned only
+ *      when it is not empty.
+ *
+ * A lookup reads at most the two candidate buckets (plus the stash, which is empty in
+ * practice) and then the record whose fingerprint matches to confirm the key. A
+ * fingerprint matches a wrong key with probability 2^-32, so a miss almost never
+ * touches a record at all.
+ *
+ * Functionality:
+ * --------------
+ * 1. **Database Creation and Destruction**: `CreateCustomerDB`, `DestroyCustomerDB`.
+ *
+ * 2. **Registration and Displacement**:
+ *    - `RegisterCustomer`: Allocates a record (keys stored as in customer_manager2.c,
+ *      see small_string.h) and adds it to both tables. If both candidate buckets are
+ *      full, a breadth-first search over the alternative buckets of their entries
+ *      finds the shortest chain of moves that ends in a free slot, and the entries
+ *      on it are shifted one step. If the search gives up, the key goes to the stash.
+ *    - A table doubles when it would pass `MAX_LOAD` or when the stash is full; all
+ *      entries are re-placed from their hashes.
+ *
+ * 3. **Unregistration**: `UnregisterCustomerByID`, `UnregisterCustomerByName` clear the
+ *    record's slot in both tables. Stashed entries are moved back into their buckets
+ *    as soon as there is room.
+ *
+ * 4. **Retrieval and Calculation**: `GetPurchaseByID`, `GetPurchaseByName` and
+ *    `GetSumCustomerPurchase`, the latter walking the ID table.
+ *
+ * 5. **Hook, Memory Accounting and Statistics**: `SetCustomerDBHook`,
+ *    `GetCustomerDBMemoryUsage` and `GetCustomerDBStats` behave as in
+ *    customer_manager2.c. The "chain" statistics describe bucket occupancy (at most
+ *    `SLOTS`); stashed entries are not part of them.
+ *
+ * 6. **Key Ownership**: as in customer_manager2.c, `RegisterCustomerTakeOwnership`
+ *    adopts long malloc()ed keys and `RegisterCustomerPooled` takes references on
+ *    interned ones.
+ *
+ * 7. **Cursors**: `OpenCustomerCursor`/`NextCustomerBatch` walk the id table slot by
+ *    slot, then the stash. Inserts move customers, so a scan that overlaps them may
+ *    miss or repeat some; a scan that overlaps growth starts over.
+ *
+ * 8. **Bulk Removal**: `UnregisterCustomersWhere` clears matching slots in one sweep
+ *    of the id table and one of the name table, then rehomes stashed entries once.
+ *
+ * 9. **Quantiles**: `GetPurchaseQuantile` answers from a KLL sketch of the purchases
+ *    (quantile_sketch.h) that registrations and unregistrations update.
+ *
+ * 10. **Attributes** (`attrCount` option): each record holds a row of the attribute
+ *    columns (customer_columns.h), which keep a copy of its purchase too, so
+ *    `GroupSumPurchaseBy` reads two arrays front to back instead of the buckets.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include "customer_manager.h"
+#include "small_string.h"
+#include "frozen_db.h"
+#include "quantile_sketch.h"
+#include "customer_columns.h"
+#define SLOTS 4                    /* entries per bucket */
+#define STASH_SIZE 8               /* entries that may overflow a table */
+#define INITIAL_BUCKET_COUNT 256   /* per table, a power of two */
+#define MAX_BUCKET_COUNT (1U << 30)
+#define MAX_LOAD 0.9               /* of all slots, before a table doubles */
+#define MAX_BFS_NODES 256          /* buckets one displacement search visits */
+#define CACHE_LINE 64
+
+/* Statistics counters of the DB (compiled out with CUSTOMER_DB_NO_STATS) */
+#ifndef CUSTOMER_DB_NO_STATS
+#define STAT_ADD(d, field, n) ((d)->stats.field += (n))
+#else
+#define STAT_ADD(d, field, n) ((void)(n))
+#endif
+
+/*--------------------------------------------------------------------*/
+struct UserInfo {
+  int purchase;              /* purchase amount (> 0) */
+  int row;                   /* row in d->columns (if any) */
+  struct SmallString id;     /* customer id */
+  struct SmallString name;   /* customer name */
+};
+
+/* One cache line of a table; usr[i] is NULL for a free slot */
+struct Bucket {
+  uint32_t tag[SLOTS];            /* fingerprint (hash >> 32) of each key */
+  struct UserInfo *usr[SLOTS];
+  char pad[CACHE_LINE - SLOTS * (sizeof(uint32_t) + sizeof(void *))];
+};
+
+/* compile-time check that a bucket is exactly one cache line */
+typedef char bucket_fills_a_line[sizeof(struct Bucket) == CACHE_LINE ? 1 : -1];
+
+/* Overflow entry; the full hash gives back both candidate buckets */
+struct StashEntry {
+  uint64_t hash;
+  struct UserInfo *usr;
+};
+
+/* A cuckoo table indexing every record by one of its keys */
+struct Table {
+  struct Bucket *buckets;    /* cache-line aligned bucket array */
+  uint32_t mask;             /* bucket count - 1, the count a power of two */
+  int byName;                /* keyed by name rather than by id */
+  int stashCount;
+  struct StashEntry stash[STASH_SIZE];
+};
+
+struct DB {
+  struct Table ids;          /* records by id */
+  struct Table names;        /* the same records by name */
+  int numItems;              /* registered customers */
+  size_t keyBytes;           /* bytes of the id and name strings on the heap */
+  size_t allocOverhead;      /* allocator headers and rounding of our blocks */
+  HOOKFUNC_T hook;           /* called after every API call (may be NULL) */
+  void *hookCtx;             /* first argument of hook */
+  FrozenDB_T frozen;         /* read-only contents once frozen (or NULL) */
+  QuantileSketch_T quantiles; /* sketch of the purchases */
+  CustomerColumns_T columns; /* attributes by record row (NULL: none) */
+  struct CustomerDBStats stats; /* counters, updated through STAT_ADD */
+};
+/*--------------------------------------------------------------------*/
+static double now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+/*--------------------------------------------------------------------*/
+static size_t alloc_overhead(void *p, size_t size)
+
+/* Return the bytes the allocator spends on top of the 'size'-byte
+   block 'p': its chunk header and the rounding of the block size. */
+{
+#ifdef __GLIBC__
+  return malloc_usable_size(p) + sizeof(size_t) - size;
+#else
+  (void)p; (void)size;
+  return 0;
+#endif
+}
+/*--------------------------------------------------------------------*/
+static uint64_t hash_key(const char *key, size_t len)
+
+/* Return a 64-bit hash of the len-byte key: eight bytes at a time,
+   then the tail, then the murmur3 finalizer. The low bits pick the
+   first bucket and the high 32 bits are the fingerprint. */
+{
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  uint64_t h = 0x8445d61a4e774912ULL ^ (len * m), w;
+  size_t i;
+
+  for (i = 0; i + 8 <= len; i += 8) {
+    memcpy(&w, key + i, 8);
+    w *= m;
+    w ^= w >> 47;
+    h = (h ^ (w * m)) * m;
+  }
+  if (i < len) {
+    w = 0;
+    memcpy(&w, key + i, len - i);
+    h = (h ^ w) * m;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+/*--------------------------------------------------------------------*/
+static uint32_t alt_bucket(const struct Table *t, uint32_t b, uint32_t tag)
+
+/* Return the other candidate bucket of a key with fingerprint tag that
+   may live in bucket b. The offset is odd, so it is never b itself,
+   and applying it twice gives b back. */
+{
+  return b ^ (((tag * 0x5bd1e995U) & t->mask) | 1U);
+}
+/*--------------------------------------------------------------------*/
+static const struct SmallString *key_of(const struct Table *t,
+                                        const struct UserInfo *usr)
+{
+  return t->byName ? &usr->name : &usr->id;
+}
+/*--------------------------------------------------------------------*/
+static void account_user(DB_T d, struct UserInfo *usr, int sign)
+
+/* Add (sign > 0) or remove (sign < 0) the record usr and the heap
+   copies of its long keys to/from the memory accounting of d. Pooled
+   keys are shared with the pool and not counted. */
+{
+  size_t keys = 0;
+  size_t extra = alloc_overhead(usr, sizeof(struct UserInfo));
+
+  if (SmallStringIsHeap(&usr->id) && !SmallStringIsPooled(&usr->id)) {
+    keys += usr->id.len + 1;
+    extra += alloc_overhead((void *)SmallStringData(&usr->id), usr->id.len + 1);
+  }
+  if (SmallStringIsHeap(&usr->name) && !SmallStringIsPooled(&usr->name)) {
+    keys += usr->name.len + 1;
+    extra += alloc_overhead((void *)SmallStringData(&usr->name),
+                            usr->name.len + 1);
+  }
+
+  if (sign > 0) {
+    d->keyBytes += keys;
+    d->allocOverhead += extra;
+  }
+  else {
+    d->keyBytes -= keys;
+    d->allocOverhead -= extra;
+  }
+}
+/*--------------------------------------------------------------------*/
+static void free_user(struct UserInfo *usr)
+
+/* Release the record usr and the heap copies of its keys */
+{
+  SmallStringFree(&usr->id);
+  SmallStringFree(&usr->name);
+  free(usr);
+}
+/*--------------------------------------------------------------------*/
+static void discard_user(struct UserInfo *usr, int how)
+
+/* Release the record usr of a registration that failed, handing keys
+   stored with SmallStringStore(..., how) back to the caller */
+{
+  SmallStringUndo(&usr->id, how);
+  SmallStringUndo(&usr->name, how);
+  free(usr);
+}
+/*--------------------------------------------------------------------*/
+static struct Bucket *alloc_buckets(uint32_t count)
+
+/* Return 'count' empty buckets aligned on a cache line, NULL on failure */
+{
+  void *p;
+
+  if (posix_memalign(&p, CACHE_LINE, (size_t)count * sizeof(struct Bucket)))
+    return NULL;
+  memset(p, 0, (size_t)count * sizeof(struct Bucket));
+  return (struct Bucket *)p;
+}
+/*--------------------------------------------------------------------*/
+static int find(DB_T d, const struct Table *t, const char *key, size_t len,
+                uint64_t h, struct Bucket **bucket, int *slot)
+
+/* Look the len-byte key with hash h up in t. On success set *bucket and
+   *slot to its place (*bucket NULL and *slot its stash index if it is
+   stashed) and return 1; return 0 if the key is absent. Records are
+   only read when their fingerprint matches; each one is counted as a
+   probe if d is not NULL. */
+{
+  uint32_t tag = (uint32_t)(h >> 32);
+  uint32_t b = (uint32_t)h & t->mask;
+  struct Bucket *bk;
+  int i, round;
+
+  for (round = 0; round < 2; round++) {
+    bk = &t->buckets[b];
+    for (i = 0; i < SLOTS; i++) {
+      if (bk->tag[i] == tag && bk->usr[i] != NULL) {
+        if (d) STAT_ADD(d, probes, 1);
+        if (SmallStringEqual(key_of(t, bk->usr[i]), key, len)) {
+          *bucket = bk;
+          *slot = i;
+          return 1;
+        }
+      }
+    }
+    b = alt_bucket(t, b, tag);
+  }
+  for (i = 0; i < t->stashCount; i++) {
+    if (t->stash[i].hash == h) {
+      if (d) STAT_ADD(d, probes, 1);
+      if (SmallStringEqual(key_of(t, t->stash[i].usr), key, len)) {
+        *bucket = NULL;
+        *slot = i;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int take_free_slot(struct Bucket *bk, uint32_t tag,
+                          struct UserInfo *usr)
+
+/* Put usr into a free slot of bk. Return 0 on success, -1 if bk is full */
+{
+  int i;
+
+  for (i = 0; i < SLOTS; i++) {
+    if (bk->usr[i] == NULL) {
+      bk->tag[i] = tag;
+      bk->usr[i] = usr;
+      return 0;
+    }
+  }
+  return -1;
+}
+/*--------------------------------------------------------------------*/
+struct BfsNode {
+  uint32_t bucket;
+  int parent;                /* node whose entry would move here, or -1 */
+  int slot;                  /* slot of that entry in the parent bucket */
+};
+
+static int on_path(const struct BfsNode *q, int n, uint32_t bucket)
+
+/* Return non-zero if bucket is node n or one of its ancestors */
+{
+  for (; n >= 0; n = q[n].parent)
+    if (q[n].bucket == bucket) return 1;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int displace(struct Table *t, uint32_t b1, uint32_t b2, uint32_t tag,
+                    struct UserInfo *usr)
+
+/* Both candidate buckets b1 and b2 are full: search breadth-first,
+   starting from them, for the nearest bucket with a free slot that an
+   entry can reach by moving to its alternative bucket, one step per
+   level. Shift the entries along that path backwards, from the free
+   slot up, and put usr into the slot freed in b1 or b2. Return 0 on
+   success, -1 if no path was found within MAX_BFS_NODES buckets. */
+{
+  struct BfsNode q[MAX_BFS_NODES];
+  struct Bucket *bk, *from;
+  int head = 0, tail = 0, n, s, p;
+  uint32_t alt;
+
+  q[tail].bucket = b1; q[tail].parent = -1; q[tail++].slot = -1;
+  q[tail].bucket = b2; q[tail].parent = -1; q[tail++].slot = -1;
+
+  while (head < tail) {
+    n = head++;
+    bk = &t->buckets[q[n].bucket];
+    for (s = 0; s < SLOTS; s++) {
+      if (bk->usr[s] != NULL) continue;
+
+      /* free slot found: walk back to the root, moving each parent
+         entry into the slot freed below it */
+      while (q[n].parent >= 0) {
+        p = q[n].parent;
+        from = &t->buckets[q[p].bucket];
+        bk->tag[s] = from->tag[q[n].slot];
+        bk->usr[s] = from->usr[q[n].slot];
+        s = q[n].slot;
+        bk = from;
+        n = p;
+      }
+      bk->tag[s] = tag;
+      bk->usr[s] = usr;
+      return 0;
+    }
+    for (s = 0; s < SLOTS && tail < MAX_BFS_NODES; s++) {
+      alt = alt_bucket(t, q[n].bucket, bk->tag[s]);
+      if (on_path(q, n, alt)) continue;
+      q[tail].bucket = alt;
+      q[tail].parent = n;
+      q[tail++].slot = s;
+    }
+  }
+  return -1;
+}
+/*--------------------------------------------------------------------*/
+static int place(struct Table *t, uint64_t h, struct UserInfo *usr)
+
+/* Put usr, whose key has hash h, into t without growing it: into a
+   candidate bucket, by displacement, or into the stash. Return 0 on
+   success, -1 if there is no room. */
+{
+  uint32_t tag = (uint32_t)(h >> 32);
+  uint32_t b1 = (uint32_t)h & t->mask;
+  uint32_t b2 = alt_bucket(t, b1, tag);
+
+  if (take_free_slot(&t->buckets[b1], tag, usr) == 0 ||
+      take_free_slot(&t->buckets[b2], tag, usr) == 0 ||
+      displace(t, b1, b2, tag, usr) == 0)
+    return 0;
+  if (t->stashCount == STASH_SIZE) return -1;
+  t->stash[t->stashCount].hash = h;
+  t->stash[t->stashCount++].usr = usr;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int grow(DB_T d, struct Table *t)
+
+/* Double the buckets of t and re-place every entry (doubling again in
+   the unlikely case that they do not fit). Return 0 on success, -1 on
+   allocation failure or at MAX_BUCKET_COUNT, leaving t as it was. */
+{
+  struct Table old = *t;
+  uint32_t count = 2 * (t->mask + 1), i;
+  const struct SmallString *key;
+  double expandStart = now_ms();
+  int s, ok;
+
+  for (;;) {
+    if (count > MAX_BUCKET_COUNT) {
+      *t = old;
+      return -1;
+    }
+    t->buckets = alloc_buckets(count);
+    if (t->buckets == NULL) {
+      fprintf(stderr, "Error: Memory failure to expand to the table of size %u\n",
+              count);
+      *t = old;
+      return -1;
+    }
+    t->mask = count - 1;
+    t->stashCount = 0;
+
+    ok = 1;
+    for (i = 0; ok && i <= old.mask; i++) {
+      for (s = 0; ok && s < SLOTS; s++) {
+        if (old.buckets[i].usr[s] == NULL) continue;
+        key = key_of(t, old.buckets[i].usr[s]);
+        ok = place(t, hash_key(SmallStringData(key), key->len),
+                   old.buckets[i].usr[s]) == 0;
+      }
+    }
+    for (s = 0; ok && s < old.stashCount; s++)
+      ok = place(t, old.stash[s].hash, old.stash[s].usr) == 0;
+    if (ok) break;
+
+    free(t->buckets);
+    count *= 2;
+  }
+
+  d->allocOverhead -= alloc_overhead(old.buckets,
+                                     (old.mask + 1) * sizeof(struct Bucket));
+  d->allocOverhead += alloc_overhead(t->buckets,
+                                     (t->mask + 1) * sizeof(struct Bucket));
+  free(old.buckets);
+  STAT_ADD(d, resizes, 1);
+  STAT_ADD(d, expansionMs, now_ms() - expandStart);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int insert(DB_T d, struct Table *t, uint64_t h, struct UserInfo *usr)
+
+/* Add usr, whose key has hash h, to t, growing t first if it is at
+   MAX_LOAD and again whenever usr does not fit. Return 0 on success,
+   -1 on failure. */
+{
+  if ((double)(d->numItems + 1) > MAX_LOAD * SLOTS * (t->mask + 1.0) &&
+      grow(d, t) < 0)
+    return -1;
+  while (place(t, h, usr) < 0) {
+    if (grow(d, t) < 0) return -1;
+  }
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static void rehome_stash(struct Table *t)
+
+/* Move stashed entries back into their buckets while they have room */
+{
+  struct StashEntry e;
+  uint32_t b1, tag;
+  int i;
+
+  for (i = 0; i < t->stashCount; ) {
+    e = t->stash[i];
+    tag = (uint32_t)(e.hash >> 32);
+    b1 = (uint32_t)e.hash & t->mask;
+    if (take_free_slot(&t->buckets[b1], tag, e.usr) == 0 ||
+        take_free_slot(&t->buckets[alt_bucket(t, b1, tag)], tag, e.usr) == 0)
+      t->stash[i] = t->stash[--t->stashCount];
+    else
+      i++;
+  }
+}
+/*--------------------------------------------------------------------*/
+static void remove_at(struct Table *t, struct Bucket *bucket, int slot)
+
+/* Clear the place find() returned, then move stashed entries back
+   into their buckets while they have room. */
+{
+  if (bucket != NULL) {
+    bucket->usr[slot] = NULL;
+  }
+  else {
+    t->stash[slot] = t->stash[--t->stashCount];
+  }
+  rehome_stash(t);
+}
+/*--------------------------------------------------------------------*/
+DB_T
+CreateCustomerDB(void)
+{
+  return CreateCustomerDBEx(NULL);
+}
+/*--------------------------------------------------------------------*/
+DB_T
+CreateCustomerDBEx(const struct CustomerDBOptions *options)
+{
+  DB_T d;
+
+  d = (DB_T) calloc(1, sizeof(struct DB));
+  if (d == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for DB_T\n");
+    return NULL;
+  }
+  d->ids.buckets = alloc_buckets(INITIAL_BUCKET_COUNT);
+  d->names.buckets = alloc_buckets(INITIAL_BUCKET_COUNT);
+  d->quantiles = CreateQuantileSketch();
+  if (options && options->attrCount > 0)
+    d->columns = CreateCustomerColumns(options->attrCount,
+                                       options->scanThreads);
+  if (d->ids.buckets == NULL || d->names.buckets == NULL ||
+      d->quantiles == NULL ||
+      (options && options->attrCount > 0 && d->columns == NULL)) {
+    fprintf(stderr, "Error: Can't allocate a memory for the tables\n");
+    free(d->ids.buckets);
+    free(d->names.buckets);
+    DestroyQuantileSketch(d->quantiles);
+    DestroyCustomerColumns(d->columns);
+    free(d);
+    return NULL;
+  }
+  d->ids.mask = d->names.mask = INITIAL_BUCKET_COUNT - 1;
+  d->names.byName = 1;
+  d->allocOverhead =
+    alloc_overhead(d, sizeof(struct DB)) +
+    2 * alloc_overhead(d->ids.buckets,
+                       INITIAL_BUCKET_COUNT * sizeof(struct Bucket));
+  return d;
+}
+/*--------------------------------------------------------------------*/
+void
+DestroyCustomerDB(DB_T d)
+{
+  uint32_t i;
+  int s;
+
+  if (d == NULL) return;
+
+  /* every record is in the id table exactly once */
+  for (i = 0; i <= d->ids.mask; i++)
+    for (s = 0; s < SLOTS; s++)
+      if (d->ids.buckets[i].usr[s]) free_user(d->ids.buckets[i].usr[s]);
+  for (s = 0; s < d->ids.stashCount; s++)
+    free_user(d->ids.stash[s].usr);
+
+  free(d->ids.buckets);
+  free(d->names.buckets);
+  DestroyFrozenDB(d->frozen);
+  DestroyQuantileSketch(d->quantiles);
+  DestroyCustomerColumns(d->columns);
+  free(d);
+}
+/*--------------------------------------------------------------------*/
+static int frozen_lookup(DB_T d, int byName, const char *key, size_t len)
+
+/* Look the len-byte id (or name, if byName) up in the frozen image of
+   d, counting it like a table lookup. */
+{
+  int purchase = FrozenGetPurchase(d->frozen, byName, key, len);
+
+  STAT_ADD(d, lookups, 1);
+  STAT_ADD(d, probes, 1);
+  if (purchase < 0) STAT_ADD(d, misses, 1);
+  else STAT_ADD(d, hits, 1);
+  return purchase;
+}
+/*--------------------------------------------------------------------*/
+static int
+register_customer(DB_T d, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, const int purchase,
+                  int how)
+{
+  struct UserInfo *usr;
+  struct Bucket *bk;
+  uint64_t idHash, nameHash;
+  int slot;
+
+  if (d == NULL || id == NULL || name == NULL || purchase <= 0) return -1;
+  if (d->frozen) return -1; /* frozen dbs are read-only */
+
+  /* Checking whether the id or the name already exists */
+  idHash = hash_key(id, idLen);
+  nameHash = hash_key(name, nameLen);
+  if (find(NULL, &d->ids, id, idLen, idHash, &bk, &slot) ||
+      find(NULL, &d->names, name, nameLen, nameHash, &bk, &slot))
+    return -1;
+
+  usr = (struct UserInfo *)calloc(1, sizeof(struct UserInfo));
+  if (usr == NULL) {
+    fprintf(stderr, "Error: Unable to allocate memory for new user.\n");
+    return -1;
+  }
+  if (SmallStringStore(&usr->id, id, idLen, how) < 0) {
+    fprintf(stderr, "Error: Unable to allocate memory for user ID.\n");
+    free(usr);
+    return -1;
+  }
+  if (SmallStringStore(&usr->name, name, nameLen, how) < 0) {
+    fprintf(stderr, "Error: Unable to allocate memory for user name.\n");
+    SmallStringUndo(&usr->id, how);
+    free(usr);
+    return -1;
+  }
+  usr->purchase = purchase;
+  if (d->columns &&
+      (usr->row = CustomerColumnsNewRow(d->columns, purchase)) < 0) {
+    discard_user(usr, how);
+    return -1;
+  }
+
+  if (insert(d, &d->ids, idHash, usr) < 0) {
+    CustomerColumnsFreeRow(d->columns, usr->row);
+    discard_user(usr, how);
+    return -1;
+  }
+  if (insert(d, &d->names, nameHash, usr) < 0) {
+    find(NULL, &d->ids, id, idLen, idHash, &bk, &slot);
+    remove_at(&d->ids, bk, slot);
+    CustomerColumnsFreeRow(d->columns, usr->row);
+    discard_user(usr, how);
+    return -1;
+  }
+  account_user(d, usr, 1);
+  d->numItems++;
+  STAT_ADD(d, inserts, 1);
+  QuantileSketchAdd(d->quantiles, purchase);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int
+unregister(DB_T d, struct Table *t, const char *key, size_t len)
+
+/* Remove the customer whose key in t is the len-byte key from both
+   tables and free it, rebuilding the quantile sketch once the removals
+   outnumber the customers left. Return 0 on success, -1 if there is
+   none. */
+{
+  struct Table *other;
+  struct UserInfo *usr;
+  const struct SmallString *otherKey;
+  struct Bucket *bk;
+  int slot, purchase;
+
+  if (!find(NULL, t, key, len, hash_key(key, len), &bk, &slot)) return -1;
+  usr = bk ? bk->usr[slot] : t->stash[slot].usr;
+  remove_at(t, bk, slot);
+
+  other = (t == &d->ids) ? &d->names : &d->ids;
+  otherKey = key_of(other, usr);
+  if (find(NULL, other, SmallStringData(otherKey), otherKey->len,
+           hash_key(SmallStringData(otherKey), otherKey->len), &bk, &slot))
+    remove_at(other, bk, slot);
+
+  purchase = usr->purchase;
+  account_user(d, usr, -1);
+  CustomerColumnsFreeRow(d->columns, usr->row);
+  free_user(usr);
+  d->numItems--;
+  STAT_ADD(d, deletes, 1);
+  if (QuantileSketchRemove(d->quantiles, purchase) == 1)
+    QuantileSketchRebuild(d->quantiles, d);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int
+unregister_by_id(DB_T d, const char *id, size_t idLen)
+{
+  if (d == NULL || id == NULL) return -1; /* Nothing to delete */
+  if (d->frozen) return -1; /* frozen dbs are read-only */
+  return unregister(d, &d->ids, id, idLen);
+}
+/*--------------------------------------------------------------------*/
+static int
+unregister_by_name(DB_T d, const char *name, size_t nameLen)
+{
+  if (d == NULL || name == NULL) return -1; /* Nothing to delete */
+  if (d->frozen) return -1; /* frozen dbs are read-only */
+  return unregister(d, &d->names, name, nameLen);
+}
+/*--------------------------------------------------------------------*/
+static int
+get_purchase(DB_T d, const struct Table *t, const char *key, size_t len)
+
+/* Return the purchase of the customer whose key in t is the len-byte
+   key, -1 if there is none */
+{
+  struct Bucket *bk;
+  int slot;
+
+  STAT_ADD(d, lookups, 1);
+  if (!find(d, t, key, len, hash_key(key, len), &bk, &slot)) {
+    STAT_ADD(d, misses, 1);
+    return -1;
+  }
+  STAT_ADD(d, hits, 1);
+  return bk ? bk->usr[slot]->purchase : t->stash[slot].usr->purchase;
+}
+/*--------------------------------------------------------------------*/
+static int
+get_purchase_by_id(DB_T d, const char *id, size_t idLen)
+{
+  if (d == NULL || id == NULL) return -1; /* Invalid inputs */
+  if (d->frozen) return frozen_lookup(d, 0, id, idLen);
+  return get_purchase(d, &d->ids, id, idLen);
+}
+/*--------------------------------------------------------------------*/
+static int
+get_purchase_by_name(DB_T d, const char *name, size_t nameLen)
+{
+  if (d == NULL || name == NULL) return -1; /* Invalid inputs */
+  if (d->frozen) return frozen_lookup(d, 1, name, nameLen);
+  return get_purchase(d, &d->names, name, nameLen);
+}
+/*--------------------------------------------------------------------*/
+static int get_sum_customer_purchase(DB_T d, FUNCPTR_T fp)
+{
+  struct UserInfo *usr;
+  uint32_t i;
+  int s, total = 0;
+
+  if (d == NULL || fp == NULL) return -1; /* Invalid inputs */
+  if (d->frozen) return FrozenSum(d->frozen, fp);
+
+  for (i = 0; i <= d->ids.mask; i++) {
+    for (s = 0; s < SLOTS; s++) {
+      if ((usr = d->ids.buckets[i].usr[s]) != NULL)
+        total += fp(SmallStringData(&usr->id), SmallStringData(&usr->name),
+                    usr->purchase);
+    }
+  }
+  for (s = 0; s < d->ids.stashCount; s++) {
+    usr = d->ids.stash[s].usr;
+    total += fp(SmallStringData(&usr->id), SmallStringData(&usr->name),
+                usr->purchase);
+  }
+  return total;
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBOptions(DB_T d, struct CustomerDBOptions *options)
+{
+  if (d == NULL || options == NULL) return -1;
+  memset(options, 0, sizeof(*options));
+  CustomerColumnsGetOptions(d->columns, options);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBMemoryUsage(DB_T d, struct CustomerDBMemoryUsage *usage)
+{
+  if (d == NULL || usage == NULL) return -1; /* Invalid inputs */
+
+  usage->records = (size_t)d->numItems * sizeof(struct UserInfo) +
+                   CustomerColumnsMemory(d->columns);
+  usage->keys = d->keyBytes;
+  usage->buckets = ((size_t)d->ids.mask + 1 + d->names.mask + 1) *
+                   sizeof(struct Bucket) + QuantileSketchMemory(d->quantiles);
+  usage->overhead = d->allocOverhead;
+  if (d->frozen) { /* the image replaces the (empty) tables */
+    size_t records, keys, index;
+    FrozenMemory(d->frozen, &records, &keys, &index);
+    usage->records += records;
+    usage->keys += keys;
+    usage->buckets += index;
+  }
+  usage->total = sizeof(struct DB) + usage->records + usage->keys +
+                 usage->buckets + usage->overhead;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+GetPurchaseQuantile(DB_T d, double q)
+{
+  if (d == NULL) return -1;
+  return QuantileSketchQuery(d->quantiles, q);
+}
+/*--------------------------------------------------------------------*/
+static struct UserInfo *find_user(DB_T d, const char *id)
+
+/* Return the record of the customer with id, or NULL */
+{
+  struct Bucket *bk;
+  size_t len = strlen(id);
+  int slot;
+
+  if (!find(NULL, &d->ids, id, len, hash_key(id, len), &bk, &slot))
+    return NULL;
+  return bk ? bk->usr[slot] : d->ids.stash[slot].usr;
+}
+/*--------------------------------------------------------------------*/
+/* Attributes: every record names its row of d->columns. A frozen db
+   has no columns, as its image keeps only ids, names and purchases. */
+int
+SetCustomerAttr(DB_T d, const char *id, int attr, int code)
+{
+  struct UserInfo *usr;
+
+  if (d == NULL || id == NULL || d->columns == NULL) return -1;
+  if ((usr = find_user(d, id)) == NULL) return -1;
+  return CustomerColumnsSetAttr(d->columns, usr->row, attr, code);
+}
+
+int
+GetCustomerAttr(DB_T d, const char *id, int attr)
+{
+  struct UserInfo *usr;
+
+  if (d == NULL || id == NULL || d->columns == NULL) return -1;
+  if ((usr = find_user(d, id)) == NULL) return -1;
+  return CustomerColumnsGetAttr(d->columns, usr->row, attr);
+}
+
+int
+GroupSumPurchaseBy(DB_T d, int attr, long out[CUSTOMER_ATTR_CODES])
+{
+  if (d == NULL || d->columns == NULL) return -1;
+  return CustomerColumnsGroupSum(d->columns, attr, out);
+}
+/*--------------------------------------------------------------------*/
+static void bucket_stats(const struct Table *t, unsigned long *hist,
+                         double *avg, int *max)
+
+/* Fill the occupancy histogram of the buckets of t, the average
+   number of entries of the non-empty buckets and the fullest bucket. */
+{
+  unsigned long used = 0, items = 0;
+  uint32_t i;
+  int s, len;
+
+  *max = 0;
+  for (i = 0; i <= t->mask; i++) {
+    len = 0;
+    for (s = 0; s < SLOTS; s++)
+      if (t->buckets[i].usr[s]) len++;
+    hist[len < CUSTOMER_STATS_HIST ? len : CUSTOMER_STATS_HIST - 1]++;
+    if (len > 0) used++;
+    if (len > *max) *max = len;
+    items += len;
+  }
+  *avg = used ? (double)items / used : 0.0;
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBStats(DB_T d, struct CustomerDBStats *stats)
+{
+  if (d == NULL || stats == NULL) return -1; /* Invalid inputs */
+
+  *stats = d->stats;
+  memset(stats->idHistogram, 0, sizeof(stats->idHistogram));
+  memset(stats->nameHistogram, 0, sizeof(stats->nameHistogram));
+  bucket_stats(&d->ids, stats->idHistogram, &stats->avgIdChain,
+               &stats->maxIdChain);
+  bucket_stats(&d->names, stats->nameHistogram, &stats->avgNameChain,
+               &stats->maxNameChain);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int report(DB_T d, int type, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, int purchase, int result)
+
+/* Pass a finished API call to the hook of d, if one is installed,
+   and return its result unchanged. */
+{
+  struct CustomerOp op;
+
+  if (d == NULL || d->hook == NULL) return result;
+
+  op.type = type;
+  op.id = id;
+  op.idLen = id ? idLen : 0;
+  op.name = name;
+  op.nameLen = name ? nameLen : 0;
+  op.purchase = purchase;
+  op.result = result;
+  d->hook(d->hookCtx, &op);
+  return result;
+}
+/*--------------------------------------------------------------------*/
+int
+SetCustomerDBHook(DB_T d, HOOKFUNC_T hook, void *ctx)
+{
+  if (d == NULL) return -1;
+  d->hook = hook;
+  d->hookCtx = ctx;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+/* No memory limit here: nothing is ever evicted, so fn is never called */
+int
+SetCustomerDBEvictCallback(DB_T d, EVICTFUNC_T fn, void *ctx)
+{
+  (void)fn; (void)ctx;
+  return d == NULL ? -1 : 0;
+}
+/*--------------------------------------------------------------------*/
+/* Public entry points: run the operation, then report it to the hook.
+   The NUL-terminated variants measure their keys and call the ...N
+   variants. */
+int
+RegisterCustomerN(DB_T d, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, const int purchase)
+{
+  return report(d, CUSTOMER_OP_REGISTER, id, idLen, name, nameLen, purchase,
+                register_customer(d, id, idLen, name, nameLen, purchase,
+                                  SMALL_STRING_COPY));
+}
+
+int
+RegisterCustomerTakeOwnership(DB_T d, char *id, char *name, const int purchase)
+{
+  size_t idLen = id ? strlen(id) : 0, nameLen = name ? strlen(name) : 0;
+  int result;
+
+  result = report(d, CUSTOMER_OP_REGISTER, id, idLen, name, nameLen, purchase,
+                  register_customer(d, id, idLen, name, nameLen, purchase,
+                                    SMALL_STRING_ADOPT));
+  if (result == 0) { /* short keys were copied into the record */
+    if (idLen <= SMALL_STRING_INLINE) free(id);
+    if (nameLen <= SMALL_STRING_INLINE) free(name);
+  }
+  return result;
+}
+
+int
+RegisterCustomerPooled(DB_T d, const char *id, const char *name,
+                       const int purchase)
+{
+  size_t idLen = StringPoolLength(id), nameLen = StringPoolLength(name);
+
+  return report(d, CUSTOMER_OP_REGISTER, id, idLen, name, nameLen, purchase,
+                register_customer(d, id, idLen, name, nameLen, purchase,
+                                  SMALL_STRING_SHARE));
+}
+
+int
+UnregisterCustomerByIDN(DB_T d, const char *id, size_t idLen)
+{
+  return report(d, CUSTOMER_OP_UNREGISTER_ID, id, idLen, NULL, 0, 0,
+                unregister_by_id(d, id, idLen));
+}
+
+int
+UnregisterCustomerByNameN(DB_T d, const char *name, size_t nameLen)
+{
+  return report(d, CUSTOMER_OP_UNREGISTER_NAME, NULL, 0, name, nameLen, 0,
+                unregister_by_name(d, name, nameLen));
+}
+
+int
+GetPurchaseByIDN(DB_T d, const char *id, size_t idLen)
+{
+  return report(d, CUSTOMER_OP_GET_ID, id, idLen, NULL, 0, 0,
+                get_purchase_by_id(d, id, idLen));
+}
+
+int
+GetPurchaseByNameN(DB_T d, const char *name, size_t nameLen)
+{
+  return report(d, CUSTOMER_OP_GET_NAME, NULL, 0, name, nameLen, 0,
+                get_purchase_by_name(d, name, nameLen));
+}
+
+int
+RegisterCustomer(DB_T d, const char *id, const char *name, const int purchase)
+{
+  return RegisterCustomerN(d, id, id ? strlen(id) : 0,
+                           name, name ? strlen(name) : 0, purchase);
+}
+
+int
+UnregisterCustomerByID(DB_T d, const char *id)
+{
+  return UnregisterCustomerByIDN(d, id, id ? strlen(id) : 0);
+}
+
+int
+UnregisterCustomerByName(DB_T d, const char *name)
+{
+  return UnregisterCustomerByNameN(d, name, name ? strlen(name) : 0);
+}
+
+int
+GetPurchaseByID(DB_T d, const char* id)
+{
+  return GetPurchaseByIDN(d, id, id ? strlen(id) : 0);
+}
+
+int
+GetPurchaseByName(DB_T d, const char* name)
+{
+  return GetPurchaseByNameN(d, name, name ? strlen(name) : 0);
+}
+
+int
+GetSumCustomerPurchase(DB_T d, FUNCPTR_T fp)
+{
+  return report(d, CUSTOMER_OP_SUM, NULL, 0, NULL, 0, 0,
+                get_sum_customer_purchase(d, fp));
+}
+/*--------------------------------------------------------------------*/
+/* Bulk removal: one sweep of the id table evaluates pred, clears the
+   matching slots and marks their records with a zero purchase; one
+   sweep of the name table clears the marked records and frees them.
+   Stashed entries are moved back into buckets once, at the end. Every
+   removed customer is reported to the hook as an unregistration by id,
+   so a trace replays to the same contents. The quantile sketch is
+   rebuilt, if due, at the end. */
+int
+UnregisterCustomersWhere(DB_T d, FUNCPTR_T pred)
+{
+  struct Table *t;
+  struct UserInfo *usr;
+  uint32_t i;
+  int s, removed = 0, rebuild = 0;
+
+  if (d == NULL || pred == NULL) return -1; /* Invalid inputs */
+  if (d->frozen) return -1; /* frozen dbs are read-only */
+
+  t = &d->ids;
+  for (i = 0; i <= t->mask; i++) {
+    for (s = 0; s < SLOTS; s++) {
+      usr = t->buckets[i].usr[s];
+      if (usr && pred(SmallStringData(&usr->id), SmallStringData(&usr->name),
+                      usr->purchase)) {
+        t->buckets[i].usr[s] = NULL;
+        if (QuantileSketchRemove(d->quantiles, usr->purchase) == 1)
+          rebuild = 1;
+        usr->purchase = 0;
+        removed++;
+      }
+    }
+  }
+  for (s = 0; s < t->stashCount; ) {
+    usr = t->stash[s].usr;
+    if (pred(SmallStringData(&usr->id), SmallStringData(&usr->name),
+             usr->purchase)) {
+      t->stash[s] = t->stash[--t->stashCount];
+      if (QuantileSketchRemove(d->quantiles, usr->purchase) == 1)
+        rebuild = 1;
+      usr->purchase = 0;
+      removed++;
+    }
+    else
+      s++;
+  }
+  if (removed == 0) return 0;
+
+  /* every record is in the name table exactly once: free it there */
+  t = &d->names;
+  for (i = 0; i <= t->mask; i++) {
+    for (s = 0; s < SLOTS; s++) {
+      usr = t->buckets[i].usr[s];
+      if (usr && usr->purchase == 0) {
+        t->buckets[i].usr[s] = NULL;
+        report(d, CUSTOMER_OP_UNREGISTER_ID, SmallStringData(&usr->id),
+               usr->id.len, NULL, 0, 0, 0);
+        account_user(d, usr, -1);
+        CustomerColumnsFreeRow(d->columns, usr->row);
+        free_user(usr);
+      }
+    }
+  }
+  for (s = 0; s < t->stashCount; ) {
+    usr = t->stash[s].usr;
+    if (usr->purchase == 0) {
+      t->stash[s] = t->stash[--t->stashCount];
+      report(d, CUSTOMER_OP_UNREGISTER_ID, SmallStringData(&usr->id),
+             usr->id.len, NULL, 0, 0, 0);
+      account_user(d, usr, -1);
+      CustomerColumnsFreeRow(d->columns, usr->row);
+      free_user(usr);
+    }
+    else
+      s++;
+  }
+  rehome_stash(&d->ids);
+  rehome_stash(&d->names);
+  d->numItems -= removed;
+  STAT_ADD(d, deletes, removed);
+  if (rebuild) QuantileSketchRebuild(d->quantiles, d);
+  return removed;
+}
+/*--------------------------------------------------------------------*/
+/* Cursors walk the slots of the id table, then its stash. Inserts move
+   customers between buckets and the stash, so a scan only sees each
+   customer exactly once while the db is left alone. Growth re-places
+   every customer; the scan then starts over rather than miss the ones
+   that landed behind it. */
+struct CustomerCursor {
+  DB_T d;
+  uint64_t pos;              /* next slot, then stash entry (byte offset
+                                when frozen) */
+  uint32_t mask;             /* mask of the id table pos refers to */
+  int frozen;                /* the db was frozen when the scan started */
+};
+/*--------------------------------------------------------------------*/
+static int next_batch(CustomerCursor_T c, struct CustomerView *views, int max)
+{
+  const struct Table *t = &c->d->ids;
+  uint64_t slots = ((uint64_t)t->mask + 1) * SLOTS;
+  struct UserInfo *usr;
+  int n = 0;
+
+  if (c->mask != t->mask) {
+    c->mask = t->mask;
+    c->pos = 0;
+  }
+  for (; n < max && c->pos < slots + t->stashCount; c->pos++) {
+    if (c->pos < slots)
+      usr = t->buckets[c->pos / SLOTS].usr[c->pos % SLOTS];
+    else
+      usr = t->stash[c->pos - slots].usr;
+    if (usr == NULL) continue;
+    views[n].id = SmallStringData(&usr->id);
+    views[n].idLen = usr->id.len;
+    views[n].name = SmallStringData(&usr->name);
+    views[n].nameLen = usr->name.len;
+    views[n].purchase = usr->purchase;
+    n++;
+  }
+  return n;
+}
+/*--------------------------------------------------------------------*/
+CustomerCursor_T
+OpenCustomerCursor(DB_T d)
+{
+  CustomerCursor_T c;
+
+  if (d == NULL) return NULL;
+  c = (CustomerCursor_T)calloc(1, sizeof(struct CustomerCursor));
+  if (c == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the cursor\n");
+    return NULL;
+  }
+  c->d = d;
+  c->frozen = (d->frozen != NULL);
+  c->mask = d->ids.mask;
+  return c;
+}
+/*--------------------------------------------------------------------*/
+int
+NextCustomerBatch(CustomerCursor_T c, struct CustomerView *views, int max)
+{
+  if (c == NULL || views == NULL || max <= 0) return -1;
+  if (c->frozen != (c->d->frozen != NULL)) return -1;
+  if (c->frozen) return FrozenNextBatch(c->d->frozen, &c->pos, views, max);
+  return next_batch(c, views, max);
+}
+/*--------------------------------------------------------------------*/
+void
+CloseCustomerCursor(CustomerCursor_T c)
+{
+  free(c);
+}
+/*--------------------------------------------------------------------*/
+/* Frozen dbs (frozen_db.h): the customers are copied into an image
+   with minimal perfect hashes, then the tables are swapped for the
+   empty ones of a fresh db and the old contents are destroyed. */
+int
+FreezeCustomerDB(DB_T d)
+{
+  FrozenBuilder_T b;
+  FrozenDB_T f;
+  DB_T fresh;
+  struct DB old;
+  struct UserInfo *usr;
+  uint32_t i;
+  int s;
+
+  if (d == NULL || d->frozen) return -1;
+  if ((b = CreateFrozenBuilder()) == NULL) return -1;
+  for (i = 0; i <= d->ids.mask; i++) { /* every record is in ids once */
+    for (s = 0; s < SLOTS; s++) {
+      if ((usr = d->ids.buckets[i].usr[s]) != NULL &&
+          FrozenBuilderAdd(b, SmallStringData(&usr->id), usr->id.len,
+                           SmallStringData(&usr->name), usr->name.len,
+                           usr->purchase) < 0) {
+        DestroyFrozenBuilder(b);
+        return -1;
+      }
+    }
+  }
+  for (s = 0; s < d->ids.stashCount; s++) {
+    usr = d->ids.stash[s].usr;
+    if (FrozenBuilderAdd(b, SmallStringData(&usr->id), usr->id.len,
+                         SmallStringData(&usr->name), usr->name.len,
+                         usr->purchase) < 0) {
+      DestroyFrozenBuilder(b);
+      return -1;
+    }
+  }
+  if ((f = FrozenBuild(b)) == NULL) return -1;
+
+  fresh = CreateCustomerDB();
+  if (fresh == NULL) {
+    DestroyFrozenDB(f);
+    return -1;
+  }
+  old = *d;
+  *d = *fresh;
+  d->hook = old.hook;
+  d->hookCtx = old.hookCtx;
+  d->stats = old.stats;
+  d->frozen = f;
+  d->quantiles = old.quantiles; /* the purchases are the same */
+  old.quantiles = fresh->quantiles;
+  *fresh = old;
+  DestroyCustomerDB(fresh);
+  return 0;
+}
+
+int
+SaveFrozenCustomerDB(DB_T d, const char *path)
+{
+  if (d == NULL || d->frozen == NULL) return -1;
+  return FrozenSave(d->frozen, path);
+}
+
+DB_T
+LoadFrozenCustomerDB(const char *path)
+{
+  FrozenDB_T f;
+  DB_T d;
+
+  if ((f = FrozenLoad(path)) == NULL) return NULL;
+  d = CreateCustomerDB();
+  if (d == NULL) {
+    DestroyFrozenDB(f);
+    return NULL;
+  }
+  d->frozen = f;
+  if (QuantileSketchRebuild(d->quantiles, d) < 0) {
+    DestroyCustomerDB(d);
+    return NULL;
+  }
+  return d;
+}
+
+DB_T
+AttachCustomerDB(const char *shmName)
+{
+  (void)shmName;
+  fprintf(stderr, "Error: customer_manager4 has no shared-memory dbs\n");
+  return NULL;
+}
@@ -0,0 +1,1394 @@
+/*
+ * Program: customer_manager5.c
+ *
+ * Description:
+ * ------------
+ * This program implements the customer management system on disk, as two B+trees
+ * in one file of 4 KiB pages, so that the customers need not fit in memory:
+ *
+ *    - The id tree maps each id to the customer's name and purchase; the name tree
+ *      maps each name to the id (and the purchase, which never changes, so that a
+ *      lookup by name needs one descent).
+ *    - A page is slotted: a header, an array of 2-byte cell offsets sorted by key,
+ *      and the cells packed from the end of the page. A cell is {key length, value
+ *      length, purchase or child page, key, value}. Leaves of a tree are chained
+ *      left to right for scans.
+ *    - Pages are read and written with pread/pwrite through a fixed buffer pool of
+ *      `cacheBytes` (`CustomerDBOptions`, 64 MiB by default) with a hash table from
+ *      page number to frame and CLOCK replacement: a hit sets the frame's reference
+ *      bit, and the hand clears bits until it finds a frame nobody referenced since
+ *      its last pass. Dirty frames are written back when evicted and when the db is
+ *      destroyed.
+ *
+ * While the pages on the path of a lookup stay in the pool, a lookup costs one
+ * binary search per level; once the trees outgrow the pool, the inner pages (few
+ * and touched by every lookup) keep their reference bits and stay, so a miss costs
+ * about one read of a leaf.
+ *
+ * Functionality:
+ * --------------
+ * 1. **Database Creation and Destruction**: `CreateCustomerDB` keeps the trees in an
+ *    unlinked temporary file; `CreateCustomerDBEx` with `options->path` uses that
+ *    file instead and opens the trees already in it. `DestroyCustomerDB` writes back
+ *    every dirty page and the file header, so the file can be opened again.
+ *
+ * 2. **Registration**: `RegisterCustomer` looks the id and the name up, then inserts
+ *    into both trees. A full page is compacted if removals left enough room in it,
+ *    otherwise it is split by bytes and the first key of the right half (or the
+ *    middle key, in an inner page) moves up; a full root gets a new root above it.
+ *    An id, name and attribute codes longer than `MAX_KEY_BYTES` together are refused,
+ *    since both cells of a customer must fit a page with room to split.
+ *
+ * 3. **Unregistration**: `UnregisterCustomerByID`, `UnregisterCustomerByName` remove
+ *    the cell from a leaf of each tree. Pages are never merged or freed: an emptied
+ *    leaf stays in its tree and is filled again by later inserts.
+ *
+ * 4. **Retrieval and Calculation**: `GetPurchaseByID`, `GetPurchaseByName` and
+ *    `GetSumCustomerPurchase`, the latter walking the leaves of the id tree.
+ *
+ * 5. **Hook, Memory Accounting and Statistics**: as in the other engines. The memory
+ *    is the buffer pool and its tables; the customers themselves are on disk. The
+ *    statistics add the pool's hits, page reads and page writes.
+ *
+ * 6. **Key Ownership**: keys are copied into pages, so `RegisterCustomerTakeOwnership`
+ *    frees the caller's buffers and `RegisterCustomerPooled` holds no reference.
+ *
+ * 7. **Cursors**: `OpenCustomerCursor`/`NextCustomerBatch` remember the last id
+ *    returned and go on from the first id after it, so a scan is in id order and
+ *    survives any change between batches.
+ *
+ * 8. **Bulk Removal**: `UnregisterCustomersWhere` walks the id leaves, removing the
+ *    matching cells in place and their names from the name tree.
+ *
+ * 9. **Quantiles**: `GetPurchaseQuantile` answers from a KLL sketch of the purchases
+ *    (quantile_sketch.h). The sketch is kept in memory, so opening an existing file
+ *    builds it again from the id leaves.
+ *
+ * 10. **Attributes** (`attrCount` option): the codes of a customer follow its name in
+ *    its id leaf cell, one byte per attribute, so they are on disk with the rest.
+ *    `GroupSumPurchaseBy` walks the id leaves, as `GetSumCustomerPurchase` does; the
+ *    file header keeps the number of attributes, which a file opened again keeps.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "customer_manager.h"
+#include "string_pool.h"
+#include "frozen_db.h"
+#include "quantile_sketch.h"
+#define PAGE_SIZE 4096
+#define DEFAULT_CACHE_BYTES (64UL << 20)
+#define MIN_FRAMES 16              /* pages a descent and a split pin at once */
+#define MAX_KEY_BYTES CUSTOMER_DISK_MAX_KEY_BYTES /* id + name + codes */
+#define MAX_DEPTH 32
+#define META_MAGIC 0x43555342U     /* "BSUC" */
+#define META_VERSION 1
+#define NO_FRAME (-1)
+
+/* Statistics counters of the DB (compiled out with CUSTOMER_DB_NO_STATS) */
+#ifndef CUSTOMER_DB_NO_STATS
+#define STAT_ADD(d, field, n) ((d)->stats.field += (n))
+#else
+#define STAT_ADD(d, field, n) ((void)(n))
+#endif
+
+enum { ID_TREE, NAME_TREE };
+
+/*--------------------------------------------------------------------*/
+/* Page 0 of the file */
+struct Meta {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t pageSize;
+  uint32_t pageCount;        /* pages in the file, page 0 included */
+  uint32_t root[2];          /* root page of the id and the name tree */
+  uint32_t firstLeaf;        /* leftmost leaf of the id tree */
+  uint32_t attrs;            /* attribute codes after the name in the value
+                                of an id leaf cell (0 in older files) */
+  uint64_t count;            /* customers */
+};
+
+/* Start of every tree page */
+struct PageHeader {
+  uint16_t leaf;             /* 1 for a leaf, 0 for an inner page */
+  uint16_t count;            /* cells */
+  uint16_t dataStart;        /* offset of the lowest cell byte */
+  uint16_t garbage;          /* bytes of removed cells above dataStart */
+  uint32_t link;             /* leaf: right sibling (0: none);
+                                inner: child left of the first key */
+};
+
+/* Start of every cell; the key and the value follow, padded to 4 bytes */
+struct Cell {
+  uint16_t keyLen;
+  uint16_t valLen;
+  int32_t aux;               /* leaf: purchase; inner: child page holding
+                                the keys >= this one */
+};
+
+/* One page of the buffer pool */
+struct Frame {
+  uint32_t page;             /* page held, 0 for none */
+  int pins;                  /* callers using it; never evicted while > 0 */
+  unsigned char ref;         /* CLOCK reference bit */
+  unsigned char dirty;       /* changed since it was read */
+  int hashNext;              /* next frame in the hash chain */
+  unsigned char *data;
+};
+
+struct DB {
+  int fd;                    /* the db file */
+  int persistent;            /* the file outlives the db (options->path) */
+  pid_t owner;               /* process that may write the file */
+  struct Meta meta;
+  struct Frame *frames;
+  int frameCount;
+  int hand;                  /* CLOCK hand */
+  int *hash;                 /* page -> first frame of its chain */
+  uint32_t hashMask;
+  unsigned char *pool;       /* frameCount pages */
+  HOOKFUNC_T hook;           /* called after every API call (may be NULL) */
+  void *hookCtx;             /* first argument of hook */
+  FrozenDB_T frozen;         /* read-only contents once frozen (or NULL) */
+  QuantileSketch_T quantiles; /* sketch of the purchases */
+  struct CustomerDBStats stats; /* counters, updated through STAT_ADD */
+};
+
+#define HEADER(p) ((struct PageHeader *)(p))
+#define SLOT(p, i) (((uint16_t *)((p) + sizeof(struct PageHeader)))[i])
+#define CELL(p, i) ((struct Cell *)((p) + SLOT(p, i)))
+#define CELL_KEY(c) ((const char *)(c) + sizeof(struct Cell))
+#define CELL_VAL(c) (CELL_KEY(c) + (c)->keyLen)
+#define CELL_BYTES(keyLen, valLen) \
+  ((sizeof(struct Cell) + (keyLen) + (valLen) + 3) & ~(size_t)3)
+#define CELL_SIZE(c) CELL_BYTES((c)->keyLen, (c)->valLen)
+/*--------------------------------------------------------------------*/
+static uint32_t hash_page(DB_T d, uint32_t page)
+{
+  return (page * 2654435761U) & d->hashMask;
+}
+/*--------------------------------------------------------------------*/
+static int write_frame(DB_T d, struct Frame *f)
+
+/* Write the page in f back to the file if it is dirty. Return 0 or -1. */
+{
+  if (!f->dirty) return 0;
+  if (pwrite(d->fd, f->data, PAGE_SIZE,
+             (off_t)f->page * PAGE_SIZE) != PAGE_SIZE) {
+    fprintf(stderr, "Error: Can't write page %u\n", f->page);
+    return -1;
+  }
+  f->dirty = 0;
+  STAT_ADD(d, pageWrites, 1);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static void unhash(DB_T d, int i)
+{
+  int *link = &d->hash[hash_page(d, d->frames[i].page)];
+
+  while (*link != i) link = &d->frames[*link].hashNext;
+  *link = d->frames[i].hashNext;
+  d->frames[i].page = 0;
+}
+/*--------------------------------------------------------------------*/
+static int victim(DB_T d)
+
+/* Free a frame with CLOCK: pass over the frames, clearing reference
+   bits, and take the first unpinned frame whose bit is already clear.
+   A forked child (BackgroundSaveCustomerDB) shares the file with its
+   parent and must not write it, so it only takes clean frames. Return
+   the index, NO_FRAME if no frame can go or the write-back failed. */
+{
+  struct Frame *f;
+  int i, forked = -1;
+
+  for (i = 0; i < 2 * d->frameCount + 1; i++) {
+    f = &d->frames[d->hand];
+    d->hand = (d->hand + 1) % d->frameCount;
+    if (f->pins > 0) continue;
+    if (f->page != 0 && f->ref) {
+      f->ref = 0;
+      continue;
+    }
+    if (f->dirty && forked < 0) forked = getpid() != d->owner;
+    if (f->dirty && forked) continue;
+    if (f->page != 0) {
+      if (write_frame(d, f) < 0) return NO_FRAME;
+      unhash(d, (int)(f - d->frames));
+    }
+    return (int)(f - d->frames);
+  }
+  fprintf(stderr, "Error: No page of the buffer pool can be evicted\n");
+  return NO_FRAME;
+}
+/*--------------------------------------------------------------------*/
+static int install(DB_T d, uint32_t page)
+
+/* Take a free frame for page and enter it in the hash, pinned. Return
+   the frame, NO_FRAME on failure. */
+{
+  struct Frame *f;
+  uint32_t h = hash_page(d, page);
+  int i;
+
+  if ((i = victim(d)) == NO_FRAME) return NO_FRAME;
+  f = &d->frames[i];
+  f->page = page;
+  f->pins = 1;
+  f->ref = 1;
+  f->dirty = 0;
+  f->hashNext = d->hash[h];
+  d->hash[h] = i;
+  return i;
+}
+/*--------------------------------------------------------------------*/
+static int pin(DB_T d, uint32_t page)
+
+/* Return the frame holding page, read from the file if it isn't in the
+   pool, and pin it. NO_FRAME on failure. */
+{
+  struct Frame *f;
+  int i;
+
+  for (i = d->hash[hash_page(d, page)]; i != NO_FRAME;
+       i = d->frames[i].hashNext) {
+    f = &d->frames[i];
+    if (f->page == page) {
+      f->pins++;
+      f->ref = 1;
+      STAT_ADD(d, pageHits, 1);
+      return i;
+    }
+  }
+  if ((i = install(d, page)) == NO_FRAME) return NO_FRAME;
+  f = &d->frames[i];
+  if (pread(d->fd, f->data, PAGE_SIZE, (off_t)page * PAGE_SIZE) != PAGE_SIZE) {
+    fprintf(stderr, "Error: Can't read page %u\n", page);
+    f->pins = 0;
+    unhash(d, i);
+    return NO_FRAME;
+  }
+  STAT_ADD(d, pageReads, 1);
+  return i;
+}
+/*--------------------------------------------------------------------*/
+static void unpin(DB_T d, int i, int dirty)
+{
+  d->frames[i].pins--;
+  d->frames[i].dirty |= (unsigned char)dirty;
+}
+/*--------------------------------------------------------------------*/
+static int new_page(DB_T d, int leaf)
+
+/* Append an empty page to the file and return its frame, pinned and
+   dirty. NO_FRAME on failure. */
+{
+  struct PageHeader *h;
+  int i;
+
+  if ((i = install(d, d->meta.pageCount)) == NO_FRAME) return NO_FRAME;
+  d->meta.pageCount++;
+  memset(d->frames[i].data, 0, PAGE_SIZE);
+  h = HEADER(d->frames[i].data);
+  h->leaf = (uint16_t)leaf;
+  h->dataStart = PAGE_SIZE;
+  d->frames[i].dirty = 1;
+  return i;
+}
+/*--------------------------------------------------------------------*/
+static int compare_key(const struct Cell *c, const char *key, size_t len)
+
+/* Compare the key of c with the len-byte key: bytes first, then length */
+{
+  size_t n = c->keyLen < len ? c->keyLen : len;
+  int r = memcmp(CELL_KEY(c), key, n);
+
+  if (r != 0) return r;
+  return (c->keyLen > len) - (c->keyLen < len);
+}
+/*--------------------------------------------------------------------*/
+static int lower_bound(unsigned char *p, const char *key, size_t len,
+                       int *found, unsigned long *probes)
+
+/* Return the index of the first cell of page p whose key is not below
+   key, and set *found if it equals key. Add the keys compared to
+   *probes. */
+{
+  int lo = 0, hi = HEADER(p)->count, mid, r;
+
+  *found = 0;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    (*probes)++;
+    r = compare_key(CELL(p, mid), key, len);
+    if (r < 0) lo = mid + 1;
+    else {
+      if (r == 0) *found = 1;
+      hi = mid;
+    }
+  }
+  return lo;
+}
+/*--------------------------------------------------------------------*/
+static uint32_t child_for(unsigned char *p, const char *key, size_t len,
+                          unsigned long *probes)
+
+/* Return the child of inner page p whose keys include key */
+{
+  int found, i = lower_bound(p, key, len, &found, probes);
+
+  if (found) return (uint32_t)CELL(p, i)->aux;
+  return i == 0 ? HEADER(p)->link : (uint32_t)CELL(p, i - 1)->aux;
+}
+/*--------------------------------------------------------------------*/
+static int descend(DB_T d, int tree, const char *key, size_t len,
+                   uint32_t *path, int *depth, unsigned long *probes)
+
+/* Walk from the root of tree to the leaf where key belongs and return
+   its frame, pinned. If path is not NULL, store the pages passed on the
+   way (root first) in it and their number in *depth. NO_FRAME on
+   failure. */
+{
+  uint32_t page = d->meta.root[tree];
+  int i, n = 0;
+
+  for (;;) {
+    if ((i = pin(d, page)) == NO_FRAME) return NO_FRAME;
+    if (HEADER(d->frames[i].data)->leaf) break;
+    if (n == MAX_DEPTH) {
+      fprintf(stderr, "Error: The tree is deeper than %d\n", MAX_DEPTH);
+      unpin(d, i, 0);
+      return NO_FRAME;
+    }
+    if (path) path[n] = page;
+    n++;
+    page = child_for(d->frames[i].data, key, len, probes);
+    unpin(d, i, 0);
+  }
+  if (depth) *depth = n;
+  return i;
+}
+/*--------------------------------------------------------------------*/
+static int find(DB_T d, int tree, const char *key, size_t len,
+                char *val, size_t *valLen, unsigned long *probes)
+
+/* Return the purchase stored with key in tree, -1 if it isn't there.
+   If val is not NULL, copy the value there (MAX_KEY_BYTES of room) and
+   its length to *valLen. */
+{
+  struct Cell *c;
+  int i, at, found, result = -1;
+
+  if ((i = descend(d, tree, key, len, NULL, NULL, probes)) == NO_FRAME)
+    return -1;
+  at = lower_bound(d->frames[i].data, key, len, &found, probes);
+  if (found) {
+    c = CELL(d->frames[i].data, at);
+    result = c->aux;
+    if (val) {
+      memcpy(val, CELL_VAL(c), c->valLen);
+      *valLen = c->valLen;
+    }
+  }
+  unpin(d, i, 0);
+  return result;
+}
+/*--------------------------------------------------------------------*/
+static size_t free_bytes(unsigned char *p)
+{
+  return HEADER(p)->dataStart - sizeof(struct PageHeader) -
+         HEADER(p)->count * sizeof(uint16_t);
+}
+/*--------------------------------------------------------------------*/
+static void compact(unsigned char *p)
+
+/* Pack the cells of p against the end of the page again, dropping the
+   bytes of removed ones */
+{
+  unsigned char tmp[PAGE_SIZE] __attribute__((aligned(8)));
+  struct PageHeader *h = HEADER(p);
+  size_t size;
+  int i;
+
+  memcpy(tmp, p, PAGE_SIZE);
+  h->dataStart = PAGE_SIZE;
+  for (i = 0; i < h->count; i++) {
+    size = CELL_SIZE(CELL(tmp, i));
+    h->dataStart -= (uint16_t)size;
+    memcpy(p + h->dataStart, CELL(tmp, i), size);
+    SLOT(p, i) = h->dataStart;
+  }
+  h->garbage = 0;
+}
+/*--------------------------------------------------------------------*/
+static size_t make_cell(unsigned char *at, const char *key, size_t keyLen,
+                        const char *val, size_t valLen, int32_t aux)
+
+/* Write a cell at 'at' and return its size */
+{
+  struct Cell *c = (struct Cell *)at;
+
+  c->keyLen = (uint16_t)keyLen;
+  c->valLen = (uint16_t)valLen;
+  c->aux = aux;
+  memcpy((char *)CELL_KEY(c), key, keyLen);
+  if (valLen) memcpy((char *)CELL_VAL(c), val, valLen);
+  return CELL_SIZE(c);
+}
+/*--------------------------------------------------------------------*/
+static void put_cell(unsigned char *p, int at, const char *key, size_t keyLen,
+                     const char *val, size_t valLen, int32_t aux)
+
+/* Insert a cell at index at of p, which has room for it */
+{
+  struct PageHeader *h = HEADER(p);
+
+  h->dataStart -= (uint16_t)CELL_BYTES(keyLen, valLen);
+  make_cell(p + h->dataStart, key, keyLen, val, valLen, aux);
+  memmove(&SLOT(p, at + 1), &SLOT(p, at), (h->count - at) * sizeof(uint16_t));
+  SLOT(p, at) = h->dataStart;
+  h->count++;
+}
+/*--------------------------------------------------------------------*/
+static void remove_cell(unsigned char *p, int at)
+{
+  struct PageHeader *h = HEADER(p);
+
+  h->garbage += (uint16_t)CELL_SIZE(CELL(p, at));
+  memmove(&SLOT(p, at), &SLOT(p, at + 1),
+          (h->count - at - 1) * sizeof(uint16_t));
+  h->count--;
+}
+/*--------------------------------------------------------------------*/
+static void copy_cells(unsigned char *p, unsigned char *from,
+                       const uint16_t *offs, int first, int end)
+
+/* Append the cells at from + offs[first..end) to page p */
+{
+  struct Cell *c;
+  int i;
+
+  for (i = first; i < end; i++) {
+    c = (struct Cell *)(from + offs[i]);
+    put_cell(p, HEADER(p)->count, CELL_KEY(c), c->keyLen, CELL_VAL(c),
+             c->valLen, c->aux);
+  }
+}
+/*--------------------------------------------------------------------*/
+static int split(DB_T d, int left, int at, const char *key, size_t keyLen,
+                 const char *val, size_t valLen, int32_t aux,
+                 char *sep, size_t *sepLen, uint32_t *right)
+
+/* Split the full page in frame left while inserting the cell (key, val,
+   aux) at index at: the cells making up the lower half of the bytes
+   stay, the others go to a new page. A leaf keeps a copy of the first
+   key of the new page as the separator; an inner page gives its middle
+   key up, whose child becomes the new page's leftmost one. Store the
+   separator in sep and the new page in *right. Return 0 or -1 (nothing
+   changed). */
+{
+  unsigned char merged[2 * PAGE_SIZE] __attribute__((aligned(8)));
+  unsigned char *p = d->frames[left].data, *q;
+  uint16_t offs[PAGE_SIZE / sizeof(struct Cell) + 1];
+  struct PageHeader *h = HEADER(p);
+  int n = h->count + 1, i, j, m, r;
+  size_t used = 0, size = 0;
+  struct Cell *c;
+
+  if ((r = new_page(d, h->leaf)) == NO_FRAME) return -1;
+  q = d->frames[r].data;
+
+  /* the old cells and the new one, in key order */
+  for (i = 0, j = 0; i < n; i++) {
+    offs[i] = (uint16_t)used;
+    if (i == at)
+      used += make_cell(merged + used, key, keyLen, val, valLen, aux);
+    else {
+      c = CELL(p, j++);
+      memcpy(merged + used, c, CELL_SIZE(c));
+      used += CELL_SIZE(c);
+    }
+  }
+
+  /* cells [0, m) stay, counting their slots too */
+  for (m = 0; m < n - 1 && size < (used + n * sizeof(uint16_t)) / 2; m++)
+    size += CELL_SIZE((struct Cell *)(merged + offs[m])) + sizeof(uint16_t);
+  if (m == 0) m = 1;
+
+  h->count = 0;
+  h->dataStart = PAGE_SIZE;
+  h->garbage = 0;
+  copy_cells(p, merged, offs, 0, m);
+  c = (struct Cell *)(merged + offs[m]);
+  memcpy(sep, CELL_KEY(c), c->keyLen);
+  *sepLen = c->keyLen;
+  if (h->leaf) {
+    copy_cells(q, merged, offs, m, n);
+    HEADER(q)->link = h->link;
+    h->link = d->frames[r].page;
+  }
+  else {
+    HEADER(q)->link = (uint32_t)c->aux;
+    copy_cells(q, merged, offs, m + 1, n);
+  }
+  *right = d->frames[r].page;
+  unpin(d, r, 1);
+  d->frames[left].dirty = 1;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int tree_insert(DB_T d, int tree, const char *key, size_t keyLen,
+                       const char *val, size_t valLen, int32_t aux)
+
+/* Insert the cell (key, val, aux) into the leaf of tree where key
+   belongs, splitting pages up the path as long as they are full.
+   Return 0, or -1 if key is already there or on failure. */
+{
+  uint32_t path[MAX_DEPTH], right, page;
+  char sep[2][MAX_KEY_BYTES];
+  size_t sepLen, need;
+  unsigned long probes = 0;
+  unsigned char *p;
+  int i, r, at, found, depth, flip = 0;
+
+  i = descend(d, tree, key, keyLen, path, &depth, &probes);
+  if (i == NO_FRAME) return -1;
+  for (;;) {
+    p = d->frames[i].data;
+    at = lower_bound(p, key, keyLen, &found, &probes);
+    if (found && HEADER(p)->leaf) {
+      unpin(d, i, 0);
+      return -1;
+    }
+    need = sizeof(uint16_t) + CELL_BYTES(keyLen, valLen);
+    if (free_bytes(p) < need && free_bytes(p) + HEADER(p)->garbage >= need)
+      compact(p);
+    if (free_bytes(p) >= need) {
+      put_cell(p, at, key, keyLen, val, valLen, aux);
+      unpin(d, i, 1);
+      return 0;
+    }
+
+    /* full: split, then insert the separator one level up */
+    if (split(d, i, at, key, keyLen, val, valLen, aux, sep[flip], &sepLen,
+              &right) < 0) {
+      unpin(d, i, 0);
+      return -1;
+    }
+    page = d->frames[i].page;
+    unpin(d, i, 1);
+    key = sep[flip];
+    keyLen = sepLen;
+    val = NULL;
+    valLen = 0;
+    aux = (int32_t)right;
+    flip = !flip;
+    if (depth == 0) {                     /* the root split */
+      if ((r = new_page(d, 0)) == NO_FRAME) return -1;
+      HEADER(d->frames[r].data)->link = page;
+      put_cell(d->frames[r].data, 0, key, keyLen, NULL, 0, aux);
+      d->meta.root[tree] = d->frames[r].page;
+      unpin(d, r, 1);
+      return 0;
+    }
+    if ((i = pin(d, path[--depth])) == NO_FRAME) return -1;
+  }
+}
+/*--------------------------------------------------------------------*/
+static int tree_delete(DB_T d, int tree, const char *key, size_t len,
+                       char *val, size_t *valLen)
+
+/* Remove key from tree and return its purchase, -1 if it isn't there.
+   If val is not NULL, copy the value there first as find() does. */
+{
+  unsigned long probes = 0;
+  struct Cell *c;
+  int i, at, found, result = -1;
+
+  if ((i = descend(d, tree, key, len, NULL, NULL, &probes)) == NO_FRAME)
+    return -1;
+  at = lower_bound(d->frames[i].data, key, len, &found, &probes);
+  if (found) {
+    c = CELL(d->frames[i].data, at);
+    result = c->aux;
+    if (val) {
+      memcpy(val, CELL_VAL(c), c->valLen);
+      *valLen = c->valLen;
+    }
+    remove_cell(d->frames[i].data, at);
+  }
+  unpin(d, i, found);
+  return result;
+}
+/*--------------------------------------------------------------------*/
+static size_t cell_strings(DB_T d, const struct Cell *c, char *id, char *name)
+
+/* Copy the id and the name of the id leaf cell c to id and name,
+   NUL-terminated, and return the length of the name (the value without
+   the attribute codes). */
+{
+  size_t nameLen = c->valLen - d->meta.attrs;
+
+  memcpy(id, CELL_KEY(c), c->keyLen);
+  id[c->keyLen] = '\0';
+  memcpy(name, CELL_VAL(c), nameLen);
+  name[nameLen] = '\0';
+  return nameLen;
+}
+/*--------------------------------------------------------------------*/
+static int write_meta(DB_T d)
+{
+  unsigned char page[PAGE_SIZE];
+
+  memset(page, 0, PAGE_SIZE);
+  memcpy(page, &d->meta, sizeof(d->meta));
+  if (pwrite(d->fd, page, PAGE_SIZE, 0) != PAGE_SIZE) {
+    fprintf(stderr, "Error: Can't write the header of the db file\n");
+    return -1;
+  }
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int open_file(DB_T d, const char *path, int attrs)
+
+/* Open the db file at path, or an unlinked temporary file if path is
+   NULL, and read or set up its trees, with attrs attributes if the file
+   is new. Return 0 or -1. */
+{
+  const char *dir = getenv("TMPDIR");
+  char tmp[4096];
+  struct stat st;
+  int i, j;
+
+  if (path == NULL) {
+    snprintf(tmp, sizeof(tmp), "%s/customer_db_XXXXXX", dir ? dir : "/tmp");
+    if ((d->fd = mkstemp(tmp)) >= 0) unlink(tmp);
+  }
+  else
+    d->fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (d->fd < 0 || fstat(d->fd, &st) < 0) {
+    fprintf(stderr, "Error: Can't open the db file %s\n", path ? path : tmp);
+    return -1;
+  }
+
+  if (st.st_size > 0) {                   /* trees written before */
+    if (pread(d->fd, &d->meta, sizeof(d->meta), 0) != sizeof(d->meta) ||
+        d->meta.magic != META_MAGIC || d->meta.version != META_VERSION ||
+        d->meta.pageSize != PAGE_SIZE ||
+        d->meta.attrs > CUSTOMER_MAX_ATTRS ||
+        (off_t)d->meta.pageCount * PAGE_SIZE > st.st_size) {
+      fprintf(stderr, "Error: %s is not a customer db file\n", path);
+      return -1;
+    }
+    return 0;
+  }
+
+  d->meta.magic = META_MAGIC;
+  d->meta.version = META_VERSION;
+  d->meta.pageSize = PAGE_SIZE;
+  d->meta.pageCount = 1;
+  d->meta.attrs = (uint32_t)attrs;
+  if ((i = new_page(d, 1)) == NO_FRAME || (j = new_page(d, 1)) == NO_FRAME)
+    return -1;
+  d->meta.root[ID_TREE] = d->meta.firstLeaf = d->frames[i].page;
+  d->meta.root[NAME_TREE] = d->frames[j].page;
+  unpin(d, i, 1);
+  unpin(d, j, 1);
+  return path ? write_meta(d) : 0;
+}
+/*--------------------------------------------------------------------*/
+DB_T
+CreateCustomerDB(void)
+{
+  return CreateCustomerDBEx(NULL);
+}
+/*--------------------------------------------------------------------*/
+DB_T
+CreateCustomerDBEx(const struct CustomerDBOptions *options)
+{
+  size_t cache = DEFAULT_CACHE_BYTES;
+  uint32_t buckets = 1;
+  DB_T d;
+  int i, attrs = 0;
+
+  if (options && options->cacheBytes) cache = options->cacheBytes;
+  if (options && options->attrCount > 0) attrs = options->attrCount;
+  if (attrs > CUSTOMER_MAX_ATTRS) {
+    fprintf(stderr, "Error: Can't create %d attribute columns\n", attrs);
+    return NULL;
+  }
+  d = (DB_T)calloc(1, sizeof(struct DB));
+  if (d == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for DB_T\n");
+    return NULL;
+  }
+  d->fd = -1;
+  d->persistent = options && options->path;
+  d->owner = getpid();
+  d->frameCount = (int)(cache / PAGE_SIZE);
+  if (d->frameCount < MIN_FRAMES) d->frameCount = MIN_FRAMES;
+  while (buckets < (uint32_t)d->frameCount) buckets <<= 1;
+  d->hashMask = buckets - 1;
+  d->frames = (struct Frame *)calloc(d->frameCount, sizeof(struct Frame));
+  d->hash = (int *)malloc(buckets * sizeof(int));
+  if (d->frames == NULL || d->hash == NULL ||
+      posix_memalign((void **)&d->pool, PAGE_SIZE,
+                     (size_t)d->frameCount * PAGE_SIZE) != 0) {
+    fprintf(stderr, "Error: Can't allocate a buffer pool of %d pages\n",
+            d->frameCount);
+    d->pool = NULL;
+    DestroyCustomerDB(d);
+    return NULL;
+  }
+  for (i = 0; i < (int)buckets; i++) d->hash[i] = NO_FRAME;
+  for (i = 0; i < d->frameCount; i++) {
+    d->frames[i].data = d->pool + (size_t)i * PAGE_SIZE;
+    d->frames[i].hashNext = NO_FRAME;
+  }
+  if (open_file(d, options ? options->path : NULL, attrs) < 0 ||
+      (d->quantiles = CreateQuantileSketch()) == NULL ||
+      (d->meta.count > 0 && QuantileSketchRebuild(d->quantiles, d) < 0)) {
+    DestroyCustomerDB(d);
+    return NULL;
+  }
+  return d;
+}
+/*--------------------------------------------------------------------*/
+void
+DestroyCustomerDB(DB_T d)
+{
+  int i;
+
+  if (d == NULL) return;
+  if (d->persistent && d->fd >= 0 && d->meta.magic == META_MAGIC &&
+      getpid() == d->owner) {
+    /* leave the file whole for the next open */
+    for (i = 0; i < d->frameCount; i++)
+      if (d->frames[i].page != 0) write_frame(d, &d->frames[i]);
+    if (write_meta(d) == 0) fsync(d->fd);
+  }
+  if (d->fd >= 0) close(d->fd);
+  free(d->frames);
+  free(d->hash);
+  free(d->pool);
+  DestroyFrozenDB(d->frozen);
+  DestroyQuantileSketch(d->quantiles);
+  free(d);
+}
+/*--------------------------------------------------------------------*/
+static int frozen_lookup(DB_T d, int byName, const char *key, size_t len)
+
+/* Look the len-byte id (or name, if byName) up in the frozen image of
+   d, counting it like a tree lookup. */
+{
+  int purchase = FrozenGetPurchase(d->frozen, byName, key, len);
+
+  STAT_ADD(d, lookups, 1);
+  STAT_ADD(d, probes, 1);
+  if (purchase < 0) STAT_ADD(d, misses, 1);
+  else STAT_ADD(d, hits, 1);
+  return purchase;
+}
+/*--------------------------------------------------------------------*/
+static int
+register_customer(DB_T d, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, const int purchase)
+{
+  char value[MAX_KEY_BYTES];
+  unsigned long probes = 0;
+
+  if (d == NULL || id == NULL || name == NULL || purchase <= 0) return -1;
+  if (d->frozen) return -1; /* frozen dbs are read-only */
+  if (idLen + nameLen + d->meta.attrs > MAX_KEY_BYTES) {
+    fprintf(stderr, "Error: An id and a name of %zu bytes don't fit a page\n",
+            idLen + nameLen);
+    return -1;
+  }
+
+  /* both keys must be new */
+  if (find(d, ID_TREE, id, idLen, NULL, NULL, &probes) >= 0 ||
+      find(d, NAME_TREE, name, nameLen, NULL, NULL, &probes) >= 0)
+    return -1;
+  /* the id cell holds the name and the codes, all 0 to start with */
+  memcpy(value, name, nameLen);
+  memset(value + nameLen, 0, d->meta.attrs);
+  if (tree_insert(d, ID_TREE, id, idLen, value, nameLen + d->meta.attrs,
+                  purchase) < 0)
+    return -1;
+  if (tree_insert(d, NAME_TREE, name, nameLen, id, idLen, purchase) < 0) {
+    tree_delete(d, ID_TREE, id, idLen, NULL, NULL);
+    return -1;
+  }
+  d->meta.count++;
+  STAT_ADD(d, inserts, 1);
+  QuantileSketchAdd(d->quantiles, purchase);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int
+unregister_by_key(DB_T d, int tree, const char *key, size_t len)
+
+/* Remove the customer whose id (tree ID_TREE) or name (NAME_TREE) is
+   key from both trees. Return 0 or -1 if there is none. */
+{
+  char other[MAX_KEY_BYTES];
+  size_t otherLen;
+  int purchase;
+
+  if (d == NULL || key == NULL) return -1;
+  if (d->frozen) return -1; /* frozen dbs are read-only */
+  if ((purchase = tree_delete(d, tree, key, len, other, &otherLen)) < 0)
+    return -1;
+  if (tree == ID_TREE) otherLen -= d->meta.attrs; /* the name alone */
+  tree_delete(d, !tree, other, otherLen, NULL, NULL);
+  d->meta.count--;
+  STAT_ADD(d, deletes, 1);
+  if (QuantileSketchRemove(d->quantiles, purchase) == 1)
+    QuantileSketchRebuild(d->quantiles, d);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int
+get_purchase(DB_T d, int tree, const char *key, size_t len)
+{
+  unsigned long probes = 0;
+  int purchase;
+
+  if (d == NULL || key == NULL) return -1;
+  if (d->frozen) return frozen_lookup(d, tree == NAME_TREE, key, len);
+  purchase = find(d, tree, key, len, NULL, NULL, &probes);
+  STAT_ADD(d, lookups, 1);
+  STAT_ADD(d, probes, probes);
+  if (purchase < 0) STAT_ADD(d, misses, 1);
+  else STAT_ADD(d, hits, 1);
+  return purchase;
+}
+/*--------------------------------------------------------------------*/
+static int get_sum_customer_purchase(DB_T d, FUNCPTR_T fp)
+{
+  char id[MAX_KEY_BYTES + 1], name[MAX_KEY_BYTES + 1];
+  uint32_t page;
+  unsigned char *p;
+  int i, k, total = 0;
+
+  if (d == NULL || fp == NULL) return -1;
+  if (d->frozen) return FrozenSum(d->frozen, fp);
+
+  for (page = d->meta.firstLeaf; page != 0; page = HEADER(p)->link) {
+    if ((i = pin(d, page)) == NO_FRAME) return -1;
+    p = d->frames[i].data;
+    for (k = 0; k < HEADER(p)->count; k++) {
+      cell_strings(d, CELL(p, k), id, name);
+      total += fp(id, name, CELL(p, k)->aux);
+    }
+    unpin(d, i, 0);
+  }
+  return total;
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBOptions(DB_T d, struct CustomerDBOptions *options)
+{
+  if (d == NULL || options == NULL) return -1;
+  memset(options, 0, sizeof(*options));
+  options->cacheBytes = (size_t)d->frameCount * PAGE_SIZE;
+  options->attrCount = (int)d->meta.attrs;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBMemoryUsage(DB_T d, struct CustomerDBMemoryUsage *usage)
+{
+  if (d == NULL || usage == NULL) return -1;
+
+  /* the customers are in the file; memory is the pool and its tables */
+  usage->records = 0;
+  usage->keys = 0;
+  usage->buckets = (size_t)d->frameCount * PAGE_SIZE +
+                   QuantileSketchMemory(d->quantiles);
+  usage->overhead = (size_t)d->frameCount * sizeof(struct Frame) +
+                    (d->hashMask + 1) * sizeof(int);
+  if (d->frozen) { /* the image replaces the (empty) trees */
+    size_t records, keys, index;
+    FrozenMemory(d->frozen, &records, &keys, &index);
+    usage->records += records;
+    usage->keys += keys;
+    usage->buckets += index;
+  }
+  usage->total = sizeof(struct DB) + usage->records + usage->buckets +
+                 usage->keys + usage->overhead;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+GetPurchaseQuantile(DB_T d, double q)
+{
+  if (d == NULL) return -1;
+  return QuantileSketchQuery(d->quantiles, q);
+}
+/*--------------------------------------------------------------------*/
+static int attr_at(DB_T d, const char *id, int attr, int code)
+
+/* Return the code of attribute attr of the customer with id, after
+   setting it to code if code >= 0, or -1 if there is no such
+   customer. */
+{
+  unsigned long probes = 0;
+  size_t len = strlen(id);
+  unsigned char *codes;
+  struct Cell *c;
+  int i, at, found, result = -1;
+
+  if ((i = descend(d, ID_TREE, id, len, NULL, NULL, &probes)) == NO_FRAME)
+    return -1;
+  at = lower_bound(d->frames[i].data, id, len, &found, &probes);
+  if (found) {
+    c = CELL(d->frames[i].data, at);
+    codes = (unsigned char *)CELL_VAL(c) + c->valLen - d->meta.attrs;
+    if (code >= 0) codes[attr] = (unsigned char)code;
+    result = codes[attr];
+  }
+  unpin(d, i, found && code >= 0);
+  return result;
+}
+/*--------------------------------------------------------------------*/
+/* Attributes: the codes are the last meta.attrs bytes of the value of
+   each id leaf cell. A frozen db has none, as its image keeps only
+   ids, names and purchases. */
+int
+SetCustomerAttr(DB_T d, const char *id, int attr, int code)
+{
+  if (d == NULL || id == NULL || d->frozen) return -1;
+  if (attr < 0 || attr >= (int)d->meta.attrs) return -1;
+  if (code < 0 || code >= CUSTOMER_ATTR_CODES) return -1;
+  return attr_at(d, id, attr, code) < 0 ? -1 : 0;
+}
+
+int
+GetCustomerAttr(DB_T d, const char *id, int attr)
+{
+  if (d == NULL || id == NULL || d->frozen) return -1;
+  if (attr < 0 || attr >= (int)d->meta.attrs) return -1;
+  return attr_at(d, id, attr, -1);
+}
+
+int
+GroupSumPurchaseBy(DB_T d, int attr, long out[CUSTOMER_ATTR_CODES])
+{
+  const unsigned char *v;
+  uint32_t page;
+  unsigned char *p;
+  struct Cell *c;
+  int i, k, count = 0;
+
+  if (d == NULL || out == NULL || d->frozen) return -1;
+  if (attr < 0 || attr >= (int)d->meta.attrs) return -1;
+
+  memset(out, 0, CUSTOMER_ATTR_CODES * sizeof(long));
+  for (page = d->meta.firstLeaf; page != 0; page = HEADER(p)->link) {
+    if ((i = pin(d, page)) == NO_FRAME) return -1;
+    p = d->frames[i].data;
+    for (k = 0; k < HEADER(p)->count; k++) {
+      c = CELL(p, k);
+      v = (const unsigned char *)CELL_VAL(c);
+      out[v[c->valLen - d->meta.attrs + attr]] += c->aux;
+    }
+    count += HEADER(p)->count;
+    unpin(d, i, 0);
+  }
+  return count;
+}
+/*--------------------------------------------------------------------*/
+int
+GetCustomerDBStats(DB_T d, struct CustomerDBStats *stats)
+{
+  if (d == NULL || stats == NULL) return -1;
+
+  /* counters only: the trees have no chains to measure */
+  *stats = d->stats;
+  stats->avgIdChain = stats->avgNameChain = 0.0;
+  stats->maxIdChain = stats->maxNameChain = 0;
+  memset(stats->idHistogram, 0, sizeof(stats->idHistogram));
+  memset(stats->nameHistogram, 0, sizeof(stats->nameHistogram));
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int report(DB_T d, int type, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, int purchase, int result)
+
+/* Pass a finished API call to the hook of d, if one is installed,
+   and return its result unchanged. */
+{
+  struct CustomerOp op;
+
+  if (d == NULL || d->hook == NULL) return result;
+
+  op.type = type;
+  op.id = id;
+  op.idLen = id ? idLen : 0;
+  op.name = name;
+  op.nameLen = name ? nameLen : 0;
+  op.purchase = purchase;
+  op.result = result;
+  d->hook(d->hookCtx, &op);
+  return result;
+}
+/*--------------------------------------------------------------------*/
+int
+SetCustomerDBHook(DB_T d, HOOKFUNC_T hook, void *ctx)
+{
+  if (d == NULL) return -1;
+  d->hook = hook;
+  d->hookCtx = ctx;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+/* No memory limit here: nothing is ever evicted, so fn is never called */
+int
+SetCustomerDBEvictCallback(DB_T d, EVICTFUNC_T fn, void *ctx)
+{
+  (void)fn; (void)ctx;
+  return d == NULL ? -1 : 0;
+}
+/*--------------------------------------------------------------------*/
+/* Public entry points: run the operation, then report it to the hook.
+   The NUL-terminated variants measure their keys and call the ...N
+   variants. */
+int
+RegisterCustomerN(DB_T d, const char *id, size_t idLen,
+                  const char *name, size_t nameLen, const int purchase)
+{
+  return report(d, CUSTOMER_OP_REGISTER, id, idLen, name, nameLen, purchase,
+                register_customer(d, id, idLen, name, nameLen, purchase));
+}
+
+int
+RegisterCustomerTakeOwnership(DB_T d, char *id, char *name, const int purchase)
+{
+  int result = RegisterCustomer(d, id, name, purchase);
+
+  if (result == 0) { /* both keys were copied into the pages */
+    free(id);
+    free(name);
+  }
+  return result;
+}
+
+int
+RegisterCustomerPooled(DB_T d, const char *id, const char *name,
+                       const int purchase)
+{
+  /* the pages keep their own copy, no reference is held */
+  return RegisterCustomerN(d, id, StringPoolLength(id),
+                           name, StringPoolLength(name), purchase);
+}
+
+int
+UnregisterCustomerByIDN(DB_T d, const char *id, size_t idLen)
+{
+  return report(d, CUSTOMER_OP_UNREGISTER_ID, id, idLen, NULL, 0, 0,
+                unregister_by_key(d, ID_TREE, id, idLen));
+}
+
+int
+UnregisterCustomerByNameN(DB_T d, const char *name, size_t nameLen)
+{
+  return report(d, CUSTOMER_OP_UNREGISTER_NAME, NULL, 0, name, nameLen, 0,
+                unregister_by_key(d, NAME_TREE, name, nameLen));
+}
+
+int
+GetPurchaseByIDN(DB_T d, const char *id, size_t idLen)
+{
+  return report(d, CUSTOMER_OP_GET_ID, id, idLen, NULL, 0, 0,
+                get_purchase(d, ID_TREE, id, idLen));
+}
+
+int
+GetPurchaseByNameN(DB_T d, const char *name, size_t nameLen)
+{
+  return report(d, CUSTOMER_OP_GET_NAME, NULL, 0, name, nameLen, 0,
+                get_purchase(d, NAME_TREE, name, nameLen));
+}
+
+int
+RegisterCustomer(DB_T d, const char *id, const char *name, const int purchase)
+{
+  return RegisterCustomerN(d, id, id ? strlen(id) : 0,
+                           name, name ? strlen(name) : 0, purchase);
+}
+
+int
+UnregisterCustomerByID(DB_T d, const char *id)
+{
+  return UnregisterCustomerByIDN(d, id, id ? strlen(id) : 0);
+}
+
+int
+UnregisterCustomerByName(DB_T d, const char *name)
+{
+  return UnregisterCustomerByNameN(d, name, name ? strlen(name) : 0);
+}
+
+int
+GetPurchaseByID(DB_T d, const char* id)
+{
+  return GetPurchaseByIDN(d, id, id ? strlen(id) : 0);
+}
+
+int
+GetPurchaseByName(DB_T d, const char* name)
+{
+  return GetPurchaseByNameN(d, name, name ? strlen(name) : 0);
+}
+
+int
+GetSumCustomerPurchase(DB_T d, FUNCPTR_T fp)
+{
+  return report(d, CUSTOMER_OP_SUM, NULL, 0, NULL, 0, 0,
+                get_sum_customer_purchase(d, fp));
+}
+/*--------------------------------------------------------------------*/
+/* Bulk removal in one walk over the id leaves. A matching cell is
+   removed from its leaf in place, which keeps the leaf chain as it is,
+   and its name from the name tree. Every removed customer is reported
+   to the hook as an unregistration by id. A rebuild of the quantile
+   sketch reads the leaves with a cursor, so it waits for the walk. */
+int
+UnregisterCustomersWhere(DB_T d, FUNCPTR_T pred)
+{
+  char id[MAX_KEY_BYTES + 1], name[MAX_KEY_BYTES + 1];
+  uint32_t page;
+  unsigned char *p;
+  struct Cell *c;
+  size_t nameLen;
+  int i, k, dirty, removed = 0, rebuild = 0;
+
+  if (d == NULL || pred == NULL) return -1;
+  if (d->frozen) return -1; /* frozen dbs are read-only */
+
+  for (page = d->meta.firstLeaf; page != 0; page = HEADER(p)->link) {
+    if ((i = pin(d, page)) == NO_FRAME) return -1;
+    p = d->frames[i].data;
+    dirty = 0;
+    for (k = 0; k < HEADER(p)->count; ) {
+      c = CELL(p, k);
+      nameLen = cell_strings(d, c, id, name);
+      if (!pred(id, name, c->aux)) {
+        k++;
+        continue;
+      }
+      report(d, CUSTOMER_OP_UNREGISTER_ID, id, c->keyLen, NULL, 0, 0, 0);
+      tree_delete(d, NAME_TREE, name, nameLen, NULL, NULL);
+      if (QuantileSketchRemove(d->quantiles, c->aux) == 1) rebuild = 1;
+      remove_cell(p, k);
+      dirty = 1;
+      d->meta.count--;
+      STAT_ADD(d, deletes, 1);
+      removed++;
+    }
+    unpin(d, i, dirty);
+  }
+  if (rebuild) QuantileSketchRebuild(d->quantiles, d);
+  return removed;
+}
+/*--------------------------------------------------------------------*/
+/* Cursors: the position is the last id returned, so the next batch
+   starts at the first id after it wherever the splits moved it. */
+struct CustomerCursor {
+  DB_T d;
+  uint64_t pos;              /* position in the frozen image */
+  int frozen;                /* the db was frozen when the scan started */
+  int started;               /* 'last' holds the last id returned */
+  size_t lastLen;
+  char last[MAX_KEY_BYTES];
+  char *keys;                /* copies of the keys of the last batch */
+  int keysFor;               /* batch size 'keys' has room for */
+};
+/*--------------------------------------------------------------------*/
+static int next_batch(CustomerCursor_T c, struct CustomerView *views, int max)
+{
+  DB_T d = c->d;
+  unsigned long probes = 0;
+  unsigned char *p;
+  struct Cell *cell;
+  uint32_t page;
+  char *out;
+  int i, at, found, n = 0;
+
+  if (max > c->keysFor) {
+    free(c->keys);
+    c->keys = (char *)malloc((size_t)max * (MAX_KEY_BYTES + 2));
+    c->keysFor = c->keys ? max : 0;
+    if (c->keys == NULL) return -1;
+  }
+  i = descend(d, ID_TREE, c->last, c->lastLen, NULL, NULL, &probes);
+  if (i == NO_FRAME) return -1;
+  at = lower_bound(d->frames[i].data, c->last, c->lastLen, &found, &probes);
+  if (found && c->started) at++;
+
+  out = c->keys;
+  while (n < max) {
+    p = d->frames[i].data;
+    if (at >= HEADER(p)->count) {         /* on to the next leaf */
+      page = HEADER(p)->link;
+      unpin(d, i, 0);
+      if (page == 0 || (i = pin(d, page)) == NO_FRAME) {
+        i = NO_FRAME;
+        break;
+      }
+      at = 0;
+      continue;
+    }
+    cell = CELL(p, at++);
+    views[n].id = out;
+    views[n].idLen = cell->keyLen;
+    views[n].name = out + cell->keyLen + 1;
+    views[n].nameLen = cell_strings(d, cell, out, out + cell->keyLen + 1);
+    views[n].purchase = cell->aux;
+    out += cell->keyLen + views[n].nameLen + 2;
+    n++;
+  }
+  if (i != NO_FRAME) unpin(d, i, 0);
+  if (n > 0) {
+    memcpy(c->last, views[n - 1].id, views[n - 1].idLen);
+    c->lastLen = views[n - 1].idLen;
+    c->started = 1;
+  }
+  return n;
+}
+/*--------------------------------------------------------------------*/
+CustomerCursor_T
+OpenCustomerCursor(DB_T d)
+{
+  CustomerCursor_T c;
+
+  if (d == NULL) return NULL;
+  c = (CustomerCursor_T)calloc(1, sizeof(struct CustomerCursor));
+  if (c == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the cursor\n");
+    return NULL;
+  }
+  c->d = d;
+  c->frozen = (d->frozen != NULL);
+  return c;
+}
+/*--------------------------------------------------------------------*/
+int
+NextCustomerBatch(CustomerCursor_T c, struct CustomerView *views, int max)
+{
+  if (c == NULL || views == NULL || max <= 0) return -1;
+  if (c->frozen != (c->d->frozen != NULL)) return -1;
+  if (c->frozen) return FrozenNextBatch(c->d->frozen, &c->pos, views, max);
+  return next_batch(c, views, max);
+}
+/*--------------------------------------------------------------------*/
+void
+CloseCustomerCursor(CustomerCursor_T c)
+{
+  if (c == NULL) return;
+  free(c->keys);
+  free(c);
+}
+/*--------------------------------------------------------------------*/
+/* Frozen dbs (frozen_db.h): the customers are copied into an image
+   with minimal perfect hashes, then the trees are swapped for the
+   empty ones of a fresh db and the old ones are destroyed (a db file
+   keeps the customers it had when frozen). */
+int
+FreezeCustomerDB(DB_T d)
+{
+  char id[MAX_KEY_BYTES + 1], name[MAX_KEY_BYTES + 1];
+  FrozenBuilder_T b;
+  FrozenDB_T f;
+  DB_T fresh;
+  struct DB old;
+  uint32_t page;
+  unsigned char *p;
+  struct Cell *c;
+  size_t nameLen;
+  int i, k;
+
+  if (d == NULL || d->frozen) return -1;
+  if ((b = CreateFrozenBuilder()) == NULL) return -1;
+  for (page = d->meta.firstLeaf; page != 0; page = HEADER(p)->link) {
+    if ((i = pin(d, page)) == NO_FRAME) {
+      DestroyFrozenBuilder(b);
+      return -1;
+    }
+    p = d->frames[i].data;
+    for (k = 0; k < HEADER(p)->count; k++) {
+      c = CELL(p, k);
+      nameLen = cell_strings(d, c, id, name);
+      if (FrozenBuilderAdd(b, id, c->keyLen, name, nameLen, c->aux) < 0) {
+        unpin(d, i, 0);
+        DestroyFrozenBuilder(b);
+        return -1;
+      }
+    }
+    unpin(d, i, 0);
+  }
+  if ((f = FrozenBuild(b)) == NULL) return -1;
+
+  fresh = CreateCustomerDB();
+  if (fresh == NULL) {
+    DestroyFrozenDB(f);
+    return -1;
+  }
+  old = *d;
+  *d = *fresh;
+  d->hook = old.hook;
+  d->hookCtx = old.hookCtx;
+  d->stats = old.stats;
+  d->frozen = f;
+  d->quantiles = old.quantiles; /* the purchases are the same */
+  old.quantiles = fresh->quantiles;
+  *fresh = old;
+  DestroyCustomerDB(fresh);
+  return 0;
+}
+
+int
+SaveFrozenCustomerDB(DB_T d, const char *path)
+{
+  if (d == NULL || d->frozen == NULL) return -1;
+  return FrozenSave(d->frozen, path);
+}
+
+DB_T
+LoadFrozenCustomerDB(const char *path)
+{
+  FrozenDB_T f;
+  DB_T d;
+
+  if ((f = FrozenLoad(path)) == NULL) return NULL;
+  d = CreateCustomerDB();
+  if (d == NULL) {
+    DestroyFrozenDB(f);
+    return NULL;
+  }
+  d->frozen = f;
+  if (QuantileSketchRebuild(d->quantiles, d) < 0) {
+    DestroyCustomerDB(d);
+    return NULL;
+  }
+  return d;
+}
+
+DB_T
+AttachCustomerDB(const char *shmName)
+{
+  (void)shmName;
+  fprintf(stderr, "Error: customer_manager5 has no shared-memory dbs\n");
+  return NULL;
+}
@@ -0,0 +1,157 @@
+/*
+ * Program: customer_protocol.c
+ *
+ * Description:
+ * ------------
+ * Encoding and decoding of the requests and answers exchanged by
+ * customer_server and customer_load (see customer_protocol.h). Decoding
+ * works on whatever has arrived so far and reports an incomplete
+ * request instead of blocking, so the server can parse a whole read of
+ * pipelined requests in place.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "customer_protocol.h"
+
+#define MAX_REQUEST (1UL << 30)   /* longest request body accepted */
+/*--------------------------------------------------------------------*/
+static size_t put_varint(unsigned char *p, uint64_t v)
+{
+  size_t n = 0;
+
+  while (v >= 0x80) {
+    p[n++] = (unsigned char)((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (unsigned char)v;
+  return n;
+}
+/*--------------------------------------------------------------------*/
+static int get_varint(const unsigned char **p, const unsigned char *end,
+                      uint64_t *v)
+
+/* Read a varint at *p (not past end) into *v and advance *p. Return 1
+   on success, 0 if the varint is cut off at end, -1 if it's overlong. */
+{
+  const unsigned char *q = *p;
+  uint64_t result = 0;
+  int shift = 0;
+
+  for (;;) {
+    if (q == end) return 0;
+    result |= (uint64_t)(*q & 0x7f) << shift;
+    if ((*q++ & 0x80) == 0) break;
+    if ((shift += 7) > 63) return -1;
+  }
+  *p = q;
+  *v = result;
+  return 1;
+}
+/*--------------------------------------------------------------------*/
+static uint64_t zigzag(int v)
+{
+  return ((uint64_t)(int64_t)v << 1) ^ (uint64_t)((int64_t)v >> 63);
+}
+
+static int unzigzag(uint64_t v)
+{
+  return (int)(int64_t)((v >> 1) ^ (~(v & 1) + 1));
+}
+/*--------------------------------------------------------------------*/
+static int has_id(int type)
+{
+  return type == CUSTOMER_OP_REGISTER || type == CUSTOMER_OP_UNREGISTER_ID ||
+         type == CUSTOMER_OP_GET_ID;
+}
+
+static int has_name(int type)
+{
+  return type == CUSTOMER_OP_REGISTER ||
+         type == CUSTOMER_OP_UNREGISTER_NAME || type == CUSTOMER_OP_GET_NAME;
+}
+/*--------------------------------------------------------------------*/
+size_t
+ProtoEncodeRequest(unsigned char *buf, const struct CustomerOp *op)
+{
+  unsigned char head[PROTO_MAX_RESULT];
+  unsigned char *p = buf + PROTO_MAX_RESULT; /* body, moved down below */
+  size_t n = 0, h;
+
+  p[n++] = (unsigned char)op->type;
+  if (has_id(op->type)) {
+    n += put_varint(p + n, op->idLen);
+    memcpy(p + n, op->id, op->idLen);
+    n += op->idLen;
+  }
+  if (has_name(op->type)) {
+    n += put_varint(p + n, op->nameLen);
+    memcpy(p + n, op->name, op->nameLen);
+    n += op->nameLen;
+  }
+  if (op->type == CUSTOMER_OP_REGISTER)
+    n += put_varint(p + n, zigzag(op->purchase));
+
+  h = put_varint(head, n);
+  memcpy(buf, head, h);
+  memmove(buf + h, p, n);
+  return h + n;
+}
+/*--------------------------------------------------------------------*/
+static int get_key(const unsigned char **p, const unsigned char *end,
+                   const char **key, size_t *len)
+{
+  uint64_t n;
+
+  if (get_varint(p, end, &n) != 1 || n > (uint64_t)(end - *p)) return -1;
+  *key = (const char *)*p;
+  *len = (size_t)n;
+  *p += n;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+long
+ProtoDecodeRequest(const unsigned char *buf, size_t len,
+                   struct CustomerOp *op)
+{
+  const unsigned char *p = buf, *end;
+  uint64_t n, v;
+  int r;
+
+  if ((r = get_varint(&p, buf + len, &n)) <= 0) return r;
+  if (n == 0 || n > MAX_REQUEST) return -1;
+  if (n > (uint64_t)(buf + len - p)) return 0;
+  end = p + n;
+
+  memset(op, 0, sizeof(*op));
+  op->type = *p++;
+  if (op->type < CUSTOMER_OP_REGISTER || op->type > CUSTOMER_OP_SUM)
+    return -1;
+  if (has_id(op->type) && get_key(&p, end, &op->id, &op->idLen) < 0)
+    return -1;
+  if (has_name(op->type) && get_key(&p, end, &op->name, &op->nameLen) < 0)
+    return -1;
+  if (op->type == CUSTOMER_OP_REGISTER) {
+    if (get_varint(&p, end, &v) != 1) return -1;
+    op->purchase = unzigzag(v);
+  }
+  return p == end ? (long)(end - buf) : -1;
+}
+/*--------------------------------------------------------------------*/
+size_t
+ProtoEncodeResult(unsigned char *buf, int result)
+{
+  return put_varint(buf, zigzag(result));
+}
+/*--------------------------------------------------------------------*/
+long
+ProtoDecodeResult(const unsigned char *buf, size_t len, int *result)
+{
+  const unsigned char *p = buf;
+  uint64_t v;
+  int r;
+
+  if ((r = get_varint(&p, buf + len, &v)) <= 0) return r;
+  *result = unzigzag(v);
+  return (long)(p - buf);
+}
@@ -0,0 +1,47 @@
+#ifndef CUSTOMER_PROTOCOL_H
+#define CUSTOMER_PROTOCOL_H
+
+/* customer_protocol.h */
+/* Wire format of customer_server and customer_load.
+
+   A client sends requests back to back without waiting; the server
+   answers them in order, several answers per write. A request is a
+   varint body length followed by the body
+     u8      op type (CUSTOMER_OP_*)
+     [varint id length, id bytes]      if the op has an id
+     [varint name length, name bytes]  if the op has a name
+     [zigzag varint purchase]          register only
+   and an answer is the zigzag varint result of the call. The sum
+   request takes no function: the server sums the purchases.
+
+   Integers are LEB128 varints as in customer_trace.h. */
+
+#include <stddef.h>
+#include "customer_manager.h"
+
+/* bytes of request framing besides the keys */
+#define PROTO_REQUEST_OVERHEAD 48
+
+/* bytes of the longest answer */
+#define PROTO_MAX_RESULT 10
+
+/* write the request for op (type, keys and purchase) at buf, which has
+   room for PROTO_REQUEST_OVERHEAD + idLen + nameLen bytes. return the
+   bytes written */
+size_t ProtoEncodeRequest(unsigned char *buf, const struct CustomerOp *op);
+
+/* decode the request at the start of the len bytes at buf into op,
+   whose keys then point into buf (not NUL-terminated). return the bytes
+   it takes, 0 if it is incomplete, -1 if it is malformed */
+long ProtoDecodeRequest(const unsigned char *buf, size_t len,
+                        struct CustomerOp *op);
+
+/* write the answer result at buf (PROTO_MAX_RESULT bytes of room) and
+   return its bytes */
+size_t ProtoEncodeResult(unsigned char *buf, int result);
+
+/* decode the answer at the start of the len bytes at buf into *result.
+   return the bytes it takes, 0 if it is incomplete, -1 if malformed */
+long ProtoDecodeResult(const unsigned char *buf, size_t len, int *result);
+
+#endif /* end of CUSTOMER_PROTOCOL_H */
@@ -0,0 +1,537 @@
+/*
+ * Program: customer_server.c
+ *
+ * Description:
+ * ------------
+ * Serves a customer database over a Unix-domain or loopback TCP socket
+ * with the pipelined protocol of customer_protocol.h.
+ *
+ * The customers are split over shards by a hash of their id, each shard
+ * a DB_T behind its own mutex. One reactor thread per core runs an epoll
+ * loop over its own connections; all reactors wait on the listening
+ * socket (EPOLLEXCLUSIVE) and keep the connections they accept. A
+ * reactor reads everything a connection has sent, runs every complete
+ * request, and writes all the answers with one write.
+ *
+ * Calls by id go to one shard. Calls by name go through a name index,
+ * itself a set of DB_Ts sharded by a hash of the name, whose entries
+ * map a name to the id shard of its customer; the name shard stays
+ * locked while the call runs on that id shard, so each name call takes
+ * two locks, always in that order. A registration checks and enters the
+ * name under the same lock, so names stay unique across shards.
+ *
+ * A removal by id does not learn the name of the customer, so it leaves
+ * its index entry behind. Name calls check the id shard anyway and drop
+ * such an entry when they meet it; once removals by id outnumber the
+ * customers by SWEEP_MIN, the next one sweeps the index of the rest.
+ *
+ * Usage: customer_server [-u path | -p port] [-t reactors] [-s shards]
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "customer_manager.h"
+#include "customer_protocol.h"
+
+#define DEFAULT_SOCKET "/tmp/customer_server.sock"
+#define MAX_REACTORS 64
+#define MAX_EVENTS 64
+#define READ_CHUNK (1 << 16)
+#define READ_LIMIT (1 << 18)       /* bytes read per readiness event */
+#define OUT_HIGH_WATER (1 << 20)   /* stop reading above this backlog */
+#define CACHE_LINE 64
+#define SWEEP_MIN 4096             /* removals by id before any sweep */
+
+struct Shard {
+  pthread_mutex_t lock;
+  DB_T db;
+} __attribute__((aligned(CACHE_LINE)));
+
+struct Buf {
+  unsigned char *p;
+  size_t len, cap;
+};
+
+struct Conn {
+  int fd;
+  struct Buf in;             /* bytes read, not yet a whole request */
+  struct Buf out;            /* answers not yet written */
+  size_t sent;               /* bytes of out written */
+  unsigned events;           /* epoll events we wait for */
+};
+
+struct Reactor {
+  int epfd;
+  pthread_t thread;
+  unsigned long requests;    /* requests run */
+  unsigned long batches;     /* writes of answers */
+  unsigned long conns;       /* connections accepted */
+} __attribute__((aligned(CACHE_LINE)));
+
+static struct Shard *shards;      /* customers, by id hash */
+static struct Shard *names;       /* name -> id shard + 1, by name hash */
+static int nShards;
+static long customers;            /* customers registered */
+static long removedById;          /* removals by id since the last sweep */
+static pthread_mutex_t sweepLock = PTHREAD_MUTEX_INITIALIZER;
+static int listenFd;
+static volatile sig_atomic_t stopping;
+/*--------------------------------------------------------------------*/
+static void on_signal(int sig)
+{
+  (void)sig;
+  stopping = 1;
+}
+/*--------------------------------------------------------------------*/
+static unsigned key_hash(const char *key, size_t len)
+
+/* FNV-1a; only spreads keys over shards and stripes */
+{
+  unsigned h = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    h = (h ^ (unsigned char)key[i]) * 16777619U;
+  return h;
+}
+/*--------------------------------------------------------------------*/
+static int sum_purchase(const char *id, const char *name, const int purchase)
+{
+  (void)id; (void)name;
+  return purchase;
+}
+/*--------------------------------------------------------------------*/
+static int by_name(const char *name, size_t len, int unregister)
+
+/* Find the customer named name through the name index: return its
+   purchase (unregister == 0) or unregister it (unregister != 0). -1 if
+   there is no such customer. Drops the index entry of a customer gone
+   by id. */
+{
+  struct Shard *n = &names[key_hash(name, len) % nShards], *s;
+  int k, r = -1;
+
+  pthread_mutex_lock(&n->lock);
+  if ((k = GetPurchaseByIDN(n->db, name, len)) > 0) {
+    s = &shards[k - 1];
+    pthread_mutex_lock(&s->lock);
+    r = unregister ? UnregisterCustomerByNameN(s->db, name, len)
+                   : GetPurchaseByNameN(s->db, name, len);
+    pthread_mutex_unlock(&s->lock);
+    if (r < 0 || unregister)
+      UnregisterCustomerByIDN(n->db, name, len);
+  }
+  pthread_mutex_unlock(&n->lock);
+  if (unregister && r == 0)
+    __atomic_sub_fetch(&customers, 1, __ATOMIC_RELAXED);
+  return r;
+}
+/*--------------------------------------------------------------------*/
+static int register_customer(const struct CustomerOp *op)
+
+/* Register the customer of op on its id shard and enter its name in
+   the name index. Return 0 or -1 if the id or name is taken. */
+{
+  struct Shard *n = &names[key_hash(op->name, op->nameLen) % nShards];
+  struct Shard *s = &shards[key_hash(op->id, op->idLen) % nShards];
+  int k, r;
+
+  pthread_mutex_lock(&n->lock);
+  if ((k = GetPurchaseByIDN(n->db, op->name, op->nameLen)) > 0) {
+    /* the name is taken unless its customer is gone by id */
+    pthread_mutex_lock(&shards[k - 1].lock);
+    r = GetPurchaseByNameN(shards[k - 1].db, op->name, op->nameLen);
+    pthread_mutex_unlock(&shards[k - 1].lock);
+    if (r >= 0) {
+      pthread_mutex_unlock(&n->lock);
+      return -1;
+    }
+    UnregisterCustomerByIDN(n->db, op->name, op->nameLen);
+  }
+
+  pthread_mutex_lock(&s->lock);
+  r = RegisterCustomerN(s->db, op->id, op->idLen, op->name, op->nameLen,
+                        op->purchase);
+  pthread_mutex_unlock(&s->lock);
+  if (r == 0 && RegisterCustomerN(n->db, op->name, op->nameLen, op->name,
+                                  op->nameLen, (int)(s - shards) + 1) < 0) {
+    pthread_mutex_lock(&s->lock);
+    UnregisterCustomerByIDN(s->db, op->id, op->idLen);
+    pthread_mutex_unlock(&s->lock);
+    r = -1;
+  }
+  pthread_mutex_unlock(&n->lock);
+  if (r == 0)
+    __atomic_add_fetch(&customers, 1, __ATOMIC_RELAXED);
+  return r;
+}
+/*--------------------------------------------------------------------*/
+static int is_stale(const char *id, const char *name, const int shard)
+
+/* UnregisterCustomersWhere() predicate over the name index, whose
+   entries have the name as id and name: is the customer of this entry
+   gone from its id shard? */
+{
+  struct Shard *s = &shards[shard - 1];
+  int r;
+
+  (void)id;
+  pthread_mutex_lock(&s->lock);
+  r = GetPurchaseByName(s->db, name);
+  pthread_mutex_unlock(&s->lock);
+  return r < 0;
+}
+/*--------------------------------------------------------------------*/
+static void sweep_names(void)
+
+/* Drop the index entries of the customers removed by id. One thread
+   sweeps at a time; the others go on. */
+{
+  int i;
+
+  if (pthread_mutex_trylock(&sweepLock) != 0) return;
+  __atomic_store_n(&removedById, 0, __ATOMIC_RELAXED);
+  for (i = 0; i < nShards; i++) {
+    pthread_mutex_lock(&names[i].lock);
+    UnregisterCustomersWhere(names[i].db, is_stale);
+    pthread_mutex_unlock(&names[i].lock);
+  }
+  pthread_mutex_unlock(&sweepLock);
+}
+/*--------------------------------------------------------------------*/
+static int run(const struct CustomerOp *op)
+
+/* Run one request on the shards and return its result */
+{
+  struct Shard *s = NULL;
+  int r, i;
+
+  if (op->id)
+    s = &shards[key_hash(op->id, op->idLen) % nShards];
+
+  switch (op->type) {
+  case CUSTOMER_OP_REGISTER:
+    return register_customer(op);
+  case CUSTOMER_OP_UNREGISTER_ID:
+    pthread_mutex_lock(&s->lock);
+    r = UnregisterCustomerByIDN(s->db, op->id, op->idLen);
+    pthread_mutex_unlock(&s->lock);
+    if (r == 0) {
+      __atomic_sub_fetch(&customers, 1, __ATOMIC_RELAXED);
+      if (__atomic_add_fetch(&removedById, 1, __ATOMIC_RELAXED) >
+          SWEEP_MIN + __atomic_load_n(&customers, __ATOMIC_RELAXED))
+        sweep_names();
+    }
+    return r;
+  case CUSTOMER_OP_GET_ID:
+    pthread_mutex_lock(&s->lock);
+    r = GetPurchaseByIDN(s->db, op->id, op->idLen);
+    pthread_mutex_unlock(&s->lock);
+    return r;
+  case CUSTOMER_OP_UNREGISTER_NAME:
+    return by_name(op->name, op->nameLen, 1);
+  case CUSTOMER_OP_GET_NAME:
+    return by_name(op->name, op->nameLen, 0);
+  case CUSTOMER_OP_SUM:
+    for (i = r = 0; i < nShards; i++) {
+      pthread_mutex_lock(&shards[i].lock);
+      r += GetSumCustomerPurchase(shards[i].db, sum_purchase);
+      pthread_mutex_unlock(&shards[i].lock);
+    }
+    return r;
+  }
+  return -1;
+}
+/*--------------------------------------------------------------------*/
+static int reserve(struct Buf *b, size_t n)
+{
+  unsigned char *p;
+  size_t cap = b->cap ? b->cap : 4096;
+
+  if (b->len + n <= b->cap) return 0;
+  while (cap < b->len + n) cap *= 2;
+  if ((p = (unsigned char *)realloc(b->p, cap)) == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for a connection\n");
+    return -1;
+  }
+  b->p = p;
+  b->cap = cap;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static void close_conn(struct Reactor *r, struct Conn *c)
+{
+  epoll_ctl(r->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  free(c->in.p);
+  free(c->out.p);
+  free(c);
+}
+/*--------------------------------------------------------------------*/
+static int want(struct Reactor *r, struct Conn *c, unsigned events)
+
+/* Wait for events on c from now on. Return 0 or -1. */
+{
+  struct epoll_event ev;
+
+  if (events == c->events) return 0;
+  ev.events = events;
+  ev.data.ptr = c;
+  c->events = events;
+  return epoll_ctl(r->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+/*--------------------------------------------------------------------*/
+static int write_out(struct Reactor *r, struct Conn *c)
+
+/* Write the pending answers of c as far as the socket takes them and
+   choose what to wait for next. Return 0, or -1 if c is broken. */
+{
+  ssize_t n;
+
+  if (c->out.len == 0) return want(r, c, EPOLLIN);
+  while (c->sent < c->out.len) {
+    n = send(c->fd, c->out.p + c->sent, c->out.len - c->sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      return -1;
+    }
+    c->sent += (size_t)n;
+  }
+  if (c->sent == c->out.len)
+    c->sent = c->out.len = 0;
+  r->batches++;
+
+  if (c->out.len - c->sent > OUT_HIGH_WATER) return want(r, c, EPOLLOUT);
+  return want(r, c, c->out.len ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+/*--------------------------------------------------------------------*/
+static int read_in(struct Reactor *r, struct Conn *c)
+
+/* Read what c has sent, run its complete requests and queue their
+   answers. Return 0, or -1 if c is closed or broken. */
+{
+  struct CustomerOp op;
+  size_t total = 0, at;
+  ssize_t n;
+  long used;
+
+  while (total < READ_LIMIT) {
+    if (reserve(&c->in, READ_CHUNK) < 0) return -1;
+    n = recv(c->fd, c->in.p + c->in.len, READ_CHUNK, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      return -1;
+    }
+    if (n == 0) return -1;
+    c->in.len += (size_t)n;
+    total += (size_t)n;
+  }
+
+  for (at = 0; (used = ProtoDecodeRequest(c->in.p + at, c->in.len - at,
+                                          &op)) > 0; at += (size_t)used) {
+    if (reserve(&c->out, PROTO_MAX_RESULT) < 0) return -1;
+    c->out.len += ProtoEncodeResult(c->out.p + c->out.len, run(&op));
+    r->requests++;
+  }
+  if (used < 0) {
+    fprintf(stderr, "Error: malformed request, closing the connection\n");
+    return -1;
+  }
+  memmove(c->in.p, c->in.p + at, c->in.len - at);
+  c->in.len -= at;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static void accept_conns(struct Reactor *r)
+{
+  struct epoll_event ev;
+  struct Conn *c;
+  int fd, one = 1;
+
+  while ((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c = (struct Conn *)calloc(1, sizeof(struct Conn));
+    if (c == NULL) {
+      close(fd);
+      continue;
+    }
+    c->fd = fd;
+    c->events = EPOLLIN;
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      close(fd);
+      free(c);
+      continue;
+    }
+    r->conns++;
+  }
+}
+/*--------------------------------------------------------------------*/
+static void *reactor_main(void *arg)
+{
+  struct Reactor *r = (struct Reactor *)arg;
+  struct epoll_event events[MAX_EVENTS];
+  struct Conn *c;
+  int n, i;
+
+  while (!stopping) {
+    n = epoll_wait(r->epfd, events, MAX_EVENTS, 200);
+    for (i = 0; i < n; i++) {
+      if ((c = (struct Conn *)events[i].data.ptr) == NULL) {
+        accept_conns(r);
+        continue;
+      }
+      if ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) &&
+          read_in(r, c) < 0) {
+        close_conn(r, c);
+        continue;
+      }
+      if (write_out(r, c) < 0)
+        close_conn(r, c);
+    }
+  }
+  return NULL;
+}
+/*--------------------------------------------------------------------*/
+static int open_listener(const char *path, int port)
+{
+  struct sockaddr_un un;
+  struct sockaddr_in in;
+  int fd, one = 1;
+
+  if (port > 0) {
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_port = htons((unsigned short)port);
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&in, sizeof(in)) < 0) goto fail;
+  } else {
+    if (strlen(path) >= sizeof(un.sun_path)) return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strcpy(un.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&un, sizeof(un)) < 0) goto fail;
+  }
+  if (listen(fd, 1024) < 0) goto fail;
+  return fd;
+
+ fail:
+  close(fd);
+  return -1;
+}
+/*--------------------------------------------------------------------*/
+int
+main(int argc, char *argv[])
+{
+  static struct Reactor reactors[MAX_REACTORS];
+  struct epoll_event ev;
+  struct sigaction sa;
+  const char *path = DEFAULT_SOCKET;
+  unsigned long requests = 0, batches = 0, conns = 0;
+  int nReactors = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int port = 0, opt, i;
+
+  nShards = 0;
+  while ((opt = getopt(argc, argv, "u:p:t:s:")) != -1) {
+    switch (opt) {
+    case 'u': path = optarg; break;
+    case 'p': port = atoi(optarg); break;
+    case 't': nReactors = atoi(optarg); break;
+    case 's': nShards = atoi(optarg); break;
+    default:
+      fprintf(stderr, "Usage: %s [-u path | -p port] [-t reactors]"
+              " [-s shards]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (nReactors < 1) nReactors = 1;
+  if (nReactors > MAX_REACTORS) nReactors = MAX_REACTORS;
+  if (nShards < 1) nShards = 4 * nReactors;
+
+  shards = (struct Shard *)calloc(nShards, sizeof(struct Shard));
+  names = (struct Shard *)calloc(nShards, sizeof(struct Shard));
+  if (shards == NULL || names == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the shards\n");
+    return 1;
+  }
+  for (i = 0; i < nShards; i++) {
+    pthread_mutex_init(&shards[i].lock, NULL);
+    pthread_mutex_init(&names[i].lock, NULL);
+    if ((shards[i].db = CreateCustomerDB()) == NULL ||
+        (names[i].db = CreateCustomerDB()) == NULL) return 1;
+  }
+
+  if ((listenFd = open_listener(path, port)) < 0) {
+    perror("Error: Can't listen");
+    return 1;
+  }
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  for (i = 0; i < nReactors; i++) {
+    reactors[i].epfd = epoll_create1(0);
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;
+    if (reactors[i].epfd < 0 ||
+        epoll_ctl(reactors[i].epfd, EPOLL_CTL_ADD, listenFd, &ev) < 0 ||
+        pthread_create(&reactors[i].thread, NULL, reactor_main,
+                       &reactors[i]) != 0) {
+      perror("Error: Can't start a reactor");
+      return 1;
+    }
+  }
+  if (port > 0)
+    printf("Serving on 127.0.0.1 port %d", port);
+  else
+    printf("Serving on %s", path);
+  printf(" with %d reactors over %d shards\n", nReactors, nShards);
+  fflush(stdout);
+
+  for (i = 0; i < nReactors; i++) {
+    pthread_join(reactors[i].thread, NULL);
+    requests += reactors[i].requests;
+    batches += reactors[i].batches;
+    conns += reactors[i].conns;
+    close(reactors[i].epfd);
+  }
+  printf("%lu connections, %lu requests in %lu answer batches"
+         " (%.1f per batch)\n", conns, requests, batches,
+         batches ? (double)requests / batches : 0.0);
+
+  close(listenFd);
+  if (port == 0) unlink(path);
+  for (i = 0; i < nShards; i++) {
+    DestroyCustomerDB(shards[i].db);
+    DestroyCustomerDB(names[i].db);
+  }
+  free(shards);
+  free(names);
+  return 0;
+}
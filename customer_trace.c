@@ -0,0 +1,243 @@
+/*
+ * Program: customer_trace.c
+ *
+ * Description:
+ * ------------
+ * Binary trace of the calls made on a customer database. The writer is
+ * installed as the hook of a DB_T and appends one variable-length record
+ * per call; the reader decodes them again for replay (see client.c).
+ * Integers are LEB128 varints (signed ones zigzag-encoded first) and
+ * timestamps are deltas, so a typical lookup costs a dozen bytes.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "customer_trace.h"
+
+#define TRACE_MAGIC "CDBTRACE"
+#define TRACE_VERSION 1
+#define TRACE_BUFFER_SIZE (1 << 16)
+
+struct CustomerTrace {
+  FILE *fp;
+  int writing;           /* 1 for a writer, 0 for a reader */
+  int error;             /* a write failed */
+  uint64_t last;         /* writer: clock of the last record (ns),
+                            reader: timestamp of the last record */
+  char *key[2];          /* reader: id and name buffers */
+  size_t keySize[2];
+};
+/*--------------------------------------------------------------------*/
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+/*--------------------------------------------------------------------*/
+static void put_varint(FILE *fp, uint64_t v)
+{
+  while (v >= 0x80) {
+    putc((int)(v & 0x7f) | 0x80, fp);
+    v >>= 7;
+  }
+  putc((int)v, fp);
+}
+/*--------------------------------------------------------------------*/
+static int get_varint(FILE *fp, uint64_t *v)
+
+/* Read a varint into *v. Return 1 on success, 0 on a clean end of
+   file before the first byte, -1 on a truncated or overlong varint. */
+{
+  int c, shift = 0;
+  uint64_t result = 0;
+
+  c = getc(fp);
+  if (c == EOF) return 0;
+  for (;;) {
+    result |= (uint64_t)(c & 0x7f) << shift;
+    if ((c & 0x80) == 0) break;
+    shift += 7;
+    if (shift > 63 || (c = getc(fp)) == EOF) return -1;
+  }
+  *v = result;
+  return 1;
+}
+/*--------------------------------------------------------------------*/
+static uint64_t zigzag(int v)
+{
+  return ((uint64_t)(int64_t)v << 1) ^ (uint64_t)((int64_t)v >> 63);
+}
+
+static int unzigzag(uint64_t v)
+{
+  return (int)(int64_t)((v >> 1) ^ (~(v & 1) + 1));
+}
+/*--------------------------------------------------------------------*/
+static int has_id(int type)
+{
+  return type == CUSTOMER_OP_REGISTER || type == CUSTOMER_OP_UNREGISTER_ID ||
+         type == CUSTOMER_OP_GET_ID;
+}
+
+static int has_name(int type)
+{
+  return type == CUSTOMER_OP_REGISTER ||
+         type == CUSTOMER_OP_UNREGISTER_NAME || type == CUSTOMER_OP_GET_NAME;
+}
+/*--------------------------------------------------------------------*/
+CustomerTrace_T
+OpenTraceWriter(const char *path)
+{
+  CustomerTrace_T t;
+  unsigned char version[4] = { TRACE_VERSION, 0, 0, 0 };
+
+  if (path == NULL) return NULL;
+  t = (CustomerTrace_T)calloc(1, sizeof(struct CustomerTrace));
+  if (t == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the trace\n");
+    return NULL;
+  }
+  t->fp = fopen(path, "wb");
+  if (t->fp == NULL) {
+    fprintf(stderr, "Error: Can't create trace file %s\n", path);
+    free(t);
+    return NULL;
+  }
+  setvbuf(t->fp, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+  fwrite(TRACE_MAGIC, 1, 8, t->fp);
+  fwrite(version, 1, sizeof(version), t->fp);
+  t->writing = 1;
+  t->last = now_ns();
+  return t;
+}
+/*--------------------------------------------------------------------*/
+void
+TraceHook(void *ctx, const struct CustomerOp *op)
+{
+  CustomerTrace_T t = (CustomerTrace_T)ctx;
+  uint64_t now;
+
+  if (t == NULL || !t->writing || op == NULL) return;
+
+  now = now_ns();
+  putc(op->type, t->fp);
+  put_varint(t->fp, now - t->last);
+  t->last = now;
+
+  if (has_id(op->type)) {
+    put_varint(t->fp, op->id ? op->idLen : 0);
+    if (op->id) fwrite(op->id, 1, op->idLen, t->fp);
+  }
+  if (has_name(op->type)) {
+    put_varint(t->fp, op->name ? op->nameLen : 0);
+    if (op->name) fwrite(op->name, 1, op->nameLen, t->fp);
+  }
+  if (op->type == CUSTOMER_OP_REGISTER)
+    put_varint(t->fp, zigzag(op->purchase));
+  put_varint(t->fp, zigzag(op->result));
+
+  if (ferror(t->fp)) t->error = 1;
+}
+/*--------------------------------------------------------------------*/
+CustomerTrace_T
+OpenTraceReader(const char *path)
+{
+  CustomerTrace_T t;
+  char header[12];
+
+  if (path == NULL) return NULL;
+  t = (CustomerTrace_T)calloc(1, sizeof(struct CustomerTrace));
+  if (t == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the trace\n");
+    return NULL;
+  }
+  t->fp = fopen(path, "rb");
+  if (t->fp == NULL) {
+    fprintf(stderr, "Error: Can't open trace file %s\n", path);
+    free(t);
+    return NULL;
+  }
+  if (fread(header, 1, sizeof(header), t->fp) != sizeof(header) ||
+      memcmp(header, TRACE_MAGIC, 8) != 0 || header[8] != TRACE_VERSION) {
+    fprintf(stderr, "Error: %s is not a customer trace file\n", path);
+    fclose(t->fp);
+    free(t);
+    return NULL;
+  }
+  setvbuf(t->fp, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+  return t;
+}
+/*--------------------------------------------------------------------*/
+static const char *read_key(CustomerTrace_T t, int which, size_t *len)
+
+/* Read a length-prefixed key into key buffer 'which' of t and
+   NUL-terminate it. Return the key or NULL on a corrupt file. */
+{
+  uint64_t n;
+  char *buf;
+
+  if (get_varint(t->fp, &n) != 1 || n > (1U << 30)) return NULL;
+  if (n + 1 > t->keySize[which]) {
+    buf = (char *)realloc(t->key[which], n + 1);
+    if (buf == NULL) {
+      fprintf(stderr, "Error: Can't allocate a memory for a trace key\n");
+      return NULL;
+    }
+    t->key[which] = buf;
+    t->keySize[which] = n + 1;
+  }
+  if (fread(t->key[which], 1, n, t->fp) != n) return NULL;
+  t->key[which][n] = '\0';
+  *len = (size_t)n;
+  return t->key[which];
+}
+/*--------------------------------------------------------------------*/
+int
+ReadTraceRecord(CustomerTrace_T t, struct TraceRecord *rec)
+{
+  int type;
+  uint64_t v;
+
+  if (t == NULL || t->writing || rec == NULL) return -1;
+
+  if ((type = getc(t->fp)) == EOF) return 0;
+  if (type < CUSTOMER_OP_REGISTER || type > CUSTOMER_OP_SUM) return -1;
+
+  memset(rec, 0, sizeof(*rec));
+  rec->type = type;
+  if (get_varint(t->fp, &v) != 1) return -1;
+  t->last += v;
+  rec->timestamp = t->last;
+
+  if (has_id(type) && (rec->id = read_key(t, 0, &rec->idLen)) == NULL)
+    return -1;
+  if (has_name(type) && (rec->name = read_key(t, 1, &rec->nameLen)) == NULL)
+    return -1;
+  if (type == CUSTOMER_OP_REGISTER) {
+    if (get_varint(t->fp, &v) != 1) return -1;
+    rec->purchase = unzigzag(v);
+  }
+  if (get_varint(t->fp, &v) != 1) return -1;
+  rec->result = unzigzag(v);
+  return 1;
+}
+/*--------------------------------------------------------------------*/
+int
+CloseTrace(CustomerTrace_T t)
+{
+  int result = 0;
+
+  if (t == NULL) return -1;
+  if (t->writing && (fflush(t->fp) != 0 || t->error)) result = -1;
+  if (fclose(t->fp) != 0 && t->writing) result = -1;
+  free(t->key[0]);
+  free(t->key[1]);
+  free(t);
+  return result;
+}
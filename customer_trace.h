@@ -0,0 +1,59 @@
+#ifndef CUSTOMER_TRACE_H
+#define CUSTOMER_TRACE_H
+
+/* customer_trace.h */
+/* Record the calls made on a DB_T to a compact binary trace file and
+   read them back for replay.
+
+   Recording:
+     CustomerTrace_T t = OpenTraceWriter("ops.trace");
+     SetCustomerDBHook(d, TraceHook, t);
+     ... use d ...
+     SetCustomerDBHook(d, NULL, NULL);
+     CloseTrace(t);
+
+   File format: the 8-byte magic "CDBTRACE" and a 4-byte little endian
+   version, followed by one record per call:
+     u8      op type (CUSTOMER_OP_*)
+     varint  nanoseconds since the previous record
+     [varint id length, id bytes]      if the op has an id
+     [varint name length, name bytes]  if the op has a name
+     [zigzag varint purchase]          register only
+     zigzag varint result */
+
+#include <stdint.h>
+#include "customer_manager.h"
+
+typedef struct CustomerTrace *CustomerTrace_T;
+
+/* one decoded record; id and name point into the reader and stay valid
+   until the next ReadTraceRecord() */
+struct TraceRecord {
+  int type;              /* CUSTOMER_OP_* */
+  uint64_t timestamp;    /* nanoseconds since the trace was opened */
+  const char *id;        /* NUL-terminated, NULL if the op has no id */
+  size_t idLen;
+  const char *name;      /* NUL-terminated, NULL if the op has no name */
+  size_t nameLen;
+  int purchase;
+  int result;            /* value the traced call returned */
+};
+
+/* create 'path' and return a trace to record into, NULL on failure */
+CustomerTrace_T OpenTraceWriter(const char *path);
+
+/* HOOKFUNC_T appending 'op' to the trace writer 'ctx' */
+void TraceHook(void *ctx, const struct CustomerOp *op);
+
+/* open the trace file 'path' for reading, NULL on failure */
+CustomerTrace_T OpenTraceReader(const char *path);
+
+/* read the next record into 'rec'.
+   return 1 on success, 0 at the end of the trace, -1 on a corrupt file */
+int ReadTraceRecord(CustomerTrace_T t, struct TraceRecord *rec);
+
+/* flush (writer) and close a trace. return 0 on success, -1 if
+   writing the file failed */
+int CloseTrace(CustomerTrace_T t);
+
+#endif /* end of CUSTOMER_TRACE_H */
@@ -0,0 +1,675 @@
+/*
+ * Program: frozen_db.c
+ *
+ * Description:
+ * ------------
+ * Frozen customer image (see frozen_db.h). The image is one block:
+ *
+ *    header | id index | name index | records
+ *
+ * An index is a BBHash minimal perfect hash: level l is a bit array of
+ * about GAMMA bits per key still unplaced at that level; a key whose
+ * level-l position no other remaining key shares sets that bit, the
+ * others move on to level l+1. The rank of a key's bit among all set
+ * bits (from a table of per-word ranks plus one popcount) is its hash
+ * value, and a slot array maps it to the record's offset. Records are
+ * laid out in id-hash order, each one {purchase, id length, name length,
+ * id NUL name NUL} padded to 4 bytes, so the id slots increase along
+ * the record area and GetSum walks it from front to back.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "frozen_db.h"
+
+#define FROZEN_MAGIC "CUSTFRZ1"
+#define BYTE_ORDER_MARK 0x01020304U
+#define MAX_LEVELS 32
+#define GAMMA 2.0                 /* bits per remaining key and level */
+#define MAX_SEEDS 8               /* hash seeds tried before giving up */
+
+/* one minimal perfect hash; offsets are from the start of the image */
+struct FrozenIndex {
+  uint64_t bits;                  /* bit words of all levels */
+  uint64_t ranks;                 /* uint32 set bits before each word */
+  uint64_t slots;                 /* uint32 record offset of each rank */
+  uint64_t levelStart[MAX_LEVELS + 1]; /* first bit of each level */
+  uint32_t levels;
+  uint32_t seed;
+};
+
+struct FrozenHeader {
+  char magic[8];                  /* FROZEN_MAGIC */
+  uint32_t byteOrder;             /* BYTE_ORDER_MARK as written */
+  uint32_t count;                 /* customers */
+  uint64_t size;                  /* bytes of the whole image */
+  uint64_t records;               /* offset of the record area */
+  uint64_t recordBytes;
+  uint64_t keyBytes;              /* id and name bytes with their NULs */
+  struct FrozenIndex ids;
+  struct FrozenIndex names;
+};
+
+struct FrozenRecord {
+  int32_t purchase;
+  uint32_t idLen;
+  uint32_t nameLen;
+  char keys[];                    /* id, NUL, name, NUL */
+};
+
+struct FrozenDB {
+  char *image;                    /* malloc()ed, or mapped from a file */
+  size_t size;
+  int mapped;
+};
+
+struct Entry {                    /* one customer in a builder */
+  size_t text;                    /* offset of "id\0name\0" in text */
+  uint32_t idLen;
+  uint32_t nameLen;
+  int purchase;
+};
+
+struct FrozenBuilder {
+  struct Entry *entries;
+  size_t count, cap;
+  char *text;
+  size_t textUsed, textCap;
+};
+/*--------------------------------------------------------------------*/
+static uint64_t hash_key(const char *key, size_t len, uint32_t seed)
+
+/* Return a 64-bit hash of the len-byte key under seed: eight bytes at
+   a time, then the tail, then the murmur3 finalizer */
+{
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  uint64_t h = (seed * 0x9e3779b97f4a7c15ULL) ^ (len * m), w;
+  size_t i;
+
+  for (i = 0; i + 8 <= len; i += 8) {
+    memcpy(&w, key + i, 8);
+    w *= m;
+    w ^= w >> 47;
+    h = (h ^ (w * m)) * m;
+  }
+  if (i < len) {
+    w = 0;
+    memcpy(&w, key + i, len - i);
+    h = (h ^ w) * m;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+/*--------------------------------------------------------------------*/
+static uint64_t level_pos(uint64_t h, uint32_t level, uint64_t bits)
+
+/* Return the position of the key with hash h in the 'bits'-bit array
+   of 'level' (bits is below 2^32) */
+{
+  uint64_t x = h ^ ((uint64_t)(level + 1) * 0x9e3779b97f4a7c15ULL);
+
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  return ((x >> 32) * bits) >> 32;
+}
+/*--------------------------------------------------------------------*/
+static int64_t index_rank(const struct FrozenIndex *ix, const uint64_t *bits,
+                          const uint32_t *ranks, uint64_t h)
+
+/* Return the hash value of the key with hash h, -1 if it falls on no
+   set bit (and so was certainly not in the key set) */
+{
+  uint64_t p, w, m;
+  uint32_t l;
+
+  for (l = 0; l < ix->levels; l++) {
+    p = ix->levelStart[l] +
+        level_pos(h, l, ix->levelStart[l + 1] - ix->levelStart[l]);
+    w = bits[p >> 6];
+    m = 1ULL << (p & 63);
+    if (w & m)
+      return ranks[p >> 6] + __builtin_popcountll(w & (m - 1));
+  }
+  return -1;
+}
+/*--------------------------------------------------------------------*/
+static int build_index(const uint64_t *hashes, size_t n,
+                       struct FrozenIndex *ix, uint64_t **bitsOut,
+                       uint32_t **ranksOut, size_t *wordsOut)
+
+/* Build the levels of a minimal perfect hash over the n key hashes.
+   Return 0 and the bit words and their ranks on success, -1 if some
+   keys are still unplaced after MAX_LEVELS levels (equal hashes) or on
+   allocation failure. */
+{
+  uint64_t *keys, *bits = NULL, *seen = NULL, *coll = NULL, *more;
+  uint32_t *ranks;
+  size_t rem = n, next, i, lw, words = 0;
+  uint64_t p, lbits;
+  uint32_t l, total;
+
+  keys = (uint64_t *)malloc((n ? n : 1) * sizeof(uint64_t));
+  if (keys == NULL) return -1;
+  memcpy(keys, hashes, n * sizeof(uint64_t));
+
+  for (l = 0; rem > 0; l++) {
+    if (l == MAX_LEVELS) goto fail;
+    lw = (size_t)(GAMMA * rem + 63) / 64;
+    lbits = (uint64_t)lw * 64;
+    seen = (uint64_t *)calloc(lw, sizeof(uint64_t));
+    coll = (uint64_t *)calloc(lw, sizeof(uint64_t));
+    more = (uint64_t *)realloc(bits, (words + lw) * sizeof(uint64_t));
+    if (seen == NULL || coll == NULL || more == NULL) {
+      if (more) bits = more;
+      goto fail;
+    }
+    bits = more;
+    memset(bits + words, 0, lw * sizeof(uint64_t));
+
+    /* first pass: find the positions taken by more than one key */
+    for (i = 0; i < rem; i++) {
+      p = level_pos(keys[i], l, lbits);
+      if (seen[p >> 6] & (1ULL << (p & 63))) coll[p >> 6] |= 1ULL << (p & 63);
+      else seen[p >> 6] |= 1ULL << (p & 63);
+    }
+    /* second pass: place the others, keep the colliding ones */
+    for (i = next = 0; i < rem; i++) {
+      p = level_pos(keys[i], l, lbits);
+      if (coll[p >> 6] & (1ULL << (p & 63))) keys[next++] = keys[i];
+      else bits[words + (p >> 6)] |= 1ULL << (p & 63);
+    }
+    free(seen);
+    free(coll);
+    seen = coll = NULL;
+    ix->levelStart[l] = (uint64_t)words * 64;
+    words += lw;
+    rem = next;
+  }
+  ix->levels = l;
+  ix->levelStart[l] = (uint64_t)words * 64;
+
+  ranks = (uint32_t *)malloc((words ? words : 1) * sizeof(uint32_t));
+  if (ranks == NULL) goto fail;
+  for (i = 0, total = 0; i < words; i++) {
+    ranks[i] = total;
+    total += (uint32_t)__builtin_popcountll(bits[i]);
+  }
+  free(keys);
+  *bitsOut = bits;
+  *ranksOut = ranks;
+  *wordsOut = words;
+  return 0;
+
+ fail:
+  free(seen);
+  free(coll);
+  free(bits);
+  free(keys);
+  return -1;
+}
+/*--------------------------------------------------------------------*/
+FrozenBuilder_T
+CreateFrozenBuilder(void)
+{
+  FrozenBuilder_T b;
+
+  b = (FrozenBuilder_T)calloc(1, sizeof(struct FrozenBuilder));
+  if (b == NULL)
+    fprintf(stderr, "Error: Can't allocate a memory for the frozen builder\n");
+  return b;
+}
+/*--------------------------------------------------------------------*/
+int
+FrozenBuilderAdd(FrozenBuilder_T b, const char *id, size_t idLen,
+                 const char *name, size_t nameLen, int purchase)
+{
+  size_t need = idLen + nameLen + 2;
+
+  if (b == NULL || idLen > UINT32_MAX || nameLen > UINT32_MAX ||
+      b->count >= UINT32_MAX)
+    return -1;
+  if (b->count == b->cap) {
+    size_t cap = b->cap ? 2 * b->cap : 1024;
+    struct Entry *e = (struct Entry *)realloc(b->entries,
+                                              cap * sizeof(struct Entry));
+    if (e == NULL) return -1;
+    b->entries = e;
+    b->cap = cap;
+  }
+  if (b->textUsed + need > b->textCap) {
+    size_t cap = b->textCap ? 2 * b->textCap : 65536;
+    char *t;
+    while (cap < b->textUsed + need) cap *= 2;
+    t = (char *)realloc(b->text, cap);
+    if (t == NULL) return -1;
+    b->text = t;
+    b->textCap = cap;
+  }
+  b->entries[b->count].text = b->textUsed;
+  b->entries[b->count].idLen = (uint32_t)idLen;
+  b->entries[b->count].nameLen = (uint32_t)nameLen;
+  b->entries[b->count].purchase = purchase;
+  memcpy(b->text + b->textUsed, id, idLen);
+  b->text[b->textUsed + idLen] = '\0';
+  memcpy(b->text + b->textUsed + idLen + 1, name, nameLen);
+  b->text[b->textUsed + need - 1] = '\0';
+  b->textUsed += need;
+  b->count++;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+void
+DestroyFrozenBuilder(FrozenBuilder_T b)
+{
+  if (b == NULL) return;
+  free(b->entries);
+  free(b->text);
+  free(b);
+}
+/*--------------------------------------------------------------------*/
+static size_t record_size(uint32_t idLen, uint32_t nameLen)
+{
+  return (sizeof(struct FrozenRecord) + idLen + nameLen + 2 + 3) & ~(size_t)3;
+}
+
+static size_t align8(size_t n)
+{
+  return (n + 7) & ~(size_t)7;
+}
+/*--------------------------------------------------------------------*/
+static int build_key_index(FrozenBuilder_T b, int byName,
+                           struct FrozenIndex *ix, uint64_t **bits,
+                           uint32_t **ranks, size_t *words, uint32_t *rankOf)
+
+/* Build the index over the ids (or names) of b, trying seeds until the
+   hash values are distinct, and store each entry's rank in rankOf.
+   Return 0 on success, -1 on failure. */
+{
+  uint64_t *hashes;
+  const struct Entry *e;
+  uint32_t seed;
+  size_t i;
+
+  hashes = (uint64_t *)malloc((b->count ? b->count : 1) * sizeof(uint64_t));
+  if (hashes == NULL) return -1;
+  for (seed = 0; seed < MAX_SEEDS; seed++) {
+    for (i = 0; i < b->count; i++) {
+      e = &b->entries[i];
+      hashes[i] = byName ?
+        hash_key(b->text + e->text + e->idLen + 1, e->nameLen, seed) :
+        hash_key(b->text + e->text, e->idLen, seed);
+    }
+    if (build_index(hashes, b->count, ix, bits, ranks, words) == 0) break;
+  }
+  if (seed == MAX_SEEDS) {
+    free(hashes);
+    return -1;
+  }
+  ix->seed = seed;
+  for (i = 0; i < b->count; i++)
+    rankOf[i] = (uint32_t)index_rank(ix, *bits, *ranks, hashes[i]);
+  free(hashes);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+FrozenDB_T
+FrozenBuild(FrozenBuilder_T b)
+{
+  struct FrozenHeader hdr;
+  FrozenDB_T f = NULL;
+  uint64_t *bits[2] = { NULL, NULL };
+  uint32_t *ranks[2] = { NULL, NULL }, *rankOf[2] = { NULL, NULL };
+  uint32_t *order = NULL, *recOff = NULL, *slots;
+  size_t words[2], n, i, off, recordBytes = 0, keyBytes = 0;
+  struct FrozenIndex *ix[2];
+  struct FrozenRecord *rec;
+  const struct Entry *e;
+  char *image;
+  int k;
+
+  if (b == NULL) return NULL;
+  n = b->count;
+  memset(&hdr, 0, sizeof(hdr));
+  ix[0] = &hdr.ids;
+  ix[1] = &hdr.names;
+
+  order = (uint32_t *)malloc((n ? n : 1) * sizeof(uint32_t));
+  recOff = (uint32_t *)malloc((n ? n : 1) * sizeof(uint32_t));
+  rankOf[0] = (uint32_t *)malloc((n ? n : 1) * sizeof(uint32_t));
+  rankOf[1] = (uint32_t *)malloc((n ? n : 1) * sizeof(uint32_t));
+  if (order == NULL || recOff == NULL || rankOf[0] == NULL ||
+      rankOf[1] == NULL)
+    goto out;
+  for (k = 0; k < 2; k++) {
+    if (build_key_index(b, k, ix[k], &bits[k], &ranks[k], &words[k],
+                        rankOf[k]) < 0) {
+      fprintf(stderr, "Error: Can't build the perfect hash of the %s\n",
+              k ? "names" : "ids");
+      goto out;
+    }
+  }
+
+  /* records in id-hash order */
+  for (i = 0; i < n; i++) order[rankOf[0][i]] = (uint32_t)i;
+  for (i = 0; i < n; i++) {
+    e = &b->entries[order[i]];
+    if (recordBytes > UINT32_MAX) goto out;
+    recOff[order[i]] = (uint32_t)recordBytes;
+    recordBytes += record_size(e->idLen, e->nameLen);
+    keyBytes += (size_t)e->idLen + e->nameLen + 2;
+  }
+
+  /* lay out the image */
+  off = align8(sizeof(struct FrozenHeader));
+  for (k = 0; k < 2; k++) {
+    ix[k]->bits = off;
+    off = align8(off + words[k] * sizeof(uint64_t));
+    ix[k]->ranks = off;
+    off = align8(off + words[k] * sizeof(uint32_t));
+    ix[k]->slots = off;
+    off = align8(off + n * sizeof(uint32_t));
+  }
+  memcpy(hdr.magic, FROZEN_MAGIC, sizeof(hdr.magic));
+  hdr.byteOrder = BYTE_ORDER_MARK;
+  hdr.count = (uint32_t)n;
+  hdr.records = off;
+  hdr.recordBytes = recordBytes;
+  hdr.keyBytes = keyBytes;
+  hdr.size = off + recordBytes;
+
+  f = (FrozenDB_T)calloc(1, sizeof(struct FrozenDB));
+  image = (char *)calloc(1, hdr.size);
+  if (f == NULL || image == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the frozen image\n");
+    free(f);
+    free(image);
+    f = NULL;
+    goto out;
+  }
+  f->image = image;
+  f->size = hdr.size;
+  memcpy(image, &hdr, sizeof(hdr));
+  for (k = 0; k < 2; k++) {
+    if (words[k] > 0) { /* an empty db has no levels */
+      memcpy(image + ix[k]->bits, bits[k], words[k] * sizeof(uint64_t));
+      memcpy(image + ix[k]->ranks, ranks[k], words[k] * sizeof(uint32_t));
+    }
+    slots = (uint32_t *)(void *)(image + ix[k]->slots);
+    for (i = 0; i < n; i++) slots[rankOf[k][i]] = recOff[i];
+  }
+  for (i = 0; i < n; i++) {
+    e = &b->entries[i];
+    rec = (struct FrozenRecord *)(void *)(image + hdr.records + recOff[i]);
+    rec->purchase = e->purchase;
+    rec->idLen = e->idLen;
+    rec->nameLen = e->nameLen;
+    memcpy(rec->keys, b->text + e->text, (size_t)e->idLen + e->nameLen + 2);
+  }
+
+ out:
+  for (k = 0; k < 2; k++) {
+    free(bits[k]);
+    free(ranks[k]);
+    free(rankOf[k]);
+  }
+  free(order);
+  free(recOff);
+  DestroyFrozenBuilder(b);
+  return f;
+}
+/*--------------------------------------------------------------------*/
+int
+FrozenSave(FrozenDB_T f, const char *path)
+{
+  FILE *fp;
+
+  if (f == NULL || path == NULL) return -1;
+  fp = fopen(path, "wb");
+  if (fp == NULL) {
+    fprintf(stderr, "Error: Can't open %s\n", path);
+    return -1;
+  }
+  if (fwrite(f->image, 1, f->size, fp) != f->size) {
+    fprintf(stderr, "Error: Can't write %s\n", path);
+    fclose(fp);
+    return -1;
+  }
+  if (fclose(fp) != 0) {
+    fprintf(stderr, "Error: Can't write %s\n", path);
+    return -1;
+  }
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int index_fits(const struct FrozenIndex *ix, uint64_t count,
+                      uint64_t size)
+
+/* Return non-zero if the sections of ix lie inside a size-byte image */
+{
+  uint64_t words;
+  uint32_t l;
+
+  if (ix->levels > MAX_LEVELS || ix->levelStart[ix->levels] % 64) return 0;
+  for (l = 0; l < ix->levels; l++)
+    if (ix->levelStart[l] >= ix->levelStart[l + 1]) return 0;
+  words = ix->levelStart[ix->levels] / 64;
+  return ix->bits % 8 == 0 && ix->ranks % 4 == 0 && ix->slots % 4 == 0 &&
+         ix->bits + words * 8 <= size && ix->ranks + words * 4 <= size &&
+         ix->slots + count * 4 <= size;
+}
+/*--------------------------------------------------------------------*/
+static int records_fit(const char *image, const struct FrozenHeader *hdr)
+
+/* Return non-zero if the records exactly fill the record area, each
+   with its two NULs in place, and every slot of both indexes points at
+   the start of one. hdr lies inside the image and the sections of its
+   indexes were checked by index_fits(). */
+{
+  const struct FrozenRecord *rec;
+  const struct FrozenIndex *ix;
+  const uint32_t *slots;
+  uint64_t off = 0, size, *starts;
+  uint32_t i;
+  int k, ok = 0;
+
+  if (hdr->recordBytes % 4 != 0) return 0;
+  starts = (uint64_t *)calloc(hdr->recordBytes / 256 + 1, sizeof(uint64_t));
+  if (starts == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory to check the image\n");
+    return 0;
+  }
+  for (i = 0; i < hdr->count; i++) {
+    if (hdr->recordBytes - off < sizeof(struct FrozenRecord)) goto out;
+    rec = (const struct FrozenRecord *)(const void *)
+      (image + hdr->records + off);
+    size = record_size(rec->idLen, rec->nameLen);
+    if (size > hdr->recordBytes - off ||
+        rec->keys[rec->idLen] != '\0' ||
+        rec->keys[(uint64_t)rec->idLen + rec->nameLen + 1] != '\0')
+      goto out;
+    starts[off / 256] |= 1ULL << (off / 4 % 64);
+    off += size;
+  }
+  if (off != hdr->recordBytes) goto out;
+
+  for (k = 0; k < 2; k++) {
+    ix = k ? &hdr->names : &hdr->ids;
+    slots = (const uint32_t *)(const void *)(image + ix->slots);
+    for (i = 0; i < hdr->count; i++)
+      if (slots[i] % 4 != 0 || slots[i] >= hdr->recordBytes ||
+          !(starts[slots[i] / 256] & (1ULL << (slots[i] / 4 % 64))))
+        goto out;
+  }
+  ok = 1;
+
+ out:
+  free(starts);
+  return ok;
+}
+/*--------------------------------------------------------------------*/
+FrozenDB_T
+FrozenLoad(const char *path)
+{
+  const struct FrozenHeader *hdr;
+  struct stat st;
+  FrozenDB_T f;
+  void *image;
+  int fd;
+
+  if (path == NULL) return NULL;
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Error: Can't open %s\n", path);
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct FrozenHeader)) {
+    fprintf(stderr, "Error: %s is not a frozen customer db\n", path);
+    close(fd);
+    return NULL;
+  }
+  image = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    fprintf(stderr, "Error: Can't map %s\n", path);
+    return NULL;
+  }
+
+  /* check that everything the lookups, sums and cursors read lies
+     inside the file */
+  hdr = (const struct FrozenHeader *)image;
+  if (memcmp(hdr->magic, FROZEN_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->byteOrder != BYTE_ORDER_MARK ||
+      hdr->size != (uint64_t)st.st_size ||
+      hdr->records % 4 != 0 || hdr->records > hdr->size ||
+      hdr->recordBytes > hdr->size - hdr->records ||
+      !index_fits(&hdr->ids, hdr->count, hdr->size) ||
+      !index_fits(&hdr->names, hdr->count, hdr->size) ||
+      !records_fit((const char *)image, hdr)) {
+    fprintf(stderr, "Error: %s is not a frozen customer db\n", path);
+    munmap(image, (size_t)st.st_size);
+    return NULL;
+  }
+
+  f = (FrozenDB_T)calloc(1, sizeof(struct FrozenDB));
+  if (f == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the frozen db\n");
+    munmap(image, (size_t)st.st_size);
+    return NULL;
+  }
+  f->image = (char *)image;
+  f->size = (size_t)st.st_size;
+  f->mapped = 1;
+  return f;
+}
+/*--------------------------------------------------------------------*/
+void
+DestroyFrozenDB(FrozenDB_T f)
+{
+  if (f == NULL) return;
+  if (f->mapped) munmap(f->image, f->size);
+  else free(f->image);
+  free(f);
+}
+/*--------------------------------------------------------------------*/
+int
+FrozenGetPurchase(FrozenDB_T f, int byName, const char *key, size_t len)
+{
+  const struct FrozenHeader *hdr = (const struct FrozenHeader *)f->image;
+  const struct FrozenIndex *ix = byName ? &hdr->names : &hdr->ids;
+  const struct FrozenRecord *rec;
+  const uint32_t *slots;
+  int64_t r;
+
+  r = index_rank(ix, (const uint64_t *)(const void *)(f->image + ix->bits),
+                 (const uint32_t *)(const void *)(f->image + ix->ranks),
+                 hash_key(key, len, ix->seed));
+  if (r < 0 || r >= (int64_t)hdr->count) return -1;
+
+  slots = (const uint32_t *)(const void *)(f->image + ix->slots);
+  if (slots[r] >= hdr->recordBytes) return -1;
+  rec = (const struct FrozenRecord *)(const void *)
+    (f->image + hdr->records + slots[r]);
+  if (byName) {
+    if (rec->nameLen != len ||
+        memcmp(rec->keys + rec->idLen + 1, key, len) != 0)
+      return -1;
+  }
+  else if (rec->idLen != len || memcmp(rec->keys, key, len) != 0) {
+    return -1;
+  }
+  return rec->purchase;
+}
+/*--------------------------------------------------------------------*/
+int
+FrozenSum(FrozenDB_T f, FUNCPTR_T fp)
+{
+  const struct FrozenHeader *hdr = (const struct FrozenHeader *)f->image;
+  const struct FrozenRecord *rec;
+  uint64_t off = 0;
+  uint32_t i;
+  int total = 0;
+
+  for (i = 0; i < hdr->count && off < hdr->recordBytes; i++) {
+    rec = (const struct FrozenRecord *)(const void *)
+      (f->image + hdr->records + off);
+    total += fp(rec->keys, rec->keys + rec->idLen + 1, rec->purchase);
+    off += record_size(rec->idLen, rec->nameLen);
+  }
+  return total;
+}
+/*--------------------------------------------------------------------*/
+int
+FrozenNextBatch(FrozenDB_T f, uint64_t *pos, struct CustomerView *views,
+                int max)
+{
+  const struct FrozenHeader *hdr = (const struct FrozenHeader *)f->image;
+  const struct FrozenRecord *rec;
+  int n = 0;
+
+  /* *pos is the byte offset of the next record */
+  while (n < max && *pos < hdr->recordBytes) {
+    rec = (const struct FrozenRecord *)(const void *)
+      (f->image + hdr->records + *pos);
+    views[n].id = rec->keys;
+    views[n].idLen = rec->idLen;
+    views[n].name = rec->keys + rec->idLen + 1;
+    views[n].nameLen = rec->nameLen;
+    views[n].purchase = rec->purchase;
+    n++;
+    *pos += record_size(rec->idLen, rec->nameLen);
+  }
+  return n;
+}
+/*--------------------------------------------------------------------*/
+size_t
+FrozenCount(FrozenDB_T f)
+{
+  return (f != NULL) ? ((const struct FrozenHeader *)f->image)->count : 0;
+}
+/*--------------------------------------------------------------------*/
+void
+FrozenMemory(FrozenDB_T f, size_t *records, size_t *keys, size_t *index)
+{
+  const struct FrozenHeader *hdr;
+
+  *records = *keys = *index = 0;
+  if (f == NULL) return;
+  hdr = (const struct FrozenHeader *)f->image;
+  *keys = hdr->keyBytes;
+  *records = hdr->recordBytes - hdr->keyBytes;
+  *index = f->size - hdr->recordBytes;
+}
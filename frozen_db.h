@@ -0,0 +1,72 @@
+#ifndef FROZEN_DB_H
+#define FROZEN_DB_H
+
+/* frozen_db.h */
+/* Immutable customer set behind FreezeCustomerDB(). The customers are
+   packed back to back in one image, ordered by a minimal perfect hash
+   (BBHash) of their ids, with a second one over the names. A lookup
+   hashes the key once, finds its rank in the hash's bit array, reads
+   the record at that rank and compares the key; there are no empty
+   slots and no chains.
+
+   The image holds no pointers, so it can be written to a file as is
+   and mapped back read-only. It is in native byte order and is only
+   meant to be loaded on the machine type that wrote it.
+
+     FrozenBuilder_T b = CreateFrozenBuilder();
+     FrozenBuilderAdd(b, id, idLen, name, nameLen, purchase);  (each)
+     FrozenDB_T f = FrozenBuild(b);                            (frees b) */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "customer_manager.h"
+
+typedef struct FrozenDB *FrozenDB_T;
+typedef struct FrozenBuilder *FrozenBuilder_T;
+
+/* create an empty builder, NULL on failure */
+FrozenBuilder_T CreateFrozenBuilder(void);
+
+/* copy one customer into the builder. return 0 on success, -1 on
+   allocation failure */
+int FrozenBuilderAdd(FrozenBuilder_T b, const char *id, size_t idLen,
+                     const char *name, size_t nameLen, int purchase);
+
+/* free a builder that was not passed to FrozenBuild() */
+void DestroyFrozenBuilder(FrozenBuilder_T b);
+
+/* build the frozen image of the customers in b and free b. ids and
+   names must be unique. return NULL on failure */
+FrozenDB_T FrozenBuild(FrozenBuilder_T b);
+
+/* write the image of f to path. return 0 on success, -1 on failure */
+int FrozenSave(FrozenDB_T f, const char *path);
+
+/* map an image written by FrozenSave() read-only, NULL on failure */
+FrozenDB_T FrozenLoad(const char *path);
+
+/* free (or unmap) f */
+void DestroyFrozenDB(FrozenDB_T f);
+
+/* return the purchase of the customer with the len-byte id (or name,
+   if byName), -1 if there is none */
+int FrozenGetPurchase(FrozenDB_T f, int byName, const char *key, size_t len);
+
+/* call fp for every customer and return the sum of the results */
+int FrozenSum(FrozenDB_T f, FUNCPTR_T fp);
+
+/* fill views with up to max customers starting at *pos (0 for the
+   first one) and advance *pos past them. return the number filled, 0
+   at the end */
+int FrozenNextBatch(FrozenDB_T f, uint64_t *pos, struct CustomerView *views,
+                    int max);
+
+/* return the number of customers in f */
+size_t FrozenCount(FrozenDB_T f);
+
+/* report the bytes of the image: record headers, key bytes and both
+   hash indexes */
+void FrozenMemory(FrozenDB_T f, size_t *records, size_t *keys,
+                  size_t *index);
+
+#endif /* end of FROZEN_DB_H */
@@ -0,0 +1,370 @@
+/*
+ * Program: key_dict.c
+ *
+ * Description:
+ * ------------
+ * Dictionary coder for customer keys (see key_dict.h). Every encoded item
+ * starts with a tag byte:
+ *
+ *    0x00-0x7F  word code 0..127
+ *    0x80-0xBF  word code 128 + ((tag & 0x3F) << 8 | next byte)
+ *    0xC0-0xDF  (tag & 0x1F) + 1 digits, packed two to a byte
+ *    0xE0-0xEF  (tag & 0x0F) + 1 literal bytes
+ *    0xF0       word code 16512 + the next three bytes (big endian)
+ *
+ * A word is only coded when its code is no longer than the word, so no
+ * key grows by more than one tag byte per literal byte. Words live back
+ * to back in one text buffer and are found through an open-addressing
+ * table of codes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "key_dict.h"
+
+#define MAX_WORD 32               /* longer letter runs stay literal */
+#define MAX_DIGITS 32             /* digits per packed item */
+#define MAX_LITERAL 16            /* bytes per literal item */
+#define SHORT_CODES 128           /* codes taking one byte */
+#define MEDIUM_CODES (128 + 16384) /* codes taking at most two bytes */
+#define INITIAL_SLOTS 1024
+
+struct Word {
+  uint32_t off;                  /* offset of the word in text */
+  uint32_t len;
+};
+
+struct KeyDict {
+  char *text;                    /* all words back to back */
+  size_t textUsed, textCap;
+  struct Word *words;            /* words by code */
+  uint32_t count, cap;
+  uint32_t *slots;               /* code + 1 of each word, 0 if empty */
+  uint32_t slotCount;            /* a power of two */
+};
+/*--------------------------------------------------------------------*/
+static int is_letter(unsigned char c)
+{
+  /* bytes of multi-byte UTF-8 sequences count as letters */
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+static int is_digit(unsigned char c)
+{
+  return c >= '0' && c <= '9';
+}
+/*--------------------------------------------------------------------*/
+static size_t code_size(uint32_t code)
+{
+  return code < SHORT_CODES ? 1 : code < MEDIUM_CODES ? 2 : 4;
+}
+/*--------------------------------------------------------------------*/
+static uint32_t hash_word(const char *s, size_t len)
+
+/* FNV-1a over the len bytes of s */
+{
+  uint32_t h = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 16777619U;
+  }
+  return h;
+}
+/*--------------------------------------------------------------------*/
+KeyDict_T
+CreateKeyDict(void)
+{
+  KeyDict_T k;
+
+  k = (KeyDict_T)calloc(1, sizeof(struct KeyDict));
+  if (k == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the key dictionary\n");
+    return NULL;
+  }
+  k->slotCount = INITIAL_SLOTS;
+  k->slots = (uint32_t *)calloc(k->slotCount, sizeof(uint32_t));
+  if (k->slots == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the key dictionary\n");
+    free(k);
+    return NULL;
+  }
+  return k;
+}
+/*--------------------------------------------------------------------*/
+void
+DestroyKeyDict(KeyDict_T k)
+{
+  if (k == NULL) return;
+  free(k->text);
+  free(k->words);
+  free(k->slots);
+  free(k);
+}
+/*--------------------------------------------------------------------*/
+static int grow_slots(KeyDict_T k)
+
+/* Double the slot table. Return 0 on success, -1 on failure. */
+{
+  uint32_t *slots, n = k->slotCount * 2, i, j;
+
+  slots = (uint32_t *)calloc(n, sizeof(uint32_t));
+  if (slots == NULL) return -1;
+  for (i = 0; i < k->count; i++) {
+    struct Word *w = &k->words[i];
+    for (j = hash_word(k->text + w->off, w->len) & (n - 1); slots[j];
+         j = (j + 1) & (n - 1))
+      ;
+    slots[j] = i + 1;
+  }
+  free(k->slots);
+  k->slots = slots;
+  k->slotCount = n;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int64_t word_code(KeyDict_T k, const char *s, size_t len)
+
+/* Return the code of the len-byte word s, adding it to the dictionary
+   if it is new and its code would be no longer than the word itself.
+   Return -1 if the word has no (useful) code. */
+{
+  uint32_t j, mask = k->slotCount - 1;
+  struct Word *w;
+
+  for (j = hash_word(s, len) & mask; k->slots[j]; j = (j + 1) & mask) {
+    w = &k->words[k->slots[j] - 1];
+    if (w->len == len && memcmp(k->text + w->off, s, len) == 0)
+      return k->slots[j] - 1;
+  }
+
+  if (k->count >= KEY_DICT_MAX_WORDS || code_size(k->count) > len) return -1;
+
+  /* keep the slot table at most half full */
+  if (2 * (k->count + 1) > k->slotCount) {
+    if (grow_slots(k) < 0) return -1;
+    mask = k->slotCount - 1;
+    for (j = hash_word(s, len) & mask; k->slots[j]; j = (j + 1) & mask)
+      ;
+  }
+  if (k->count == k->cap) {
+    uint32_t cap = k->cap ? k->cap * 2 : 256;
+    struct Word *words = (struct Word *)realloc(k->words,
+                                                cap * sizeof(struct Word));
+    if (words == NULL) return -1;
+    k->words = words;
+    k->cap = cap;
+  }
+  if (k->textUsed + len > k->textCap) {
+    size_t cap = k->textCap ? k->textCap * 2 : 4096;
+    char *text = (char *)realloc(k->text, cap);
+    if (text == NULL) return -1;
+    k->text = text;
+    k->textCap = cap;
+  }
+  memcpy(k->text + k->textUsed, s, len);
+  k->words[k->count].off = (uint32_t)k->textUsed;
+  k->words[k->count].len = (uint32_t)len;
+  k->textUsed += len;
+  k->slots[j] = k->count + 1;
+  return k->count++;
+}
+/*--------------------------------------------------------------------*/
+static size_t put_literal(unsigned char *out, const char *s, size_t len)
+
+/* Write len bytes of s as literal items, return the bytes written */
+{
+  size_t o = 0, n;
+
+  while (len > 0) {
+    n = len < MAX_LITERAL ? len : MAX_LITERAL;
+    out[o++] = (unsigned char)(0xE0 | (n - 1));
+    memcpy(out + o, s, n);
+    o += n;
+    s += n;
+    len -= n;
+  }
+  return o;
+}
+/*--------------------------------------------------------------------*/
+static size_t put_digits(unsigned char *out, const char *s, size_t len)
+
+/* Write the len digits of s as packed items, return the bytes written */
+{
+  size_t o = 0, n, i;
+
+  while (len > 0) {
+    n = len < MAX_DIGITS ? len : MAX_DIGITS;
+    out[o++] = (unsigned char)(0xC0 | (n - 1));
+    for (i = 0; i < n; i += 2) {
+      unsigned char hi = (unsigned char)(s[i] - '0');
+      unsigned char lo = (i + 1 < n) ? (unsigned char)(s[i + 1] - '0') : 0;
+      out[o++] = (unsigned char)(hi << 4 | lo);
+    }
+    s += n;
+    len -= n;
+  }
+  return o;
+}
+/*--------------------------------------------------------------------*/
+static size_t put_code(unsigned char *out, uint32_t code)
+{
+  if (code < SHORT_CODES) {
+    out[0] = (unsigned char)code;
+    return 1;
+  }
+  if (code < MEDIUM_CODES) {
+    code -= SHORT_CODES;
+    out[0] = (unsigned char)(0x80 | (code >> 8));
+    out[1] = (unsigned char)(code & 0xFF);
+    return 2;
+  }
+  code -= MEDIUM_CODES;
+  out[0] = 0xF0;
+  out[1] = (unsigned char)(code >> 16);
+  out[2] = (unsigned char)(code >> 8);
+  out[3] = (unsigned char)code;
+  return 4;
+}
+/*--------------------------------------------------------------------*/
+size_t
+KeyDictEncode(KeyDict_T k, const char *key, size_t len, unsigned char *out)
+{
+  size_t i = 0, n, o = 0;
+  size_t litStart = 0, litLen = 0;  /* pending literal bytes of key */
+  int64_t code;
+
+  while (i < len) {
+    unsigned char c = (unsigned char)key[i];
+
+    n = 1;
+    if (is_digit(c) || is_letter(c)) {
+      int (*same)(unsigned char) = is_digit(c) ? is_digit : is_letter;
+      while (i + n < len && same((unsigned char)key[i + n])) n++;
+    }
+
+    if (is_digit(c) && n >= 3) {
+      o += put_literal(out + o, key + litStart, litLen);
+      litLen = 0;
+      o += put_digits(out + o, key + i, n);
+    }
+    else if (!is_digit(c) && n <= MAX_WORD &&
+             (code = word_code(k, key + i, n)) >= 0) {
+      o += put_literal(out + o, key + litStart, litLen);
+      litLen = 0;
+      o += put_code(out + o, (uint32_t)code);
+    }
+    else {
+      if (litLen == 0) litStart = i;
+      litLen += n;
+    }
+    i += n;
+  }
+  o += put_literal(out + o, key + litStart, litLen);
+  return o;
+}
+/*--------------------------------------------------------------------*/
+size_t
+KeyDictDecode(KeyDict_T k, const unsigned char *enc, size_t encLen,
+              char *out)
+{
+  size_t i = 0, o = 0, n, j;
+  uint32_t code;
+
+  while (i < encLen) {
+    unsigned char t = enc[i++];
+
+    if (t < 0x80) {
+      code = t;
+    }
+    else if (t < 0xC0) {
+      code = SHORT_CODES + ((uint32_t)(t & 0x3F) << 8 | enc[i]);
+      i++;
+    }
+    else if (t < 0xE0) {
+      n = (size_t)(t & 0x1F) + 1;
+      for (j = 0; j < n; j++) {
+        unsigned char b = enc[i + j / 2];
+        out[o++] = (char)('0' + ((j & 1) ? (b & 0x0F) : (b >> 4)));
+      }
+      i += (n + 1) / 2;
+      continue;
+    }
+    else if (t < 0xF0) {
+      n = (size_t)(t & 0x0F) + 1;
+      memcpy(out + o, enc + i, n);
+      o += n;
+      i += n;
+      continue;
+    }
+    else {
+      code = MEDIUM_CODES + ((uint32_t)enc[i] << 16 |
+                             (uint32_t)enc[i + 1] << 8 | enc[i + 2]);
+      i += 3;
+    }
+    memcpy(out + o, k->text + k->words[code].off, k->words[code].len);
+    o += k->words[code].len;
+  }
+  out[o] = '\0';
+  return o;
+}
+/*--------------------------------------------------------------------*/
+int
+KeyDictEqual(KeyDict_T k, const unsigned char *enc, size_t encLen,
+             const char *key, size_t len)
+{
+  size_t i = 0, o = 0, n, j;
+  uint32_t code;
+  const struct Word *w;
+
+  while (i < encLen) {
+    unsigned char t = enc[i++];
+
+    if (t < 0x80) {
+      code = t;
+    }
+    else if (t < 0xC0) {
+      code = SHORT_CODES + ((uint32_t)(t & 0x3F) << 8 | enc[i]);
+      i++;
+    }
+    else if (t < 0xE0) {
+      n = (size_t)(t & 0x1F) + 1;
+      if (o + n > len) return 0;
+      for (j = 0; j < n; j++) {
+        unsigned char b = enc[i + j / 2];
+        if (key[o++] != (char)('0' + ((j & 1) ? (b & 0x0F) : (b >> 4))))
+          return 0;
+      }
+      i += (n + 1) / 2;
+      continue;
+    }
+    else if (t < 0xF0) {
+      n = (size_t)(t & 0x0F) + 1;
+      if (o + n > len || memcmp(key + o, enc + i, n) != 0) return 0;
+      o += n;
+      i += n;
+      continue;
+    }
+    else {
+      code = MEDIUM_CODES + ((uint32_t)enc[i] << 16 |
+                             (uint32_t)enc[i + 1] << 8 | enc[i + 2]);
+      i += 3;
+    }
+    w = &k->words[code];
+    if (o + w->len > len || memcmp(key + o, k->text + w->off, w->len) != 0)
+      return 0;
+    o += w->len;
+  }
+  return o == len;
+}
+/*--------------------------------------------------------------------*/
+size_t
+KeyDictMemory(KeyDict_T k)
+{
+  if (k == NULL) return 0;
+  return sizeof(struct KeyDict) + k->textCap +
+         k->cap * sizeof(struct Word) + k->slotCount * sizeof(uint32_t);
+}
@@ -0,0 +1,50 @@
+#ifndef KEY_DICT_H
+#define KEY_DICT_H
+
+/* key_dict.h */
+/* Dictionary compression of customer keys. A key is cut into words
+   (runs of letters), digit runs and single separators. Words and
+   separators are replaced by their code in a shared, append-only
+   dictionary, digit runs are packed two to a byte, and whatever does
+   not pay off is kept as literal bytes. "Maria Garcia 1234" takes 6
+   bytes once "Maria", " " and "Garcia" are known.
+
+   Codes never change once assigned, so an encoded key stays valid for
+   the lifetime of the dictionary. The dictionary only grows; it stops
+   taking new words at KEY_DICT_MAX_WORDS. */
+
+#include <stddef.h>
+
+typedef struct KeyDict *KeyDict_T;
+
+/* most bytes KeyDictEncode() writes for a len-byte key */
+#define KEY_DICT_MAX_ENCODED(len) (2 * (len) + 1)
+
+/* most words the dictionary takes */
+#define KEY_DICT_MAX_WORDS (1U << 20)
+
+/* create an empty dictionary, NULL on failure */
+KeyDict_T CreateKeyDict(void);
+
+/* free the dictionary */
+void DestroyKeyDict(KeyDict_T k);
+
+/* encode the len-byte key into out (KEY_DICT_MAX_ENCODED(len) bytes),
+   adding new words to the dictionary. return the encoded length */
+size_t KeyDictEncode(KeyDict_T k, const char *key, size_t len,
+                     unsigned char *out);
+
+/* decode the encLen bytes at enc into out, which has room for the
+   decoded key and a terminating NUL. return the decoded length */
+size_t KeyDictDecode(KeyDict_T k, const unsigned char *enc, size_t encLen,
+                     char *out);
+
+/* return non-zero if the encLen bytes at enc decode to the len-byte
+   key. stops at the first difference without decoding the rest */
+int KeyDictEqual(KeyDict_T k, const unsigned char *enc, size_t encLen,
+                 const char *key, size_t len);
+
+/* return the bytes held by the dictionary */
+size_t KeyDictMemory(KeyDict_T k);
+
+#endif /* end of KEY_DICT_H */
@@ -0,0 +1,129 @@
+/*
+ * Program: perf_counter.c
+ *
+ * Description:
+ * ------------
+ * Hardware performance counters for the benchmark phases in client.c.
+ * Every event is opened as its own counter so that a single event the CPU
+ * (or the hypervisor) does not expose does not disable the others. Counts
+ * are scaled by time_enabled / time_running when the kernel had to
+ * multiplex the PMU between more events than it has registers.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <string.h>
+#include <unistd.h>
+#include "perf_counter.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define CACHE_MISS_CONFIG(cache) \
+  ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+  const char *name;
+  unsigned int type;
+  unsigned long long config;
+} events[PERF_NUM_EVENTS] = {
+  { "cycles",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "L1d-miss",     PERF_TYPE_HW_CACHE, CACHE_MISS_CONFIG(PERF_COUNT_HW_CACHE_L1D) },
+  { "LLC-miss",     PERF_TYPE_HW_CACHE, CACHE_MISS_CONFIG(PERF_COUNT_HW_CACHE_LL) },
+  { "dTLB-miss",    PERF_TYPE_HW_CACHE, CACHE_MISS_CONFIG(PERF_COUNT_HW_CACHE_DTLB) },
+  { "branch-miss",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+/*--------------------------------------------------------------------*/
+int
+PerfCountersOpen(struct PerfCounters *pc)
+{
+  struct perf_event_attr attr;
+  int i, opened = 0;
+
+  for (i = 0; i < PERF_NUM_EVENTS; i++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;  /* allowed with perf_event_paranoid <= 2 */
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    pc->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    pc->value[i] = 0;
+    if (pc->fd[i] >= 0) opened++;
+  }
+  return opened;
+}
+/*--------------------------------------------------------------------*/
+void
+PerfCountersStart(struct PerfCounters *pc)
+{
+  int i;
+  for (i = 0; i < PERF_NUM_EVENTS; i++) {
+    if (pc->fd[i] < 0) continue;
+    ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+    ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+/*--------------------------------------------------------------------*/
+void
+PerfCountersStop(struct PerfCounters *pc)
+{
+  uint64_t buf[3]; /* value, time_enabled, time_running */
+  int i;
+
+  for (i = 0; i < PERF_NUM_EVENTS; i++) {
+    if (pc->fd[i] < 0) continue;
+    ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+  }
+  for (i = 0; i < PERF_NUM_EVENTS; i++) {
+    pc->value[i] = 0;
+    if (pc->fd[i] < 0) continue;
+    if (read(pc->fd[i], buf, sizeof(buf)) != sizeof(buf)) continue;
+    if (buf[2] == 0) continue; /* never scheduled on the PMU */
+    pc->value[i] = (buf[2] < buf[1]) ?
+      (uint64_t)((double)buf[0] * buf[1] / buf[2]) : buf[0];
+  }
+}
+/*--------------------------------------------------------------------*/
+void
+PerfCountersClose(struct PerfCounters *pc)
+{
+  int i;
+  for (i = 0; i < PERF_NUM_EVENTS; i++) {
+    if (pc->fd[i] >= 0) close(pc->fd[i]);
+    pc->fd[i] = -1;
+  }
+}
+/*--------------------------------------------------------------------*/
+const char *
+PerfCounterName(int i)
+{
+  return (i >= 0 && i < PERF_NUM_EVENTS) ? events[i].name : "?";
+}
+
+#else /* !__linux__: no perf_event_open, report every event as missing */
+
+int PerfCountersOpen(struct PerfCounters *pc)
+{
+  int i;
+  for (i = 0; i < PERF_NUM_EVENTS; i++) {
+    pc->fd[i] = -1;
+    pc->value[i] = 0;
+  }
+  return 0;
+}
+void PerfCountersStart(struct PerfCounters *pc) { (void)pc; }
+void PerfCountersStop(struct PerfCounters *pc) { (void)pc; }
+void PerfCountersClose(struct PerfCounters *pc) { (void)pc; }
+const char *PerfCounterName(int i) { (void)i; return "?"; }
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef PERF_COUNTER_H
+#define PERF_COUNTER_H
+
+/* perf_counter.h */
+/* Thin wrapper around Linux perf_event_open(2) used by the performance
+   test to count hardware events around each benchmark phase. */
+
+#include <stdint.h>
+
+/* events counted for every phase, in report order */
+enum {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_DTLB_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_NUM_EVENTS
+};
+
+struct PerfCounters {
+  int fd[PERF_NUM_EVENTS];          /* -1 if the event is unavailable */
+  uint64_t value[PERF_NUM_EVENTS];  /* scaled counts of the last phase */
+};
+
+/* open all counters for the calling thread (user space only).
+   return the number of events that could be opened */
+int PerfCountersOpen(struct PerfCounters *pc);
+
+/* reset and enable every open counter */
+void PerfCountersStart(struct PerfCounters *pc);
+
+/* disable the counters and store the (multiplex-scaled) counts in
+   pc->value */
+void PerfCountersStop(struct PerfCounters *pc);
+
+/* close every open counter */
+void PerfCountersClose(struct PerfCounters *pc);
+
+/* short printable name of event 'i' */
+const char *PerfCounterName(int i);
+
+#endif /* end of PERF_COUNTER_H */
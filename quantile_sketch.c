@@ -0,0 +1,391 @@
+/*
+ * Program: quantile_sketch.c
+ *
+ * Description:
+ * ------------
+ * KLL quantile sketch (see quantile_sketch.h), after Karnin, Lang and
+ * Liberty, "Optimal Quantile Approximation in Streams". Values enter
+ * level 0. A level h item stands for 2^h values. Level h may hold about
+ * K * (2/3)^(top - h) items; when all the levels together hold more
+ * than their capacities add up to, the lowest full level is compacted:
+ * it is sorted and every other item, starting at a random one of the
+ * first two, moves up a level while the rest are dropped, which keeps
+ * every rank unbiased. A query sorts the items of both sketches by
+ * value with their weights (negative for removals), and keeps the
+ * running maximum of the prefix sums, so that a binary search finds the
+ * first value whose rank reaches the target.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "quantile_sketch.h"
+
+#define SKETCH_K 200            /* capacity of the top level */
+#define MIN_CAPACITY 8          /* capacity of the lowest levels */
+#define MAX_LEVELS 56           /* 2^56 values, far beyond an int count */
+#define REBUILD_BATCH 256       /* customers read per cursor call */
+
+struct Level {
+  int *items;
+  int size;                     /* items in use */
+  int alloc;                    /* items allocated */
+};
+
+struct Kll {
+  struct Level level[MAX_LEVELS];
+  int levels;                   /* levels in use */
+  int size;                     /* items kept over all levels */
+  int maxSize;                  /* sum of the capacities of the levels */
+  size_t n;                     /* values counted */
+};
+
+struct Ranked {
+  int value;
+  long long rank;               /* weight of the values up to this one,
+                                   then its running maximum */
+};
+
+struct QuantileSketch {
+  struct Kll added;
+  struct Kll removed;
+  uint64_t seed;                /* xorshift state of the compactions */
+  struct Ranked *sorted;        /* query table, valid if nSorted > 0 */
+  size_t nSorted;
+  size_t sortedAlloc;
+};
+/*--------------------------------------------------------------------*/
+static int capacity(int depth)
+
+/* Return the capacity of a level 'depth' levels below the top. */
+{
+  double c = SKETCH_K;
+
+  while (depth-- > 0 && c > MIN_CAPACITY)
+    c = c * 2 / 3;
+  return c > MIN_CAPACITY ? (int)c + 1 : MIN_CAPACITY;
+}
+/*--------------------------------------------------------------------*/
+static int compare_int(const void *a, const void *b)
+{
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+/*--------------------------------------------------------------------*/
+static int reserve(struct Level *l, int items)
+
+/* Make room for 'items' more items in l. Return 0 or -1. */
+{
+  int alloc;
+  int *p;
+
+  if (l->size + items <= l->alloc) return 0;
+  alloc = l->alloc ? l->alloc : MIN_CAPACITY;
+  while (alloc < l->size + items) alloc *= 2;
+  p = (int *)realloc(l->items, (size_t)alloc * sizeof(int));
+  if (p == NULL) return -1;
+  l->items = p;
+  l->alloc = alloc;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static void add_level(struct Kll *k)
+
+/* Put a new empty level on top of k and recompute its capacity. */
+{
+  int h;
+
+  k->levels++;
+  k->maxSize = 0;
+  for (h = 0; h < k->levels; h++)
+    k->maxSize += capacity(k->levels - h - 1);
+}
+/*--------------------------------------------------------------------*/
+static int compact(struct Kll *k, int h, uint64_t *seed)
+
+/* Sort level h, move every other item of it to level h + 1 and drop the
+   rest. An odd item out stays. Return 0 or -1. */
+{
+  struct Level *l = &k->level[h], *up;
+  int pairs, offset, i;
+
+  if (h + 1 == MAX_LEVELS) return -1;
+  if (h + 1 == k->levels) add_level(k);
+  up = &k->level[h + 1];
+  pairs = l->size / 2;
+  if (reserve(up, pairs) < 0) return -1;
+
+  qsort(l->items, (size_t)l->size, sizeof(int), compare_int);
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 7;
+  *seed ^= *seed << 17;
+  offset = (int)(*seed >> 63);
+  for (i = 0; i < pairs; i++)
+    up->items[up->size++] = l->items[2 * i + offset];
+  if (l->size % 2) {
+    l->items[0] = l->items[l->size - 1];
+    l->size = 1;
+  }
+  else
+    l->size = 0;
+  k->size -= pairs;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static void compress(struct Kll *k, uint64_t *seed)
+
+/* Compact the lowest full levels until k holds no more items than its
+   capacity. A failed compaction leaves k larger than it should be, but
+   still right. */
+{
+  int h;
+
+  while (k->size >= k->maxSize) {
+    for (h = 0; h < k->levels; h++)
+      if (k->level[h].size >= capacity(k->levels - h - 1)) break;
+    if (h == k->levels || compact(k, h, seed) < 0) return;
+  }
+}
+/*--------------------------------------------------------------------*/
+static int kll_add(struct Kll *k, int value, uint64_t *seed)
+{
+  if (k->levels == 0) add_level(k);
+  if (reserve(&k->level[0], 1) < 0) {
+    fprintf(stderr, "Error: Can't allocate a memory for the sketch\n");
+    return -1;
+  }
+  k->level[0].items[k->level[0].size++] = value;
+  k->size++;
+  k->n++;
+  compress(k, seed);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int kll_merge(struct Kll *into, const struct Kll *from, uint64_t *seed)
+
+/* Append the levels of from to those of into. Return 0 or -1. */
+{
+  int h;
+
+  while (into->levels < from->levels) add_level(into);
+  for (h = 0; h < from->levels; h++)
+    if (reserve(&into->level[h], from->level[h].size) < 0) {
+      fprintf(stderr, "Error: Can't allocate a memory for the sketch\n");
+      return -1;
+    }
+  for (h = 0; h < from->levels; h++) {
+    memcpy(into->level[h].items + into->level[h].size, from->level[h].items,
+           (size_t)from->level[h].size * sizeof(int));
+    into->level[h].size += from->level[h].size;
+  }
+  into->size += from->size;
+  into->n += from->n;
+  compress(into, seed);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static void kll_free(struct Kll *k)
+{
+  int h;
+
+  for (h = 0; h < MAX_LEVELS; h++)
+    free(k->level[h].items);
+  memset(k, 0, sizeof(*k));
+}
+/*--------------------------------------------------------------------*/
+QuantileSketch_T
+CreateQuantileSketch(void)
+{
+  QuantileSketch_T s;
+
+  s = (QuantileSketch_T)calloc(1, sizeof(struct QuantileSketch));
+  if (s == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the sketch\n");
+    return NULL;
+  }
+  s->seed = 88172645463325252ULL;
+  return s;
+}
+/*--------------------------------------------------------------------*/
+void
+DestroyQuantileSketch(QuantileSketch_T s)
+{
+  if (s == NULL) return;
+  kll_free(&s->added);
+  kll_free(&s->removed);
+  free(s->sorted);
+  free(s);
+}
+/*--------------------------------------------------------------------*/
+int
+QuantileSketchAdd(QuantileSketch_T s, int value)
+{
+  if (s == NULL) return -1;
+  s->nSorted = 0;
+  return kll_add(&s->added, value, &s->seed);
+}
+/*--------------------------------------------------------------------*/
+int
+QuantileSketchRemove(QuantileSketch_T s, int value)
+{
+  if (s == NULL) return -1;
+  s->nSorted = 0;
+  if (kll_add(&s->removed, value, &s->seed) < 0) return -1;
+  return s->removed.n > s->added.n - s->removed.n;
+}
+/*--------------------------------------------------------------------*/
+int
+QuantileSketchRebuild(QuantileSketch_T s, DB_T d)
+{
+  struct CustomerView views[REBUILD_BATCH];
+  struct QuantileSketch fresh;
+  CustomerCursor_T c;
+  int n = 0, i;
+
+  if (s == NULL || d == NULL) return -1;
+  if ((c = OpenCustomerCursor(d)) == NULL) return -1;
+  memset(&fresh, 0, sizeof(fresh));
+  fresh.seed = s->seed;
+  while ((n = NextCustomerBatch(c, views, REBUILD_BATCH)) > 0) {
+    for (i = 0; i < n && kll_add(&fresh.added, views[i].purchase,
+                                 &fresh.seed) == 0; i++)
+      ;
+    if (i < n) {
+      n = -1;
+      break;
+    }
+  }
+  CloseCustomerCursor(c);
+  if (n < 0) {
+    kll_free(&fresh.added);
+    return -1;
+  }
+
+  kll_free(&s->added);
+  kll_free(&s->removed);
+  s->added = fresh.added;
+  s->seed = fresh.seed;
+  s->nSorted = 0;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+QuantileSketchMerge(QuantileSketch_T into, QuantileSketch_T from)
+{
+  if (into == NULL || from == NULL || into == from) return -1;
+  into->nSorted = 0;
+  if (kll_merge(&into->added, &from->added, &into->seed) < 0 ||
+      kll_merge(&into->removed, &from->removed, &into->seed) < 0)
+    return -1;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static int compare_ranked(const void *a, const void *b)
+{
+  int x = ((const struct Ranked *)a)->value;
+  int y = ((const struct Ranked *)b)->value;
+  return (x > y) - (x < y);
+}
+/*--------------------------------------------------------------------*/
+static size_t list_items(const struct Kll *k, int sign, struct Ranked *out)
+
+/* Store the items of k in out with their weights, negated if sign < 0.
+   Return the number stored. */
+{
+  long long weight = sign;
+  size_t n = 0;
+  int h, j;
+
+  for (h = 0; h < k->levels; h++, weight *= 2) {
+    for (j = 0; j < k->level[h].size; j++) {
+      out[n].value = k->level[h].items[j];
+      out[n++].rank = weight;
+    }
+  }
+  return n;
+}
+/*--------------------------------------------------------------------*/
+static int sort_items(QuantileSketch_T s)
+
+/* Fill the query table of s: one entry per distinct value kept, in
+   increasing order, with the running maximum of the weights up to it.
+   Return 0 or -1. */
+{
+  struct Ranked *p;
+  size_t total = (size_t)s->added.size + (size_t)s->removed.size, n, i;
+  long long sum, max;
+
+  if (total > s->sortedAlloc) {
+    p = (struct Ranked *)realloc(s->sorted, total * sizeof(struct Ranked));
+    if (p == NULL) {
+      fprintf(stderr, "Error: Can't allocate a memory for the sketch\n");
+      return -1;
+    }
+    s->sorted = p;
+    s->sortedAlloc = total;
+  }
+  n = list_items(&s->added, 1, s->sorted);
+  n += list_items(&s->removed, -1, s->sorted + n);
+  qsort(s->sorted, n, sizeof(struct Ranked), compare_ranked);
+
+  /* merge equal values and turn the weights into ranks */
+  sum = 0;
+  max = 0;
+  for (i = 0, total = 0; i < n; i++) {
+    sum += s->sorted[i].rank;
+    if (i + 1 < n && s->sorted[i + 1].value == s->sorted[i].value) continue;
+    if (sum > max) max = sum;
+    s->sorted[total].value = s->sorted[i].value;
+    s->sorted[total++].rank = max;
+  }
+  s->nSorted = total;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+int
+QuantileSketchQuery(QuantileSketch_T s, double q)
+{
+  size_t lo, hi, mid;
+  double target;
+
+  if (s == NULL || !(q >= 0.0 && q <= 1.0)) return -1;
+  if (s->added.n <= s->removed.n) return -1;
+  if (s->nSorted == 0 && sort_items(s) < 0) return -1;
+  if (s->nSorted == 0) return -1;
+
+  /* first value whose rank reaches the target; the rank of the
+     smallest value is 1, and a removed value can leave a rank of 0 */
+  target = q * (double)(s->added.n - s->removed.n);
+  if (target < 1.0) target = 1.0;
+  lo = 0;
+  hi = s->nSorted - 1;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if ((double)s->sorted[mid].rank >= target) hi = mid;
+    else lo = mid + 1;
+  }
+  return s->sorted[lo].value;
+}
+/*--------------------------------------------------------------------*/
+size_t
+QuantileSketchCount(QuantileSketch_T s)
+{
+  if (s == NULL || s->added.n < s->removed.n) return 0;
+  return s->added.n - s->removed.n;
+}
+/*--------------------------------------------------------------------*/
+size_t
+QuantileSketchMemory(QuantileSketch_T s)
+{
+  size_t bytes;
+  int h;
+
+  if (s == NULL) return 0;
+  bytes = sizeof(struct QuantileSketch) +
+          s->sortedAlloc * sizeof(struct Ranked);
+  for (h = 0; h < MAX_LEVELS; h++)
+    bytes += ((size_t)s->added.level[h].alloc +
+              (size_t)s->removed.level[h].alloc) * sizeof(int);
+  return bytes;
+}
@@ -0,0 +1,61 @@
+#ifndef QUANTILE_SKETCH_H
+#define QUANTILE_SKETCH_H
+
+/* quantile_sketch.h */
+/* KLL sketch of the purchases of a db. It keeps a few hundred of the
+   values it was given, each standing for a power-of-two number of them,
+   and answers "the value at rank q * n" to within about 1.5% of n in
+   rank, whatever n is. Removals go into a second sketch whose ranks are
+   subtracted; its error grows with the removals, so the caller rebuilds
+   the sketch from the live values once they are outnumbered.
+
+     QuantileSketchAdd(s, purchase);
+     if (QuantileSketchRemove(s, purchase))
+       QuantileSketchRebuild(s, d);
+     median = QuantileSketchQuery(s, 0.5);
+
+   Sketches of disjoint sets of values merge into the sketch of their
+   union. The sampling is pseudo-random with a fixed seed, so the same
+   calls give the same answers. */
+
+#include <stddef.h>
+#include "customer_manager.h"
+
+typedef struct QuantileSketch *QuantileSketch_T;
+
+/* create an empty sketch, NULL on failure */
+QuantileSketch_T CreateQuantileSketch(void);
+
+/* free the sketch */
+void DestroyQuantileSketch(QuantileSketch_T s);
+
+/* count value. return 0, -1 on allocation failure (the value is then
+   lost to the sketch) */
+int QuantileSketchAdd(QuantileSketch_T s, int value);
+
+/* uncount a value that was added. return 1 if the removals now
+   outnumber the values left, when the sketch is due for a rebuild,
+   otherwise 0 (-1 on allocation failure) */
+int QuantileSketchRemove(QuantileSketch_T s, int value);
+
+/* replace the contents of s by the purchases of the customers of d,
+   read with a cursor. return 0, -1 on failure (s is then unchanged) */
+int QuantileSketchRebuild(QuantileSketch_T s, DB_T d);
+
+/* add the values and removals of from to into. return 0, -1 on
+   allocation failure */
+int QuantileSketchMerge(QuantileSketch_T into, QuantileSketch_T from);
+
+/* return a value whose rank among the values counted is about q times
+   their number (0 <= q <= 1), -1 if there are none or q is out of range.
+   the first query after a change sorts the values kept, the next ones
+   search them */
+int QuantileSketchQuery(QuantileSketch_T s, double q);
+
+/* return the number of values counted (added and not removed) */
+size_t QuantileSketchCount(QuantileSketch_T s);
+
+/* return the bytes held by the sketch */
+size_t QuantileSketchMemory(QuantileSketch_T s);
+
+#endif /* end of QUANTILE_SKETCH_H */
@@ -0,0 +1,342 @@
+/*
+ * Program: shm_segment.c
+ *
+ * Description:
+ * ------------
+ * Named shared-memory segments (see shm_segment.h). The segment starts
+ * with a header page: the sequence number, the file size, the bump
+ * pointer, a small sorted list of free extents and the owner's root
+ * area. Every mapping first reserves SHM_RESERVE bytes of address space
+ * with PROT_NONE and maps the file over its start with MAP_FIXED; when
+ * the file grows the mapping is extended the same way, so the base
+ * never moves.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_segment.h"
+
+#define SHM_MAGIC "CUSTSHM1"
+#define SHM_RESERVE ((size_t)1 << 35)  /* address space per mapping */
+#define SHM_MAX_EXTENTS 64             /* free extents kept */
+#define SHM_ALIGN 64
+#define SPINS_PER_YIELD 64
+
+struct Extent {
+  uint64_t off;
+  uint64_t size;
+};
+
+struct ShmHeader {
+  char magic[8];
+  uint64_t seq;          /* odd while the writer changes the segment */
+  uint64_t fileSize;
+  uint64_t used;         /* bump pointer */
+  uint64_t lost;         /* freed bytes that didn't fit the extent list */
+  uint32_t extentCount;
+  uint32_t pad;
+  struct Extent extents[SHM_MAX_EXTENTS];
+  char root[SHM_ROOT_SIZE] __attribute__((aligned(SHM_ALIGN)));
+};
+
+struct ShmSegment {
+  char *base;
+  size_t mapped;         /* bytes of the file mapped at base */
+  int fd;
+  int writer;
+  char *name;
+};
+/*--------------------------------------------------------------------*/
+static size_t page_round(size_t n)
+{
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  return (n + page - 1) / page * page;
+}
+/*--------------------------------------------------------------------*/
+static int map_range(ShmSegment_T s, size_t from, size_t to)
+
+/* map file bytes [from, to) at base + from */
+{
+  int prot = s->writer ? PROT_READ | PROT_WRITE : PROT_READ;
+
+  if (to > SHM_RESERVE) {
+    fprintf(stderr, "Error: shared segment %s is out of address space\n",
+            s->name);
+    return -1;
+  }
+  if (mmap(s->base + from, to - from, prot, MAP_SHARED | MAP_FIXED,
+           s->fd, (off_t)from) == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  s->mapped = to;
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+static ShmSegment_T open_segment(const char *name, int writer)
+{
+  ShmSegment_T s;
+  void *base;
+
+  if (name == NULL || name[0] != '/') {
+    fprintf(stderr, "Error: shared segment names start with '/'\n");
+    return NULL;
+  }
+  s = (ShmSegment_T)calloc(1, sizeof(struct ShmSegment));
+  if (s == NULL || (s->name = strdup(name)) == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the segment\n");
+    free(s);
+    return NULL;
+  }
+  s->writer = writer;
+  s->fd = writer ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)
+                 : shm_open(name, O_RDONLY, 0);
+  if (s->fd < 0) {
+    fprintf(stderr, "Error: Can't open shared segment %s\n", name);
+    free(s->name);
+    free(s);
+    return NULL;
+  }
+  base = mmap(NULL, SHM_RESERVE, PROT_NONE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED) {
+    perror("mmap");
+    if (writer) shm_unlink(name);
+    close(s->fd);
+    free(s->name);
+    free(s);
+    return NULL;
+  }
+  s->base = (char *)base;
+  return s;
+}
+/*--------------------------------------------------------------------*/
+ShmSegment_T
+ShmCreate(const char *name)
+{
+  ShmSegment_T s;
+  struct ShmHeader *h;
+  size_t size;
+
+  if ((s = open_segment(name, 1)) == NULL) return NULL;
+  size = page_round(sizeof(struct ShmHeader));
+  if (ftruncate(s->fd, (off_t)size) < 0 || map_range(s, 0, size) < 0) {
+    fprintf(stderr, "Error: Can't size shared segment %s\n", name);
+    ShmClose(s);
+    return NULL;
+  }
+  h = (struct ShmHeader *)s->base;
+  memcpy(h->magic, SHM_MAGIC, sizeof(h->magic));
+  h->fileSize = size;
+  h->used = size;
+  return s;
+}
+/*--------------------------------------------------------------------*/
+ShmSegment_T
+ShmAttach(const char *name)
+{
+  ShmSegment_T s;
+  struct stat st;
+
+  if ((s = open_segment(name, 0)) == NULL) return NULL;
+  if (fstat(s->fd, &st) < 0 || (size_t)st.st_size < sizeof(struct ShmHeader)
+      || map_range(s, 0, (size_t)st.st_size) < 0
+      || memcmp(s->base, SHM_MAGIC, 8) != 0) {
+    fprintf(stderr, "Error: %s is not a customer db segment\n", name);
+    ShmClose(s);
+    return NULL;
+  }
+  return s;
+}
+/*--------------------------------------------------------------------*/
+void
+ShmClose(ShmSegment_T s)
+{
+  if (s == NULL) return;
+  munmap(s->base, SHM_RESERVE);
+  close(s->fd);
+  if (s->writer) shm_unlink(s->name);
+  free(s->name);
+  free(s);
+}
+/*--------------------------------------------------------------------*/
+static int grow(ShmSegment_T s, uint64_t need)
+
+/* make the file at least need bytes, plus an eighth of its size so
+   that small blocks don't each cost an ftruncate(). The arrays that
+   grow double themselves already. The new size is published under the
+   write lock, so readers map it before they look at new blocks */
+{
+  struct ShmHeader *h = (struct ShmHeader *)s->base;
+  size_t size = page_round(need + h->fileSize / 8);
+
+  if (ftruncate(s->fd, (off_t)size) < 0) {
+    perror("ftruncate");
+    return -1;
+  }
+  if (map_range(s, s->mapped, size) < 0) return -1;
+  __atomic_store_n(&h->fileSize, size, __ATOMIC_RELEASE);
+  return 0;
+}
+/*--------------------------------------------------------------------*/
+void *
+ShmAlloc(ShmSegment_T s, size_t size)
+{
+  struct ShmHeader *h = (struct ShmHeader *)s->base;
+  uint64_t off;
+  uint32_t i;
+
+  size = (size + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+  if (size == 0) size = SHM_ALIGN;
+
+  /* first fit among the freed extents */
+  for (i = 0; i < h->extentCount; i++) {
+    if (h->extents[i].size < size) continue;
+    off = h->extents[i].off;
+    h->extents[i].off += size;
+    h->extents[i].size -= size;
+    if (h->extents[i].size == 0) {
+      memmove(&h->extents[i], &h->extents[i + 1],
+              (h->extentCount - i - 1) * sizeof(struct Extent));
+      h->extentCount--;
+    }
+    return s->base + off;
+  }
+
+  off = (h->used + SHM_ALIGN - 1) & ~(uint64_t)(SHM_ALIGN - 1);
+  if (off + size > h->fileSize && grow(s, off + size) < 0)
+    return NULL;
+  h->used = off + size;
+  return s->base + off;
+}
+/*--------------------------------------------------------------------*/
+void
+ShmFree(ShmSegment_T s, void *p, size_t size)
+{
+  struct ShmHeader *h = (struct ShmHeader *)s->base;
+  struct Extent *e = h->extents;
+  uint64_t off;
+  uint32_t i;
+
+  if (p == NULL) return;
+  off = (uint64_t)((char *)p - s->base);
+  size = (size + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+  if (size == 0) size = SHM_ALIGN;
+
+  /* the list is sorted by offset; merge with the neighbours */
+  for (i = 0; i < h->extentCount && e[i].off < off; i++)
+    ;
+  if (i > 0 && e[i - 1].off + e[i - 1].size == off) {
+    e[i - 1].size += size;
+    if (i < h->extentCount && off + size == e[i].off) {
+      e[i - 1].size += e[i].size;
+      memmove(&e[i], &e[i + 1], (h->extentCount - i - 1) * sizeof(*e));
+      h->extentCount--;
+    }
+    i--;
+  } else if (i < h->extentCount && off + size == e[i].off) {
+    e[i].off = off;
+    e[i].size += size;
+  } else if (h->extentCount < SHM_MAX_EXTENTS) {
+    memmove(&e[i + 1], &e[i], (h->extentCount - i) * sizeof(*e));
+    e[i].off = off;
+    e[i].size = size;
+    h->extentCount++;
+  } else {
+    h->lost += size;
+    return;
+  }
+
+  /* an extent at the end goes back to the bump pointer */
+  if (i == h->extentCount - 1 && e[i].off + e[i].size >= h->used) {
+    h->used = e[i].off;
+    h->extentCount--;
+  }
+}
+/*--------------------------------------------------------------------*/
+void *
+ShmRoot(ShmSegment_T s)
+{
+  return ((struct ShmHeader *)s->base)->root;
+}
+/*--------------------------------------------------------------------*/
+uint64_t
+ShmOffset(ShmSegment_T s, const void *p)
+{
+  return p ? (uint64_t)((const char *)p - s->base) : 0;
+}
+/*--------------------------------------------------------------------*/
+void *
+ShmPointer(ShmSegment_T s, uint64_t off)
+{
+  return off ? s->base + off : NULL;
+}
+/*--------------------------------------------------------------------*/
+int
+ShmContains(ShmSegment_T s, uint64_t off, uint64_t len)
+{
+  return off <= s->mapped && len <= s->mapped - off;
+}
+/*--------------------------------------------------------------------*/
+void
+ShmWriteBegin(ShmSegment_T s)
+{
+  struct ShmHeader *h = (struct ShmHeader *)s->base;
+
+  __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+/*--------------------------------------------------------------------*/
+void
+ShmWriteEnd(ShmSegment_T s)
+{
+  struct ShmHeader *h = (struct ShmHeader *)s->base;
+
+  __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELEASE);
+}
+/*--------------------------------------------------------------------*/
+uint64_t
+ShmReadBegin(ShmSegment_T s)
+{
+  struct ShmHeader *h = (struct ShmHeader *)s->base;
+  uint64_t seq, size;
+  int spins = 0;
+
+  while ((seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE)) & 1) {
+    if (++spins % SPINS_PER_YIELD == 0)
+      sched_yield();
+  }
+  size = __atomic_load_n(&h->fileSize, __ATOMIC_ACQUIRE);
+  if (size > s->mapped)
+    map_range(s, s->mapped, size);
+  return seq;
+}
+/*--------------------------------------------------------------------*/
+int
+ShmReadRetry(ShmSegment_T s, uint64_t seq)
+{
+  struct ShmHeader *h = (struct ShmHeader *)s->base;
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&h->seq, __ATOMIC_RELAXED) != seq;
+}
+/*--------------------------------------------------------------------*/
+void
+ShmMemory(ShmSegment_T s, size_t *size, size_t *unused)
+{
+  struct ShmHeader *h = (struct ShmHeader *)s->base;
+  uint64_t n;
+  uint32_t i;
+
+  n = h->fileSize - h->used + h->lost;
+  for (i = 0; i < h->extentCount; i++)
+    n += h->extents[i].size;
+  if (size) *size = h->fileSize;
+  if (unused) *unused = n;
+}
@@ -0,0 +1,72 @@
+#ifndef SHM_SEGMENT_H
+#define SHM_SEGMENT_H
+
+/* shm_segment.h */
+/* A named POSIX shared-memory segment that one writer process fills
+   and any number of processes map read-only. Data inside the segment
+   refers to other data by offset, never by pointer.
+
+   The writer allocates blocks with ShmAlloc()/ShmFree(); the segment
+   grows with ftruncate() as needed. Every mapping reserves address
+   space up front and only extends in place, so pointers into a
+   segment stay valid in the process that made them.
+
+   Consistency is a sequence lock: the writer brackets each change with
+   ShmWriteBegin()/ShmWriteEnd(), and a reader repeats its read until
+   ShmReadRetry() says no write overlapped it:
+
+     do {
+       seq = ShmReadBegin(s);
+       ... read, checking every offset with ShmContains() ...
+     } while (ShmReadRetry(s, seq));
+
+   A reader may see a half-made change before it retries, so it must
+   not trust anything it reads until then. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct ShmSegment *ShmSegment_T;
+
+/* bytes at ShmRoot() for the owner's own header */
+#define SHM_ROOT_SIZE 256
+
+/* create the segment 'name' ("/something") for writing. fails if it
+   exists. return NULL on failure */
+ShmSegment_T ShmCreate(const char *name);
+
+/* map the existing segment 'name' read-only, NULL on failure */
+ShmSegment_T ShmAttach(const char *name);
+
+/* unmap s; the writer also removes the name. readers that still have
+   it mapped keep their view */
+void ShmClose(ShmSegment_T s);
+
+/* return a 64-byte aligned block of size bytes (writer only), NULL if
+   the segment can't grow */
+void *ShmAlloc(ShmSegment_T s, size_t size);
+
+/* return a block of size bytes to the segment (writer only) */
+void ShmFree(ShmSegment_T s, void *p, size_t size);
+
+/* SHM_ROOT_SIZE bytes at a fixed place in the segment */
+void *ShmRoot(ShmSegment_T s);
+
+/* convert between pointers into the mapping and segment offsets */
+uint64_t ShmOffset(ShmSegment_T s, const void *p);
+void *ShmPointer(ShmSegment_T s, uint64_t off);
+
+/* return non-zero if [off, off + len) lies inside the mapping */
+int ShmContains(ShmSegment_T s, uint64_t off, uint64_t len);
+
+/* sequence lock, see above */
+void ShmWriteBegin(ShmSegment_T s);
+void ShmWriteEnd(ShmSegment_T s);
+uint64_t ShmReadBegin(ShmSegment_T s);
+int ShmReadRetry(ShmSegment_T s, uint64_t seq);
+
+/* report the bytes of the segment file and the bytes of it that are
+   not handed out */
+void ShmMemory(ShmSegment_T s, size_t *size, size_t *unused);
+
+#endif /* end of SHM_SEGMENT_H */
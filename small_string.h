@@ -0,0 +1,135 @@
+#ifndef SMALL_STRING_H
+#define SMALL_STRING_H
+
+/* small_string.h */
+/* Key storage for customer records: keys of up to SMALL_STRING_INLINE
+   bytes are kept inside the record, longer ones are spilled to a heap
+   copy. Either way the key is NUL-terminated and its length is stored
+   next to it, so comparing against a candidate key checks the length
+   first and only then runs memcmp over the bytes already in cache.
+
+   A long key is either a malloc()ed block owned by the record (copied or
+   adopted from the caller) or a reference into a StringPool; a tag byte
+   behind the heap pointer tells SmallStringFree() how to let go of it. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "string_pool.h"
+
+/* longest key stored inline; buf also holds its terminating NUL */
+#define SMALL_STRING_INLINE 27
+
+struct SmallString {
+  uint32_t len;                         /* key length in bytes */
+  char buf[SMALL_STRING_INLINE + 1];    /* inline key, or the heap
+                                           pointer of a longer one */
+};
+
+/* how SmallStringStore() takes the caller's key */
+#define SMALL_STRING_COPY  0   /* store a copy */
+#define SMALL_STRING_ADOPT 1   /* take over the malloc()ed key */
+#define SMALL_STRING_SHARE 2   /* take a reference on a pooled key */
+
+/* tag byte of a long key, stored right behind its heap pointer */
+#define SMALL_STRING_TAG(s) ((s)->buf[sizeof(char *)])
+#define SMALL_STRING_OWNED  0
+#define SMALL_STRING_POOLED 1
+
+/* return non-zero if the key of s lives on the heap */
+static inline int
+SmallStringIsHeap(const struct SmallString *s)
+{
+  return s->len > SMALL_STRING_INLINE;
+}
+
+/* return the NUL-terminated key of s */
+static inline const char *
+SmallStringData(const struct SmallString *s)
+{
+  char *p;
+
+  if (!SmallStringIsHeap(s)) return s->buf;
+  memcpy(&p, s->buf, sizeof(p));
+  return p;
+}
+
+/* return non-zero if the key of s is a reference into a StringPool */
+static inline int
+SmallStringIsPooled(const struct SmallString *s)
+{
+  return SmallStringIsHeap(s) && SMALL_STRING_TAG(s) == SMALL_STRING_POOLED;
+}
+
+/* store the len-byte key in s the way 'how' (SMALL_STRING_*) says. Short
+   keys are always copied inline. return 0 on success, -1 if the heap copy
+   of a long key can't be allocated or a shared key can't take another
+   reference */
+static inline int
+SmallStringStore(struct SmallString *s, const char *key, size_t len, int how)
+{
+  char *p;
+
+  if (len > UINT32_MAX) return -1;
+  s->len = (uint32_t)len;
+  if (len <= SMALL_STRING_INLINE) {
+    memcpy(s->buf, key, len);
+    s->buf[len] = '\0';
+    return 0;
+  }
+  if (how == SMALL_STRING_COPY) {
+    p = (char *)malloc(len + 1);
+    if (p == NULL) return -1;
+    memcpy(p, key, len);
+    p[len] = '\0';
+  }
+  else if (how == SMALL_STRING_SHARE) {
+    p = (char *)StringPoolRetain(key);
+    if (p == NULL) return -1;
+  }
+  else
+    p = (char *)key;
+  memcpy(s->buf, &p, sizeof(p));
+  SMALL_STRING_TAG(s) = (how == SMALL_STRING_SHARE) ?
+    SMALL_STRING_POOLED : SMALL_STRING_OWNED;
+  return 0;
+}
+
+/* store a copy of the len-byte key in s (see SmallStringStore()) */
+static inline int
+SmallStringSet(struct SmallString *s, const char *key, size_t len)
+{
+  return SmallStringStore(s, key, len, SMALL_STRING_COPY);
+}
+
+/* release the heap copy of s, if any */
+static inline void
+SmallStringFree(struct SmallString *s)
+{
+  if (SmallStringIsPooled(s)) StringPoolRelease(SmallStringData(s));
+  else if (SmallStringIsHeap(s)) free((void *)SmallStringData(s));
+  s->len = 0;
+  s->buf[0] = '\0';
+}
+
+/* undo a SmallStringStore(s, ..., how) of a call that failed: an adopted
+   key goes back to the caller untouched, anything else is released */
+static inline void
+SmallStringUndo(struct SmallString *s, int how)
+{
+  if (how != SMALL_STRING_ADOPT) {
+    SmallStringFree(s);
+    return;
+  }
+  s->len = 0;
+  s->buf[0] = '\0';
+}
+
+/* return non-zero if s holds the len-byte key */
+static inline int
+SmallStringEqual(const struct SmallString *s, const char *key, size_t len)
+{
+  return s->len == len && memcmp(SmallStringData(s), key, len) == 0;
+}
+
+#endif /* end of SMALL_STRING_H */
@@ -0,0 +1,197 @@
+/*
+ * Program: string_pool.c
+ *
+ * Description:
+ * ------------
+ * Interning pool for customer keys (see string_pool.h). Every string is a
+ * single block: a small header with its reference count, length, hash and
+ * hash-chain link, followed by the NUL-terminated bytes that callers see.
+ * The header also points back to the pool, so a release needs nothing but
+ * the string itself. The chain table doubles once it holds one string per
+ * bucket.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "string_pool.h"
+
+#define POOL_INITIAL_BUCKETS 1024
+
+struct PoolString {
+  struct StringPool *pool;   /* owning pool */
+  struct PoolString *next;   /* next string in the same bucket */
+  uint32_t refs;             /* references held by callers and DBs */
+  uint32_t hash;             /* full hash of the bytes */
+  size_t len;                /* length without the NUL */
+  char data[];               /* the string handed out */
+};
+
+struct StringPool {
+  struct PoolString **buckets;
+  size_t bucketCount;        /* always a power of two */
+  size_t count;              /* distinct strings */
+};
+/*--------------------------------------------------------------------*/
+static uint32_t hash_bytes(const char *s, size_t len)
+
+/* FNV-1a over the len bytes of s */
+{
+  uint32_t h = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 16777619U;
+  }
+  return h;
+}
+/*--------------------------------------------------------------------*/
+static struct PoolString *header_of(const char *s)
+{
+  return (struct PoolString *)(void *)
+    (s - offsetof(struct PoolString, data));
+}
+/*--------------------------------------------------------------------*/
+StringPool_T
+CreateStringPool(void)
+{
+  StringPool_T p;
+
+  p = (StringPool_T)calloc(1, sizeof(struct StringPool));
+  if (p == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the string pool\n");
+    return NULL;
+  }
+  p->bucketCount = POOL_INITIAL_BUCKETS;
+  p->buckets = (struct PoolString **)calloc(p->bucketCount,
+                                            sizeof(struct PoolString *));
+  if (p->buckets == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for the string pool\n");
+    free(p);
+    return NULL;
+  }
+  return p;
+}
+/*--------------------------------------------------------------------*/
+void
+DestroyStringPool(StringPool_T p)
+{
+  struct PoolString *ps, *next;
+  size_t i;
+
+  if (p == NULL) return;
+  for (i = 0; i < p->bucketCount; i++) {
+    for (ps = p->buckets[i]; ps; ps = next) {
+      next = ps->next;
+      free(ps);
+    }
+  }
+  free(p->buckets);
+  free(p);
+}
+/*--------------------------------------------------------------------*/
+static void expand(StringPool_T p)
+
+/* Double the bucket array of p. On allocation failure the pool just
+   keeps its longer chains. */
+{
+  struct PoolString **buckets, *ps, *next;
+  size_t i, n = p->bucketCount * 2;
+
+  buckets = (struct PoolString **)calloc(n, sizeof(struct PoolString *));
+  if (buckets == NULL) return;
+  for (i = 0; i < p->bucketCount; i++) {
+    for (ps = p->buckets[i]; ps; ps = next) {
+      next = ps->next;
+      ps->next = buckets[ps->hash & (n - 1)];
+      buckets[ps->hash & (n - 1)] = ps;
+    }
+  }
+  free(p->buckets);
+  p->buckets = buckets;
+  p->bucketCount = n;
+}
+/*--------------------------------------------------------------------*/
+const char *
+StringPoolIntern(StringPool_T p, const char *s, size_t len)
+{
+  struct PoolString *ps;
+  uint32_t h;
+
+  if (p == NULL || s == NULL) return NULL;
+
+  h = hash_bytes(s, len);
+  for (ps = p->buckets[h & (p->bucketCount - 1)]; ps; ps = ps->next) {
+    if (ps->hash == h && ps->len == len && memcmp(ps->data, s, len) == 0) {
+      if (ps->refs == UINT32_MAX) return NULL;
+      ps->refs++;
+      return ps->data;
+    }
+  }
+
+  ps = (struct PoolString *)malloc(sizeof(struct PoolString) + len + 1);
+  if (ps == NULL) {
+    fprintf(stderr, "Error: Can't allocate a memory for a pooled string\n");
+    return NULL;
+  }
+  ps->pool = p;
+  ps->refs = 1;
+  ps->hash = h;
+  ps->len = len;
+  memcpy(ps->data, s, len);
+  ps->data[len] = '\0';
+
+  if (p->count >= p->bucketCount) expand(p);
+  ps->next = p->buckets[h & (p->bucketCount - 1)];
+  p->buckets[h & (p->bucketCount - 1)] = ps;
+  p->count++;
+  return ps->data;
+}
+/*--------------------------------------------------------------------*/
+const char *
+StringPoolRetain(const char *s)
+{
+  struct PoolString *ps;
+
+  if (s == NULL) return NULL;
+  ps = header_of(s);
+  if (ps->refs == UINT32_MAX) return NULL;
+  ps->refs++;
+  return s;
+}
+/*--------------------------------------------------------------------*/
+void
+StringPoolRelease(const char *s)
+{
+  struct PoolString *ps, **link;
+  StringPool_T p;
+
+  if (s == NULL) return;
+  ps = header_of(s);
+  if (--ps->refs > 0) return;
+
+  p = ps->pool;
+  for (link = &p->buckets[ps->hash & (p->bucketCount - 1)]; *link;
+       link = &(*link)->next) {
+    if (*link == ps) {
+      *link = ps->next;
+      break;
+    }
+  }
+  p->count--;
+  free(ps);
+}
+/*--------------------------------------------------------------------*/
+size_t
+StringPoolLength(const char *s)
+{
+  return (s != NULL) ? header_of(s)->len : 0;
+}
+/*--------------------------------------------------------------------*/
+size_t
+StringPoolCount(StringPool_T p)
+{
+  return (p != NULL) ? p->count : 0;
+}
@@ -0,0 +1,45 @@
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+/* string_pool.h */
+/* Interning pool of immutable, reference-counted strings. Interning the
+   same bytes twice returns the same pointer, so keys that repeat across
+   records (or across databases) are stored once.
+
+     StringPool_T pool = CreateStringPool();
+     const char *id = StringPoolIntern(pool, buf, len);   (one reference)
+     RegisterCustomerPooled(d, id, name, purchase);       (DB takes its own)
+     StringPoolRelease(id);                               (drop ours)
+
+   A pooled string is NUL-terminated and is freed when its last
+   reference is released. The pool is not thread-safe and must outlive
+   every database that holds strings from it. */
+
+#include <stddef.h>
+
+typedef struct StringPool *StringPool_T;
+
+/* create an empty pool, NULL on failure */
+StringPool_T CreateStringPool(void);
+
+/* free the pool and every string still in it */
+void DestroyStringPool(StringPool_T p);
+
+/* return the pooled copy of the len-byte key s with one more reference,
+   NULL on failure */
+const char *StringPoolIntern(StringPool_T p, const char *s, size_t len);
+
+/* add a reference to the pooled string s and return s, NULL if its
+   count of references is saturated */
+const char *StringPoolRetain(const char *s);
+
+/* drop a reference to the pooled string s, freeing it with the last one */
+void StringPoolRelease(const char *s);
+
+/* return the length of the pooled string s */
+size_t StringPoolLength(const char *s);
+
+/* return the number of distinct strings in the pool */
+size_t StringPoolCount(StringPool_T p);
+
+#endif /* end of STRING_POOL_H */